@@ -0,0 +1,62 @@
+#include <hatrack.h>
+#include <stdio.h>
+
+#define NUM_THREADS 4
+#define NUM_MSGS    100000
+
+static hatlog_t *logger;
+
+void *
+log_thread(void *item)
+{
+    uint64_t id;
+
+    for (id = 0; id < NUM_MSGS; id++) {
+        hatlog_printf(logger,
+                      "tid=%lu; mid=%lu; msg=This is a log message!\n",
+                      (uint64_t)item,
+                      id);
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t threads[NUM_THREADS];
+    uint64_t  i;
+    uint64_t  written;
+    uint64_t  dropped;
+
+    logger = hatlog_new(argc > 1 ? argv[1] : "hatlogex.log", 1 << 14, 128);
+
+    hatlog_set_rotation(logger, 1 << 22, 2);
+
+    if (!hatlog_start(logger)) {
+        perror("hatlog_start");
+        return 1;
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, log_thread, (void *)(i + 1));
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    hatlog_stop(logger);
+
+    written = hatlog_written(logger);
+    dropped = hatlog_dropped(logger);
+
+    printf("Logged %lu messages; wrote %lu; dropped %lu.\n",
+           (uint64_t)NUM_THREADS * NUM_MSGS,
+           written,
+           dropped);
+
+    hatlog_delete(logger);
+
+    return 0;
+}
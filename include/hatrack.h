@@ -22,6 +22,11 @@
 #ifndef __HATRACK_H__
 #define __HATRACK_H__
 
+#include <hatrack/hatalloc.h>
+#include <hatrack/arena.h>
+#include <hatrack/membudget.h>
+#include <hatrack/prefault.h>
+#include <hatrack/rcu.h>
 #include <hatrack/gate.h>
 
 // Currently pulls in Crown.
@@ -29,7 +34,12 @@
 
 // Currently pulls in Woolhat.
 #include <hatrack/set.h>
+#include <hatrack/intset.h>
 #include <hatrack/flexarray.h>
+#include <hatrack/flex64.h>
+
+// Segmented table that grows one segment at a time.
+#include <hatrack/quilt.h>
 
 #ifdef HATRACK_COMPILE_ALL_ALGORITHMS
 #include <hatrack/tophat.h>
@@ -42,6 +52,7 @@
 #include <hatrack/ballcap.h>
 #include <hatrack/newshat.h>
 #include <hatrack/swimcap.h>
+#include <hatrack/solohat.h>
 #include <hatrack/duncecap.h>
 #include <hatrack/refhat.h>
 #endif
@@ -50,12 +61,17 @@
 #include <hatrack/queue.h>
 #include <hatrack/q64.h>
 #include <hatrack/hq.h>
+#include <hatrack/queue_set.h>
 #include <hatrack/capq.h>
 #include <hatrack/helpmanager.h>
+#include <hatrack/idalloc.h>
 #include <hatrack/llstack.h>
 #include <hatrack/stack.h>
 #include <hatrack/hatring.h>
 #include <hatrack/logring.h>
+#include <hatrack/hatlog.h>
 #include <hatrack/vector.h>
+#include <hatrack/pool.h>
+#include <hatrack/parallel.h>
 
 #endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           arena.h
+ *  Description:    Bump-allocated arenas, for data structures that
+ *                  get torn down all at once.
+ *
+ *                  An arena hands out memory from large chunks by
+ *                  bumping an offset with a fetch-and-add, so any
+ *                  number of threads can allocate from one arena at
+ *                  once. Nothing is freed individually; the chunks
+ *                  all go back to the global allocator when the arena
+ *                  is deleted.
+ *
+ *                  Arenas plug into mmm through the allocator's
+ *                  retire hook (see hatalloc.h): when mmm retires
+ *                  memory from an arena, it doesn't go on any thread's
+ *                  retire list, since those lists might not get
+ *                  processed until long after the arena is gone.
+ *                  Instead, if the memory has a cleanup handler, the
+ *                  arena keeps it on its own list, and runs the
+ *                  handlers either when asked, or right before it
+ *                  releases its chunks. Memory without a cleanup
+ *                  handler just stays where it is until then.
+ *
+ *                  Since other threads may still be reading from the
+ *                  arena when the structure using it goes away,
+ *                  hatrack_arena_retire() waits out an mmm grace
+ *                  period before deleting it.
+ *
+ *                  Dictionaries and sets can use a private arena for
+ *                  all of their records and stores; see
+ *                  hatrack_dict_set_arena() and hatrack_set_set_arena().
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_ARENA_H__
+#define __HATRACK_ARENA_H__
+
+#include <hatrack/mmm.h>
+
+typedef struct hatrack_arena_chunk_st hatrack_arena_chunk_t;
+
+/* size   -- The number of bytes available in data[].
+ *
+ * offset -- The next free byte in data[]. Threads fetch-and-add their
+ *           (rounded up) allocation size to this, and if the result
+ *           runs past size, the chunk is full. That means offset can
+ *           end up well past size, which is harmless.
+ */
+struct hatrack_arena_chunk_st {
+    hatrack_arena_chunk_t *next;
+    uint64_t               size;
+    _Atomic uint64_t       offset;
+    alignas(16)
+    uint8_t                data[];
+};
+
+/* allocator  -- What to hand to data structures that should allocate
+ *               from this arena.
+ *
+ * chunks     -- Chunks we're bumping through, newest first.  Only the
+ *               first one ever gets allocated from.
+ *
+ * large      -- Allocations too big to share a chunk get a chunk to
+ *               themselves, and live here, so that they don't cause
+ *               the current chunk to get abandoned.
+ *
+ * deferred   -- Retired memory with cleanup handlers, linked through
+ *               the mmm header's next field.
+ *
+ * chunk_size -- The size of the data area for regular chunks.
+ */
+typedef struct {
+    hatrack_allocator_t              allocator;
+    _Atomic(hatrack_arena_chunk_t *) chunks;
+    _Atomic(hatrack_arena_chunk_t *) large;
+    _Atomic(mmm_header_t *)          deferred;
+    uint64_t                         chunk_size;
+} hatrack_arena_t;
+
+// clang-format off
+hatrack_arena_t     *hatrack_arena_new         (uint64_t);
+void                 hatrack_arena_init        (hatrack_arena_t *, uint64_t);
+void                 hatrack_arena_cleanup     (hatrack_arena_t *);
+void                 hatrack_arena_delete      (hatrack_arena_t *);
+void                 hatrack_arena_retire      (hatrack_arena_t *);
+void                 hatrack_arena_run_cleanups(hatrack_arena_t *);
+void                *hatrack_arena_alloc       (hatrack_arena_t *, size_t);
+// clang-format on
+
+static inline hatrack_allocator_t *
+hatrack_arena_allocator(hatrack_arena_t *self)
+{
+    return &self->allocator;
+}
+
+#endif
@@ -52,6 +52,7 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/qstats.h>
 
 
 // clang-format off
@@ -72,13 +73,16 @@ struct capq_store_t {
     uint64_t                size;
     _Atomic uint64_t        enqueue_index;
     _Atomic uint64_t        dequeue_index;
+    _Atomic uint64_t       *stamps;
+    alignas(16)
     capq_cell_t             cells[];
 };
 
+// As with hq, stamps is only allocated when sampling is on.
 typedef struct {
     alignas(8)
     _Atomic (capq_store_t *)store;
-    _Atomic int64_t         len;
+    hatrack_qstats_t        stats;
 } capq_t;
 
 enum {
@@ -91,12 +95,6 @@ enum {
     CAPQ_STORE_INITIALIZING = 0xffffffffffffffff
 };
 
-static inline int64_t
-capq_len(hq_t *self)
-{
-    return atomic_read(&self->len);
-}
-
 capq_t    *capq_new        (void);
 capq_t    *capq_new_size   (uint64_t);
 void       capq_init       (capq_t *);
@@ -107,6 +105,9 @@ uint64_t   capq_enqueue    (capq_t *, void *);
 capq_top_t capq_top        (capq_t *, bool *);
 bool       capq_cap        (capq_t *, uint64_t);
 void      *capq_dequeue    (capq_t *, bool *);
+int64_t    capq_len        (capq_t *);
+void       capq_set_sample_rate(capq_t *, uint64_t);
+void       capq_stats      (capq_t *, hatrack_qstats_snapshot_t *);
 
 static inline uint64_t
 capq_set_enqueued(uint64_t ix)
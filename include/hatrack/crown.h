@@ -28,11 +28,13 @@
 #define __CROWN_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/shardctr.h>
 
 #ifdef HATRACK_32_BIT_HOP_TABLE
 
 
 #define CROWN_HOME_BIT  0x80000000
+#define CROWN_MAP_BITS  32
 
 typedef uint32_t hop_t;
 
@@ -41,6 +43,7 @@ typedef uint32_t hop_t;
 #else
 
 #define CROWN_HOME_BIT  0x8000000000000000
+#define CROWN_MAP_BITS  64
 
 typedef uint64_t hop_t;
     
@@ -48,6 +51,14 @@ typedef uint64_t hop_t;
 
 #endif
 
+/* With bounded probes on (see crown_set_bounded_probes()), the last
+ * bit of a neighborhood map doesn't stand for a bucket; instead, it
+ * means that at least one hash value that maps to the bucket lives
+ * in the store's stash.  So the neighborhood is one bucket smaller.
+ */
+#define CROWN_STASH_BIT    0x1
+#define CROWN_NEIGHBORHOOD (CROWN_MAP_BITS - 1)
+
 typedef struct {
     void    *item;
     uint64_t info;
@@ -72,14 +83,34 @@ typedef struct {
 
 typedef struct crown_store_st crown_store_t;
 
+typedef void (*crown_scan_func_t)(hatrack_hash_t, void *, void *);
+
+/* stash_len  -- The number of stash buckets, which sit right after
+ *               the regular buckets.  Zero unless bounded probes are
+ *               on.
+ *
+ * stash_full -- Set once the stash has filled up, so that the store
+ *               doubles in size when it migrates.
+ *
+ * overflowed -- Set if the stash filled up while we were migrating
+ *               into this store.  The items that didn't fit got
+ *               placed by plain linear probing, past their
+ *               neighborhoods, so operations on this store fall back
+ *               to linear probing too.
+ */
 // clang-format off
 struct crown_store_st {
     alignas(8)
     uint64_t                 last_slot;
     uint64_t                 threshold;
+    uint64_t                 stash_len;
     _Atomic uint64_t         used_count;    
+    hatrack_shard_t         *budget;
     _Atomic(crown_store_t *) store_next;
     _Atomic bool             claimed;
+    _Atomic bool             stash_full;
+    _Atomic bool             overflowed;
+    _Atomic uint64_t         prefault;
     alignas(16)
     crown_bucket_t           buckets[];
 };
@@ -87,10 +118,11 @@ struct crown_store_st {
 typedef struct {
     alignas(8)
     _Atomic(crown_store_t *) store_current;
-    _Atomic uint64_t         item_count;
+    hatrack_shardctr_t       item_count;
     _Atomic uint64_t         help_needed;
             uint64_t         next_epoch;
-
+    hatrack_allocator_t     *allocator;
+    uint64_t                 stash_len;
 } crown_t;
 
 
@@ -100,12 +132,16 @@ void            crown_init       (crown_t *);
 void            crown_init_size  (crown_t *, char);
 void            crown_cleanup    (crown_t *);
 void            crown_delete     (crown_t *);
+void            crown_set_allocator(crown_t *, hatrack_allocator_t *);
+void            crown_set_bounded_probes(crown_t *, bool);
+bool            crown_get_bounded_probes(crown_t *);
 void           *crown_get        (crown_t *, hatrack_hash_t, bool *);
 void           *crown_put        (crown_t *, hatrack_hash_t, void *, bool *);
 void           *crown_replace    (crown_t *, hatrack_hash_t, void *, bool *);
 bool            crown_add        (crown_t *, hatrack_hash_t, void *);
 void           *crown_remove     (crown_t *, hatrack_hash_t, bool *);
 uint64_t        crown_len        (crown_t *);
+uint64_t        crown_len_approx (crown_t *);
 hatrack_view_t *crown_view       (crown_t *, uint64_t *, bool);
 hatrack_view_t *crown_view_fast  (crown_t *, uint64_t *, bool);
 hatrack_view_t *crown_view_slow  (crown_t *, uint64_t *, bool);
@@ -115,7 +151,8 @@ hatrack_view_t *crown_view_slow  (crown_t *, uint64_t *, bool);
  * MMM. But, they should be considered "friend" functions, and not
  * part of the public API.
  */
-crown_store_t    *crown_store_new    (uint64_t);
+crown_store_t    *crown_store_new    (uint64_t, hatrack_allocator_t *,
+				      uint64_t);
 void             *crown_store_get    (crown_store_t *, hatrack_hash_t, bool *);
 void             *crown_store_put    (crown_store_t *, crown_t *,
 				      hatrack_hash_t, void *, bool *, uint64_t);
@@ -125,5 +162,29 @@ bool              crown_store_add    (crown_store_t *, crown_t *,
 				      hatrack_hash_t, void *, uint64_t);
 void             *crown_store_remove (crown_store_t *, crown_t *,
 				      hatrack_hash_t, bool *, uint64_t);
+bool              crown_store_cas    (crown_store_t *, crown_t *,
+				      hatrack_hash_t, void *, void *,
+				      uint64_t);
+void              crown_store_scan   (crown_store_t *, crown_t *,
+				      uint64_t, uint64_t,
+				      crown_scan_func_t, void *);
+crown_store_t    *crown_store_claim  (crown_t *);
+
+/* Exclusive-access versions of the write operations, plus get, for
+ * when the caller can guarantee that no other thread is touching the
+ * table at all (see hatrack_dict_begin_exclusive()).  They use plain
+ * loads and stores instead of CAS, skip mmm, and migrate without
+ * marking buckets, freeing the old store on the spot. They leave the
+ * table in a state the regular operations can pick up from, once
+ * the caller hands it back to other threads through some
+ * synchronizing operation.
+ */
+void             *crown_excl_get     (crown_t *, hatrack_hash_t, bool *);
+void             *crown_excl_put     (crown_t *, hatrack_hash_t, void *,
+				      bool *);
+void             *crown_excl_replace (crown_t *, hatrack_hash_t, void *,
+				      bool *);
+bool              crown_excl_add     (crown_t *, hatrack_hash_t, void *);
+void             *crown_excl_remove  (crown_t *, hatrack_hash_t, bool *);
 
 #endif
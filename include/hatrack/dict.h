@@ -23,6 +23,10 @@
 #define __HATRACK_DICT_H__
 
 #include <hatrack/crown.h>
+#include <hatrack/arena.h>
+#include <hatrack/membudget.h>
+
+#include <pthread.h>
 
 enum
 {
@@ -55,6 +59,11 @@ typedef struct {
 
 typedef struct hatrack_dict_st hatrack_dict_t;
 
+/* Called by the hash range scans with the argument passed in, then
+ * the key and the value.
+ */
+typedef void (*hatrack_dict_scan_hook_t)(void *, void *, void *);
+
 typedef void *hatrack_dict_key_t;
 typedef void *hatrack_dict_value_t;
 
@@ -63,6 +72,58 @@ typedef union {
     hatrack_hash_func_t   custom_hash;
 } hatrack_hash_info_t;
 
+/* In replicated mode, this describes the write currently being
+ * applied to the replicas.  Readers that are looking for the same
+ * key use it instead of their local replica; see dict.c.
+ */
+typedef struct {
+    hatrack_hash_t       hv;
+    hatrack_dict_item_t *item;
+} hatrack_dict_pending_t;
+
+/* One operation in a multi-key transaction (see
+ * hatrack_dict_txn_apply()).  If remove is true, the value is
+ * ignored.
+ */
+typedef struct {
+    hatrack_dict_t *dict;
+    void           *key;
+    void           *value;
+    bool            remove;
+} hatrack_dict_txn_op_t;
+
+/* The rest of these types are internal to the transaction code in
+ * dict.c.  While a transaction is in progress, the records it touches
+ * hold tagged pointers to these descriptors instead of items.
+ */
+enum
+{
+    HATRACK_DICT_TXN_UNDECIDED,
+    HATRACK_DICT_TXN_SUCCEEDED,
+    HATRACK_DICT_TXN_FAILED
+};
+
+typedef struct hatrack_dict_txn_st hatrack_dict_txn_t;
+
+typedef struct {
+    hatrack_hash_t       hv;
+    hatrack_dict_t      *dict;
+    hatrack_dict_txn_t  *txn;
+    hatrack_dict_item_t *old_item;
+    hatrack_dict_item_t *new_item;
+} hatrack_dict_txn_entry_t;
+
+struct hatrack_dict_txn_st {
+    _Atomic uint64_t         status;
+    uint64_t                 num_entries;
+    hatrack_dict_txn_entry_t entries[];
+};
+
+typedef struct {
+    hatrack_dict_txn_t       *txn;
+    hatrack_dict_txn_entry_t *entry;
+} hatrack_dict_txn_install_t;
+
 struct hatrack_dict_st {
     crown_t               crown_instance;
     hatrack_hash_info_t   hash_info;
@@ -72,8 +133,46 @@ struct hatrack_dict_st {
     uint32_t              key_type;
     bool                  slow_views;
     bool                  sorted_views;    
+    crown_t             **replicas;
+    crown_store_t       **replica_stores;
+    uint64_t              num_replicas;
+    pthread_mutex_t       write_mutex;
+    _Atomic(hatrack_dict_pending_t *) pending;
+    bool                  transactional;
+    bool                  exclusive;
+    hatrack_arena_t      *arena;
+    hatrack_membudget_t  *membudget;
+    hatrack_allocator_t  *record_allocator;
 };
 
+/* A frozen dictionary is an immutable copy of a dictionary, laid out
+ * for lookups (see hatrack_dict_freeze()).  It's a bucketized cuckoo
+ * table: every key can live in one of two buckets, and each bucket
+ * holds HATRACK_DICT_FROZEN_SLOTS items, inline, with their hash
+ * values up front.  Unused slots have a hash value of zero.
+ *
+ * A bucket is two cache lines, the first one holding the hash values.
+ */
+#define HATRACK_DICT_FROZEN_SLOTS 4
+
+typedef struct {
+    alignas(64)
+    hatrack_hash_t      hv[HATRACK_DICT_FROZEN_SLOTS];
+    hatrack_dict_item_t items[HATRACK_DICT_FROZEN_SLOTS];
+} hatrack_dict_frozen_bucket_t;
+
+typedef struct {
+    hatrack_dict_frozen_bucket_t *buckets;
+    uint64_t                      num_buckets;
+    uint64_t                      item_count;
+    void                         *mem;
+    uint64_t                      alloc_len;
+    hatrack_hash_info_t           hash_info;
+    hatrack_mem_hook_t            key_return_hook;
+    hatrack_mem_hook_t            val_return_hook;
+    uint32_t                      key_type;
+} hatrack_dict_frozen_t;
+
 // clang-format off
 hatrack_dict_t *hatrack_dict_new    (uint32_t);
 void            hatrack_dict_init   (hatrack_dict_t *, uint32_t);
@@ -84,18 +183,38 @@ void hatrack_dict_set_hash_offset     (hatrack_dict_t *, int32_t);
 void hatrack_dict_set_cache_offset    (hatrack_dict_t *, int32_t);
 void hatrack_dict_set_custom_hash     (hatrack_dict_t *, hatrack_hash_func_t);
 void hatrack_dict_set_free_handler    (hatrack_dict_t *, hatrack_mem_hook_t);
+void hatrack_dict_set_allocator       (hatrack_dict_t *, hatrack_allocator_t *);
+void hatrack_dict_set_arena           (hatrack_dict_t *, bool);
+bool hatrack_dict_get_arena           (hatrack_dict_t *);
+void hatrack_dict_set_bounded_probes  (hatrack_dict_t *, bool);
+bool hatrack_dict_get_bounded_probes  (hatrack_dict_t *);
+void hatrack_dict_set_membudget       (hatrack_dict_t *, hatrack_membudget_t *);
+hatrack_membudget_t *hatrack_dict_get_membudget(hatrack_dict_t *);
 void hatrack_dict_set_key_return_hook (hatrack_dict_t *, hatrack_mem_hook_t);
 void hatrack_dict_set_val_return_hook (hatrack_dict_t *, hatrack_mem_hook_t);
 void hatrack_dict_set_consistent_views(hatrack_dict_t *, bool);
 void hatrack_dict_set_sorted_views    (hatrack_dict_t *, bool);
 bool hatrack_dict_get_consistent_views(hatrack_dict_t *);
 bool hatrack_dict_get_sorted_views    (hatrack_dict_t *);
+void hatrack_dict_set_replicated      (hatrack_dict_t *, bool);
+bool hatrack_dict_get_replicated      (hatrack_dict_t *);
+void hatrack_dict_set_transactional   (hatrack_dict_t *, bool);
+bool hatrack_dict_get_transactional   (hatrack_dict_t *);
+void hatrack_dict_begin_exclusive     (hatrack_dict_t *);
+void hatrack_dict_end_exclusive       (hatrack_dict_t *);
+bool hatrack_dict_get_exclusive       (hatrack_dict_t *);
 
 void *hatrack_dict_get    (hatrack_dict_t *, void *, bool *);
-void  hatrack_dict_put    (hatrack_dict_t *, void *, void *);
+bool  hatrack_dict_put    (hatrack_dict_t *, void *, void *);
 bool  hatrack_dict_replace(hatrack_dict_t *, void *, void *);
 bool  hatrack_dict_add    (hatrack_dict_t *, void *, void *);
 bool  hatrack_dict_remove (hatrack_dict_t *, void *);
+void  hatrack_dict_txn_apply(hatrack_dict_txn_op_t *, uint64_t);
+
+uint64_t hatrack_dict_scan_hash_range   (hatrack_dict_t *, uint64_t, uint64_t,
+					 hatrack_dict_scan_hook_t, void *);
+uint64_t hatrack_dict_extract_hash_range(hatrack_dict_t *, uint64_t, uint64_t,
+					 hatrack_dict_scan_hook_t, void *);
 
 hatrack_dict_key_t   *hatrack_dict_keys         (hatrack_dict_t *, uint64_t *);
 hatrack_dict_value_t *hatrack_dict_values       (hatrack_dict_t *, uint64_t *);
@@ -107,4 +226,12 @@ hatrack_dict_key_t   *hatrack_dict_keys_nosort  (hatrack_dict_t *, uint64_t *);
 hatrack_dict_value_t *hatrack_dict_values_nosort(hatrack_dict_t *, uint64_t *);
 hatrack_dict_item_t  *hatrack_dict_items_nosort (hatrack_dict_t *, uint64_t *);
 
+hatrack_dict_frozen_t *hatrack_dict_freeze      (hatrack_dict_t *);
+void                  *hatrack_dict_frozen_get  (hatrack_dict_frozen_t *,
+						 void *, bool *);
+uint64_t               hatrack_dict_frozen_len  (hatrack_dict_frozen_t *);
+hatrack_dict_item_t   *hatrack_dict_frozen_items(hatrack_dict_frozen_t *,
+						 uint64_t *);
+void                   hatrack_dict_frozen_delete(hatrack_dict_frozen_t *);
+
 #endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           flex64.h
+ *  Description:    A variant of our flex array with 64-bit cells.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ * In flexarray_t, each cell is an item, plus a 64-bit state field, of
+ * which we only use a few bits. That costs 16 bytes per cell, and
+ * every read is a 128-bit atomic load.
+ *
+ * In this version, like in q64, we steal the low bits of the item for
+ * the state instead, so cells are a single word, reads are plain
+ * 64-bit loads, and writes are 64-bit compare-and-swaps.  The
+ * interface is otherwise the same as flexarray_t's, and so is the
+ * algorithm.
+ *
+ * We need three bits, so contents must either be pointers to things
+ * aligned to at least 8 bytes (anything from malloc() is), or values
+ * that fit in 61 bits, shifted left by three bits. flex64_set()
+ * aborts if any of the low three bits of an item are set.
+ */
+
+#ifndef __FLEX64_H__
+#define __FLEX64_H__
+
+#include <hatrack/flexarray.h>
+
+// clang-format off
+typedef uint64_t flex64_item_t;
+
+typedef _Atomic flex64_item_t flex64_cell_t;
+
+typedef struct flex64_store_t flex64_store_t;
+
+typedef struct {
+    uint64_t        next_ix;
+    flex64_store_t *contents;
+    flex_callback_t eject_callback;
+} flex64_view_t;
+
+struct flex64_store_t {
+    alignas(8)
+    uint64_t                  store_size;
+    _Atomic uint64_t          array_size;
+    _Atomic (flex64_store_t *)next;
+    _Atomic bool              claimed;
+    flex64_cell_t             cells[];
+};
+
+typedef struct {
+    flex_callback_t            ret_callback;
+    flex_callback_t            eject_callback;
+    _Atomic (flex64_store_t  *)store;
+} flex64_t;
+
+flex64_t      *flex64_new               (uint64_t);
+void           flex64_init              (flex64_t *, uint64_t);
+void           flex64_set_ret_callback  (flex64_t *, flex_callback_t);
+void           flex64_set_eject_callback(flex64_t *, flex_callback_t);
+void           flex64_cleanup           (flex64_t *);
+void           flex64_delete            (flex64_t *);
+void          *flex64_get               (flex64_t *, uint64_t, int *);
+bool           flex64_set               (flex64_t *, uint64_t, void *);
+void           flex64_grow              (flex64_t *, uint64_t);
+void           flex64_shrink            (flex64_t *, uint64_t);
+uint64_t       flex64_len               (flex64_t *);
+flex64_view_t *flex64_view              (flex64_t *);
+void          *flex64_view_next         (flex64_view_t *, bool *);
+void           flex64_view_delete       (flex64_view_t *);
+void          *flex64_view_get          (flex64_view_t *, uint64_t, int *);
+uint64_t       flex64_view_len          (flex64_view_t *);
+flex64_t      *flex64_add               (flex64_t *, flex64_t *);
+
+/* The array size uses FLEX_ARRAY_SHRINK from flexarray.h, and the
+ * status codes are the same FLEX_* values.
+ */
+enum64(flex64_enum_t,
+       FLEX64_USED       = 0x01,
+       FLEX64_MOVING     = 0x02,
+       FLEX64_MOVED      = 0x04,
+       FLEX64_STATE_MASK = 0x07
+       );
+
+static inline void *
+flex64_item(flex64_item_t cell)
+{
+    return (void *)(cell & ~FLEX64_STATE_MASK);
+}
+
+#endif
@@ -49,6 +49,7 @@ typedef struct flex_store_t flex_store_t;
 typedef struct {
     uint64_t        next_ix;
     flex_store_t   *contents;
+    flex_callback_t ret_callback;
     flex_callback_t eject_callback;
 } flex_view_t;
     
@@ -43,6 +43,7 @@
 typedef struct {
     _Atomic int64_t count;
     uint64_t        max_threads;
+    uint64_t        alloc_len;
     double          elapsed_time;
     double          fastest_time;
     double          avg_time;
@@ -74,12 +75,16 @@ gate_init(gate_t *gate, uint64_t max_threads)
 static inline gate_t *
 gate_new_size(uint64_t mt)
 {
-    gate_t *ret;
+    gate_t  *ret;
+    uint64_t alloc_len;
 
-    ret = (gate_t *)malloc(sizeof(gate_t) + sizeof(struct timespec) * mt);
+    alloc_len = sizeof(gate_t) + sizeof(struct timespec) * mt;
+    ret       = (gate_t *)hatrack_malloc(alloc_len);
 
     gate_init(ret, mt);
 
+    ret->alloc_len = alloc_len;
+
     return ret;
 }
 
@@ -92,7 +97,7 @@ gate_new(void)
 static inline void
 gate_delete(gate_t *gate)
 {
-    free(gate);
+    hatrack_free(gate, gate->alloc_len);
 
     return;
 }
@@ -0,0 +1,188 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hatalloc.h
+ *  Description:    Pluggable allocators.
+ *
+ *                  Every allocation the library makes goes through a
+ *                  hatrack_allocator_t, which is a set of function
+ *                  pointers plus an argument to pass them (e.g., an
+ *                  arena).  By default, that's a thin wrapper around
+ *                  the C library.
+ *
+ *                  There's one global allocator, which can be changed
+ *                  with hatrack_set_allocator().  Since memory that
+ *                  isn't managed by mmm gets freed to whatever the
+ *                  global allocator is at the time, it should only be
+ *                  changed before any hatrack objects exist.
+ *
+ *                  Memory that IS managed by mmm (stores, records,
+ *                  and so on) remembers the allocator it came from,
+ *                  and always goes back to it.  That makes it safe for
+ *                  individual data structures to use their own
+ *                  allocator for their stores and records, which
+ *                  dictionaries and sets support (see
+ *                  hatrack_dict_set_allocator() and
+ *                  hatrack_set_set_allocator()).
+ *
+ *                  Every call gets a size hint.  For allocation, it's
+ *                  the size.  For free and realloc, it's the size of
+ *                  the existing allocation, when we know it, and 0
+ *                  when we don't.  Allocators that need exact sizes on
+ *                  free (e.g., size-class allocators) should keep
+ *                  their own headers for the 0 case.  Memory from mmm
+ *                  always comes with its exact size.
+ *
+ *                  Arrays that get handed back to the caller, such as
+ *                  views, come from the global allocator, and should
+ *                  be released with hatrack_free() (which is the same
+ *                  as free() unless you've changed the allocator).
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATALLOC_H__
+#define __HATALLOC_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef void *(*hatrack_alloc_func)  (size_t, void *);
+typedef void *(*hatrack_zalloc_func) (size_t, void *);
+typedef void *(*hatrack_realloc_func)(void *, size_t, size_t, void *);
+typedef void  (*hatrack_free_func)   (void *, size_t, void *);
+typedef bool  (*hatrack_retire_func) (void *, void *);
+
+/* alloc   -- Returns size bytes, with undefined contents.
+ *
+ * zalloc  -- Returns size bytes, all zero.
+ *
+ * realloc -- Called with the pointer, the old size (or 0, if not
+ *            known), and the new size.  Like the C library's
+ *            realloc(), contents up to the smaller of the two sizes
+ *            must be preserved.
+ *
+ * free    -- Called with the pointer, and its size (or 0).
+ *
+ * arg     -- Passed as the last argument to each of the above.
+ *
+ * retire  -- Optional. When mmm retires memory that came from this
+ *            allocator, it normally puts it on the retiring thread's
+ *            list, to be freed once no thread can be using it.  If
+ *            this is set, mmm first hands it the allocation's mmm
+ *            header (and arg).  If it returns true, mmm forgets about
+ *            the memory; that's for allocators that reclaim
+ *            everything at once, after their own grace period (see
+ *            arena.h), where the thread lists could otherwise outlive
+ *            the memory they point into.  If it returns false, mmm
+ *            carries on as usual; memory budgets (see membudget.h)
+ *            use that to keep track of retired memory.
+ */
+typedef struct {
+    hatrack_alloc_func   alloc;
+    hatrack_zalloc_func  zalloc;
+    hatrack_realloc_func realloc;
+    hatrack_free_func    free;
+    void                *arg;
+    hatrack_retire_func  retire;
+} hatrack_allocator_t;
+
+// clang-format off
+extern hatrack_allocator_t            hatrack_default_allocator;
+extern _Atomic(hatrack_allocator_t *) hatrack_global_allocator;
+
+void                 hatrack_set_allocator(hatrack_allocator_t *);
+hatrack_allocator_t *hatrack_get_allocator(void);
+// clang-format on
+
+/* Data structures that allow their own allocator keep NULL to mean
+ * "the global one".
+ */
+static inline hatrack_allocator_t *
+hatrack_resolve_allocator(hatrack_allocator_t *allocator)
+{
+    if (allocator) {
+        return allocator;
+    }
+
+    return atomic_load_explicit(&hatrack_global_allocator,
+                                memory_order_relaxed);
+}
+
+static inline void *
+hatrack_malloc_with(hatrack_allocator_t *allocator, size_t size)
+{
+    allocator = hatrack_resolve_allocator(allocator);
+
+    return (*allocator->alloc)(size, allocator->arg);
+}
+
+static inline void *
+hatrack_zalloc_with(hatrack_allocator_t *allocator, size_t size)
+{
+    allocator = hatrack_resolve_allocator(allocator);
+
+    return (*allocator->zalloc)(size, allocator->arg);
+}
+
+static inline void *
+hatrack_realloc_with(hatrack_allocator_t *allocator,
+                     void                *ptr,
+                     size_t               old_size,
+                     size_t               new_size)
+{
+    allocator = hatrack_resolve_allocator(allocator);
+
+    return (*allocator->realloc)(ptr, old_size, new_size, allocator->arg);
+}
+
+static inline void
+hatrack_free_with(hatrack_allocator_t *allocator, void *ptr, size_t size)
+{
+    allocator = hatrack_resolve_allocator(allocator);
+
+    (*allocator->free)(ptr, size, allocator->arg);
+
+    return;
+}
+
+static inline void *
+hatrack_malloc(size_t size)
+{
+    return hatrack_malloc_with(NULL, size);
+}
+
+static inline void *
+hatrack_zalloc(size_t size)
+{
+    return hatrack_zalloc_with(NULL, size);
+}
+
+static inline void *
+hatrack_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    return hatrack_realloc_with(NULL, ptr, old_size, new_size);
+}
+
+static inline void
+hatrack_free(void *ptr, size_t size)
+{
+    hatrack_free_with(NULL, ptr, size);
+
+    return;
+}
+
+#endif
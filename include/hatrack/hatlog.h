@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hatlog.h
+ *  Description:    A logger that formats into a logring, and has a
+ *                  background thread drain it to a file.
+ *
+ *                  Producers format directly into a logring entry
+ *                  (via logring_reserve() / logring_commit()), so
+ *                  logging a message never touches the disk, and
+ *                  never blocks.  If the drain thread falls behind
+ *                  far enough for the ring to wrap, the oldest
+ *                  messages get dropped, and we count them (see
+ *                  hatlog_dropped()).
+ *
+ *                  The drain thread dequeues up to batch_size
+ *                  messages at a time, and writes each batch with a
+ *                  single writev() call.  When there's nothing to
+ *                  write, it sleeps for HATLOG_DRAIN_SLEEP_NS.
+ *
+ *                  Optionally, the file gets rotated when it would
+ *                  grow past a maximum size: the current file
+ *                  becomes path.1, path.1 becomes path.2, and so on,
+ *                  keeping up to max_files old files.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATLOG_H__
+#define __HATLOG_H__
+
+#include <hatrack/logring.h>
+
+#include <pthread.h>
+#include <sys/uio.h>
+
+typedef struct {
+    logring_t       *ring;
+    char            *path;
+    int              fd;
+    uint64_t         msg_size;
+    uint64_t         batch_size;
+    uint64_t         max_file_size;
+    uint64_t         max_files;
+    uint64_t         file_size;
+    char            *batch;
+    struct iovec    *iov;
+    pthread_t        drain_thread;
+    bool             running;
+    _Atomic bool     stop;
+    _Atomic uint64_t written;
+    _Atomic uint64_t write_errors;
+} hatlog_t;
+
+// clang-format off
+hatlog_t *hatlog_new           (const char *, uint64_t, uint64_t);
+void      hatlog_init          (hatlog_t *, const char *, uint64_t, uint64_t);
+void      hatlog_cleanup       (hatlog_t *);
+void      hatlog_delete        (hatlog_t *);
+void      hatlog_set_batch_size(hatlog_t *, uint64_t);
+void      hatlog_set_rotation  (hatlog_t *, uint64_t, uint64_t);
+bool      hatlog_start         (hatlog_t *);
+void      hatlog_stop          (hatlog_t *);
+void      hatlog_write         (hatlog_t *, void *, uint64_t);
+void      hatlog_printf        (hatlog_t *, const char *, ...)
+                                __attribute__((format(printf, 2, 3)));
+uint64_t  hatlog_dropped       (hatlog_t *);
+uint64_t  hatlog_written       (hatlog_t *);
+uint64_t  hatlog_write_errors  (hatlog_t *);
+// clang-format on
+
+#endif
@@ -290,6 +290,44 @@ hatrack_bucket_index(hatrack_hash_t hv, uint64_t last_slot)
 
 #endif
 
+/* A hash value's "position" is the word we take bucket indices from,
+ * with its bits reversed.  Since the bucket index is the low bits of
+ * that word, all the hash values that map to a given bucket form one
+ * contiguous range of positions, and any range of positions maps to a
+ * set of buckets.  That's what lets us scan or extract a range of
+ * hash values (e.g., one shard out of 64) by only looking at the
+ * buckets that range maps to; see hatrack_dict_scan_hash_range().
+ */
+static inline uint64_t
+hatrack_bit_reverse64(uint64_t n)
+{
+    n = ((n & 0x5555555555555555ULL) << 1)  | ((n >> 1)  & 0x5555555555555555ULL);
+    n = ((n & 0x3333333333333333ULL) << 2)  | ((n >> 2)  & 0x3333333333333333ULL);
+    n = ((n & 0x0f0f0f0f0f0f0f0fULL) << 4)  | ((n >> 4)  & 0x0f0f0f0f0f0f0f0fULL);
+    n = ((n & 0x00ff00ff00ff00ffULL) << 8)  | ((n >> 8)  & 0x00ff00ff00ff00ffULL);
+    n = ((n & 0x0000ffff0000ffffULL) << 16) | ((n >> 16) & 0x0000ffff0000ffffULL);
+
+    return (n << 32) | (n >> 32);
+}
+
+#ifdef HAVE___INT128_T
+
+static inline uint64_t
+hatrack_hash_position(hatrack_hash_t hv)
+{
+    return hatrack_bit_reverse64((uint64_t)hv);
+}
+
+#else
+
+static inline uint64_t
+hatrack_hash_position(hatrack_hash_t hv)
+{
+    return hatrack_bit_reverse64(hv.w1);
+}
+
+#endif
+
 #ifdef HAVE___INT128_T
 
 static inline void
@@ -420,7 +458,41 @@ hatrack_or2x64h(generic_2x64_u *s1, uint64_t h)
 #define ORPTR(s1, s2) atomic_fetch_or((_Atomic uint64_t *)(s1), s2)
 
 #define hatrack_cell_alloc(container_type, cell_type, n)                       \
-    (container_type *)calloc(1, sizeof(container_type) + sizeof(cell_type) * n)
+    (container_type *)hatrack_zalloc(sizeof(container_type)                  \
+                                     + sizeof(cell_type) * (n))
 
 int  hatrack_quicksort_cmp(const void *, const void *);
+
+/* NUMA support, used by replicated dictionaries.  We don't depend on
+ * libnuma; we get the node count from sysfs, and the current node via
+ * the getcpu system call.  Since that's a real system call, each
+ * thread caches its node, and only re-checks every
+ * HATRACK_NUMA_NODE_REFRESH calls, which is plenty for threads that
+ * rarely hop sockets.
+ *
+ * On platforms without those facilities, everything is node 0.
+ *
+ * If hatrack_numa_forced_nodes is non-zero, hatrack_numa_node_count()
+ * returns it instead of asking sysfs.  That's there so that
+ * replication can get exercised on single-node machines; set it
+ * before making any replicated dictionaries.
+ */
+extern __thread uint64_t hatrack_numa_node;
+extern __thread uint64_t hatrack_numa_node_ttl;
+extern uint64_t          hatrack_numa_forced_nodes;
+
+uint64_t hatrack_numa_node_count  (void);
+uint64_t hatrack_numa_refresh_node(void);
+void     hatrack_numa_place       (void *, uint64_t, uint64_t);
+
+static inline uint64_t
+hatrack_numa_current_node(void)
+{
+    if (!hatrack_numa_node_ttl--) {
+	return hatrack_numa_refresh_node();
+    }
+
+    return hatrack_numa_node;
+}
+
 #endif
@@ -606,6 +606,48 @@
  */
 // #define HATRACK_SKIP_ON_MIGRATIONS
 
+/* HATRACK_CROWN_STASH_SIZE
+ *
+ * When bounded probes are on for a crown table, items that can't
+ * find a bucket in their neighborhood go into a small stash at the
+ * end of the store, instead of probing further.  This is the number
+ * of buckets in the stash.  If it fills up, the table doubles in
+ * size.
+ *
+ * Lookups that have to check the stash scan it linearly, so this
+ * should stay small.
+ */
+#ifndef HATRACK_CROWN_STASH_SIZE
+#define HATRACK_CROWN_STASH_SIZE 64
+#endif
+
+/* QUILT_SEGMENT_SIZE_LOG
+ *
+ * Quilt keeps its buckets in fixed-size segments hanging off of a
+ * directory, and grows one segment at a time, instead of migrating
+ * the whole table at once. This controls the largest size a segment
+ * is allowed to grow to before it gets split in two, expressed as a
+ * base two logarithm of the number of buckets.
+ *
+ * The extra memory needed while the table grows is bounded by one
+ * segment per thread that is actively migrating, so smaller values
+ * reduce peak memory, at the expense of a larger directory, and more
+ * (but much cheaper) migrations.
+ *
+ * With the default of 14, each segment is 16K buckets (512K of memory
+ * with 128-bit hash values).
+ */
+#if !defined(QUILT_SEGMENT_SIZE_LOG)
+#define QUILT_SEGMENT_SIZE_LOG 14
+#endif
+
+#if QUILT_SEGMENT_SIZE_LOG < HATRACK_MIN_SIZE_LOG
+#error "QUILT_SEGMENT_SIZE_LOG must be >= HATRACK_MIN_SIZE_LOG"
+#endif
+
+#undef QUILT_SEGMENT_SIZE
+#define QUILT_SEGMENT_SIZE (1 << QUILT_SEGMENT_SIZE_LOG)
+
 /* QUEUE_HELP_STEPS
  *
  * The "bonus" directory has a fast, wait-free queue
@@ -718,6 +760,197 @@
 
 #define CAPQ_TOP_SUSPEND_THRESHOLD 2
 
+/* HATRACK_NUMA_MAX_NODES
+ *
+ * The most NUMA nodes we will ever replicate a dictionary across. If
+ * the machine reports more, the extra nodes share replicas (node n
+ * reads from replica n % HATRACK_NUMA_MAX_NODES). This needs to fit
+ * in a single word of node mask when we ask the kernel to place
+ * memory.
+ */
+#ifndef HATRACK_NUMA_MAX_NODES
+#define HATRACK_NUMA_MAX_NODES 64
+#endif
+
+#if HATRACK_NUMA_MAX_NODES > 64 || HATRACK_NUMA_MAX_NODES < 1
+#error "HATRACK_NUMA_MAX_NODES must be between 1 and 64, inclusive"
+#endif
+
+/* HATRACK_NUMA_NODE_REFRESH
+ *
+ * Each thread caches the NUMA node it's running on, and asks the
+ * kernel again after this many lookups.
+ */
+#ifndef HATRACK_NUMA_NODE_REFRESH
+#define HATRACK_NUMA_NODE_REFRESH 1024
+#endif
+
+/* HATRACK_DICT_TXN_MAX_OPS
+ *
+ * The most puts / removes that hatrack_dict_txn_apply() will accept
+ * in a single call.  The descriptor is sized per call, so this is
+ * only a sanity limit; every operation in a transaction costs a CAS
+ * to install, and one to uninstall.
+ */
+#ifndef HATRACK_DICT_TXN_MAX_OPS
+#define HATRACK_DICT_TXN_MAX_OPS 8
+#endif
+
+/* HATRACK_DICT_FROZEN_MAX_KICKS
+ *
+ * When building a frozen dictionary (see hatrack_dict_freeze()), the
+ * most items one insertion will move out of the way before we give
+ * up, and start over with more buckets.  Higher values get the
+ * table more full, at the cost of slower builds.
+ */
+#ifndef HATRACK_DICT_FROZEN_MAX_KICKS
+#define HATRACK_DICT_FROZEN_MAX_KICKS 500
+#endif
+
+/* HATLOG_DEFAULT_BATCH_SIZE
+ *
+ * The most messages the hatlog drain thread will dequeue before
+ * writing them out with a single writev() call. This can be changed
+ * per-logger with hatlog_set_batch_size(), but is always capped at
+ * IOV_MAX.
+ */
+#ifndef HATLOG_DEFAULT_BATCH_SIZE
+#define HATLOG_DEFAULT_BATCH_SIZE 64
+#endif
+
+/* HATLOG_DRAIN_SLEEP_NS
+ *
+ * How long the hatlog drain thread sleeps when it finds the ring
+ * empty.
+ */
+#ifndef HATLOG_DRAIN_SLEEP_NS
+#define HATLOG_DRAIN_SLEEP_NS 1000000
+#endif
+
+/* HATRACK_QSTATS_BUCKETS
+ *
+ * The number of buckets in the dwell-time histograms kept by hq,
+ * capq and hatring when sampling is on (see qstats.h).  Bucket i
+ * covers dwell times below 2^i ns, so the default of 40 tops out at
+ * around nine minutes; anything longer lands in the last bucket.
+ */
+#ifndef HATRACK_QSTATS_BUCKETS
+#define HATRACK_QSTATS_BUCKETS 40
+#endif
+
+#if HATRACK_QSTATS_BUCKETS > 64 || HATRACK_QSTATS_BUCKETS < 2
+#error "HATRACK_QSTATS_BUCKETS must be between 2 and 64, inclusive"
+#endif
+
+/* HATRACK_COUNTER_SHARDS_LOG
+ *
+ * crown, witchhat and woolhat spread their item counts (and, for big
+ * stores, their used-bucket counts) across 2^N shards, each on its
+ * own cache line, to keep writers from all hitting the same word; see
+ * shardctr.h.  Threads map to shards by mmm thread ID, so there's no
+ * point in going much above the number of cores.
+ */
+#ifndef HATRACK_COUNTER_SHARDS_LOG
+#define HATRACK_COUNTER_SHARDS_LOG 4
+#endif
+
+/* HATRACK_COUNTER_FLUSH
+ *
+ * How far a shard of an item count can drift from zero before it
+ * gets folded into the shared total.  This bounds the error of the
+ * *_len_approx() calls, at (HATRACK_COUNTER_FLUSH - 1) per shard.
+ */
+#ifndef HATRACK_COUNTER_FLUSH
+#define HATRACK_COUNTER_FLUSH 64
+#endif
+
+/* HATRACK_BUDGET_CHUNK_SHIFT and HATRACK_BUDGET_CHUNK_MAX
+ *
+ * When claiming buckets, threads reserve (threshold >>
+ * HATRACK_BUDGET_CHUNK_SHIFT) of a store's threshold at a time, up to
+ * HATRACK_BUDGET_CHUNK_MAX. Reservations parked in shards can make a
+ * store resize up to (chunk - 1) buckets per shard early, so the
+ * defaults keep that to a few percent of the threshold.  Stores
+ * where the chunk would be 1 don't use shards at all.
+ */
+#ifndef HATRACK_BUDGET_CHUNK_SHIFT
+#define HATRACK_BUDGET_CHUNK_SHIFT 10
+#endif
+
+#ifndef HATRACK_BUDGET_CHUNK_MAX
+#define HATRACK_BUDGET_CHUNK_MAX 32
+#endif
+
+/* HATRACK_ARENA_CHUNK_SIZE
+ *
+ * The default number of bytes arenas (see arena.h) grab from the
+ * global allocator at a time.  Allocations bigger than a quarter of
+ * this get a chunk of their own.  Arenas are meant for lots of small,
+ * short-lived structures, so we keep this modest.
+ */
+#ifndef HATRACK_ARENA_CHUNK_SIZE
+#define HATRACK_ARENA_CHUNK_SIZE 8192
+#endif
+
+/* HATRACK_MEMBUDGET_FLUSH
+ *
+ * How many bytes a shard of a memory budget's counts can drift from
+ * zero before getting folded into the shared total (see membudget.h).
+ * Limit checks only look at the total, so this is the slack, per
+ * shard, per count.
+ */
+#ifndef HATRACK_MEMBUDGET_FLUSH
+#define HATRACK_MEMBUDGET_FLUSH 16384
+#endif
+
+/* HATRACK_PREFAULT_MIN and HATRACK_PREFAULT_CHUNK
+ *
+ * New stores (in crown, woolhat and hq) at least HATRACK_PREFAULT_MIN
+ * bytes in size get their pages faulted in by the migrating threads,
+ * HATRACK_PREFAULT_CHUNK bytes per claim, before the copy starts (see
+ * prefault.h).  Setting HATRACK_PREFAULT_MIN to 0 turns this off.
+ */
+#ifndef HATRACK_PREFAULT_MIN
+#define HATRACK_PREFAULT_MIN (1 << 23)
+#endif
+
+#ifndef HATRACK_PREFAULT_CHUNK
+#define HATRACK_PREFAULT_CHUNK (1 << 20)
+#endif
+
+/* HATRACK_INTSET_ARRAY_MAX
+ *
+ * The most items a chunk of a hatrack_intset_t (see intset.h) keeps
+ * in a sorted array before switching to a bitmap.  At 4096, the array
+ * is as big as the bitmap would be.  Lower values mean less copying
+ * on adds, at some cost in memory for mid-density chunks.
+ */
+#ifndef HATRACK_INTSET_ARRAY_MAX
+#define HATRACK_INTSET_ARRAY_MAX 4096
+#endif
+
+/* HATRACK_POOL_THREADS
+ *
+ * The number of worker threads in the built-in thread pool (see
+ * pool.h), which gets used when the parallel array algorithms aren't
+ * handed a pool.  The thread calling into the pool also does work, so
+ * when this is 0, we use one less than the number of online CPUs.
+ */
+#ifndef HATRACK_POOL_THREADS
+#define HATRACK_POOL_THREADS 0
+#endif
+
+/* HATRACK_PAR_CHUNK
+ *
+ * The number of array cells each task in the parallel array
+ * algorithms (see parallel.h) handles.  Views smaller than this get
+ * processed on the calling thread.  This needs to be a power of two,
+ * since the sort merges runs of this size.
+ */
+#ifndef HATRACK_PAR_CHUNK
+#define HATRACK_PAR_CHUNK 4096
+#endif
+
 #ifndef FLEXARRAY_DEFAULT_GROW_SIZE_LOG
 #define FLEXARRAY_DEFAULT_GROW_SIZE_LOG 8
 #endif
@@ -48,6 +48,7 @@
 #include <stdatomic.h>
 #include <time.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/qstats.h>
 
 
 typedef struct {
@@ -69,8 +70,12 @@ typedef struct {
     alignas(16)
     _Atomic uint64_t             epochs;
     hatring_drop_handler         drop_handler;
+    _Atomic uint64_t             drops;
     uint64_t                     last_slot;
     uint64_t                     size;
+    _Atomic uint64_t            *stamps;
+    hatrack_qstats_t             stats;
+    alignas(16)
     hatring_cell_t               cells[];
 } hatring_t;
 
@@ -136,5 +141,9 @@ hatring_view_t *hatring_view            (hatring_t *);
 void           *hatring_view_next       (hatring_view_t *, bool *);
 void            hatring_view_delete     (hatring_view_t *);
 void            hatring_set_drop_handler(hatring_t *, hatring_drop_handler);
+uint64_t        hatring_drops           (hatring_t *);
+void            hatring_set_sample_rate (hatring_t *, uint64_t);
+void            hatring_stats           (hatring_t *,
+					 hatrack_qstats_snapshot_t *);
 			 
 #endif
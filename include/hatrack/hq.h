@@ -38,6 +38,7 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/qstats.h>
 
 
 // clang-format off
@@ -64,13 +65,23 @@ struct hq_store_t {
     _Atomic uint64_t      enqueue_index;
     _Atomic uint64_t      dequeue_index;
     _Atomic bool          claimed;
+    _Atomic uint64_t     *stamps;
+    _Atomic uint64_t      prefault;
+    alignas(16)
     hq_cell_t             cells[];
 };
 
+/* stamps is NULL unless sampling was turned on with
+ * hq_set_sample_rate(); otherwise it lives in the same allocation as
+ * the store, right after the cells.
+ *
+ * prefault is the cursor migrating threads share when prefaulting a
+ * big new store; see prefault.h.
+ */
 typedef struct {
     alignas(8)
     _Atomic (hq_store_t *)store;
-    _Atomic int64_t       len;
+    hatrack_qstats_t      stats;
 } hq_t;
 
 enum {
@@ -83,12 +94,6 @@ enum {
     HQ_STORE_INITIALIZING = 0xffffffffffffffff
 };
 
-static inline int64_t
-hq_len(hq_t *self)
-{
-    return atomic_read(&self->len);
-}
-
 hq_t      *hq_new        (void);
 hq_t      *hq_new_size   (uint64_t);
 void       hq_init       (hq_t *);
@@ -100,6 +105,9 @@ void      *hq_dequeue    (hq_t *, bool *);
 hq_view_t *hq_view       (hq_t *);
 void      *hq_view_next  (hq_view_t *, bool *);
 void       hq_view_delete(hq_view_t *);
+int64_t    hq_len        (hq_t *);
+void       hq_set_sample_rate(hq_t *, uint64_t);
+void       hq_stats      (hq_t *, hatrack_qstats_snapshot_t *);
 
 static inline bool
 hq_cell_too_slow(hq_item_t item)
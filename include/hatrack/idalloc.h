@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           idalloc.h
+ *  Description:    A lock-free allocator for small integer IDs.
+ *
+ *                  IDs are handed out lowest-free-first, so that the
+ *                  range of IDs in use stays as dense as it can be.
+ *                  That's what we want for mmm's thread IDs (every
+ *                  pass through the retire list scans the
+ *                  reservations up to the highest TID ever issued),
+ *                  and it's handy for slot and connection IDs that
+ *                  index into arrays.
+ *
+ *                  The allocator is a hierarchical bitmap.  The
+ *                  bottom level has one bit per ID, set when the ID
+ *                  is in use.  Each level above has one bit per word
+ *                  in the level below, set when that word is full.
+ *                  The top level is a single word.  To allocate, we
+ *                  walk down from the top, following the lowest clear
+ *                  bit at each level, and then try to set the bit we
+ *                  land on with an atomic OR. Freeing is an atomic
+ *                  AND, plus clearing the 'full' bits above, which
+ *                  only needs doing when the word was full before.
+ *
+ *                  When a word fills up, the thread that filled it
+ *                  sets the bit above, and then looks at the word
+ *                  again, backing the bit out if an ID got freed in
+ *                  the meantime.  So the 'full' bits can lag behind
+ *                  for a moment, but don't get stuck. If the top
+ *                  word says everything is in use, we double check
+ *                  by scanning the bottom level before giving up, so
+ *                  a lagging bit can never cause a spurious failure.
+ *
+ *                  While IDs are being allocated and freed
+ *                  concurrently, "lowest free" is only approximate,
+ *                  but once things quiesce, the next ID handed out
+ *                  is always the lowest one not in use.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __IDALLOC_H__
+#define __IDALLOC_H__
+
+#include <hatrack/hatomic.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Six levels of 64 bits each gets us 2^36 IDs, which is more than
+ * anyone should need.
+ */
+#define IDALLOC_MAX_LEVELS 6
+
+typedef struct {
+    uint64_t          capacity;
+    uint64_t          num_levels;
+    uint64_t          offsets[IDALLOC_MAX_LEVELS];
+    _Atomic uint64_t  high_water;
+    _Atomic uint64_t *words;
+} idalloc_t;
+
+// clang-format off
+idalloc_t *idalloc_new       (uint64_t);
+void       idalloc_init      (idalloc_t *, uint64_t);
+void       idalloc_cleanup   (idalloc_t *);
+void       idalloc_delete    (idalloc_t *);
+int64_t    idalloc_get       (idalloc_t *);
+void       idalloc_put       (idalloc_t *, uint64_t);
+bool       idalloc_in_use    (idalloc_t *, uint64_t);
+// clang-format on
+
+/* One more than the highest ID ever handed out. Every ID that's in
+ * use is below this, but some below it may not be in use.
+ */
+static inline uint64_t
+idalloc_high_water(idalloc_t *self)
+{
+    return atomic_read(&self->high_water);
+}
+
+static inline uint64_t
+idalloc_capacity(idalloc_t *self)
+{
+    return self->capacity;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           intset.h
+ *  Description:    A compact, lock-free set of 32-bit integers.
+ *
+ *                  hatrack_set_t stores a 128-bit hash and a woolhat
+ *                  record for every item, which is a lot of overhead
+ *                  when the items are just integer IDs, especially
+ *                  dense ones.
+ *
+ *                  This set splits the 32-bit space into 65536
+ *                  chunks, keyed by the high 16 bits of an item, and
+ *                  keeps one container per non-empty chunk, holding
+ *                  the low 16 bits.  Containers come in two kinds:
+ *
+ *                  - Arrays: a sorted array of 16-bit values, for
+ *                    chunks with up to HATRACK_INTSET_ARRAY_MAX
+ *                    items.  Arrays are never modified in place;
+ *                    writers build a new array and swap it in with a
+ *                    compare-and-swap, and the old one is retired
+ *                    through mmm.
+ *
+ *                  - Bitmaps: 8K for all 65536 possible values. Once
+ *                    an array would get too big, it gets swapped out
+ *                    for a bitmap, which writers then update in place
+ *                    with atomic ORs and ANDs.  Bitmaps don't turn
+ *                    back into arrays, even if the chunk empties out.
+ *
+ *                  The chunk directory is two levels of 256 entries,
+ *                  so an empty set is about 2K, and the second-level
+ *                  pages get added as needed.
+ *
+ *                  The set operations (union, intersection and so on)
+ *                  build a new set, chunk by chunk.  Bitmaps get
+ *                  combined a word at a time, in loops simple enough
+ *                  for the compiler to vectorize; arrays get merged,
+ *                  unless the other side is a bitmap.  Each chunk is
+ *                  read as of when the operation gets to it, so if
+ *                  the inputs change while the operation runs, the
+ *                  result isn't a point-in-time snapshot of them.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_INTSET_H__
+#define __HATRACK_INTSET_H__
+
+#include <hatrack/shardctr.h>
+
+#define HATRACK_INTSET_BITMAP_WORDS 1024
+
+enum {
+    HATRACK_INTSET_ARRAY,
+    HATRACK_INTSET_BITMAP
+};
+
+/* kind        -- HATRACK_INTSET_ARRAY or HATRACK_INTSET_BITMAP.
+ *
+ * cardinality -- The number of items in the container. It never
+ *                changes for arrays.  For bitmaps, it's only
+ *                approximate while adds and removes are racing, and
+ *                can even wrap for a moment.
+ *
+ * contents    -- For arrays, cardinality sorted uint16_t values. For
+ *                bitmaps, HATRACK_INTSET_BITMAP_WORDS words.
+ */
+typedef struct {
+    uint32_t         kind;
+    _Atomic uint32_t cardinality;
+    alignas(16)
+    uint64_t         contents[];
+} hatrack_intset_container_t;
+
+typedef struct {
+    _Atomic(hatrack_intset_container_t *) chunks[256];
+} hatrack_intset_page_t;
+
+typedef struct {
+    _Atomic(hatrack_intset_page_t *) pages[256];
+    hatrack_shardctr_t               item_count;
+} hatrack_intset_t;
+
+// clang-format off
+hatrack_intset_t *hatrack_intset_new         (void);
+void              hatrack_intset_init        (hatrack_intset_t *);
+void              hatrack_intset_cleanup     (hatrack_intset_t *);
+void              hatrack_intset_delete      (hatrack_intset_t *);
+bool              hatrack_intset_contains    (hatrack_intset_t *, uint32_t);
+bool              hatrack_intset_add         (hatrack_intset_t *, uint32_t);
+bool              hatrack_intset_remove      (hatrack_intset_t *, uint32_t);
+uint64_t          hatrack_intset_len         (hatrack_intset_t *);
+uint32_t         *hatrack_intset_items       (hatrack_intset_t *, uint64_t *);
+hatrack_intset_t *hatrack_intset_difference  (hatrack_intset_t *,
+					      hatrack_intset_t *);
+hatrack_intset_t *hatrack_intset_union       (hatrack_intset_t *,
+					      hatrack_intset_t *);
+hatrack_intset_t *hatrack_intset_intersection(hatrack_intset_t *,
+					      hatrack_intset_t *);
+hatrack_intset_t *hatrack_intset_disjunction (hatrack_intset_t *,
+					      hatrack_intset_t *);
+// clang-format on
+
+#endif
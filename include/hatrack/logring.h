@@ -144,6 +144,19 @@
  *  people to be able to scan either forward or backward through the
  *  ring (knowing there may be dequeues and enqueues that impact us).
  *
+ *  Views do that, but they cost the writers: enqueuers and dequeuers
+ *  both help finish any view in progress. For readers that just want
+ *  to tail the log as it's written (e.g., shipping it somewhere, or
+ *  watching it live), there are followers instead.  A follower keeps
+ *  its own read position (a ring epoch), and reads entries in place,
+ *  without ever writing to the ring or the entries, so having any
+ *  number of them costs producers nothing.  In return, they get no
+ *  protection: a follower copies an entry out, then checks that its
+ *  write epoch didn't change while it was copying.  If it did, or if
+ *  the ring lapped the follower, or a dequeuer got to the entry
+ *  first, the follower skips ahead, and reports how many entries it
+ *  missed.
+ *
  *  Author:         John Viega, john@zork.org
  */
 
@@ -212,8 +225,17 @@ typedef struct {
     _Atomic view_info_t       view_state;
     hatring_t                *ring;
     logring_entry_t          *entries;
+    _Atomic uint64_t          dropped;
 } logring_t;
 
+/* A tail reader that never writes to the ring. next_epoch is the
+ * ring epoch of the next entry it will try to read.
+ */
+typedef struct {
+    logring_t *ring;
+    uint32_t   next_epoch;
+} logring_follower_t;
+
 static inline bool
 logring_entry_is_being_used(logring_entry_info_t info)
 {
@@ -286,9 +308,16 @@ void            logring_init       (logring_t *, uint64_t, uint64_t);
 void            logring_cleanup    (logring_t *);
 void            logring_delete     (logring_t *);
 void            logring_enqueue    (logring_t *, void *, uint64_t);
+char           *logring_reserve    (logring_t *, uint64_t *);
+void            logring_commit     (logring_t *, uint64_t, uint64_t);
+uint64_t        logring_dropped    (logring_t *);
 bool            logring_dequeue    (logring_t *, void *, uint64_t *);
 logring_view_t *logring_view       (logring_t *, bool);
 void           *logring_view_next  (logring_view_t *, uint64_t *);
 void            logring_view_delete(logring_view_t *);
+void            logring_follower_init(logring_follower_t *, logring_t *,
+				      bool);
+bool            logring_follow       (logring_follower_t *, void *,
+				      uint64_t *, uint64_t *);
 
 #endif
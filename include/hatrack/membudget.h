@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           membudget.h
+ *  Description:    Memory accounting and limits for individual data
+ *                  structures.
+ *
+ *                  A budget is a pair of allocators (see hatalloc.h),
+ *                  one for stores and one for records, that pass
+ *                  allocations through to the global allocator while
+ *                  keeping count of three things:
+ *
+ *                  - Bytes in live stores (including queue segments).
+ *                  - Bytes in live records (e.g., dictionary items).
+ *                  - Bytes that have been retired, but that mmm hasn't
+ *                    freed yet, because some thread might still be
+ *                    looking at them.
+ *
+ *                  The counts are sharded counters (see shardctr.h),
+ *                  so threads mostly update their own shard.  Limit
+ *                  checks only look at the shared totals, which can
+ *                  lag by up to HATRACK_MEMBUDGET_FLUSH bytes per
+ *                  shard per count.
+ *
+ *                  There are two optional limits, on the sum of the
+ *                  three counts:
+ *
+ *                  - The soft limit. When usage crosses it, the next
+ *                    write operation on the structure calls the
+ *                    budget's callback (once per crossing), before
+ *                    doing anything else.  That's the place to evict
+ *                    entries or shed load.  The callback can operate
+ *                    on the structure itself.
+ *
+ *                  - The hard limit. While usage is above it,
+ *                    operations that would grow the structure fail
+ *                    (see hatrack_dict_put(), hatrack_set_add() and
+ *                    queue_enqueue()), instead of allocating.
+ *                    Operations that make room still work.
+ *
+ *                  A limit of 0 means no limit.
+ *
+ *                  These allocators are only for memory that's
+ *                  allocated through mmm, since they look at mmm's
+ *                  header to tell retired memory from live memory.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_MEMBUDGET_H__
+#define __HATRACK_MEMBUDGET_H__
+
+#include <hatrack/shardctr.h>
+
+typedef struct hatrack_membudget_st hatrack_membudget_t;
+
+typedef void (*hatrack_membudget_func)(hatrack_membudget_t *, uint64_t,
+				       void *);
+
+typedef struct {
+    hatrack_allocator_t  allocator;
+    hatrack_membudget_t *budget;
+    hatrack_shardctr_t   live;
+} hatrack_membudget_class_t;
+
+/* stores, records -- Each has the allocator to give to the data
+ *                    structure, and the count of live bytes.
+ *
+ * retired         -- Retired, but not yet freed, bytes, from either.
+ *
+ * soft_limit,     -- See above.
+ * hard_limit
+ *
+ * callback        -- Called when the soft limit is crossed, with the
+ *                    budget, the (approximate) usage, and
+ *                    callback_arg.
+ *
+ * soft_state      -- One of the HATRACK_MEMBUDGET_* states below.
+ */
+struct hatrack_membudget_st {
+    hatrack_membudget_class_t stores;
+    hatrack_membudget_class_t records;
+    hatrack_shardctr_t        retired;
+    uint64_t                  soft_limit;
+    uint64_t                  hard_limit;
+    hatrack_membudget_func    callback;
+    void                     *callback_arg;
+    _Atomic uint64_t          soft_state;
+};
+
+/* Under the soft limit; over it, with the callback not yet called;
+ * and over it, with the callback called (or running). We only go back
+ * to the first state once usage drops below the limit again.
+ */
+enum {
+    HATRACK_MEMBUDGET_UNDER,
+    HATRACK_MEMBUDGET_OWED,
+    HATRACK_MEMBUDGET_CALLED
+};
+
+// clang-format off
+hatrack_membudget_t *hatrack_membudget_new          (uint64_t, uint64_t);
+void                 hatrack_membudget_init         (hatrack_membudget_t *,
+						     uint64_t, uint64_t);
+void                 hatrack_membudget_cleanup      (hatrack_membudget_t *);
+void                 hatrack_membudget_delete       (hatrack_membudget_t *);
+void                 hatrack_membudget_set_callback (hatrack_membudget_t *,
+						     hatrack_membudget_func,
+						     void *);
+uint64_t             hatrack_membudget_used         (hatrack_membudget_t *);
+uint64_t             hatrack_membudget_store_bytes  (hatrack_membudget_t *);
+uint64_t             hatrack_membudget_record_bytes (hatrack_membudget_t *);
+uint64_t             hatrack_membudget_retired_bytes(hatrack_membudget_t *);
+void                 hatrack_membudget_poll         (hatrack_membudget_t *);
+// clang-format on
+
+static inline uint64_t
+hatrack_membudget_used_approx(hatrack_membudget_t *self)
+{
+    return hatrack_shardctr_read_approx(&self->stores.live)
+	+ hatrack_shardctr_read_approx(&self->records.live)
+	+ hatrack_shardctr_read_approx(&self->retired);
+}
+
+// Data structures call this before any operation that would grow them.
+static inline bool
+hatrack_membudget_at_hard_limit(hatrack_membudget_t *self)
+{
+    return self->hard_limit
+	&& hatrack_membudget_used_approx(self) >= self->hard_limit;
+}
+
+static inline hatrack_allocator_t *
+hatrack_membudget_store_allocator(hatrack_membudget_t *self)
+{
+    return &self->stores.allocator;
+}
+
+static inline hatrack_allocator_t *
+hatrack_membudget_record_allocator(hatrack_membudget_t *self)
+{
+    return &self->records.allocator;
+}
+
+#endif
@@ -27,6 +27,8 @@
 #include <hatrack/debug.h>
 #include <hatrack/counters.h>
 #include <hatrack/hatomic.h>
+#include <hatrack/idalloc.h>
+#include <hatrack/hatalloc.h>
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -43,8 +45,7 @@
  */
 typedef void (*mmm_cleanup_func)(void *, void *);
 
-typedef struct mmm_header_st    mmm_header_t;
-typedef struct mmm_free_tids_st mmm_free_tids_t;
+typedef struct mmm_header_st mmm_header_t;
 
 /* We don't want to keep reservation space for threads that don't need
  * it, so we issue a threadid for each thread to keep locally, which
@@ -52,8 +53,9 @@ typedef struct mmm_free_tids_st mmm_free_tids_t;
  *
  * If desired, threads can decide to "give back" their thread IDs, so
  * that they can be re-used, for instance, if the thread exits, or
- * decides to switch roles to something that won't require it.  If you
- * never run out of TID space, this will not get used; see
+ * decides to switch roles to something that won't require it.  TIDs
+ * come from mmm_tids, which always hands out the lowest free one, so
+ * a given-back TID is the next one to get re-used; see idalloc.h, and
  * HATRACK_THREADS_MAX in config.h.
  */
 
@@ -62,6 +64,7 @@ extern __thread int64_t        mmm_mytid;
 extern __thread pthread_once_t mmm_inited;
 extern _Atomic  uint64_t       mmm_epoch;
 extern          uint64_t       mmm_reservations[HATRACK_THREADS_MAX];
+extern          idalloc_t      mmm_tids;
 
 /* The header data structure. Note that we keep a linked list of
  * "retired" records, which is the purpose of the field 'next'.  The
@@ -73,23 +76,24 @@ extern          uint64_t       mmm_reservations[HATRACK_THREADS_MAX];
  * to be able to free the old records from the original creation,
  * we need to cache that time in the create_epoch field.
  *
+ * We also keep the allocator the memory came from, and the size of
+ * the allocation (including the header), so that it always gets
+ * freed back to the right place, with an exact size hint, no matter
+ * which thread ends up freeing it. See hatalloc.h.
  */
 // clang-format off
 struct mmm_header_st {
     alignas(16)
-    mmm_header_t    *next;
-    _Atomic uint64_t create_epoch;
-    _Atomic uint64_t write_epoch;
-    uint64_t         retire_epoch;
-    mmm_cleanup_func cleanup;
-    void            *cleanup_aux; // Data needed for cleanup, usually the object
+    mmm_header_t        *next;
+    _Atomic uint64_t     create_epoch;
+    _Atomic uint64_t     write_epoch;
+    uint64_t             retire_epoch;
+    mmm_cleanup_func     cleanup;
+    void                *cleanup_aux; // Data needed for cleanup, usually the object
+    hatrack_allocator_t *allocator;
+    uint64_t             size;
     alignas(16)
-    uint8_t          data[];
-};
-
-struct mmm_free_tids_st {
-    mmm_free_tids_t *next;
-    uint64_t         tid;
+    uint8_t              data[];
 };
 
 void mmm_register_thread     (void);
@@ -583,36 +587,70 @@ mmm_end_op(void)
  * condition if need be (though we need to be cognizent of possible
  * 'helpers').
  */
-static inline void *
-mmm_alloc(uint64_t size)
+static inline mmm_header_t *
+mmm_alloc_header(hatrack_allocator_t *allocator, uint64_t size)
 {
-    uint64_t      actual_size = sizeof(mmm_header_t) + size;
-    mmm_header_t *item        = (mmm_header_t *)calloc(1, actual_size);
+    uint64_t      actual_size;
+    mmm_header_t *item;
+
+    actual_size     = sizeof(mmm_header_t) + size;
+    allocator       = hatrack_resolve_allocator(allocator);
+    item            = (mmm_header_t *)hatrack_zalloc_with(allocator,
+                                                          actual_size);
+    item->allocator = allocator;
+    item->size      = actual_size;
 
     HATRACK_MALLOC_CTR();
+
+    return item;
+}
+
+static inline void *
+mmm_alloc_with(hatrack_allocator_t *allocator, uint64_t size)
+{
+    mmm_header_t *item = mmm_alloc_header(allocator, size);
+
     DEBUG_MMM_INTERNAL(item->data, "mmm_alloc");
 
     return (void *)item->data;
 }
 
+static inline void *
+mmm_alloc(uint64_t size)
+{
+    return mmm_alloc_with(NULL, size);
+}
+
 /*
  * Note here that atomic_fetch_add() returns the value before the add,
  * so we add one to it when storing our write epoch.
  */
 static inline void *
-mmm_alloc_committed(uint64_t size)
+mmm_alloc_committed_with(hatrack_allocator_t *allocator, uint64_t size)
 {
-    uint64_t      actual_size = sizeof(mmm_header_t) + size;
-    mmm_header_t *item        = (mmm_header_t *)calloc(1, actual_size);
+    mmm_header_t *item = mmm_alloc_header(allocator, size);
 
     atomic_store(&item->write_epoch, atomic_fetch_add(&mmm_epoch, 1) + 1);
 
-    HATRACK_MALLOC_CTR();
     DEBUG_MMM_INTERNAL(item->data, "mmm_alloc_committed");
 
     return (void *)item->data;
 }
 
+static inline void *
+mmm_alloc_committed(uint64_t size)
+{
+    return mmm_alloc_committed_with(NULL, size);
+}
+
+static inline void
+mmm_free_header(mmm_header_t *header)
+{
+    hatrack_free_with(header->allocator, header, header->size);
+
+    return;
+}
+
 /* Cleanup handlers get called right before an allocation is freed.
  * They're used for sub-objects that aren't allocated via mmm, such as
  * mutex objects.
@@ -698,7 +736,7 @@ mmm_retire_unused(void *ptr)
     DEBUG_MMM_INTERNAL(ptr, "mmm_retire_unused");
     HATRACK_RETIRE_UNUSED_CTR();
 
-    free(mmm_get_header(ptr));
+    mmm_free_header(mmm_get_header(ptr));
 
     return;
 }
@@ -740,6 +778,12 @@ mmm_retire_fast(void *ptr)
 
     cell               = mmm_get_header(ptr);
     cell->retire_epoch = atomic_load(&mmm_epoch);
+
+    if (cell->allocator->retire
+        && (*cell->allocator->retire)(cell, cell->allocator->arg)) {
+        return;
+    }
+
     cell->next         = mmm_retire_list;
     mmm_retire_list    = cell;
 
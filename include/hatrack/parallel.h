@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           parallel.h
+ *  Description:    Parallel algorithms over flexarray and vector views.
+ *
+ *                  Walking a view with flexarray_view_next() is a
+ *                  sequential loop, but a view's store never changes
+ *                  once the view has it, so any number of threads can
+ *                  read it at once, without synchronizing.  These
+ *                  functions split a view's store into chunks of
+ *                  HATRACK_PAR_CHUNK cells, and farm them out to a
+ *                  thread pool (see pool.h); pass NULL for the pool
+ *                  to use the built-in one.
+ *
+ *                  - for_each calls a function on every item, along
+ *                    with its index in the array.  Calls happen in no
+ *                    particular order.
+ *
+ *                  - reduce folds each chunk's items, in order, into
+ *                    an accumulator that starts out as the identity
+ *                    value, and then combines the chunks' results, in
+ *                    order.  So the fold and combine functions need
+ *                    to be associative, but needn't be commutative.
+ *
+ *                  - sort returns a new flexarray holding the view's
+ *                    items, stably sorted with a parallel merge sort.
+ *
+ *                  - filter returns a new flexarray holding the items
+ *                    the predicate accepts, in their original order,
+ *                    without the gaps.
+ *
+ *                  All of these skip cells that were never set, just
+ *                  like flexarray_view_next(), and none of them move
+ *                  the view's iterator.
+ *
+ *                  The view already called the array's ret_callback
+ *                  on its items when it was created.  The arrays that
+ *                  sort and filter return get the source array's
+ *                  callbacks, and since each of them holds onto its
+ *                  items independently of the view, ret_callback gets
+ *                  called on every item they keep, by the thread that
+ *                  stores it.  Deleting the view still ejects the
+ *                  view's own copies, as usual.
+ *
+ *                  The functions passed in here get called on the
+ *                  pool's threads, and shouldn't call back into the
+ *                  same pool (they'd run the nested job serially).
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_PARALLEL_H__
+#define __HATRACK_PARALLEL_H__
+
+#include <hatrack/pool.h>
+#include <hatrack/flexarray.h>
+#include <hatrack/helpmanager.h>
+#include <hatrack/vector.h>
+
+// clang-format off
+typedef void  (*hatrack_par_each_fn)(void *, uint64_t, void *);
+typedef void *(*hatrack_par_fold_fn)(void *, void *, void *);
+typedef int   (*hatrack_par_cmp_fn) (void *, void *, void *);
+typedef bool  (*hatrack_par_pred_fn)(void *, void *);
+
+void         flexarray_view_for_each(flex_view_t *, hatrack_pool_t *,
+				     hatrack_par_each_fn, void *);
+void        *flexarray_view_reduce  (flex_view_t *, hatrack_pool_t *, void *,
+				     hatrack_par_fold_fn, hatrack_par_fold_fn,
+				     void *);
+flexarray_t *flexarray_view_sort    (flex_view_t *, hatrack_pool_t *,
+				     hatrack_par_cmp_fn, void *);
+flexarray_t *flexarray_view_filter  (flex_view_t *, hatrack_pool_t *,
+				     hatrack_par_pred_fn, void *);
+void         vector_view_for_each   (vector_view_t *, hatrack_pool_t *,
+				     hatrack_par_each_fn, void *);
+void        *vector_view_reduce     (vector_view_t *, hatrack_pool_t *, void *,
+				     hatrack_par_fold_fn, hatrack_par_fold_fn,
+				     void *);
+flexarray_t *vector_view_sort       (vector_view_t *, hatrack_pool_t *,
+				     hatrack_par_cmp_fn, void *);
+flexarray_t *vector_view_filter     (vector_view_t *, hatrack_pool_t *,
+				     hatrack_par_pred_fn, void *);
+// clang-format on
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           pool.h
+ *  Description:    A minimal fork-join thread pool.
+ *
+ *                  hatrack_pool_run() runs a function over task
+ *                  indexes 0 through n - 1, on the pool's workers and
+ *                  the calling thread, and returns when they're all
+ *                  done.  Threads claim tasks with a fetch-and-add,
+ *                  so uneven tasks balance out on their own.
+ *
+ *                  One job runs at a time; other threads calling
+ *                  hatrack_pool_run() on the same pool wait their
+ *                  turn.  A task that calls back into a pool just
+ *                  runs the nested job itself, on its own thread.
+ *
+ *                  Idle workers sleep on a condition variable, so a
+ *                  pool that isn't in use doesn't cost any CPU.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_POOL_H__
+#define __HATRACK_POOL_H__
+
+#include <hatrack/hatrack_config.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef void (*hatrack_pool_fn)(uint64_t, void *);
+
+/* busy -- The number of workers that haven't finished with the
+ *         current job.  Protected by mutex, as are the job fields.
+ */
+typedef struct {
+    pthread_mutex_t  run_mutex;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   start;
+    pthread_cond_t   finished;
+    uint64_t         generation;
+    uint64_t         busy;
+    bool             exiting;
+    hatrack_pool_fn  fn;
+    void            *aux;
+    uint64_t         num_tasks;
+    _Atomic uint64_t next_task;
+    uint64_t         num_threads;
+    pthread_t       *threads;
+} hatrack_pool_t;
+
+// clang-format off
+hatrack_pool_t *hatrack_pool_new    (uint64_t);
+void            hatrack_pool_init   (hatrack_pool_t *, uint64_t);
+void            hatrack_pool_cleanup(hatrack_pool_t *);
+void            hatrack_pool_delete (hatrack_pool_t *);
+hatrack_pool_t *hatrack_pool_default(void);
+uint64_t        hatrack_pool_width  (hatrack_pool_t *);
+void            hatrack_pool_run    (hatrack_pool_t *, uint64_t,
+				     hatrack_pool_fn, void *);
+// clang-format on
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           prefault.h
+ *  Description:    Cooperative prefaulting of large, freshly allocated
+ *                  stores.
+ *
+ *                  When a store gets big, the allocator hands back
+ *                  pages the kernel hasn't mapped in yet, and the
+ *                  first write to each one takes a page fault. During
+ *                  a migration, those faults all land at once, on
+ *                  every thread doing the copy, and they serialize on
+ *                  the kernel's lock for the address space.
+ *
+ *                  So, before copying into a big store, migrating
+ *                  threads call hatrack_prefault(), which splits the
+ *                  store into HATRACK_PREFAULT_CHUNK byte pieces, and
+ *                  has each thread claim pieces (via a fetch-and-add
+ *                  on a cursor in the store) and fault them in, until
+ *                  there are none left. The faults still happen, but
+ *                  up front and in parallel, and the copy itself then
+ *                  runs at memory speed.
+ *
+ *                  Where the kernel supports it, we fault pages in
+ *                  with madvise(MADV_POPULATE_WRITE). Otherwise, we
+ *                  touch one word per page, with an atomic add of 0,
+ *                  which is safe even if another thread has already
+ *                  started writing into the store.
+ *
+ *                  Stores smaller than HATRACK_PREFAULT_MIN are left
+ *                  alone.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_PREFAULT_H__
+#define __HATRACK_PREFAULT_H__
+
+#include <hatrack/hatrack_config.h>
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+void hatrack_prefault(void *, uint64_t, _Atomic uint64_t *);
+
+#endif
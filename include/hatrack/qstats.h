@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           qstats.h
+ *  Description:    Optional depth and dwell-time telemetry for hq,
+ *                  capq and hatring.
+ *
+ *                  When sampling is turned on for a queue, the queue
+ *                  keeps a side array of timestamps, one per cell,
+ *                  indexed the same way as the cells. Enqueuers
+ *                  write a timestamp for one in every N epochs (and
+ *                  a zero otherwise), just before they try to
+ *                  install their item.  The dequeuer that removes an
+ *                  item looks at the timestamp for its cell, and if
+ *                  there is one, adds the time the item spent in the
+ *                  queue to a histogram.
+ *
+ *                  Buckets in the histogram are powers of two of
+ *                  nanoseconds: bucket 0 holds dwell times of 0ns,
+ *                  and bucket i holds dwell times in [2^(i-1), 2^i).
+ *                  The last bucket also collects everything larger.
+ *
+ *                  The numbers are statistical.  A timestamp can get
+ *                  clobbered by a slow enqueuer that loses its slot,
+ *                  and a dequeue that races a migration or a lapping
+ *                  write can miss its sample.  But, with sampling
+ *                  turned off, the only cost to the queues is
+ *                  checking a pointer that is already in cache.
+ *
+ *                  Queue depth is computed from the difference
+ *                  between the enqueue and dequeue indices, so it
+ *                  costs nothing on the enqueue / dequeue path.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __QSTATS_H__
+#define __QSTATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <hatrack/hatrack_config.h>
+
+// clang-format off
+typedef struct {
+    uint64_t         sample_mask;
+    _Atomic uint64_t samples;
+    _Atomic uint64_t dwell_total;
+    _Atomic uint64_t dwell_max;
+    _Atomic uint64_t hist[HATRACK_QSTATS_BUCKETS];
+} hatrack_qstats_t;
+
+/* depth is approximate while operations are in flight; capacity is
+ * the number of cells in the current store. sample_rate is 0 when
+ * sampling is off.
+ */
+typedef struct {
+    uint64_t depth;
+    uint64_t capacity;
+    uint64_t sample_rate;
+    uint64_t samples;
+    uint64_t dwell_total_ns;
+    uint64_t dwell_max_ns;
+    uint64_t dwell_hist[HATRACK_QSTATS_BUCKETS];
+} hatrack_qstats_snapshot_t;
+
+void     hatrack_qstats_init      (hatrack_qstats_t *, uint64_t);
+void     hatrack_qstats_record    (hatrack_qstats_t *, uint64_t);
+void     hatrack_qstats_snapshot  (hatrack_qstats_t *,
+				   hatrack_qstats_snapshot_t *);
+uint64_t hatrack_qstats_percentile(hatrack_qstats_snapshot_t *, double);
+// clang-format on
+
+static inline uint64_t
+hatrack_qstats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* The timestamp an enqueuer should write for the given epoch. Zero
+ * means the item isn't sampled.
+ */
+static inline uint64_t
+hatrack_qstats_stamp(hatrack_qstats_t *stats, uint64_t epoch)
+{
+    if (epoch & stats->sample_mask) {
+	return 0;
+    }
+
+    return hatrack_qstats_now();
+}
+
+static inline uint64_t
+hatrack_qstats_depth(uint64_t enqueue_index,
+		     uint64_t dequeue_index,
+		     uint64_t size)
+{
+    if (dequeue_index >= enqueue_index) {
+	return 0;
+    }
+
+    if (enqueue_index - dequeue_index > size) {
+	return size;
+    }
+
+    return enqueue_index - dequeue_index;
+}
+
+#endif
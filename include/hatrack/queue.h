@@ -81,6 +81,7 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <hatrack/hatrack_config.h>
+#include <hatrack/membudget.h>
 
 
 #define QUEUE_HELP_VALUE 1 << QUEUE_HELP_STEPS
@@ -123,6 +124,7 @@ typedef struct {
     uint64_t                 default_segment_size;
     _Atomic uint64_t         help_needed;
     _Atomic uint64_t         len;
+    hatrack_membudget_t     *membudget;
 } queue_t;
 
 enum64(queue_cell_state_t,
@@ -136,13 +138,14 @@ queue_len(queue_t *self)
     return atomic_read(&self->len);
 }
 
-queue_t *queue_new      (void);
-queue_t *queue_new_size (char);
-void     queue_init     (queue_t *);
-void     queue_init_size(queue_t *, char);
-void     queue_cleanup  (queue_t *);
-void     queue_delete   (queue_t *);
-void     queue_enqueue  (queue_t *, void *);
-void    *queue_dequeue  (queue_t *, bool *);
+queue_t *queue_new          (void);
+queue_t *queue_new_size     (char);
+void     queue_init         (queue_t *);
+void     queue_init_size    (queue_t *, char);
+void     queue_cleanup      (queue_t *);
+void     queue_delete       (queue_t *);
+void     queue_set_membudget(queue_t *, hatrack_membudget_t *);
+bool     queue_enqueue      (queue_t *, void *);
+void    *queue_dequeue      (queue_t *, bool *);
 
 #endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           queue_set.h
+ *  Description:    A set of hq instances that consumers can dequeue
+ *                  from as a group, without polling every member.
+ *
+ *                  The set keeps a two-level bitmap of which members
+ *                  might have items in them.  There's one bit per
+ *                  queue in the 'ready' words, and one bit per ready
+ *                  word in the 'summary' word, so finding a queue to
+ *                  dequeue from is two count-trailing-zeros
+ *                  operations, no matter how many members there are.
+ *
+ *                  Enqueues have to go through the set (with
+ *                  queue_set_enqueue()) for it to notice them.  An
+ *                  enqueuer only writes to the bitmap when the bit
+ *                  for its queue is clear, so in the steady state
+ *                  (a busy queue) the bitmap stays read-only.
+ *
+ *                  A bit can be set for a queue that turns out to be
+ *                  empty; the dequeuer that notices clears it. To
+ *                  avoid losing a wakeup when an enqueue races with
+ *                  that, the dequeuer tries the queue one more time
+ *                  after clearing the bit, and puts the bit back if
+ *                  it finds something.
+ *
+ *                  For fairness, each thread remembers where it last
+ *                  found an item, and starts its next search just
+ *                  past that point, so a consumer round-robins
+ *                  across the non-empty queues.
+ *
+ *                  When every member is empty, consumers can block
+ *                  on a futex with queue_set_dequeue_wait().
+ *                  Enqueuers only make the wake-up system call when
+ *                  someone is actually waiting.
+ *
+ *                  Queues can be removed from the set, but their
+ *                  indices don't get reused.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __QUEUE_SET_H__
+#define __QUEUE_SET_H__
+
+#include <hatrack/hq.h>
+
+/* The summary is a single word, so we can track 64 ready words of 64
+ * queues each.
+ */
+#define QUEUE_SET_MAX_QUEUES 4096
+
+typedef struct {
+    alignas(8)
+    _Atomic uint64_t    summary;
+    _Atomic uint64_t   *ready;
+    _Atomic(hq_t *)    *queues;
+    uint64_t            max_queues;
+    _Atomic uint64_t    num_queues;
+    _Atomic uint64_t    waiters;
+    _Atomic uint32_t    futex;
+} queue_set_t;
+
+// clang-format off
+queue_set_t *queue_set_new          (uint64_t);
+void         queue_set_init         (queue_set_t *, uint64_t);
+void         queue_set_cleanup      (queue_set_t *);
+void         queue_set_delete       (queue_set_t *);
+uint64_t     queue_set_add          (queue_set_t *, hq_t *);
+hq_t        *queue_set_remove       (queue_set_t *, uint64_t);
+hq_t        *queue_set_get          (queue_set_t *, uint64_t);
+void         queue_set_enqueue      (queue_set_t *, uint64_t, void *);
+void        *queue_set_dequeue_any  (queue_set_t *, bool *, uint64_t *);
+void        *queue_set_dequeue_wait (queue_set_t *, bool *, uint64_t *,
+				     uint64_t);
+void         queue_set_wake_all     (queue_set_t *);
+// clang-format on
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           quilt.h
+ *  Description:    Quilt: Unbounded, In-place, Lazily Tiled
+ *
+ *                  Quilt is a lock-free hash table, based on
+ *                  witchhat, that never migrates the whole table at
+ *                  once.
+ *
+ *                  Every other table in hatrack grows by allocating
+ *                  a new store twice the size of the old one, and
+ *                  the old store stays live until the migration is
+ *                  done (and until mmm decides nobody is looking at
+ *                  it).  For very large tables, that means the peak
+ *                  memory footprint during a resize is about three
+ *                  times the size of the old store.
+ *
+ *                  Quilt instead keeps its buckets in segments,
+ *                  which are individually small witchhat-style
+ *                  stores, and uses a directory in the style of
+ *                  extendible hashing to map the high word of the
+ *                  hash value to a segment.  Each segment has a
+ *                  "local depth", which is the number of directory
+ *                  index bits all the items in it share, and the
+ *                  directory has a "global depth", which is the
+ *                  number of bits it uses for indexing.  A segment
+ *                  with local depth L is referenced by 2^(G - L)
+ *                  directory entries.
+ *
+ *                  Segments start out small, and grow the same way a
+ *                  witchhat store does, until they reach
+ *                  QUILT_SEGMENT_SIZE buckets.  After that, when a
+ *                  segment fills up, we split it into two segments
+ *                  of the same size, using the next bit of the hash
+ *                  value to decide which half an item goes to.  If
+ *                  the segment's local depth is already equal to the
+ *                  directory's global depth, we double the directory
+ *                  first, which just copies pointers.
+ *
+ *                  So the only transient overhead while growing is
+ *                  the segment being split, no matter how big the
+ *                  table is.
+ *
+ *                  Migrating a segment uses the same MOVING / MOVED
+ *                  bucket flags as witchhat, and writers help finish
+ *                  any migration they run into.  Once the items are
+ *                  moved, the directory entries pointing at the old
+ *                  segment are CAS'd over to the new ones.  Doubling
+ *                  the directory "freezes" every entry (by setting
+ *                  the low bit of the pointer), so that entry updates
+ *                  can't get lost while the entries are copied; a
+ *                  thread that finds a frozen entry helps finish the
+ *                  doubling, then retries in the new directory.
+ *
+ *                  Like hihat, quilt is lock-free, not wait-free; we
+ *                  don't bother with witchhat's help mechanism.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __QUILT_H__
+#define __QUILT_H__
+
+#include <hatrack/hatrack_common.h>
+
+typedef struct {
+    void    *item;
+    uint64_t info;
+} quilt_record_t;
+
+enum64(quilt_flag_t,
+       QUILT_F_MOVING   = 0x8000000000000000,
+       QUILT_F_MOVED    = 0x4000000000000000,
+       QUILT_F_INITED   = 0x2000000000000000,
+       QUILT_EPOCH_MASK = 0x1fffffffffffffff);
+
+// Set in directory entries when the directory is being doubled.
+#define QUILT_F_FROZEN 0x0000000000000001
+
+typedef struct {
+    _Atomic hatrack_hash_t hv;
+    _Atomic quilt_record_t record;
+} quilt_bucket_t;
+
+typedef struct quilt_segment_st quilt_segment_t;
+typedef struct quilt_dir_st     quilt_dir_t;
+
+// clang-format off
+
+/* If a migration only resizes a segment, next[0] is its replacement,
+ * and next[1] stays NULL.  If the segment is split, items whose next
+ * hash bit is 0 go to next[0], and the rest go to next[1].
+ */
+struct quilt_segment_st {
+    alignas(8)
+    uint64_t                   depth;
+    uint64_t                   prefix;
+    uint64_t                   last_slot;
+    uint64_t                   threshold;
+    _Atomic uint64_t           used_count;
+    _Atomic(quilt_segment_t *) next[2];
+    _Atomic bool               migrated;
+    _Atomic bool               retired;
+    alignas(16)
+    quilt_bucket_t             buckets[];
+};
+
+struct quilt_dir_st {
+    alignas(8)
+    uint64_t                   depth;
+    uint64_t                   last_entry;
+    _Atomic(quilt_dir_t *)     dir_next;
+    _Atomic(quilt_segment_t *) segments[];
+};
+
+typedef struct {
+    alignas(8)
+    _Atomic(quilt_dir_t *) dir;
+    _Atomic uint64_t       item_count;
+            uint64_t       next_epoch;
+} quilt_t;
+
+quilt_t        *quilt_new        (void);
+quilt_t        *quilt_new_size   (char);
+void            quilt_init       (quilt_t *);
+void            quilt_init_size  (quilt_t *, char);
+void            quilt_cleanup    (quilt_t *);
+void            quilt_delete     (quilt_t *);
+void           *quilt_get        (quilt_t *, hatrack_hash_t, bool *);
+void           *quilt_put        (quilt_t *, hatrack_hash_t, void *, bool *);
+void           *quilt_replace    (quilt_t *, hatrack_hash_t, void *, bool *);
+bool            quilt_add        (quilt_t *, hatrack_hash_t, void *);
+void           *quilt_remove     (quilt_t *, hatrack_hash_t, bool *);
+uint64_t        quilt_len        (quilt_t *);
+hatrack_view_t *quilt_view       (quilt_t *, uint64_t *, bool);
+hatrack_view_t *quilt_view_no_mmm(quilt_t *, uint64_t *, bool);
+
+// clang-format on
+
+/* The bucket index within a segment comes from the low word of the
+ * hash value (see hatrack_bucket_index()), so the directory uses the
+ * high word, to keep the two independent.
+ */
+#ifdef HAVE___INT128_T
+static inline uint64_t
+quilt_dir_bits(hatrack_hash_t hv)
+{
+    return (uint64_t)(hv >> 64);
+}
+#else
+static inline uint64_t
+quilt_dir_bits(hatrack_hash_t hv)
+{
+    return hv.w2;
+}
+#endif
+
+static inline uint64_t
+quilt_dir_index(hatrack_hash_t hv, uint64_t last_entry)
+{
+    return quilt_dir_bits(hv) & last_entry;
+}
+
+static inline uint64_t
+quilt_split_bit(hatrack_hash_t hv, uint64_t depth)
+{
+    return (quilt_dir_bits(hv) >> depth) & 1;
+}
+
+#endif
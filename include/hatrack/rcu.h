@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           rcu.h
+ *  Description:    RCU-style protected pointers, on top of mmm.
+ *
+ *                  For read-mostly state (configuration, routing
+ *                  tables, and the like) that lives behind a single
+ *                  pointer. Readers bracket their accesses with
+ *                  hatrack_rcu_read_begin() / hatrack_rcu_read_end(),
+ *                  and get the current object with hatrack_rcu_load().
+ *                  That's wait-free, and the only shared write is to
+ *                  the thread's own mmm reservation, so readers don't
+ *                  fight over a lock's cache line.
+ *
+ *                  Writers build a new object (which must come from
+ *                  mmm, e.g., via hatrack_rcu_alloc()), and swap it
+ *                  in with hatrack_rcu_publish() or hatrack_rcu_cas().
+ *                  The old object gets retired through mmm, and once
+ *                  no reader can still be looking at it, the pointer's
+ *                  destructor (if any) runs, and the memory is freed.
+ *
+ *                  Objects that aren't behind a protected pointer can
+ *                  go through hatrack_rcu_defer_free(), and
+ *                  hatrack_rcu_synchronize() waits out every read
+ *                  section that was in progress when it was called,
+ *                  for memory that mmm doesn't manage.
+ *
+ *                  Read sections can nest, but, since mmm operations
+ *                  don't, the other hatrack data structures can't be
+ *                  used inside of one: their operations would end the
+ *                  section's reservation.  Load what you need first.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __HATRACK_RCU_H__
+#define __HATRACK_RCU_H__
+
+#include <hatrack/mmm.h>
+
+/* destructor -- Called on each object this pointer held, right before
+ *               mmm frees it, with aux as its second argument.  It
+ *               should only release what the object points to, not
+ *               the object itself.  May be NULL.
+ */
+typedef struct {
+    _Atomic(void *)  ptr;
+    mmm_cleanup_func destructor;
+    void            *aux;
+} hatrack_rcu_ptr_t;
+
+extern __thread uint64_t hatrack_rcu_depth;
+
+// clang-format off
+void  hatrack_rcu_init       (hatrack_rcu_ptr_t *, void *, mmm_cleanup_func,
+			      void *);
+void  hatrack_rcu_cleanup    (hatrack_rcu_ptr_t *);
+void  hatrack_rcu_publish    (hatrack_rcu_ptr_t *, void *);
+void *hatrack_rcu_exchange   (hatrack_rcu_ptr_t *, void *);
+bool  hatrack_rcu_cas        (hatrack_rcu_ptr_t *, void *, void *);
+void  hatrack_rcu_defer_free (void *, mmm_cleanup_func, void *);
+void  hatrack_rcu_synchronize(void);
+// clang-format on
+
+/* The fence makes sure our reservation is visible before we load any
+ * protected pointers; otherwise, a writer could swap out and free an
+ * object we're about to read, without ever seeing our reservation.
+ */
+static inline void
+hatrack_rcu_read_begin(void)
+{
+    if (!hatrack_rcu_depth++) {
+	mmm_start_basic_op();
+	atomic_thread_fence(memory_order_seq_cst);
+    }
+
+    return;
+}
+
+static inline void
+hatrack_rcu_read_end(void)
+{
+    if (!--hatrack_rcu_depth) {
+	mmm_end_op();
+    }
+
+    return;
+}
+
+// Only valid inside a read section, and only until it ends.
+static inline void *
+hatrack_rcu_load(hatrack_rcu_ptr_t *self)
+{
+    return atomic_load_explicit(&self->ptr, memory_order_acquire);
+}
+
+static inline void *
+hatrack_rcu_alloc(uint64_t size)
+{
+    return mmm_alloc_committed(size);
+}
+
+#endif
@@ -29,11 +29,13 @@
 typedef struct hatrack_set_st hatrack_set_t;
 
 struct hatrack_set_st {
-    woolhat_t           woolhat_instance;
-    hatrack_hash_info_t hash_info;
-    uint32_t            item_type;
-    hatrack_mem_hook_t  pre_return_hook;
-    hatrack_mem_hook_t  free_handler;
+    woolhat_t            woolhat_instance;
+    hatrack_hash_info_t  hash_info;
+    uint32_t             item_type;
+    hatrack_mem_hook_t   pre_return_hook;
+    hatrack_mem_hook_t   free_handler;
+    hatrack_arena_t     *arena;
+    hatrack_membudget_t *membudget;
 };
 
 
@@ -49,6 +51,13 @@ void            hatrack_set_set_custom_hash (hatrack_set_t *,
 					     hatrack_hash_func_t);
 void            hatrack_set_set_free_handler(hatrack_set_t *,
 					     hatrack_mem_hook_t);
+void            hatrack_set_set_allocator   (hatrack_set_t *,
+					     hatrack_allocator_t *);
+void            hatrack_set_set_arena       (hatrack_set_t *, bool);
+bool            hatrack_set_get_arena       (hatrack_set_t *);
+void            hatrack_set_set_membudget   (hatrack_set_t *,
+					     hatrack_membudget_t *);
+hatrack_membudget_t *hatrack_set_get_membudget(hatrack_set_t *);
 void            hatrack_set_set_return_hook (hatrack_set_t *,
 					     hatrack_mem_hook_t);
 bool            hatrack_set_contains        (hatrack_set_t *, void *);
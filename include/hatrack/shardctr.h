@@ -0,0 +1,260 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           shardctr.h
+ *  Description:    Sharded counters, for the per-table item counts and
+ *                  per-store used-bucket counts in crown, witchhat and
+ *                  woolhat.
+ *
+ *                  Those algorithms used to bump two shared words on
+ *                  every insert of a new key (the store's used count
+ *                  and the table's item count), and one on every
+ *                  remove.  Writers to different buckets otherwise
+ *                  never touch the same cache line, so with enough
+ *                  threads, those two words become the bottleneck.
+ *
+ *                  There are two pieces here:
+ *
+ *                  1) hatrack_shardctr_t, for item counts.  Each
+ *                     thread adds to one of HATRACK_COUNTER_SHARDS
+ *                     shards (each on its own cache line), picked by
+ *                     its mmm thread ID.  When a shard drifts
+ *                     HATRACK_COUNTER_FLUSH away from zero, it gets
+ *                     folded into the shared total.  An exact read
+ *                     sums the total and every shard; an approximate
+ *                     read looks at the total only, and can be off by
+ *                     up to (HATRACK_COUNTER_FLUSH - 1) per shard.
+ *
+ *                  2) A budget for the used-bucket count, which is
+ *                     what triggers resizing, so it must never read
+ *                     low.  Instead of adding one to the shared count
+ *                     per bucket claimed, a thread reserves a chunk
+ *                     of buckets at a time, and parks what it doesn't
+ *                     need yet in its shard, for it (and any other
+ *                     thread on that shard) to draw from later.
+ *                     Reservations are counted when they're made, so
+ *                     the shared count only ever runs ahead of the
+ *                     number of buckets actually in use, and the
+ *                     worst that happens is a resize that comes a bit
+ *                     early; a chunk is never allowed to reach past
+ *                     the threshold.
+ *
+ *                     Chunks scale with the store's threshold, and
+ *                     small stores just use the shared count directly
+ *                     (and don't pay for the shards), since they
+ *                     don't live long enough for contention to
+ *                     matter.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __SHARDCTR_H__
+#define __SHARDCTR_H__
+
+#include <hatrack/mmm.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define HATRACK_COUNTER_SHARDS (1 << HATRACK_COUNTER_SHARDS_LOG)
+#define HATRACK_COUNTER_MASK   (HATRACK_COUNTER_SHARDS - 1)
+
+/* Each shard gets padded out to a cache line.  We pad instead of
+ * using alignas(64), since these get embedded in tables that are
+ * allocated with plain malloc(); either way, no two shards share a
+ * line.
+ */
+typedef struct {
+    _Atomic int64_t value;
+    char            pad[56];
+} hatrack_shard_t;
+
+typedef struct {
+    _Atomic int64_t total;
+    char            pad[56];
+    hatrack_shard_t shards[HATRACK_COUNTER_SHARDS];
+} hatrack_shardctr_t;
+
+static inline void
+hatrack_shardctr_init(hatrack_shardctr_t *ctr, int64_t value)
+{
+    uint64_t i;
+
+    for (i = 0; i < HATRACK_COUNTER_SHARDS; i++) {
+	atomic_store(&ctr->shards[i].value, 0);
+    }
+
+    atomic_store(&ctr->total, value);
+
+    return;
+}
+
+/* Same as hatrack_shardctr_add(), for counters that want their own
+ * flush threshold (e.g., byte counts, where 64 would mean flushing on
+ * nearly every add).
+ */
+static inline void
+hatrack_shardctr_add_flush(hatrack_shardctr_t *ctr, int64_t n, int64_t flush)
+{
+    hatrack_shard_t *shard;
+    int64_t          value;
+
+    shard = &ctr->shards[mmm_mytid & HATRACK_COUNTER_MASK];
+    value = atomic_fetch_add(&shard->value, n) + n;
+
+    if (value >= flush || value <= -flush) {
+	value = atomic_exchange(&shard->value, 0);
+	atomic_fetch_add(&ctr->total, value);
+    }
+
+    return;
+}
+
+static inline void
+hatrack_shardctr_add(hatrack_shardctr_t *ctr, int64_t n)
+{
+    hatrack_shardctr_add_flush(ctr, n, HATRACK_COUNTER_FLUSH);
+
+    return;
+}
+
+/* For when the caller knows no other thread can be touching the
+ * counter; skips the atomic add, and just updates the total.
+ */
+static inline void
+hatrack_shardctr_add_excl(hatrack_shardctr_t *ctr, int64_t n)
+{
+    int64_t total;
+
+    total = atomic_load_explicit(&ctr->total, memory_order_relaxed);
+
+    atomic_store_explicit(&ctr->total, total + n, memory_order_relaxed);
+
+    return;
+}
+
+/* Neither read is linearized with respect to concurrent adds, but
+ * once writers quiesce, hatrack_shardctr_read() is exact.  Since
+ * shards can go negative (a remove on a different shard than the
+ * add), we clamp at zero.
+ */
+static inline uint64_t
+hatrack_shardctr_read(hatrack_shardctr_t *ctr)
+{
+    int64_t  sum;
+    uint64_t i;
+
+    sum = atomic_read(&ctr->total);
+
+    for (i = 0; i < HATRACK_COUNTER_SHARDS; i++) {
+	sum += atomic_read(&ctr->shards[i].value);
+    }
+
+    return sum < 0 ? 0 : (uint64_t)sum;
+}
+
+/* Only reads the shared total, so it doesn't touch the per-thread
+ * shards' cache lines.  Each shard can hold up to
+ * HATRACK_COUNTER_FLUSH - 1 that hasn't been folded in yet, so the
+ * result can be off by up to HATRACK_COUNTER_SHARDS *
+ * (HATRACK_COUNTER_FLUSH - 1), in either direction.  The tables'
+ * *_len_approx() functions all come through here.
+ */
+static inline uint64_t
+hatrack_shardctr_read_approx(hatrack_shardctr_t *ctr)
+{
+    int64_t sum;
+
+    sum = atomic_read(&ctr->total);
+
+    return sum < 0 ? 0 : (uint64_t)sum;
+}
+
+static inline uint64_t
+hatrack_budget_chunk(uint64_t threshold)
+{
+    uint64_t chunk;
+
+    chunk = threshold >> HATRACK_BUDGET_CHUNK_SHIFT;
+
+    if (chunk > HATRACK_BUDGET_CHUNK_MAX) {
+	return HATRACK_BUDGET_CHUNK_MAX;
+    }
+
+    return chunk;
+}
+
+/* How many bytes a store with the given threshold should allocate
+ * past its buckets for the budget shards. Zero if it shouldn't
+ * bother.
+ */
+static inline uint64_t
+hatrack_budget_alloc_len(uint64_t threshold)
+{
+    if (hatrack_budget_chunk(threshold) < 2) {
+	return 0;
+    }
+
+    return sizeof(hatrack_shard_t) * HATRACK_COUNTER_SHARDS;
+}
+
+/* Claims one bucket's worth of the store's threshold.  Returns true
+ * if the store is at its threshold, in which case the caller should
+ * migrate, exactly as if atomic_fetch_add() on the used count had
+ * returned something at or above the threshold.
+ */
+static inline bool
+hatrack_budget_claim(hatrack_shard_t  *budget,
+		     _Atomic uint64_t *used_count,
+		     uint64_t          threshold)
+{
+    hatrack_shard_t *shard;
+    int64_t          left;
+    uint64_t         chunk;
+    uint64_t         used;
+
+    if (!budget) {
+	return atomic_fetch_add(used_count, 1) >= threshold;
+    }
+
+    shard = &budget[mmm_mytid & HATRACK_COUNTER_MASK];
+    left  = atomic_read(&shard->value);
+
+    while (left > 0) {
+	if (CAS(&shard->value, &left, left - 1)) {
+	    return false;
+	}
+    }
+
+    chunk = hatrack_budget_chunk(threshold);
+    used  = atomic_fetch_add(used_count, chunk);
+
+    if (used >= threshold) {
+	return true;
+    }
+
+    if (used + chunk > threshold) {
+	chunk = threshold - used;
+    }
+
+    if (chunk > 1) {
+	atomic_fetch_add(&shard->value, chunk - 1);
+    }
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           solohat.h
+ *  Description:    A single-writer, multi-reader table, with no locks
+ *                  and no CAS anywhere.
+ *
+ *                  This is swimcap without the mutex. Swimcap lets any
+ *                  thread write, and serializes writers with a lock.
+ *                  Here, the caller promises that only one thread
+ *                  writes at a time (typically a single, designated
+ *                  updater thread, which is what most config and
+ *                  routing tables look like). In exchange, the writer
+ *                  never takes a lock, never does a CAS, and never
+ *                  does a 128-bit atomic; everything it does is a
+ *                  plain store, with release fences where readers need
+ *                  ordering. On x86, that's plain MOVs.
+ *
+ *                  Migration is done by the writer alone, into a
+ *                  private store, which gets published with a single
+ *                  release store when it's complete. Since no other
+ *                  thread ever writes to a store, there's no need for
+ *                  per-bucket MOVING / MOVED bits.
+ *
+ *                  Readers are wait free. They use mmm to keep the
+ *                  store they're reading from alive, and never retry.
+ *
+ *                  If you need more than one writer, use swimcap (or
+ *                  anything else); having two threads write to a
+ *                  solohat concurrently will corrupt it.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#ifndef __SOLOHAT_H__
+#define __SOLOHAT_H__
+
+#include <hatrack/hatrack_common.h>
+
+// clang-format off
+
+/* solohat_bucket_t
+ *
+ * Swimcap keeps the item and the epoch together in a 128-bit record
+ * that gets loaded and stored atomically, so that readers always see
+ * the two consistently. Here, they're separate 64-bit words, and the
+ * writer orders its stores so that readers can detect when they've
+ * seen an inconsistent pair:
+ *
+ * - When adding an item to a bucket, the writer stores the item
+ *   first, then the epoch (with a release fence in between).
+ *
+ * - When removing an item, the writer stores 0 to the epoch.
+ *
+ * - When replacing an item, the writer stores the item, and leaves
+ *   the epoch alone.
+ *
+ * Epochs are never reused, so a reader that reads the epoch, then the
+ * item, then the epoch again, and sees the same non-zero epoch both
+ * times, knows the item it read belonged to that epoch. If the two
+ * epochs don't match, the bucket was emptied at some point while the
+ * reader was looking at it, and the reader linearizes to that point,
+ * reporting the item as not found. See solohat_bucket_read() in
+ * solohat.c.
+ *
+ * item  -- The item passed to the hash table, usually a key : value
+ *          pair of some sort.
+ *
+ * epoch -- 0 means the bucket has no item (either it never had one,
+ *          or the item has been removed). Otherwise, the creation
+ *          time of the item, for sort ordering. Since there's only
+ *          one writer, these are unique and strictly increasing.
+ *
+ * hv    -- The hash value associated with the bucket, if any. As with
+ *          swimcap, this is written once (before the bucket's first
+ *          epoch), and readers that see it half-written just
+ *          experience a miss.
+ */
+typedef struct {
+    _Atomic(void *)  item;
+    _Atomic uint64_t epoch;
+    hatrack_hash_t   hv;
+} solohat_bucket_t;
+
+/* solohat_store_t
+ *
+ * last_slot  -- The array index of the last bucket.
+ *
+ * threshold  -- When used_count would reach this, we migrate.
+ *
+ * used_count -- The number of buckets that have a hash value in them.
+ *               Only the writer ever looks at this.
+ *
+ * buckets    -- The buckets, allocated inline with the store.
+ */
+typedef struct {
+    uint64_t         last_slot;
+    uint64_t         threshold;
+    uint64_t         used_count;
+    solohat_bucket_t buckets[];
+} solohat_store_t;
+
+/* solohat_t
+ *
+ * store_current -- The current store. Only the writer ever stores to
+ *                  this, with a release store, once a new store is
+ *                  completely filled in.
+ *
+ * item_count    -- The number of items in the table. Only the writer
+ *                  updates it, but readers may read it at any time.
+ *
+ * next_epoch    -- The next epoch to hand out. Writer only.
+ */
+typedef struct {
+    _Atomic(solohat_store_t *) store_current;
+    _Atomic uint64_t           item_count;
+    uint64_t                   next_epoch;
+} solohat_t;
+
+/* Reads (get, len and view) are safe from any number of threads at
+ * once.  Writes (put, replace, add and remove) must only ever come
+ * from one thread at a time. If the writer changes, the hand-off
+ * needs to synchronize (e.g., via a mutex or a thread join), so that
+ * the new writer sees everything the old one did.
+ */
+solohat_t      *solohat_new      (void);
+solohat_t      *solohat_new_size (char);
+void            solohat_init     (solohat_t *);
+void            solohat_init_size(solohat_t *, char);
+void            solohat_cleanup  (solohat_t *);
+void            solohat_delete   (solohat_t *);
+void           *solohat_get      (solohat_t *, hatrack_hash_t, bool *);
+void           *solohat_put      (solohat_t *, hatrack_hash_t, void *, bool *);
+void           *solohat_replace  (solohat_t *, hatrack_hash_t, void *, bool *);
+bool            solohat_add      (solohat_t *, hatrack_hash_t, void *);
+void           *solohat_remove   (solohat_t *, hatrack_hash_t, bool *);
+uint64_t        solohat_len      (solohat_t *);
+hatrack_view_t *solohat_view     (solohat_t *, uint64_t *, bool);
+
+#endif
@@ -46,6 +46,7 @@ typedef struct {
     int64_t             next_ix;
     int64_t             size;
     vector_store_t     *contents;
+    vector_callback_t   ret_callback;
     vector_callback_t   eject_callback;
 } vector_view_t;
 
@@ -36,6 +36,7 @@
 #define __WITCHHAT_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/shardctr.h>
 
 typedef struct {
     void    *item;
@@ -61,6 +62,7 @@ struct witchhat_store_st {
     uint64_t                    last_slot;
     uint64_t                    threshold;
     _Atomic uint64_t            used_count;
+    hatrack_shard_t            *budget;
     _Atomic(witchhat_store_t *) store_next;
     alignas(16)
     witchhat_bucket_t           buckets[];
@@ -69,7 +71,7 @@ struct witchhat_store_st {
 typedef struct {
     alignas(8)
     _Atomic(witchhat_store_t *) store_current;
-    _Atomic uint64_t            item_count;
+    hatrack_shardctr_t          item_count;
     _Atomic uint64_t            help_needed;
             uint64_t            next_epoch;
 
@@ -90,6 +92,7 @@ void           *witchhat_replace    (witchhat_t *, hatrack_hash_t, void *,
 bool            witchhat_add        (witchhat_t *, hatrack_hash_t, void *);
 void           *witchhat_remove     (witchhat_t *, hatrack_hash_t, bool *);
 uint64_t        witchhat_len        (witchhat_t *);
+uint64_t        witchhat_len_approx (witchhat_t *);
 hatrack_view_t *witchhat_view       (witchhat_t *, uint64_t *, bool);
 hatrack_view_t *witchhat_view_no_mmm(witchhat_t *, uint64_t *, bool);
 
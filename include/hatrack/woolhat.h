@@ -25,6 +25,7 @@
 #define __WOOLHAT_H__
 
 #include <hatrack/hatrack_common.h>
+#include <hatrack/shardctr.h>
 
 typedef struct woolhat_record_st woolhat_record_t;
 
@@ -60,17 +61,21 @@ struct woolhat_store_st {
     uint64_t                   last_slot;
     uint64_t                   threshold;
     _Atomic uint64_t           used_count;
+    hatrack_shard_t           *budget;
     _Atomic(woolhat_store_t *) store_next;
+    _Atomic uint64_t           prefault;
     woolhat_history_t          hist_buckets[];
 };
 
 typedef struct woolhat_st {
     alignas(8)
     _Atomic(woolhat_store_t *) store_current;
-    _Atomic uint64_t           item_count;
+    hatrack_shardctr_t         item_count;
     _Atomic uint64_t           help_needed;
     mmm_cleanup_func           cleanup_func;
     void                      *cleanup_aux;
+    hatrack_allocator_t       *allocator;
+    hatrack_allocator_t       *record_allocator;
 } woolhat_t;
 
 
@@ -92,6 +97,9 @@ void            woolhat_init_size       (woolhat_t *, char);
 void            woolhat_cleanup         (woolhat_t *);
 void            woolhat_delete          (woolhat_t *);
 void            woolhat_set_cleanup_func(woolhat_t *, mmm_cleanup_func, void *);
+void            woolhat_set_allocator   (woolhat_t *, hatrack_allocator_t *);
+void            woolhat_set_record_allocator(woolhat_t *,
+					     hatrack_allocator_t *);
 void           *woolhat_get             (woolhat_t *, hatrack_hash_t, bool *);
 void           *woolhat_put             (woolhat_t *, hatrack_hash_t, void *,
 					 bool *);
@@ -100,6 +108,7 @@ void           *woolhat_replace         (woolhat_t *, hatrack_hash_t, void *,
 bool            woolhat_add             (woolhat_t *, hatrack_hash_t, void *);
 void           *woolhat_remove          (woolhat_t *, hatrack_hash_t, bool *);
 uint64_t        woolhat_len             (woolhat_t *);
+uint64_t        woolhat_len_approx      (woolhat_t *);
 
 hatrack_view_t     *woolhat_view        (woolhat_t *, uint64_t *, bool);
 hatrack_set_view_t *woolhat_view_epoch  (woolhat_t *, uint64_t *, uint64_t);
@@ -34,6 +34,7 @@
 #include <hatrack/refhat.h>
 #include <hatrack/duncecap.h>
 #include <hatrack/swimcap.h>
+#include <hatrack/solohat.h>
 #include <hatrack/newshat.h>
 #include <hatrack/ballcap.h>
 #include <hatrack/hihat.h>
@@ -45,6 +46,7 @@
 #include <hatrack/woolhat.h>
 #include <hatrack/tophat.h>
 #include <hatrack/crown.h>
+#include <hatrack/quilt.h>
 
 typedef struct {
     hatrack_vtable_t vtable;
@@ -180,11 +182,17 @@ typedef struct {
 } benchmark_t;
 
 typedef struct {
-    bool        run_default_tests;
-    bool        run_func_tests;
-    bool        run_custom_test;
-    benchmark_t custom;
-    char       *hat_list[];
+    bool         run_default_tests;
+    bool         run_func_tests;
+    bool         run_unit_tests;
+    bool         run_custom_test;
+    bool         run_mmm_bench;
+    bool         run_api_bench;
+    bool         run_sweep;
+    unsigned int sweep_reps;
+    unsigned int key_len;
+    benchmark_t  custom;
+    char        *hat_list[];
 } config_info_t;
 
 typedef struct {
@@ -195,7 +203,6 @@ typedef struct {
     bool              threadsafe;
 } alg_info_t;
 
-extern _Atomic uint64_t mmm_nexttid;
 extern hatrack_hash_t  *precomputed_hashes;
 
 // clang-format off
@@ -217,6 +224,35 @@ testhat_t     *testhat_new_size      (char *, char);
 // functional.c -- functional tests, off by default.
 void           run_functional_tests  (config_info_t *);
 
+// unit.c -- tests that don't go through the vtable, off by default.
+void           run_unit_tests        (config_info_t *);
+
+// unit_*.c -- one file per component, registered in unit.c.
+bool           test_idalloc          (void);
+bool           test_solohat          (void);
+bool           test_dict_excl        (void);
+bool           test_dict_arena       (void);
+bool           test_membudget        (void);
+bool           test_intset           (void);
+bool           test_crown_stash      (void);
+bool           test_dict_freeze      (void);
+bool           test_rcu              (void);
+bool           test_logring_follow   (void);
+bool           test_par_views        (void);
+bool           test_dict_replica     (void);
+bool           test_dict_txn         (void);
+bool           test_hash_scan        (void);
+bool           test_hatlog           (void);
+bool           test_qstats           (void);
+bool           test_queue_set        (void);
+bool           test_flex64           (void);
+
+// mmmbench.c -- microbenchmarks for mmm, off by default.
+void           run_mmm_benchmarks    (config_info_t *);
+
+// apibench.c -- benchmarks for the dict and set APIs, off by default.
+void           run_api_benchmarks    (config_info_t *);
+
 // default.c -- default tests.
 void           run_default_tests     (config_info_t *);
 
@@ -224,6 +260,9 @@ void           run_default_tests     (config_info_t *);
 // kicked off from the main() function in test.c
 void           run_performance_test  (benchmark_t *);
 
+// Also in performance.c -- runs a test over a series of thread counts.
+void           run_scaling_sweep     (benchmark_t *, unsigned int);
+
 // config.c -- Command-line argument parsing.
 config_info_t *parse_args            (int, char *[]);
 
@@ -0,0 +1,572 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           flex64.c
+ *  Description:    A variant of our flex array with 64-bit cells.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+static flex64_store_t *flex64_new_store(uint64_t, uint64_t);
+static void            flex64_migrate(flex64_store_t *, flex64_t *);
+
+// See flexarray_new().
+flex64_t *
+flex64_new(uint64_t initial_size)
+{
+    flex64_t *arr;
+
+    arr = (flex64_t *)hatrack_malloc(sizeof(flex64_t));
+
+    flex64_init(arr, initial_size);
+
+    return arr;
+}
+
+void
+flex64_init(flex64_t *arr, uint64_t initial_size)
+{
+    uint64_t store_size;
+
+    arr->ret_callback   = NULL;
+    arr->eject_callback = NULL;
+    store_size          = hatrack_round_up_to_power_of_2(initial_size);
+
+    if (store_size < (1 << FLEXARRAY_MIN_STORE_SZ_LOG)) {
+	store_size = 1 << FLEXARRAY_MIN_STORE_SZ_LOG;
+    }
+
+    atomic_store(&arr->store, flex64_new_store(initial_size, store_size));
+
+    return;
+}
+
+void
+flex64_set_ret_callback(flex64_t *self, flex_callback_t callback)
+{
+    self->ret_callback = callback;
+
+    return;
+}
+
+void
+flex64_set_eject_callback(flex64_t *self, flex_callback_t callback)
+{
+    self->eject_callback = callback;
+
+    return;
+}
+
+void
+flex64_cleanup(flex64_t *self)
+{
+    flex64_store_t *store;
+    uint64_t        i;
+    flex64_item_t   item;
+
+    store = atomic_load(&self->store);
+
+    if (self->eject_callback) {
+	for (i = 0; i < (store->array_size & ~FLEX_ARRAY_SHRINK); i++) {
+	    item = atomic_read(&store->cells[i]);
+	    if (item & FLEX64_USED) {
+		(*self->eject_callback)(flex64_item(item));
+	    }
+	}
+    }
+
+    mmm_retire_unused(store);
+
+    return;
+}
+
+void
+flex64_delete(flex64_t *self)
+{
+    flex64_cleanup(self);
+    hatrack_free(self, sizeof(flex64_t));
+
+    return;
+}
+
+uint64_t
+flex64_len(flex64_t *self)
+{
+    flex64_store_t *store = atomic_read(&self->store);
+
+    return atomic_read(&store->array_size) & ~FLEX_ARRAY_SHRINK;
+}
+
+void *
+flex64_get(flex64_t *self, uint64_t index, int *status)
+{
+    flex64_item_t   current;
+    flex64_store_t *store;
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->store);
+
+    if (index >= (atomic_read(&store->array_size) & ~FLEX_ARRAY_SHRINK)) {
+	if (status) {
+	    *status = FLEX_OOB;
+	}
+	mmm_end_op();
+	return NULL;
+    }
+
+    // A resize is in progress, item is not there yet.
+    if (index >= store->store_size) {
+	if (status) {
+	    *status = FLEX_UNINITIALIZED;
+	}
+	mmm_end_op();
+	return NULL;
+    }
+
+    current = atomic_read(&store->cells[index]);
+
+    if (!(current & FLEX64_USED)) {
+	if (status) {
+	    *status = FLEX_UNINITIALIZED;
+	}
+	mmm_end_op();
+	return NULL;
+    }
+
+    if (self->ret_callback && flex64_item(current)) {
+	(*self->ret_callback)(flex64_item(current));
+    }
+
+    mmm_end_op();
+
+    if (status) {
+	*status = FLEX_OK;
+    }
+
+    return flex64_item(current);
+}
+
+// Returns true if successful, false if write would be out-of-bounds.
+bool
+flex64_set(flex64_t *self, uint64_t index, void *item)
+{
+    flex64_store_t *store;
+    flex64_item_t   current;
+    flex64_item_t   candidate;
+    flex64_cell_t  *cellptr;
+    uint64_t        read_index;
+
+    if (((flex64_item_t)item) & FLEX64_STATE_MASK) {
+	abort();
+    }
+
+    mmm_start_basic_op();
+
+    store      = atomic_read(&self->store);
+    read_index = atomic_read(&store->array_size) & ~FLEX_ARRAY_SHRINK;
+
+    if (index >= read_index) {
+	mmm_end_op();
+	return false;
+    }
+
+    if (index >= store->store_size) {
+	flex64_migrate(store, self);
+	mmm_end_op();
+	return flex64_set(self, index, item);
+    }
+
+    cellptr = &store->cells[index];
+    current = atomic_read(cellptr);
+
+    if (current & FLEX64_MOVING) {
+	flex64_migrate(store, self);
+	mmm_end_op();
+	return flex64_set(self, index, item);
+    }
+
+    candidate = ((flex64_item_t)item) | FLEX64_USED;
+
+    if (CAS(cellptr, &current, candidate)) {
+	if (self->eject_callback && (current & FLEX64_USED)) {
+	    (*self->eject_callback)(flex64_item(current));
+	}
+	mmm_end_op();
+	return true;
+    }
+
+    if (current & FLEX64_MOVING) {
+	flex64_migrate(store, self);
+	mmm_end_op();
+	return flex64_set(self, index, item);
+    }
+
+    // See flexarray_set(); we got overwritten.
+    if (self->eject_callback) {
+	(*self->eject_callback)(item);
+    }
+
+    mmm_end_op();
+    return true;
+}
+
+void
+flex64_grow(flex64_t *self, uint64_t index)
+{
+    flex64_store_t *store;
+    uint64_t        array_size;
+
+    mmm_start_basic_op();
+
+    do {
+	store      = atomic_read(&self->store);
+	array_size = atomic_read(&store->array_size);
+
+	if (array_size & FLEX_ARRAY_SHRINK) {
+	    flex64_migrate(store, self);
+	    continue;
+	}
+
+	if (index < array_size) {
+	    mmm_end_op();
+	    return;
+	}
+    } while (!CAS(&store->array_size, &array_size, index));
+
+    if (index > store->store_size) {
+	flex64_migrate(store, self);
+    }
+
+    mmm_end_op();
+    return;
+}
+
+void
+flex64_shrink(flex64_t *self, uint64_t index)
+{
+    flex64_store_t *store;
+    uint64_t        array_size;
+
+    mmm_start_basic_op();
+
+    do {
+	store      = atomic_read(&self->store);
+	array_size = atomic_read(&store->array_size);
+
+	if (index >= (array_size & ~FLEX_ARRAY_SHRINK)) {
+	    mmm_end_op();
+	    return;
+	}
+    } while (!CAS(&store->array_size,
+		  &array_size,
+		  index | FLEX_ARRAY_SHRINK));
+
+    flex64_migrate(store, self);
+
+    mmm_end_op();
+    return;
+}
+
+flex64_view_t *
+flex64_view(flex64_t *self)
+{
+    flex64_view_t  *ret;
+    flex64_store_t *store;
+    bool            expected;
+    uint64_t        i;
+    flex64_item_t   item;
+
+    mmm_start_basic_op();
+
+    while (true) {
+	store    = atomic_read(&self->store);
+	expected = false;
+
+	if (CAS(&store->claimed, &expected, true)) {
+	    break;
+	}
+	flex64_migrate(store, self);
+    }
+
+    flex64_migrate(store, self);
+
+    if (self->ret_callback) {
+	for (i = 0; i < (store->array_size & ~FLEX_ARRAY_SHRINK); i++) {
+	    item = atomic_read(&store->cells[i]);
+	    if (item & FLEX64_USED) {
+		(*self->ret_callback)(flex64_item(item));
+	    }
+	}
+    }
+
+    mmm_end_op();
+
+    ret                 = (flex64_view_t *)hatrack_malloc(sizeof(flex64_view_t));
+    ret->contents       = store;
+    ret->next_ix        = 0;
+    ret->eject_callback = self->eject_callback;
+
+    return ret;
+}
+
+void *
+flex64_view_next(flex64_view_t *view, bool *found)
+{
+    flex64_item_t item;
+
+    while (true) {
+	if (view->next_ix >= flex64_view_len(view)) {
+	    if (found) {
+		*found = false;
+	    }
+	    return NULL;
+	}
+
+	item = atomic_read(&view->contents->cells[view->next_ix++]);
+
+	if (item & FLEX64_USED) {
+	    if (found) {
+		*found = true;
+	    }
+	    return flex64_item(item);
+	}
+    }
+}
+
+void
+flex64_view_delete(flex64_view_t *view)
+{
+    void *item;
+    bool  found;
+
+    if (view->eject_callback) {
+	while (true) {
+	    item = flex64_view_next(view, &found);
+	    if (!found) {
+		break;
+	    }
+
+	    (*view->eject_callback)(item);
+	}
+    }
+
+    mmm_retire(view->contents);
+
+    hatrack_free(view, sizeof(flex64_view_t));
+
+    return;
+}
+
+void *
+flex64_view_get(flex64_view_t *view, uint64_t ix, int *err)
+{
+    flex64_item_t item;
+
+    if (ix >= flex64_view_len(view)) {
+	if (err) {
+	    *err = FLEX_OOB;
+	}
+	return NULL;
+    }
+
+    item = atomic_read(&view->contents->cells[ix]);
+
+    if (!(item & FLEX64_USED)) {
+	if (err) {
+	    *err = FLEX_UNINITIALIZED;
+	}
+	return NULL;
+    }
+    if (err) {
+	*err = FLEX_OK;
+    }
+    return flex64_item(item);
+}
+
+uint64_t
+flex64_view_len(flex64_view_t *view)
+{
+    return atomic_read(&view->contents->array_size) & ~FLEX_ARRAY_SHRINK;
+}
+
+/* Unlike flexarray_add(), we copy both views into a fresh array,
+ * since the cells in a view's store are all marked as moving. Any
+ * references the views took (through the return callback) pass on to
+ * the new array, so we release the views without ejecting anything.
+ */
+flex64_t *
+flex64_add(flex64_t *arr1, flex64_t *arr2)
+{
+    flex64_t       *res;
+    flex64_view_t  *v1;
+    flex64_view_t  *v2;
+    flex64_store_t *store;
+    flex64_item_t   item;
+    uint64_t        v1_sz;
+    uint64_t        v2_sz;
+    uint64_t        i;
+
+    v1    = flex64_view(arr1);
+    v2    = flex64_view(arr2);
+    v1_sz = flex64_view_len(v1);
+    v2_sz = flex64_view_len(v2);
+    res   = flex64_new(v1_sz + v2_sz);
+    store = atomic_load(&res->store);
+
+    res->ret_callback   = arr1->ret_callback;
+    res->eject_callback = arr1->eject_callback;
+
+    for (i = 0; i < v1_sz; i++) {
+	item = atomic_read(&v1->contents->cells[i]);
+	if (item & FLEX64_USED) {
+	    atomic_store(&store->cells[i], (item & ~FLEX64_STATE_MASK)
+			 | FLEX64_USED);
+	}
+    }
+
+    for (i = 0; i < v2_sz; i++) {
+	item = atomic_read(&v2->contents->cells[i]);
+	if (item & FLEX64_USED) {
+	    atomic_store(&store->cells[v1_sz + i], (item & ~FLEX64_STATE_MASK)
+			 | FLEX64_USED);
+	}
+    }
+
+    v1->eject_callback = NULL;
+    v2->eject_callback = NULL;
+
+    flex64_view_delete(v1);
+    flex64_view_delete(v2);
+
+    return res;
+}
+
+static flex64_store_t *
+flex64_new_store(uint64_t array_size, uint64_t store_size)
+{
+    flex64_store_t *ret;
+    uint64_t        alloc_len;
+
+    alloc_len = sizeof(flex64_store_t) + sizeof(flex64_cell_t) * store_size;
+    ret       = (flex64_store_t *)mmm_alloc_committed(alloc_len);
+
+    ret->store_size = store_size;
+
+    atomic_store(&ret->array_size, array_size);
+
+    return ret;
+}
+
+/* Same as flexarray_migrate(), except that, since the state lives in
+ * the same word as the item, marking cells uses a CAS loop rather than
+ * a blind OR, so we never mark a cell as moved right after someone
+ * has written an item into it.
+ */
+static void
+flex64_migrate(flex64_store_t *store, flex64_t *top)
+{
+    flex64_store_t *next_store;
+    flex64_store_t *expected_next;
+    flex64_item_t   expected_item;
+    flex64_item_t   candidate_item;
+    uint64_t        i;
+    uint64_t        new_array_len;
+    uint64_t        new_store_len;
+
+    if (atomic_read(&top->store) != store) {
+	return;
+    }
+
+    next_store = atomic_read(&store->next);
+
+    if (next_store) {
+	goto help_move;
+    }
+
+    for (i = 0; i < store->store_size; i++) {
+	expected_item = atomic_read(&store->cells[i]);
+
+	while (!(expected_item & FLEX64_MOVING)) {
+	    if (expected_item & FLEX64_USED) {
+		candidate_item = expected_item | FLEX64_MOVING;
+	    }
+	    else {
+		candidate_item = expected_item | FLEX64_MOVING | FLEX64_MOVED;
+	    }
+
+	    if (CAS(&store->cells[i], &expected_item, candidate_item)) {
+		break;
+	    }
+	}
+    }
+
+    expected_next = NULL;
+    new_array_len = atomic_read(&store->array_size) & ~FLEX_ARRAY_SHRINK;
+    new_store_len = hatrack_round_up_to_power_of_2(new_array_len) << 1;
+
+    if (new_store_len < (1 << FLEXARRAY_MIN_STORE_SZ_LOG)) {
+	new_store_len = 1 << FLEXARRAY_MIN_STORE_SZ_LOG;
+    }
+
+    next_store = flex64_new_store(new_array_len, new_store_len);
+
+    if (!CAS(&store->next, &expected_next, next_store)) {
+	mmm_retire_unused(next_store);
+	next_store = expected_next;
+    }
+
+ help_move:
+    new_array_len = atomic_read(&next_store->array_size) & ~FLEX_ARRAY_SHRINK;
+
+    for (i = 0; i < store->store_size; i++) {
+	candidate_item = atomic_read(&store->cells[i]);
+
+	if (candidate_item & FLEX64_MOVED) {
+	    continue;
+	}
+
+	if (i < new_array_len) {
+	    expected_item = 0;
+
+	    CAS(&next_store->cells[i],
+		&expected_item,
+		(candidate_item & ~FLEX64_STATE_MASK) | FLEX64_USED);
+	    atomic_fetch_or(&store->cells[i], FLEX64_MOVED);
+	    continue;
+	}
+
+	// Truncated; whoever marks it moved calls the ejection handler.
+	expected_item = candidate_item;
+
+	if (CAS(&store->cells[i],
+		&expected_item,
+		candidate_item | FLEX64_MOVED)) {
+	    if (top->eject_callback) {
+		(*top->eject_callback)(flex64_item(candidate_item));
+	    }
+	}
+    }
+
+    if (CAS(&top->store, &store, next_store)) {
+	if (!store->claimed) {
+	    mmm_retire(store);
+	}
+    }
+
+    return;
+}
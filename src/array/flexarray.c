@@ -37,7 +37,7 @@ flexarray_new(uint64_t initial_size)
 {
     flexarray_t *arr;
 
-    arr = (flexarray_t *)malloc(sizeof(flexarray_t));
+    arr = (flexarray_t *)hatrack_malloc(sizeof(flexarray_t));
     
     flexarray_init(arr, initial_size);
     
@@ -103,7 +103,7 @@ void
 flexarray_delete(flexarray_t *self)
 {
     flexarray_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(flexarray_t));
 
     return;
 }
@@ -329,9 +329,11 @@ flexarray_view(flexarray_t *self)
     
     mmm_end_op();
     
-    ret           = (flex_view_t *)malloc(sizeof(flex_view_t));
-    ret->contents = store;
-    ret->next_ix  = 0;
+    ret                 = (flex_view_t *)hatrack_malloc(sizeof(flex_view_t));
+    ret->contents       = store;
+    ret->next_ix        = 0;
+    ret->ret_callback   = self->ret_callback;
+    ret->eject_callback = self->eject_callback;
     
     return ret;
 }
@@ -379,7 +381,7 @@ flexarray_view_delete(flex_view_t *view)
 
     mmm_retire(view->contents);
 
-    free(view);
+    hatrack_free(view, 0);
 
     return;
 }
@@ -422,7 +424,7 @@ flexarray_view_len(flex_view_t *view)
 flexarray_t *
 flexarray_add(flexarray_t *arr1, flexarray_t *arr2)
 {
-    flexarray_t  *res    = (flexarray_t *)malloc(sizeof(flexarray_t));
+    flexarray_t  *res    = (flexarray_t *)hatrack_malloc(sizeof(flexarray_t));
     flex_view_t  *v1     = flexarray_view(arr1);
     flex_view_t  *v2     = flexarray_view(arr2);
     flex_store_t *s1     = v1->contents;
@@ -434,7 +436,7 @@ flexarray_add(flexarray_t *arr1, flexarray_t *arr2)
     res->eject_callback = arr1->eject_callback;
 
     atomic_store(&res->store, s1);
-    free(v1);
+    hatrack_free(v1, 0);
 
     if (v1_sz + v2_sz > s1->array_size) {
 	flexarray_grow(res, v1_sz + v2_sz);
@@ -447,7 +449,7 @@ flexarray_add(flexarray_t *arr1, flexarray_t *arr2)
 
     atomic_store(&(s1->array_size), v1_sz);
     mmm_retire_unused(s2);
-    free(v2);
+    hatrack_free(v2, 0);
 
     return res;
 }
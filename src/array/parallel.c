@@ -0,0 +1,797 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           parallel.c
+ *  Description:    Parallel algorithms over flexarray and vector views.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+#include <hatrack/parallel.h>
+
+#if HATRACK_PAR_CHUNK & (HATRACK_PAR_CHUNK - 1)
+#error "HATRACK_PAR_CHUNK must be a power of two"
+#endif
+
+/* Flexarray and vector cells have the same layout, so, once we've
+ * pulled the store out of a view, the algorithms don't care which
+ * kind of array it came from; they just need to know the flag that
+ * marks a cell as set.
+ *
+ * A view's store has been claimed and fully migrated by the time the
+ * view gets it, so nothing writes to its cells anymore.  We read them
+ * as plain memory, since a 128-bit atomic load (a lock cmpxchg16b on
+ * x86) would make every reader write to the cache lines it reads, and
+ * the threads would spend their time fighting over them.  The same
+ * goes for the stores of the arrays we build, which nobody else can
+ * see until we return them.
+ */
+typedef struct {
+    flex_item_t     *cells;
+    uint64_t         len;
+    uint64_t         used;
+    flex_callback_t  ret_callback;
+    flex_callback_t  eject_callback;
+    hatrack_pool_t  *pool;
+} par_source_t;
+
+typedef struct {
+    par_source_t        *src;
+    hatrack_par_each_fn  fn;
+    void                *aux;
+} par_each_job_t;
+
+typedef struct {
+    par_source_t        *src;
+    void                *identity;
+    hatrack_par_fold_fn  fold;
+    void                *aux;
+    void               **partials;
+} par_reduce_job_t;
+
+/* keep   -- One byte per cell, set if the predicate accepted the
+ *           cell's item.  NULL when there's no predicate.
+ *
+ * counts -- The number of items each chunk keeps, which then gets
+ *           turned into each chunk's offset in the output.
+ */
+typedef struct {
+    par_source_t        *src;
+    hatrack_par_pred_fn  pred;
+    void                *aux;
+    uint8_t             *keep;
+    uint64_t            *counts;
+    void               **out;
+} par_compact_job_t;
+
+typedef struct {
+    void               **src;
+    void               **dst;
+    uint64_t             n;
+    uint64_t             width;
+    hatrack_par_cmp_fn   cmp;
+    void                *aux;
+} par_sort_job_t;
+
+typedef struct {
+    par_source_t        *src;
+    void               **items;
+    uint64_t             n;
+    flex_item_t         *cells;
+} par_build_job_t;
+
+static void         par_source_flex   (par_source_t *, flex_view_t *,
+				       hatrack_pool_t *);
+static void         par_source_vector (par_source_t *, vector_view_t *,
+				       hatrack_pool_t *);
+static void         par_for_each      (par_source_t *, hatrack_par_each_fn,
+				       void *);
+static void        *par_reduce        (par_source_t *, void *,
+				       hatrack_par_fold_fn,
+				       hatrack_par_fold_fn, void *);
+static flexarray_t *par_sort          (par_source_t *, hatrack_par_cmp_fn,
+				       void *);
+static flexarray_t *par_filter        (par_source_t *, hatrack_par_pred_fn,
+				       void *);
+static void       **par_compact       (par_source_t *, hatrack_par_pred_fn,
+				       void *, uint64_t *);
+static flexarray_t *par_build         (par_source_t *, void **, uint64_t);
+static void         par_each_task     (uint64_t, void *);
+static void         par_reduce_task   (uint64_t, void *);
+static void         par_count_task    (uint64_t, void *);
+static void         par_copy_task     (uint64_t, void *);
+static void         par_run_sort_task (uint64_t, void *);
+static void         par_merge_task    (uint64_t, void *);
+static void         par_build_task    (uint64_t, void *);
+static void         par_msort         (void **, void **, uint64_t,
+				       hatrack_par_cmp_fn, void *);
+static uint64_t     par_co_rank       (uint64_t, void **, uint64_t, void **,
+				       uint64_t, hatrack_par_cmp_fn, void *);
+
+void
+flexarray_view_for_each(flex_view_t        *view,
+			hatrack_pool_t     *pool,
+			hatrack_par_each_fn fn,
+			void               *aux)
+{
+    par_source_t src;
+
+    par_source_flex(&src, view, pool);
+    par_for_each(&src, fn, aux);
+
+    return;
+}
+
+void *
+flexarray_view_reduce(flex_view_t        *view,
+		      hatrack_pool_t     *pool,
+		      void               *identity,
+		      hatrack_par_fold_fn fold,
+		      hatrack_par_fold_fn combine,
+		      void               *aux)
+{
+    par_source_t src;
+
+    par_source_flex(&src, view, pool);
+
+    return par_reduce(&src, identity, fold, combine, aux);
+}
+
+flexarray_t *
+flexarray_view_sort(flex_view_t       *view,
+		    hatrack_pool_t    *pool,
+		    hatrack_par_cmp_fn cmp,
+		    void              *aux)
+{
+    par_source_t src;
+
+    par_source_flex(&src, view, pool);
+
+    return par_sort(&src, cmp, aux);
+}
+
+flexarray_t *
+flexarray_view_filter(flex_view_t        *view,
+		      hatrack_pool_t     *pool,
+		      hatrack_par_pred_fn pred,
+		      void               *aux)
+{
+    par_source_t src;
+
+    par_source_flex(&src, view, pool);
+
+    return par_filter(&src, pred, aux);
+}
+
+void
+vector_view_for_each(vector_view_t      *view,
+		     hatrack_pool_t     *pool,
+		     hatrack_par_each_fn fn,
+		     void               *aux)
+{
+    par_source_t src;
+
+    par_source_vector(&src, view, pool);
+    par_for_each(&src, fn, aux);
+
+    return;
+}
+
+void *
+vector_view_reduce(vector_view_t      *view,
+		   hatrack_pool_t     *pool,
+		   void               *identity,
+		   hatrack_par_fold_fn fold,
+		   hatrack_par_fold_fn combine,
+		   void               *aux)
+{
+    par_source_t src;
+
+    par_source_vector(&src, view, pool);
+
+    return par_reduce(&src, identity, fold, combine, aux);
+}
+
+flexarray_t *
+vector_view_sort(vector_view_t     *view,
+		 hatrack_pool_t    *pool,
+		 hatrack_par_cmp_fn cmp,
+		 void              *aux)
+{
+    par_source_t src;
+
+    par_source_vector(&src, view, pool);
+
+    return par_sort(&src, cmp, aux);
+}
+
+flexarray_t *
+vector_view_filter(vector_view_t      *view,
+		   hatrack_pool_t     *pool,
+		   hatrack_par_pred_fn pred,
+		   void               *aux)
+{
+    par_source_t src;
+
+    par_source_vector(&src, view, pool);
+
+    return par_filter(&src, pred, aux);
+}
+
+/* The store's array_size can have the shrink flag set, and in the
+ * middle of a grow it can be past the end of the store's cells.
+ */
+static void
+par_source_flex(par_source_t *src, flex_view_t *view, hatrack_pool_t *pool)
+{
+    uint64_t len;
+
+    len = atomic_read(&view->contents->array_size) & ~FLEX_ARRAY_SHRINK;
+
+    if (len > view->contents->store_size) {
+	len = view->contents->store_size;
+    }
+
+    src->cells          = (flex_item_t *)view->contents->cells;
+    src->len            = len;
+    src->used           = FLEX_ARRAY_USED;
+    src->ret_callback   = view->ret_callback;
+    src->eject_callback = view->eject_callback;
+    src->pool           = pool ? pool : hatrack_pool_default();
+
+    return;
+}
+
+static void
+par_source_vector(par_source_t *src, vector_view_t *view, hatrack_pool_t *pool)
+{
+    src->cells          = (flex_item_t *)view->contents->cells;
+    src->len            = (uint64_t)view->size;
+    src->used           = VECTOR_USED;
+    src->ret_callback   = view->ret_callback;
+    src->eject_callback = view->eject_callback;
+    src->pool           = pool ? pool : hatrack_pool_default();
+
+    return;
+}
+
+static inline uint64_t
+par_num_tasks(uint64_t n)
+{
+    return (n + HATRACK_PAR_CHUNK - 1) / HATRACK_PAR_CHUNK;
+}
+
+static inline uint64_t
+par_chunk_end(uint64_t task, uint64_t n)
+{
+    uint64_t end;
+
+    end = (task + 1) * HATRACK_PAR_CHUNK;
+
+    return end < n ? end : n;
+}
+
+static void
+par_for_each(par_source_t *src, hatrack_par_each_fn fn, void *aux)
+{
+    par_each_job_t job;
+
+    job.src = src;
+    job.fn  = fn;
+    job.aux = aux;
+
+    hatrack_pool_run(src->pool, par_num_tasks(src->len), par_each_task, &job);
+
+    return;
+}
+
+static void *
+par_reduce(par_source_t       *src,
+	   void               *identity,
+	   hatrack_par_fold_fn fold,
+	   hatrack_par_fold_fn combine,
+	   void               *aux)
+{
+    par_reduce_job_t job;
+    uint64_t         num_tasks;
+    uint64_t         i;
+    void            *ret;
+
+    num_tasks = par_num_tasks(src->len);
+
+    if (!num_tasks) {
+	return identity;
+    }
+
+    job.src      = src;
+    job.identity = identity;
+    job.fold     = fold;
+    job.aux      = aux;
+    job.partials = (void **)hatrack_malloc(sizeof(void *) * num_tasks);
+
+    hatrack_pool_run(src->pool, num_tasks, par_reduce_task, &job);
+
+    ret = job.partials[0];
+
+    for (i = 1; i < num_tasks; i++) {
+	ret = (*combine)(ret, job.partials[i], aux);
+    }
+
+    hatrack_free(job.partials, sizeof(void *) * num_tasks);
+
+    return ret;
+}
+
+/* We gather the items into a flat array, sort each chunk on its own,
+ * and then merge pairs of sorted runs until there's one run left.
+ * Each merge pass gets split up by output position, not by pair of
+ * runs, so the last passes (with just a couple of huge runs) are just
+ * as parallel as the first ones: each task binary searches both runs
+ * for where its piece of the output starts and ends.
+ */
+static flexarray_t *
+par_sort(par_source_t *src, hatrack_par_cmp_fn cmp, void *aux)
+{
+    par_sort_job_t job;
+    void         **items;
+    void         **tmp;
+    void         **swap;
+    uint64_t       n;
+    uint64_t       num_tasks;
+    flexarray_t   *ret;
+
+    items     = par_compact(src, NULL, NULL, &n);
+    num_tasks = par_num_tasks(n);
+    tmp       = (void **)hatrack_malloc(sizeof(void *) * (n ? n : 1));
+
+    job.src   = items;
+    job.dst   = tmp;
+    job.n     = n;
+    job.width = HATRACK_PAR_CHUNK;
+    job.cmp   = cmp;
+    job.aux   = aux;
+
+    hatrack_pool_run(src->pool, num_tasks, par_run_sort_task, &job);
+
+    while (job.width < n) {
+	hatrack_pool_run(src->pool, num_tasks, par_merge_task, &job);
+
+	swap       = job.src;
+	job.src    = job.dst;
+	job.dst    = swap;
+	job.width <<= 1;
+    }
+
+    ret = par_build(src, job.src, n);
+
+    hatrack_free(items, sizeof(void *) * (n ? n : 1));
+    hatrack_free(tmp, sizeof(void *) * (n ? n : 1));
+
+    return ret;
+}
+
+static flexarray_t *
+par_filter(par_source_t *src, hatrack_par_pred_fn pred, void *aux)
+{
+    void       **items;
+    uint64_t     n;
+    flexarray_t *ret;
+
+    items = par_compact(src, pred, aux, &n);
+    ret   = par_build(src, items, n);
+
+    hatrack_free(items, sizeof(void *) * (n ? n : 1));
+
+    return ret;
+}
+
+/* Collects the items in the source that are set (and that the
+ * predicate accepts, if there is one) into a new array, in order.
+ * One pass counts how many items each chunk keeps, and then, once
+ * we know where each chunk's items go, a second pass copies them.
+ */
+static void **
+par_compact(par_source_t       *src,
+	    hatrack_par_pred_fn pred,
+	    void               *aux,
+	    uint64_t           *num_items)
+{
+    par_compact_job_t job;
+    uint64_t          num_tasks;
+    uint64_t          total;
+    uint64_t          count;
+    uint64_t          i;
+
+    num_tasks  = par_num_tasks(src->len);
+    job.src    = src;
+    job.pred   = pred;
+    job.aux    = aux;
+    job.keep   = NULL;
+    job.counts = (uint64_t *)hatrack_malloc(sizeof(uint64_t)
+					    * (num_tasks ? num_tasks : 1));
+
+    if (pred) {
+	job.keep = (uint8_t *)hatrack_malloc(src->len ? src->len : 1);
+    }
+
+    hatrack_pool_run(src->pool, num_tasks, par_count_task, &job);
+
+    total = 0;
+
+    for (i = 0; i < num_tasks; i++) {
+	count          = job.counts[i];
+	job.counts[i]  = total;
+	total         += count;
+    }
+
+    job.out = (void **)hatrack_malloc(sizeof(void *) * (total ? total : 1));
+
+    hatrack_pool_run(src->pool, num_tasks, par_copy_task, &job);
+
+    if (pred) {
+	hatrack_free(job.keep, src->len ? src->len : 1);
+    }
+
+    hatrack_free(job.counts, sizeof(uint64_t) * (num_tasks ? num_tasks : 1));
+
+    *num_items = total;
+
+    return job.out;
+}
+
+// Builds a flexarray that inherits the source array's callbacks.
+static flexarray_t *
+par_build(par_source_t *src, void **items, uint64_t n)
+{
+    par_build_job_t job;
+    flexarray_t    *ret;
+
+    ret                 = flexarray_new(n);
+    ret->ret_callback   = src->ret_callback;
+    ret->eject_callback = src->eject_callback;
+
+    job.src   = src;
+    job.items = items;
+    job.n     = n;
+    job.cells = (flex_item_t *)atomic_read(&ret->store)->cells;
+
+    hatrack_pool_run(src->pool, par_num_tasks(n), par_build_task, &job);
+
+    return ret;
+}
+
+static void
+par_each_task(uint64_t task, void *arg)
+{
+    par_each_job_t *job;
+    flex_item_t    *cells;
+    uint64_t        i;
+    uint64_t        end;
+
+    job   = (par_each_job_t *)arg;
+    cells = job->src->cells;
+    end   = par_chunk_end(task, job->src->len);
+
+    for (i = task * HATRACK_PAR_CHUNK; i < end; i++) {
+	if (cells[i].state & job->src->used) {
+	    (*job->fn)(cells[i].item, i, job->aux);
+	}
+    }
+
+    return;
+}
+
+static void
+par_reduce_task(uint64_t task, void *arg)
+{
+    par_reduce_job_t *job;
+    flex_item_t      *cells;
+    uint64_t          i;
+    uint64_t          end;
+    void             *acc;
+
+    job   = (par_reduce_job_t *)arg;
+    cells = job->src->cells;
+    end   = par_chunk_end(task, job->src->len);
+    acc   = job->identity;
+
+    for (i = task * HATRACK_PAR_CHUNK; i < end; i++) {
+	if (cells[i].state & job->src->used) {
+	    acc = (*job->fold)(acc, cells[i].item, job->aux);
+	}
+    }
+
+    job->partials[task] = acc;
+
+    return;
+}
+
+static void
+par_count_task(uint64_t task, void *arg)
+{
+    par_compact_job_t *job;
+    flex_item_t       *cells;
+    uint64_t           i;
+    uint64_t           end;
+    uint64_t           count;
+    bool               keep;
+
+    job   = (par_compact_job_t *)arg;
+    cells = job->src->cells;
+    end   = par_chunk_end(task, job->src->len);
+    count = 0;
+
+    for (i = task * HATRACK_PAR_CHUNK; i < end; i++) {
+	keep = cells[i].state & job->src->used;
+
+	if (keep && job->pred) {
+	    keep = (*job->pred)(cells[i].item, job->aux);
+	}
+
+	if (job->keep) {
+	    job->keep[i] = keep;
+	}
+
+	count += keep;
+    }
+
+    job->counts[task] = count;
+
+    return;
+}
+
+static void
+par_copy_task(uint64_t task, void *arg)
+{
+    par_compact_job_t *job;
+    flex_item_t       *cells;
+    uint64_t           i;
+    uint64_t           end;
+    uint64_t           out_ix;
+    bool               keep;
+
+    job    = (par_compact_job_t *)arg;
+    cells  = job->src->cells;
+    end    = par_chunk_end(task, job->src->len);
+    out_ix = job->counts[task];
+
+    for (i = task * HATRACK_PAR_CHUNK; i < end; i++) {
+	if (job->keep) {
+	    keep = job->keep[i];
+	}
+	else {
+	    keep = cells[i].state & job->src->used;
+	}
+
+	if (keep) {
+	    job->out[out_ix++] = cells[i].item;
+	}
+    }
+
+    return;
+}
+
+static void
+par_run_sort_task(uint64_t task, void *arg)
+{
+    par_sort_job_t *job;
+    uint64_t        start;
+
+    job   = (par_sort_job_t *)arg;
+    start = task * HATRACK_PAR_CHUNK;
+
+    par_msort(&job->src[start],
+	      &job->dst[start],
+	      par_chunk_end(task, job->n) - start,
+	      job->cmp,
+	      job->aux);
+
+    return;
+}
+
+/* Since the chunk size is a power of two, and so is the run width
+ * (which starts at the chunk size), no task's output straddles two
+ * pairs of runs.
+ */
+static void
+par_merge_task(uint64_t task, void *arg)
+{
+    par_sort_job_t *job;
+    void          **a;
+    void          **b;
+    void          **out;
+    uint64_t        pair_start;
+    uint64_t        mid;
+    uint64_t        pair_end;
+    uint64_t        a_len;
+    uint64_t        b_len;
+    uint64_t        k_start;
+    uint64_t        k_end;
+    uint64_t        i;
+    uint64_t        j;
+    uint64_t        i_end;
+    uint64_t        j_end;
+
+    job        = (par_sort_job_t *)arg;
+    k_start    = task * HATRACK_PAR_CHUNK;
+    k_end      = par_chunk_end(task, job->n);
+    out        = &job->dst[k_start];
+    pair_start = k_start & ~((job->width << 1) - 1);
+    mid        = pair_start + job->width;
+    pair_end   = mid + job->width;
+
+    if (mid > job->n) {
+	mid = job->n;
+    }
+
+    if (pair_end > job->n) {
+	pair_end = job->n;
+    }
+
+    a       = &job->src[pair_start];
+    b       = &job->src[mid];
+    a_len   = mid - pair_start;
+    b_len   = pair_end - mid;
+    k_start = k_start - pair_start;
+    k_end   = k_end - pair_start;
+    i       = par_co_rank(k_start, a, a_len, b, b_len, job->cmp, job->aux);
+    i_end   = par_co_rank(k_end, a, a_len, b, b_len, job->cmp, job->aux);
+    j       = k_start - i;
+    j_end   = k_end - i_end;
+
+    // On ties, items from the first run go first, to keep it stable.
+    while (i < i_end && j < j_end) {
+	if ((*job->cmp)(a[i], b[j], job->aux) <= 0) {
+	    *out++ = a[i++];
+	}
+	else {
+	    *out++ = b[j++];
+	}
+    }
+
+    while (i < i_end) {
+	*out++ = a[i++];
+    }
+
+    while (j < j_end) {
+	*out++ = b[j++];
+    }
+
+    return;
+}
+
+static void
+par_build_task(uint64_t task, void *arg)
+{
+    par_build_job_t *job;
+    uint64_t         i;
+    uint64_t         end;
+
+    job = (par_build_job_t *)arg;
+    end = par_chunk_end(task, job->n);
+
+    for (i = task * HATRACK_PAR_CHUNK; i < end; i++) {
+	job->cells[i].item  = job->items[i];
+	job->cells[i].state = FLEX_ARRAY_USED;
+
+	if (job->src->ret_callback) {
+	    (*job->src->ret_callback)(job->items[i]);
+	}
+    }
+
+    return;
+}
+
+// A stable, sequential merge sort, for a single chunk.
+static void
+par_msort(void             **items,
+	  void             **tmp,
+	  uint64_t           n,
+	  hatrack_par_cmp_fn cmp,
+	  void              *aux)
+{
+    uint64_t half;
+    uint64_t i;
+    uint64_t j;
+    uint64_t k;
+    void    *item;
+
+    if (n <= 16) {
+	for (i = 1; i < n; i++) {
+	    item = items[i];
+
+	    for (j = i; j && (*cmp)(items[j - 1], item, aux) > 0; j--) {
+		items[j] = items[j - 1];
+	    }
+
+	    items[j] = item;
+	}
+
+	return;
+    }
+
+    half = n >> 1;
+
+    par_msort(items, tmp, half, cmp, aux);
+    par_msort(items + half, tmp + half, n - half, cmp, aux);
+
+    if ((*cmp)(items[half - 1], items[half], aux) <= 0) {
+	return;
+    }
+
+    memcpy(tmp, items, sizeof(void *) * n);
+
+    i = 0;
+    j = half;
+    k = 0;
+
+    while (i < half && j < n) {
+	if ((*cmp)(tmp[i], tmp[j], aux) <= 0) {
+	    items[k++] = tmp[i++];
+	}
+	else {
+	    items[k++] = tmp[j++];
+	}
+    }
+
+    while (i < half) {
+	items[k++] = tmp[i++];
+    }
+
+    while (j < n) {
+	items[k++] = tmp[j++];
+    }
+
+    return;
+}
+
+/* Returns how many of the first k items of the merge of a and b come
+ * from a (the rest come from b).  That's the smallest i for which a[i]
+ * has to come after b[k - i - 1], which we can binary search for, since
+ * as i goes up, a[i] only gets bigger, and b[k - i - 1] only gets
+ * smaller.
+ */
+static uint64_t
+par_co_rank(uint64_t           k,
+	    void             **a,
+	    uint64_t           a_len,
+	    void             **b,
+	    uint64_t           b_len,
+	    hatrack_par_cmp_fn cmp,
+	    void              *aux)
+{
+    uint64_t low;
+    uint64_t high;
+    uint64_t i;
+    uint64_t j;
+
+    low  = k > b_len ? k - b_len : 0;
+    high = k < a_len ? k : a_len;
+
+    while (low < high) {
+	i = low + ((high - low) >> 1);
+	j = k - i;
+
+	if (j && i < a_len && (*cmp)(a[i], b[j - 1], aux) <= 0) {
+	    low = i + 1;
+	}
+	else {
+	    high = i;
+	}
+    }
+
+    return low;
+}
@@ -53,7 +53,7 @@ vector_new(int64_t initial_size)
 {
     vector_t *arr;
 
-    arr = (vector_t *)calloc(1, sizeof(vector_t));
+    arr = (vector_t *)hatrack_zalloc(sizeof(vector_t));
     
     vector_init(arr, initial_size, false);
     
@@ -120,7 +120,7 @@ void
 vector_delete(vector_t *self)
 {
     vector_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(vector_t));
 
     return;
 }
@@ -362,7 +362,7 @@ vector_view(vector_t *self)
     vector_item_t   item;
     vec_size_info_t si;            
 
-    ret          = malloc(sizeof(vector_view_t));
+    ret          = hatrack_malloc(sizeof(vector_view_t));
     ret->next_ix = 0;
 		 
     mmm_start_basic_op();
@@ -378,13 +378,14 @@ vector_view(vector_t *self)
     if (self->ret_callback) {
 	for (i = 0; i < si.array_size; i++) {
 	    item = atomic_load(&store->cells[i]);
-	    if (item.state & FLEX_ARRAY_USED) {
+	    if (item.state & VECTOR_USED) {
 		(*self->ret_callback)(item.item);
 	    }
 	}
     }
 
     ret->contents       = store;
+    ret->ret_callback   = self->ret_callback;
     ret->eject_callback = self->eject_callback;
 
     mmm_end_op();
@@ -435,7 +436,7 @@ vector_view_delete(vector_view_t *view)
 
     mmm_retire(view->contents);
 
-    free(view);
+    hatrack_free(view, 0);
 
     return;
 }
@@ -72,7 +72,7 @@ ballcap_new(void)
 {
     ballcap_t *ret;
 
-    ret = (ballcap_t *)malloc(sizeof(ballcap_t));
+    ret = (ballcap_t *)hatrack_malloc(sizeof(ballcap_t));
 
     ballcap_init(ret);
 
@@ -84,7 +84,7 @@ ballcap_new_size(char size)
 {
     ballcap_t *ret;
 
-    ret = (ballcap_t *)malloc(sizeof(ballcap_t));
+    ret = (ballcap_t *)hatrack_malloc(sizeof(ballcap_t));
 
     ballcap_init_size(ret, size);
 
@@ -150,7 +150,7 @@ void
 ballcap_delete(ballcap_t *self)
 {
     ballcap_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(ballcap_t));
 
     return;
 }
@@ -268,7 +268,7 @@ ballcap_view(ballcap_t *self, uint64_t *num, bool sort)
     store     = self->store_current;
     last_slot = store->last_slot;
     alloc_len = sizeof(hatrack_view_t) * (last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = store->buckets;
     end       = cur + (last_slot + 1);
@@ -320,13 +320,13 @@ ballcap_view(ballcap_t *self, uint64_t *num, bool sort)
     *num = count;
 
     if (!count) {
-        free(view);
+        hatrack_free(view, alloc_len);
         mmm_end_op();
 
         return NULL;
     }
 
-    view = (hatrack_view_t *)realloc(view, sizeof(hatrack_view_t) * count);
+    view = (hatrack_view_t *)hatrack_realloc(view, alloc_len, sizeof(hatrack_view_t) * count);
 
     if (sort) {
         qsort(view, count, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
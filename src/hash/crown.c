@@ -156,6 +156,14 @@
  *                     Note that our comments only document
  *                     differences from witchhat.
  *
+ *                  Once an item's neighborhood is full, we go back to
+ *                  linear probing, which has no useful bound when the
+ *                  hash values cluster.  Optionally, tables can bound
+ *                  their probes instead, by putting items that don't
+ *                  fit into a small stash; see
+ *                  crown_set_bounded_probes() and the comment above
+ *                  crown_probe_bounded().
+ *
  *  Author:         John Viega, john@zork.org
  *
  */
@@ -169,13 +177,22 @@
 static crown_store_t  *crown_store_migrate(crown_store_t *, crown_t *);
 static inline bool     crown_help_required(uint64_t);
 static inline bool     crown_need_to_help (crown_t *);
+static inline bool     crown_probe_bounded(crown_store_t *);
+static inline uint64_t crown_map_bits     (crown_store_t *);
+static inline bool     crown_take_stash_bit(crown_store_t *, hop_t *);
+static inline void     crown_set_map_bit  (crown_store_t *, crown_bucket_t *,
+					   uint64_t);
+static crown_bucket_t *crown_stash_find   (crown_store_t *, hatrack_hash_t);
+static crown_bucket_t *crown_stash_reserve(crown_store_t *, crown_bucket_t *,
+					   hatrack_hash_t, bool *);
+static crown_bucket_t *crown_store_place  (crown_store_t *, hatrack_hash_t);
 
 crown_t *
 crown_new(void)
 {
     crown_t *ret;
 
-    ret = (crown_t *)malloc(sizeof(crown_t));
+    ret = (crown_t *)hatrack_malloc(sizeof(crown_t));
 
     crown_init(ret);
 
@@ -187,7 +204,7 @@ crown_new_size(char size)
 {
     crown_t *ret;
 
-    ret = (crown_t *)malloc(sizeof(crown_t));
+    ret = (crown_t *)hatrack_malloc(sizeof(crown_t));
 
     crown_init_size(ret, size);
 
@@ -217,11 +234,14 @@ crown_init_size(crown_t *self, char size)
     }
 
     len              = 1 << size;
-    store            = crown_store_new(len);
+    store            = crown_store_new(len, NULL, 0);
     self->next_epoch = 1;
+    self->allocator  = NULL;
+    self->stash_len  = 0;
     
     atomic_store(&self->store_current, store);
-    atomic_store(&self->item_count, 0);
+    atomic_store(&self->help_needed, 0);
+    hatrack_shardctr_init(&self->item_count, 0);
 
     return;
 }
@@ -238,11 +258,70 @@ void
 crown_delete(crown_t *self)
 {
     crown_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(crown_t));
+
+    return;
+}
+
+/* Stores (and anything else the table allocates through mmm) come
+ * from this allocator from now on. NULL means the global one.  This
+ * has to happen before the table is shared, and while it's empty;
+ * we just swap out the initial store for one of the same size.
+ */
+void
+crown_set_allocator(crown_t *self, hatrack_allocator_t *allocator)
+{
+    crown_store_t *store;
+
+    if (crown_len(self)) {
+	abort();
+    }
+
+    store           = atomic_load(&self->store_current);
+    self->allocator = allocator;
+
+    atomic_store(&self->store_current,
+		 crown_store_new(store->last_slot + 1,
+				 allocator,
+				 self->stash_len));
+    mmm_retire_unused(store);
+
+    return;
+}
+
+/* Turns bounded probes on or off. When they're on, an item that
+ * can't get a bucket in its neighborhood goes into the stash, instead
+ * of however far linear probing would take it, so that lookups never
+ * look at more than the neighborhood plus the stash.  The same rules
+ * apply as for crown_set_allocator().
+ */
+void
+crown_set_bounded_probes(crown_t *self, bool value)
+{
+    crown_store_t *store;
+
+    if (crown_len(self)) {
+	abort();
+    }
+
+    store           = atomic_load(&self->store_current);
+    self->stash_len = value ? HATRACK_CROWN_STASH_SIZE : 0;
+
+    atomic_store(&self->store_current,
+		 crown_store_new(store->last_slot + 1,
+				 self->allocator,
+				 self->stash_len));
+    mmm_retire_unused(store);
 
     return;
 }
 
+bool
+crown_get_bounded_probes(crown_t *self)
+{
+    return self->stash_len != 0;
+}
+
 void *
 crown_get(crown_t *self, hatrack_hash_t hv, bool *found)
 {
@@ -326,7 +405,14 @@ crown_remove(crown_t *self, hatrack_hash_t hv, bool *found)
 uint64_t
 crown_len(crown_t *self)
 {
-    return atomic_read(&self->item_count);
+    return hatrack_shardctr_read(&self->item_count);
+}
+
+// See hatrack_shardctr_read_approx() for how far off this can be.
+uint64_t
+crown_len_approx(crown_t *self)
+{
+    return hatrack_shardctr_read_approx(&self->item_count);
 }
 
 hatrack_view_t *
@@ -359,11 +445,12 @@ crown_view_fast(crown_t *self, uint64_t *num, bool sort)
     crown_store_t  *store;
 
     store     = atomic_read(&self->store_current);
-    alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1
+					  + store->stash_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = store->buckets;
-    end       = cur + (store->last_slot + 1);
+    end       = cur + (store->last_slot + 1 + store->stash_len);
 
     while (cur < end) {
         record        = atomic_read(&cur->record);
@@ -384,12 +471,12 @@ crown_view_fast(crown_t *self, uint64_t *num, bool sort)
     *num      = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, alloc_len);
 	
         return NULL;
     }
 
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, alloc_len, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
 	qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
@@ -399,6 +486,34 @@ crown_view_fast(crown_t *self, uint64_t *num, bool sort)
 }
 
 
+/* Claims the current store, so that it doesn't get retired out from
+ * under us, then migrates out of it, so that its contents stop
+ * changing.  The caller can then read the buckets directly, but has
+ * to mmm_retire() the store when done.
+ *
+ * Must be called inside an mmm operation.
+ */
+crown_store_t *
+crown_store_claim(crown_t *self)
+{
+    crown_store_t *store;
+    bool           expected;
+
+    while (true) {
+	store    = atomic_read(&self->store_current);
+	expected = false;
+
+	if (CAS(&store->claimed, &expected, true)) {
+	    break;
+	}
+	crown_store_migrate(store, self);
+    }
+
+    crown_store_migrate(store, self);
+
+    return store;
+}
+
 /* This is modified to copy the store first, ensuring a consistent view.
  * But it's much slower, since we're doing a LOT of extra work.
  *
@@ -418,25 +533,14 @@ crown_view_slow(crown_t *self, uint64_t *num, bool sort)
     uint64_t        num_items;
     uint64_t        alloc_len;
     crown_store_t  *store;
-    bool            expected;
-
-    while (true) {
-	store    = atomic_read(&self->store_current);
-	expected = false;
-
-	if (CAS(&store->claimed, &expected, true)) {
-	    break;
-	}
-	crown_store_migrate(store, self);
-    }
-
-    crown_store_migrate(store, self);
 
-    alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    store     = crown_store_claim(self);
+    alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1
+					  + store->stash_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = store->buckets;
-    end       = cur + (store->last_slot + 1);
+    end       = cur + (store->last_slot + 1 + store->stash_len);
 
     while (cur < end) {
         record        = atomic_read(&cur->record);
@@ -457,12 +561,12 @@ crown_view_slow(crown_t *self, uint64_t *num, bool sort)
     *num      = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, alloc_len);
 	
         return NULL;
     }
 
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, alloc_len, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
 	qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
@@ -473,17 +577,32 @@ crown_view_slow(crown_t *self, uint64_t *num, bool sort)
     return view;
 }
 
+/* The stash, if there is one, is stash_len buckets tacked onto the
+ * end of the regular ones.
+ */
 crown_store_t *
-crown_store_new(uint64_t size)
+crown_store_new(uint64_t             size,
+		hatrack_allocator_t *allocator,
+		uint64_t             stash_len)
 {
     crown_store_t *store;
     uint64_t       alloc_len;
+    uint64_t       threshold;
 
-    alloc_len = sizeof(crown_store_t) + sizeof(crown_bucket_t) * size;
-    store     = (crown_store_t *)mmm_alloc_committed(alloc_len);
+    threshold = hatrack_compute_table_threshold(size);
+    alloc_len = sizeof(crown_store_t)
+	+ sizeof(crown_bucket_t) * (size + stash_len);
+    alloc_len += hatrack_budget_alloc_len(threshold);
+    store     = (crown_store_t *)mmm_alloc_committed_with(allocator,
+							 alloc_len);
 
     store->last_slot  = size - 1;
-    store->threshold  = hatrack_compute_table_threshold(size);
+    store->threshold  = threshold;
+    store->stash_len  = stash_len;
+
+    if (hatrack_budget_alloc_len(threshold)) {
+	store->budget = (hatrack_shard_t *)&store->buckets[size + stash_len];
+    }
 
     return store;
 }
@@ -497,6 +616,7 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
     crown_bucket_t *bucket;
     crown_record_t  record;
     hop_t           map;
+    bool            stashed;
 
     /* Once we get the index of our initial bucket, the first thing
      * we're going to do is load up the "neighborhood map". If there
@@ -509,10 +629,14 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
      * Note that we set i = -1 here (actually, MAXINT, but C doesn't
      * care), for reasons that should become clear after the first
      * loop.
+     *
+     * With bounded probes, the last bit of the map says whether to
+     * check the stash, so we take it out before we start.
      */
-    bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
-    i   = -1;
+    bix     = hatrack_bucket_index(hv1, self->last_slot);
+    map     = atomic_read(&self->buckets[bix].neighbor_map);
+    stashed = crown_take_stash_bit(self, &map);
+    i       = -1;
 
     /* CLZ stands for "count leading zeros."  
      * 
@@ -528,16 +652,7 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
 	hv2    = atomic_read(&bucket->hv);
 
 	if (hatrack_hashes_eq(hv1, hv2)) {
-	    record = atomic_read(&bucket->record);
-	    if (record.info & CROWN_EPOCH_MASK) {
-		if (found) {
-		    *found = true;
-		}
-		return record.item;
-	    }
-	    else {
-		goto not_found;
-	    }
+	    goto found_bucket;
 	}
 
 	/* If the entry we just looked at was some other entry, we need
@@ -555,6 +670,21 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
 	map &= ~(CROWN_HOME_BIT >> i);
     }
 
+    /* With bounded probes, the only other place the item can be is
+     * the stash, unless the store overflowed.
+     */
+    if (stashed) {
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    if (crown_probe_bounded(self)) {
+	goto not_found;
+    }
+
     /* If we get here, we exhausted our linear probe result cache, and
      * none of the cached items had the right hash value. Therefore,
      * we need to fall back on good ol' fashioned linear probing.
@@ -604,16 +734,7 @@ crown_store_get(crown_store_t *self, hatrack_hash_t hv1, bool *found)
             continue;
         }
 
-        record = atomic_read(&bucket->record);
-	
-        if (record.info & CROWN_EPOCH_MASK) {
-            if (found) {
-                *found = true;
-            }
-	    
-            return record.item;
-        }
-        break;
+	goto found_bucket;
     }
 
 not_found:
@@ -622,6 +743,19 @@ not_found:
     }
  
     return NULL;
+
+found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (!(record.info & CROWN_EPOCH_MASK)) {
+	goto not_found;
+    }
+
+    if (found) {
+	*found = true;
+    }
+
+    return record.item;
 }
 
 /* Our put operation is a little more challenging than most of our
@@ -661,16 +795,18 @@ crown_store_put(crown_store_t  *self,
 {
     void           *old_item;
     bool            new_item;
+    bool            bounded;
+    bool            stashed;
+    bool            claimed;
     uint64_t        bix;
     uint64_t        i;
+    uint64_t        limit;
     hatrack_hash_t  hv2;
     crown_bucket_t *bucket;
     crown_bucket_t *orig_bucket;
     crown_record_t  record;
     crown_record_t  candidate;
     hop_t           map;
-    hop_t           new_map;
-    hop_t           bit_to_set;
     
 #ifndef HATRACK_FULL_LINEAR_PROBES
     uint64_t        orig_index;
@@ -678,6 +814,7 @@ crown_store_put(crown_store_t  *self,
 
     bix         = hatrack_bucket_index(hv1, self->last_slot);
     orig_bucket = &self->buckets[bix];
+    bounded     = crown_probe_bounded(self);
 
 #ifndef HATRACK_FULL_LINEAR_PROBES
     /* When we're not linear probing, we first iterate through the
@@ -688,6 +825,7 @@ crown_store_put(crown_store_t  *self,
      */
     i          = -1;
     map        = atomic_read(&orig_bucket->neighbor_map);
+    stashed    = crown_take_stash_bit(self, &map);
     orig_index = bix;
 
     while (map) {
@@ -706,31 +844,56 @@ crown_store_put(crown_store_t  *self,
     bix = (bix + i) & self->last_slot;
     
 #else
-    i = 0;
+    i       = 0;
+    map     = atomic_read(&orig_bucket->neighbor_map);
+    stashed = crown_take_stash_bit(self, &map);
 #endif    
 
-    for (; i <= self->last_slot; i++) {
+    /* If the stash bit is set, the neighborhood is full, so with
+     * bounded probes, the stash is the only place left to look (or to
+     * put the item).  Otherwise, the stash has to be checked before
+     * falling back to linear probing.
+     */
+    if (stashed) {
+	if (bounded) {
+	    goto use_stash;
+	}
+
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    limit = bounded ? CROWN_NEIGHBORHOOD : self->last_slot + 1;
+
+    for (; i < limit; i++) {
         bucket = &self->buckets[bix];
 	hv2    = atomic_read(&bucket->hv);
 	
 	if (hatrack_bucket_unreserved(hv2)) {
 	    if (CAS(&bucket->hv, &hv2, hv1)) {
-		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		if (hatrack_budget_claim(self->budget,
+					 &self->used_count,
+					 self->threshold)) {
 		    goto migrate_and_retry;
 		}
 
-		map        = atomic_read(&orig_bucket->neighbor_map);
-		bit_to_set = CROWN_HOME_BIT >> i;
-		
-		do {
-		    new_map = map | bit_to_set;
-		} while (!CAS(&orig_bucket->neighbor_map, &map, new_map));
+		crown_set_map_bit(self, orig_bucket, i);
 		
 		goto found_bucket;
 	    }
 	}
 	
+	/* The thread that reserved this bucket may not have set its
+	 * bit in the map yet.  Lookups with bounded probes only go by
+	 * the map, so we make sure it's set before our write can
+	 * land.
+	 */
 	if (hatrack_hashes_eq(hv1, hv2)) {
+	    crown_set_map_bit(self, orig_bucket, i);
+	    
 	    goto found_bucket;
 	}
 
@@ -749,19 +912,36 @@ crown_store_put(crown_store_t  *self,
 	 * eliminate the chance of a race condition.
 	 */
 	if (hatrack_bucket_index(hv2, self->last_slot) == orig_index) {
-	    map        = atomic_read(&orig_bucket->neighbor_map);
-	    bit_to_set = CROWN_HOME_BIT >> i;
-	    
-	    while (!(map & bit_to_set)) {
-		new_map = map | bit_to_set;
-		CAS(&orig_bucket->neighbor_map, &map, new_map);
-	    }
+	    crown_set_map_bit(self, orig_bucket, i);
 	}
 #endif	
 	
 	bix = (bix + 1) & self->last_slot;
 	continue;
     }
+
+    if (!bounded) {
+	goto migrate_and_retry;
+    }
+
+    /* The neighborhood is full.  If the stash is too, the store needs
+     * to grow.
+     */
+ use_stash:
+    bucket = crown_stash_reserve(self, orig_bucket, hv1, &claimed);
+
+    if (!bucket) {
+	atomic_store(&self->stash_full, true);
+	goto migrate_and_retry;
+    }
+
+    if (claimed && hatrack_budget_claim(self->budget,
+					&self->used_count,
+					self->threshold)) {
+	goto migrate_and_retry;
+    }
+
+    goto found_bucket;
 	    
     // The rest of this operation is identical to Witchhat.    
  migrate_and_retry:
@@ -812,7 +992,7 @@ crown_store_put(crown_store_t  *self,
 
     if (CAS(&bucket->record, &record, candidate)) {
         if (new_item) {
-            atomic_fetch_add(&top->item_count, 1);
+            hatrack_shardctr_add(&top->item_count, 1);
         }
 	
         return old_item;
@@ -847,10 +1027,12 @@ crown_store_replace(crown_store_t    *self,
     crown_record_t  record;
     crown_record_t  candidate;
     hop_t           map;    
+    bool            stashed;
 
-    bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
-    i   = -1;
+    bix     = hatrack_bucket_index(hv1, self->last_slot);
+    map     = atomic_read(&self->buckets[bix].neighbor_map);
+    stashed = crown_take_stash_bit(self, &map);
+    i       = -1;
 
     /* Since replace never acquires a bucket, it is not subject to the
      * potential race condition that the put and add operations must
@@ -871,6 +1053,18 @@ crown_store_replace(crown_store_t    *self,
 	map &= ~(CROWN_HOME_BIT >> i);
     }
 
+    if (stashed) {
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    if (crown_probe_bounded(self)) {
+	goto not_found;
+    }
+
     i++;
     bix = (bix + i) & self->last_slot;
     
@@ -959,16 +1153,18 @@ crown_store_add(crown_store_t    *self,
 		   void          *item,
 		   uint64_t       count)
 {
+    bool            bounded;
+    bool            stashed;
+    bool            claimed;
     uint64_t        bix;
     uint64_t        i;
+    uint64_t        limit;
     hatrack_hash_t  hv2;
     crown_bucket_t *bucket;
     crown_bucket_t *orig_bucket;    
     crown_record_t  record;
     crown_record_t  candidate;
     hop_t           map;
-    hop_t           new_map;
-    hop_t           bit_to_set;
     
 #ifndef HATRACK_FULL_LINEAR_PROBES
     uint64_t        orig_index;
@@ -976,10 +1172,12 @@ crown_store_add(crown_store_t    *self,
 
     bix = hatrack_bucket_index(hv1, self->last_slot);
     orig_bucket = &self->buckets[bix];
+    bounded     = crown_probe_bounded(self);
 
 #ifndef HATRACK_FULL_LINEAR_PROBES
     i          = -1;
     map        = atomic_read(&orig_bucket->neighbor_map);
+    stashed    = crown_take_stash_bit(self, &map);
     orig_index = bix;
 
     while (map) {
@@ -998,43 +1196,52 @@ crown_store_add(crown_store_t    *self,
     bix = (bix + i) & self->last_slot;
     
 #else
-    i = 0;
+    i       = 0;
+    map     = atomic_read(&orig_bucket->neighbor_map);
+    stashed = crown_take_stash_bit(self, &map);
 #endif
+
+    if (stashed) {
+	if (bounded) {
+	    goto use_stash;
+	}
+
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    limit = bounded ? CROWN_NEIGHBORHOOD : self->last_slot + 1;
     
-    for (; i <= self->last_slot; i++) {
+    for (; i < limit; i++) {
         bucket = &self->buckets[bix];
 	hv2    = atomic_read(&bucket->hv);
 	
 	if (hatrack_bucket_unreserved(hv2)) {
 	    if (CAS(&bucket->hv, &hv2, hv1)) {
-		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		if (hatrack_budget_claim(self->budget,
+					 &self->used_count,
+					 self->threshold)) {
 		    goto migrate_and_retry;
 		}
 		
-		map        = atomic_read(&orig_bucket->neighbor_map);
-		bit_to_set = CROWN_HOME_BIT >> i;
-		
-		do {
-		    new_map = map | bit_to_set;
-		} while (!CAS(&orig_bucket->neighbor_map, &map, new_map));
+		crown_set_map_bit(self, orig_bucket, i);
 		
 		goto found_bucket;
 	    }
 	}
 	
 	if (hatrack_hashes_eq(hv1, hv2)) {
+	    crown_set_map_bit(self, orig_bucket, i);
+	    
 	    goto found_bucket;
 	}
 
 #ifndef HATRACK_FULL_LINEAR_PROBES	
 	if (hatrack_bucket_index(hv2, self->last_slot) == orig_index) {
-	    map = atomic_read(&orig_bucket->neighbor_map);
-	    bit_to_set = CROWN_HOME_BIT >> i;
-	    
-	    while (!(map & bit_to_set)) {
-		new_map = map | bit_to_set;
-		CAS(&orig_bucket->neighbor_map, &map, new_map);
-	    }
+	    crown_set_map_bit(self, orig_bucket, i);
 	}
 #endif	
 
@@ -1042,6 +1249,26 @@ crown_store_add(crown_store_t    *self,
 	continue;
     }
 
+    if (!bounded) {
+	goto migrate_and_retry;
+    }
+
+ use_stash:
+    bucket = crown_stash_reserve(self, orig_bucket, hv1, &claimed);
+
+    if (!bucket) {
+	atomic_store(&self->stash_full, true);
+	goto migrate_and_retry;
+    }
+
+    if (claimed && hatrack_budget_claim(self->budget,
+					&self->used_count,
+					self->threshold)) {
+	goto migrate_and_retry;
+    }
+
+    goto found_bucket;
+
  migrate_and_retry:
     count = count + 1;
     if (crown_help_required(count)) {
@@ -1076,7 +1303,7 @@ found_bucket:
     candidate.info = CROWN_F_INITED | top->next_epoch++;
 
     if (CAS(&bucket->record, &record, candidate)) {
-	atomic_fetch_add(&top->item_count, 1);
+	hatrack_shardctr_add(&top->item_count, 1);
         return true;
     }
     
@@ -1103,14 +1330,16 @@ crown_store_remove(crown_store_t *self,
     uint64_t        bix;
     uint64_t        i;
     hop_t           map;
+    bool            stashed;
     hatrack_hash_t  hv2;
     crown_bucket_t *bucket;
     crown_record_t  record;
     crown_record_t  candidate;
 
-    bix = hatrack_bucket_index(hv1, self->last_slot);
-    map = atomic_read(&self->buckets[bix].neighbor_map);
-    i   = -1;
+    bix     = hatrack_bucket_index(hv1, self->last_slot);
+    map     = atomic_read(&self->buckets[bix].neighbor_map);
+    stashed = crown_take_stash_bit(self, &map);
+    i       = -1;
 
     while (map) {
 	i      = CLZ(map);
@@ -1124,6 +1353,18 @@ crown_store_remove(crown_store_t *self,
 	map &= ~(CROWN_HOME_BIT >> i);
     }
 
+    if (stashed) {
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    if (crown_probe_bounded(self)) {
+	goto not_found;
+    }
+
     i++;
     bix = (bix + i) & self->last_slot;
     
@@ -1178,7 +1419,7 @@ found_bucket:
     candidate.info = CROWN_F_INITED;
 
     if (CAS(&bucket->record, &record, candidate)) {
-        atomic_fetch_sub(&top->item_count, 1);
+        hatrack_shardctr_add(&top->item_count, -1);
 
         if (found) {
             *found = true;
@@ -1198,212 +1439,1163 @@ found_bucket:
     goto not_found;
 }
 
-/* Often when we migrate, we are growing the table. This probing
- * technique is less excellent the more sparsely populated the table
- * is.
- * 
- * So, it stands to reason that linear probing could be better, at
- * least for the early part of the migration.
- *
- * Here, we use a preprocessor macro to control whether or not we
- * should use the caches in the new table's buckets, or not:
- * HATRACK_SKIP_ON_MIGRATIONS (skip in the sense of use the cache to
- * skip probing we can safely avoid).
- *
- * We do NOT have a dynamic option here. And, we control it seprately
- * from the similar macro above... particularly because we currently
- * default to having put / add use the cache, but migrate go without.
- *
- * Note that the migration operation does NOT suffer from the race
- * condition we discuss up at the front. That's because our migrations
- * consists of a deterministic set of operations on the new table,
- * that are all guaranteed to happen in-order.  
+/* This is a compare-and-swap on the item stored for a hash value,
+ * which the hatrack_dict multi-key operations are built on.  A NULL
+ * item means "not in the table", for either the expected or the new
+ * item.  So, if expected is NULL, this is an add; if item is NULL,
+ * it's a remove; otherwise it's a replace that only succeeds if the
+ * current item is the expected one.
  *
- * ALL threads that write to the new store during migration will be
- * trying to write the exact same things in the exact same order.
+ * Since it may need to acquire a bucket, the probing is the same as
+ * in the put operation (using the cache, and helping to keep it up to
+ * date), except that we don't acquire a bucket unless we're adding.
  */
-static crown_store_t *
-crown_store_migrate(crown_store_t *self, crown_t *top)
+bool
+crown_store_cas(crown_store_t *self,
+		crown_t       *top,
+		hatrack_hash_t hv1,
+		void          *expected,
+		void          *item,
+		uint64_t       count)
 {
-    crown_store_t  *new_store;
-    crown_store_t  *candidate_store;
-    uint64_t        new_size;
+    bool            ret;
+    bool            found;
+    bool            bounded;
+    bool            stashed;
+    bool            claimed;
+    uint64_t        bix;
+    uint64_t        i;
+    uint64_t        limit;
+    hatrack_hash_t  hv2;
     crown_bucket_t *bucket;
-    crown_bucket_t *new_bucket;
-    crown_bucket_t *map_bucket;
+    crown_bucket_t *orig_bucket;
     crown_record_t  record;
-    crown_record_t  candidate_record;
-    crown_record_t  expected_record;
-    hatrack_hash_t  expected_hv;
-    hatrack_hash_t  hv;
-    uint64_t        i, j;
-    uint64_t        bix;
-    uint64_t        new_used;
-    uint64_t        expected_used;
+    crown_record_t  candidate;
+    void           *cur_item;
     hop_t           map;
-    hop_t           new_map;
+    uint64_t        orig_index;
 
-#ifdef HATRACK_SKIP_ON_MIGRATIONS
-    uint64_t        original_bix;
-#endif    
+    if (!expected && !item) {
+	crown_store_get(self, hv1, &found);
 
-    new_used  = 0;
-    new_store = atomic_read(&top->store_current);
-    
-    if (new_store != self) {
-	return new_store;
+	return !found;
     }
 
-    for (i = 0; i <= self->last_slot; i++) {
-        bucket                = &self->buckets[i];
-        record                = atomic_read(&bucket->record);
-        candidate_record.item = record.item;
+    bix         = hatrack_bucket_index(hv1, self->last_slot);
+    orig_bucket = &self->buckets[bix];
+    bounded     = crown_probe_bounded(self);
+    i           = -1;
+    map         = atomic_read(&orig_bucket->neighbor_map);
+    stashed     = crown_take_stash_bit(self, &map);
+    orig_index  = bix;
 
-	if (record.info & CROWN_F_MOVING) {
-	    
-	    if (record.info & CROWN_EPOCH_MASK) {
-		new_used++;
-	    }
-	    continue;
+    while (map) {
+	i      = CLZ(map);
+	bucket = &self->buckets[(bix + i) & self->last_slot];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    goto found_bucket;
 	}
-	    
-	OR2X64L(&bucket->record, CROWN_F_MOVING);
 
-	record = atomic_read(&bucket->record);
+	map &= ~(CROWN_HOME_BIT >> i);
+    }
 
-	if (record.info & CROWN_EPOCH_MASK) {
-	    new_used++;
-	} else {
-	    OR2X64L(&bucket->record, CROWN_F_MOVED); 
+    if (stashed) {
+	if (bounded) {
+	    goto use_stash;
 	}
-    }
 
-    new_store = atomic_read(&self->store_next);
+	bucket = crown_stash_find(self, hv1);
 
-    if (!new_store) {
-	if (crown_need_to_help(top)) {
-	    new_size = (self->last_slot + 1) << 1;
+	if (bucket) {
+	    goto found_bucket;
+	}
+    }
+
+    i++;
+    bix   = (bix + i) & self->last_slot;
+    limit = bounded ? CROWN_NEIGHBORHOOD : self->last_slot + 1;
+
+    for (; i < limit; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    if (expected) {
+		return false;
+	    }
+
+	    if (CAS(&bucket->hv, &hv2, hv1)) {
+		if (hatrack_budget_claim(self->budget,
+					 &self->used_count,
+					 self->threshold)) {
+		    goto migrate_and_retry;
+		}
+
+		crown_set_map_bit(self, orig_bucket, i);
+
+		goto found_bucket;
+	    }
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    crown_set_map_bit(self, orig_bucket, i);
+
+	    goto found_bucket;
+	}
+
+	if (hatrack_bucket_index(hv2, self->last_slot) == orig_index) {
+	    crown_set_map_bit(self, orig_bucket, i);
+	}
+
+	bix = (bix + 1) & self->last_slot;
+	continue;
+    }
+
+    if (!bounded) {
+	goto migrate_and_retry;
+    }
+
+ use_stash:
+    if (expected) {
+	bucket = crown_stash_find(self, hv1);
+
+	if (!bucket) {
+	    return false;
+	}
+
+	goto found_bucket;
+    }
+
+    bucket = crown_stash_reserve(self, orig_bucket, hv1, &claimed);
+
+    if (!bucket) {
+	atomic_store(&self->stash_full, true);
+	goto migrate_and_retry;
+    }
+
+    if (claimed && hatrack_budget_claim(self->budget,
+					&self->used_count,
+					self->threshold)) {
+	goto migrate_and_retry;
+    }
+
+    goto found_bucket;
+
+ migrate_and_retry:
+    count = count + 1;
+
+    if (crown_help_required(count)) {
+	HATRACK_CTR(HATRACK_CTR_WH_HELP_REQUESTS);
+
+	atomic_fetch_add(&top->help_needed, 1);
+
+	self = crown_store_migrate(self, top);
+	ret  = crown_store_cas(self, top, hv1, expected, item, count);
+
+	atomic_fetch_sub(&top->help_needed, 1);
+
+	return ret;
+    }
+
+    self = crown_store_migrate(self, top);
+    return crown_store_cas(self, top, hv1, expected, item, count);
+
+ found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (record.info & CROWN_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    if (record.info & CROWN_EPOCH_MASK) {
+	cur_item = record.item;
+    }
+    else {
+	cur_item = NULL;
+    }
+
+    if (cur_item != expected) {
+	return false;
+    }
+
+    candidate.item = item;
+
+    if (!item) {
+	candidate.info = CROWN_F_INITED;
+    }
+    else {
+	if (expected) {
+	    candidate.info = record.info;
+	}
+	else {
+	    candidate.info = CROWN_F_INITED | top->next_epoch++;
+	}
+    }
+
+    if (!CAS(&bucket->record, &record, candidate)) {
+	if (record.info & CROWN_F_MOVING) {
+	    goto migrate_and_retry;
+	}
+
+	return false;
+    }
+
+    if (!expected) {
+	hatrack_shardctr_add(&top->item_count, 1);
+    }
+    else {
+	if (!item) {
+	    hatrack_shardctr_add(&top->item_count, -1);
+	}
+
+	if (atomic_read(&self->used_count) >= self->threshold) {
+	    crown_store_migrate(self, top);
+	}
+    }
+
+    return true;
+}
+
+/* Calls func on every item whose hash position (see
+ * hatrack_hash_position()) is in the inclusive range [lo, hi],
+ * passing the hash value, the item and arg.
+ *
+ * For a table with 2^n buckets, the items that hash to bucket b all
+ * have positions whose top n bits are b's n bits reversed, so we only
+ * look at the buckets whose reversed index is in range, and probe
+ * from each the same way get does (the neighborhood map first, then
+ * linear probing until we hit an empty bucket).  Only the buckets at
+ * the ends of the range can hold items outside of it.  If the store
+ * has an overflow stash, we check it once at the end, since items in
+ * it can belong to any bucket.
+ *
+ * If a migration is in progress when we start, we help finish it
+ * and scan the new store.  If one starts while we're scanning, we
+ * keep going in the store we have; its items are all still there.
+ * Like the fast views, this isn't a consistent snapshot: items added
+ * or removed while we're scanning may or may not be seen.
+ *
+ * Must be called inside an mmm operation.
+ */
+void
+crown_store_scan(crown_store_t    *self,
+		 crown_t          *top,
+		 uint64_t          lo,
+		 uint64_t          hi,
+		 crown_scan_func_t func,
+		 void             *arg)
+{
+    uint64_t        shift;
+    uint64_t        r;
+    uint64_t        last_r;
+    uint64_t        home;
+    uint64_t        bix;
+    uint64_t        i;
+    uint64_t        position;
+    hatrack_hash_t  hv;
+    crown_bucket_t *bucket;
+    crown_record_t  record;
+    hop_t           map;
+
+    if (lo > hi) {
+	return;
+    }
+
+    if (atomic_read(&self->store_next)) {
+	self = crown_store_migrate(self, top);
+    }
+
+    shift  = 64 - __builtin_popcountll(self->last_slot);
+    r      = lo >> shift;
+    last_r = hi >> shift;
+
+    while (true) {
+	home = hatrack_bit_reverse64(r << shift);
+	map  = atomic_read(&self->buckets[home].neighbor_map);
+	i    = -1;
+
+	crown_take_stash_bit(self, &map);
+
+	while (map) {
+	    i      = CLZ(map);
+	    map   &= ~(CROWN_HOME_BIT >> i);
+	    bucket = &self->buckets[(home + i) & self->last_slot];
+	    hv     = atomic_read(&bucket->hv);
+
+	    if (hatrack_bucket_index(hv, self->last_slot) != home) {
+		continue;
+	    }
+
+	    position = hatrack_hash_position(hv);
+
+	    if (position < lo || position > hi) {
+		continue;
+	    }
+
+	    record = atomic_read(&bucket->record);
+
+	    if (record.info & CROWN_EPOCH_MASK) {
+		(*func)(hv, record.item, arg);
+	    }
+	}
+
+	i++;
+	bix = (home + i) & self->last_slot;
+
+	for (; i <= self->last_slot; i++) {
+	    bucket = &self->buckets[bix];
+	    hv     = atomic_read(&bucket->hv);
+
+	    if (hatrack_bucket_unreserved(hv)) {
+		break;
+	    }
+
+	    bix = (bix + 1) & self->last_slot;
+
+	    if (hatrack_bucket_index(hv, self->last_slot) != home) {
+		continue;
+	    }
+
+	    position = hatrack_hash_position(hv);
+
+	    if (position < lo || position > hi) {
+		continue;
+	    }
+
+	    record = atomic_read(&bucket->record);
+
+	    if (record.info & CROWN_EPOCH_MASK) {
+		(*func)(hv, record.item, arg);
+	    }
+	}
+
+	if (r == last_r) {
+	    break;
+	}
+
+	r++;
+    }
+
+    bucket = &self->buckets[self->last_slot + 1];
+
+    for (i = 0; i < self->stash_len; i++, bucket++) {
+	hv = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv)) {
+	    break;
+	}
+
+	position = hatrack_hash_position(hv);
+
+	if (position < lo || position > hi) {
+	    continue;
+	}
+
+	record = atomic_read(&bucket->record);
+
+	if (record.info & CROWN_EPOCH_MASK) {
+	    (*func)(hv, record.item, arg);
+	}
+    }
+
+    return;
+}
+
+/* Often when we migrate, we are growing the table. This probing
+ * technique is less excellent the more sparsely populated the table
+ * is.
+ * 
+ * So, it stands to reason that linear probing could be better, at
+ * least for the early part of the migration.
+ *
+ * Here, we use a preprocessor macro to control whether or not we
+ * should use the caches in the new table's buckets, or not:
+ * HATRACK_SKIP_ON_MIGRATIONS (skip in the sense of use the cache to
+ * skip probing we can safely avoid).
+ *
+ * We do NOT have a dynamic option here. And, we control it seprately
+ * from the similar macro above... particularly because we currently
+ * default to having put / add use the cache, but migrate go without.
+ *
+ * Note that the migration operation does NOT suffer from the race
+ * condition we discuss up at the front. That's because our migrations
+ * consists of a deterministic set of operations on the new table,
+ * that are all guaranteed to happen in-order.  
+ *
+ * ALL threads that write to the new store during migration will be
+ * trying to write the exact same things in the exact same order.
+ */
+static crown_store_t *
+crown_store_migrate(crown_store_t *self, crown_t *top)
+{
+    crown_store_t  *new_store;
+    crown_store_t  *candidate_store;
+    uint64_t        new_size;
+    crown_bucket_t *bucket;
+    crown_bucket_t *new_bucket;
+    crown_record_t  record;
+    crown_record_t  candidate_record;
+    crown_record_t  expected_record;
+    hatrack_hash_t  hv;
+    uint64_t        i;
+    uint64_t        end;
+    uint64_t        new_used;
+    uint64_t        expected_used;
+
+    new_used  = 0;
+    new_store = atomic_read(&top->store_current);
+    
+    if (new_store != self) {
+	return new_store;
+    }
+
+    end = self->last_slot + self->stash_len;
+
+    for (i = 0; i <= end; i++) {
+        bucket                = &self->buckets[i];
+        record                = atomic_read(&bucket->record);
+        candidate_record.item = record.item;
+
+	if (record.info & CROWN_F_MOVING) {
+	    
+	    if (record.info & CROWN_EPOCH_MASK) {
+		new_used++;
+	    }
+	    continue;
+	}
+	    
+	OR2X64L(&bucket->record, CROWN_F_MOVING);
+
+	record = atomic_read(&bucket->record);
+
+	if (record.info & CROWN_EPOCH_MASK) {
+	    new_used++;
+	} else {
+	    OR2X64L(&bucket->record, CROWN_F_MOVED); 
+	}
+    }
+
+    new_store = atomic_read(&self->store_next);
+
+    if (!new_store) {
+	if (crown_need_to_help(top) || atomic_read(&self->stash_full)) {
+	    new_size = (self->last_slot + 1) << 1;
+	}
+	else {
+	    new_size        = hatrack_new_size(self->last_slot, new_used);
+	}
+	
+        candidate_store = crown_store_new(new_size,
+					  top->allocator,
+					  self->stash_len);
+	
+        if (!CAS(&self->store_next, &new_store, candidate_store)) {
+            mmm_retire_unused(candidate_store);
+        }
+        else {
+            new_store = candidate_store;
+        }
+    }
+
+    hatrack_prefault(new_store->buckets,
+		     sizeof(crown_bucket_t) * (new_store->last_slot + 1),
+		     &new_store->prefault);
+
+    for (i = 0; i <= end; i++) {
+        bucket = &self->buckets[i];
+        record = atomic_read(&bucket->record);
+
+        if (record.info & CROWN_F_MOVED) {
+            continue;
+        }
+
+        hv         = atomic_read(&bucket->hv);
+	new_bucket = crown_store_place(new_store, hv);
+
+        candidate_record.info = record.info & CROWN_EPOCH_MASK;
+        candidate_record.item = record.item;
+        expected_record.info  = 0;
+        expected_record.item  = NULL;
+
+        CAS(&new_bucket->record,
+	     &expected_record,
+	     candidate_record
+	   );
+
+	OR2X64L(&bucket->record, CROWN_F_MOVED);
+    }
+
+    expected_used = 0;
+    
+    CAS(&new_store->used_count,
+         &expected_used,
+         new_used
+       );
+
+    if (CAS(&top->store_current,
+	     &self,
+	     new_store
+	   )) {
+	if (!self->claimed) {
+	    mmm_retire(self);
+	}
+    }
+
+    return top->store_current;
+}
+
+static inline bool
+crown_help_required(uint64_t count)
+{
+    if (count == HATRACK_RETRY_THRESHOLD) {
+	return true;
+    }
+    
+    return false;
+}
+
+
+static inline bool
+crown_need_to_help(crown_t *self) {
+    return (bool)atomic_read(&self->help_needed);
+}
+
+/* Bounded probes.
+ *
+ * When a store has a stash, the lowest bit of each neighbor map is
+ * the stash bit, and the neighborhood is the other CROWN_NEIGHBORHOOD
+ * buckets.  An insert that can't find a spot in its neighborhood goes
+ * into the stash (first unreserved stash bucket, in order, so
+ * concurrent inserters of the same hash converge), and sets the
+ * stash bit in its home bucket.  Since every write that lands in the
+ * neighborhood sets its map bit before it goes on, a lookup only
+ * needs to check the map, plus the stash if the stash bit is set;
+ * it never probes linearly.
+ *
+ * Once the stash bit is set, the neighborhood is full for good (we
+ * never give up buckets until the next migration), so inserters can
+ * go right to the stash.
+ *
+ * When the stash fills up, we set stash_full and migrate, and the new
+ * store is twice the size.  Migration can't stop half way to grow
+ * again, so if a migration overflows the new store's stash, it sets
+ * overflowed on the new store, and places the rest of the items by
+ * linear probing, without map bits.  In an overflowed store, all
+ * operations probe linearly, just as if there were no bound; the new
+ * store has stash_full set too, so the next migration doubles.
+ */
+static inline bool
+crown_probe_bounded(crown_store_t *self)
+{
+    return self->stash_len && !atomic_read(&self->overflowed);
+}
+
+static inline uint64_t
+crown_map_bits(crown_store_t *self)
+{
+    return self->stash_len ? CROWN_NEIGHBORHOOD : CROWN_MAP_BITS;
+}
+
+static inline bool
+crown_take_stash_bit(crown_store_t *self, hop_t *map)
+{
+    bool ret;
+
+    if (!self->stash_len) {
+	return false;
+    }
+
+    ret   = (bool)(*map & CROWN_STASH_BIT);
+    *map &= ~CROWN_STASH_BIT;
+
+    return ret;
+}
+
+static inline void
+crown_set_map_bit(crown_store_t *self, crown_bucket_t *home, uint64_t i)
+{
+    hop_t bit;
+
+    if (i >= crown_map_bits(self)) {
+	return;
+    }
+
+    bit = CROWN_HOME_BIT >> i;
+
+    if (!(atomic_read(&home->neighbor_map) & bit)) {
+	atomic_fetch_or(&home->neighbor_map, bit);
+    }
+
+    return;
+}
+
+static crown_bucket_t *
+crown_stash_find(crown_store_t *self, hatrack_hash_t hv1)
+{
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    crown_bucket_t *bucket;
+
+    bucket = &self->buckets[self->last_slot + 1];
+
+    for (i = 0; i < self->stash_len; i++, bucket++) {
+	hv2 = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    return NULL;
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    return bucket;
+	}
+    }
+
+    return NULL;
+}
+
+/* Returns the stash bucket for hv1, claiming one if need be (in which
+ * case *claimed gets set), or NULL if the stash is full.
+ */
+static crown_bucket_t *
+crown_stash_reserve(crown_store_t  *self,
+		    crown_bucket_t *home,
+		    hatrack_hash_t  hv1,
+		    bool           *claimed)
+{
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    crown_bucket_t *bucket;
+
+    *claimed = false;
+    bucket   = &self->buckets[self->last_slot + 1];
+
+    for (i = 0; i < self->stash_len; i++, bucket++) {
+	hv2 = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    if (CAS(&bucket->hv, &hv2, hv1)) {
+		*claimed = true;
+		goto found_bucket;
+	    }
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    goto found_bucket;
+	}
+    }
+
+    return NULL;
+
+ found_bucket:
+    atomic_fetch_or(&home->neighbor_map, CROWN_STASH_BIT);
+
+    return bucket;
+}
+
+/* Finds or reserves the bucket for hv in a store we're migrating
+ * into.  All the helpers call this with the same hashes in the same
+ * order, so they all end up with the same answers.  We set the map
+ * bit even when someone else reserved the bucket, since bounded
+ * lookups won't find it otherwise, and that someone may not have
+ * gotten to it yet.
+ */
+static crown_bucket_t *
+crown_store_place(crown_store_t *self, hatrack_hash_t hv)
+{
+    uint64_t        bix;
+    uint64_t        j;
+    uint64_t        limit;
+    bool            claimed;
+    hatrack_hash_t  expected_hv;
+    crown_bucket_t *home;
+    crown_bucket_t *bucket;
+
+#ifdef HATRACK_SKIP_ON_MIGRATIONS
+    hop_t           map;
+#endif
+
+    bix  = hatrack_bucket_index(hv, self->last_slot);
+    home = &self->buckets[bix];
+
+#ifdef HATRACK_SKIP_ON_MIGRATIONS
+    map = atomic_read(&home->neighbor_map);
+    j   = -1;
+
+    crown_take_stash_bit(self, &map);
+
+    while (map) {
+	j           = CLZ(map);
+	bucket      = &self->buckets[(bix + j) & self->last_slot];
+	expected_hv = atomic_read(&bucket->hv);
+
+	if (hatrack_hashes_eq(hv, expected_hv)) {
+	    return bucket;
+	}
+
+	map &= ~(CROWN_HOME_BIT >> j);
+    }
+
+    j++;
+#else
+    j = 0;
+#endif
+
+    limit = self->stash_len ? CROWN_NEIGHBORHOOD : self->last_slot + 1;
+
+    for (; j < limit; j++) {
+	bucket      = &self->buckets[(bix + j) & self->last_slot];
+	expected_hv = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(expected_hv)) {
+	    CAS(&bucket->hv, &expected_hv, hv);
+	}
+
+	if (hatrack_bucket_unreserved(expected_hv)
+	    || hatrack_hashes_eq(expected_hv, hv)) {
+	    crown_set_map_bit(self, home, j);
+
+	    return bucket;
+	}
+    }
+
+    // Without a stash, we just probed the whole store, which is
+    // always big enough for everything we're moving.
+    if (!self->stash_len) {
+	abort();
+    }
+
+    bucket = crown_stash_reserve(self, home, hv, &claimed);
+
+    if (bucket) {
+	return bucket;
+    }
+
+    atomic_store(&self->overflowed, true);
+    atomic_store(&self->stash_full, true);
+
+    for (; j <= self->last_slot; j++) {
+	bucket      = &self->buckets[(bix + j) & self->last_slot];
+	expected_hv = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(expected_hv)) {
+	    CAS(&bucket->hv, &expected_hv, hv);
+	}
+
+	if (hatrack_bucket_unreserved(expected_hv)
+	    || hatrack_hashes_eq(expected_hv, hv)) {
+	    return bucket;
+	}
+    }
+
+    abort();
+}
+
+/* Exclusive access.
+ *
+ * Everything below assumes no other thread is touching the table, so
+ * we read and write buckets through plain (non-atomic) pointers,
+ * which keeps the compiler from going through the 128-bit atomic
+ * paths. The layouts are identical, since the atomic versions of
+ * these types have no extra state.
+ */
+static inline hatrack_hash_t
+crown_excl_hv(crown_bucket_t *bucket)
+{
+    return *(hatrack_hash_t *)&bucket->hv;
+}
+
+static inline crown_record_t
+crown_excl_record(crown_bucket_t *bucket)
+{
+    return *(crown_record_t *)&bucket->record;
+}
+
+static inline void
+crown_excl_set_record(crown_bucket_t *bucket, void *item, uint64_t info)
+{
+    crown_record_t *record;
+
+    record       = (crown_record_t *)&bucket->record;
+    record->item = item;
+    record->info = info;
+
+    return;
+}
+
+static inline void
+crown_excl_set_map_bit(crown_store_t *self, crown_bucket_t *home, uint64_t i)
+{
+    if (i < crown_map_bits(self)) {
+	*(hop_t *)&home->neighbor_map |= CROWN_HOME_BIT >> i;
+    }
+
+    return;
+}
+
+/* Returns the bucket for hv, or NULL if there isn't one.  If reserve
+ * is true, an unreserved bucket gets claimed for hv instead, unless
+ * the store is at its threshold, in which case we still return NULL,
+ * and the caller needs to migrate.
+ *
+ * There are no races on the neighbor maps here, so there's no need
+ * for the "help" that the concurrent probes do.  If the stash is
+ * full, we set stash_full before returning NULL, so that the
+ * migration doubles the table.
+ */
+static crown_bucket_t *
+crown_excl_probe(crown_store_t *self, hatrack_hash_t hv1, bool reserve)
+{
+    bool            bounded;
+    bool            stashed;
+    bool            claimed;
+    uint64_t        bix;
+    uint64_t        i;
+    uint64_t        used;
+    uint64_t        limit;
+    hatrack_hash_t  hv2;
+    crown_bucket_t *bucket;
+    crown_bucket_t *home;
+    hop_t           map;
+
+    bix     = hatrack_bucket_index(hv1, self->last_slot);
+    home    = &self->buckets[bix];
+    map     = *(hop_t *)&home->neighbor_map;
+    bounded = crown_probe_bounded(self);
+    stashed = crown_take_stash_bit(self, &map);
+    i       = -1;
+
+    while (map) {
+	i      = CLZ(map);
+	bucket = &self->buckets[(bix + i) & self->last_slot];
+
+	if (hatrack_hashes_eq(hv1, crown_excl_hv(bucket))) {
+	    return bucket;
 	}
-	else {
-	    new_size        = hatrack_new_size(self->last_slot, new_used);
+
+	map &= ~(CROWN_HOME_BIT >> i);
+    }
+
+    if (stashed) {
+	bucket = crown_stash_find(self, hv1);
+
+	if (bucket) {
+	    return bucket;
+	}
+
+	if (bounded) {
+	    if (!reserve) {
+		return NULL;
+	    }
+
+	    goto use_stash;
 	}
-	
-        candidate_store = crown_store_new(new_size);
-	
-        if (!CAS(&self->store_next, &new_store, candidate_store)) {
-            mmm_retire_unused(candidate_store);
-        }
-        else {
-            new_store = candidate_store;
-        }
     }
 
-    for (i = 0; i <= self->last_slot; i++) {
-        bucket = &self->buckets[i];
-        record = atomic_read(&bucket->record);
+    limit = bounded ? CROWN_NEIGHBORHOOD : self->last_slot + 1;
 
-        if (record.info & CROWN_F_MOVED) {
-            continue;
-        }
+    for (i++; i < limit; i++) {
+	bucket = &self->buckets[(bix + i) & self->last_slot];
+	hv2    = crown_excl_hv(bucket);
 
-        hv         = atomic_read(&bucket->hv);
-        bix        = hatrack_bucket_index(hv, new_store->last_slot);
-	map_bucket = &new_store->buckets[bix];
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    return bucket;
+	}
 
-#ifdef HATRACK_SKIP_ON_MIGRATIONS
-	original_bix = bix;
-	map          = atomic_read(&map_bucket->neighbor_map);
-	j            = -1;
+	if (!hatrack_bucket_unreserved(hv2)) {
+	    continue;
+	}
 
-	while (map) {
-	    uint64_t ix;
-	    
-	    j           = CLZ(map);
-	    ix          = (original_bix + j) & new_store->last_slot;
-	    new_bucket  = &new_store->buckets[ix];
-	    expected_hv = atomic_read(&new_bucket->hv);
-	    if (hatrack_hashes_eq(hv, expected_hv)) {
-		goto found_bucket;
+	if (!reserve) {
+	    return NULL;
+	}
+
+	used = atomic_load_explicit(&self->used_count, memory_order_relaxed);
+
+	if (used >= self->threshold) {
+	    return NULL;
+	}
+
+	atomic_store_explicit(&self->used_count, used + 1, memory_order_relaxed);
+
+	*(hatrack_hash_t *)&bucket->hv = hv1;
+	crown_excl_set_map_bit(self, home, i);
+
+	return bucket;
+    }
+
+    if (!bounded || !reserve) {
+	return NULL;
+    }
+
+ use_stash:
+    used = atomic_load_explicit(&self->used_count, memory_order_relaxed);
+
+    if (used >= self->threshold) {
+	return NULL;
+    }
+
+    bucket = crown_stash_reserve(self, home, hv1, &claimed);
+
+    if (!bucket) {
+	atomic_store_explicit(&self->stash_full, true, memory_order_relaxed);
+
+	return NULL;
+    }
+
+    atomic_store_explicit(&self->used_count, used + 1, memory_order_relaxed);
+
+    return bucket;
+}
+
+/* Since no one else can be looking at the old store, there's no
+ * need for the MOVING / MOVED dance; we just copy the live records
+ * over, and free the old store right away, unless a slow view has
+ * claimed it (in which case the view will retire it).
+ */
+static void
+crown_excl_migrate(crown_t *top)
+{
+    crown_store_t  *self;
+    crown_store_t  *new_store;
+    crown_bucket_t *bucket;
+    crown_bucket_t *new_bucket;
+    crown_record_t  record;
+    hatrack_hash_t  hv;
+    uint64_t        new_used;
+    uint64_t        new_size;
+    uint64_t        end;
+    uint64_t        bix;
+    uint64_t        i, j;
+
+    self     = atomic_load_explicit(&top->store_current, memory_order_relaxed);
+    end      = self->last_slot + self->stash_len;
+    new_used = 0;
+
+    for (i = 0; i <= end; i++) {
+	if (crown_excl_record(&self->buckets[i]).info & CROWN_EPOCH_MASK) {
+	    new_used++;
+	}
+    }
+
+    if (atomic_load_explicit(&self->stash_full, memory_order_relaxed)) {
+	new_size = (self->last_slot + 1) << 1;
+    }
+    else {
+	new_size = hatrack_new_size(self->last_slot, new_used);
+    }
+
+    new_store = crown_store_new(new_size, top->allocator, self->stash_len);
+
+    for (i = 0; i <= end; i++) {
+	bucket = &self->buckets[i];
+	record = crown_excl_record(bucket);
+
+	if (!(record.info & CROWN_EPOCH_MASK)) {
+	    continue;
+	}
+
+	hv = crown_excl_hv(bucket);
+
+	// With a stash, placement is more involved, and we might
+	// overflow; the concurrent version works fine here.
+	if (new_store->stash_len) {
+	    crown_excl_set_record(crown_store_place(new_store, hv),
+				  record.item,
+				  record.info & CROWN_EPOCH_MASK);
+	    continue;
+	}
+
+	bix = hatrack_bucket_index(hv, new_store->last_slot);
+
+	for (j = 0; j <= new_store->last_slot; j++) {
+	    new_bucket = &new_store->buckets[(bix + j) & new_store->last_slot];
+
+	    if (hatrack_bucket_unreserved(crown_excl_hv(new_bucket))) {
+		break;
 	    }
+	}
+
+	*(hatrack_hash_t *)&new_bucket->hv = hv;
+
+	crown_excl_set_map_bit(new_store, &new_store->buckets[bix], j);
+	crown_excl_set_record(new_bucket,
+			      record.item,
+			      record.info & CROWN_EPOCH_MASK);
+    }
+
+    atomic_store_explicit(&new_store->used_count,
+			  new_used,
+			  memory_order_relaxed);
+    atomic_store_explicit(&top->store_current,
+			  new_store,
+			  memory_order_relaxed);
+
+    if (!self->claimed) {
+	mmm_retire_unused(self);
+    }
+
+    return;
+}
+
+static crown_bucket_t *
+crown_excl_reserve(crown_t *top, hatrack_hash_t hv)
+{
+    crown_store_t  *store;
+    crown_bucket_t *bucket;
 
-	    map &= ~(CROWN_HOME_BIT >> j);
+    while (true) {
+	store  = atomic_load_explicit(&top->store_current,
+				      memory_order_relaxed);
+	bucket = crown_excl_probe(store, hv, true);
+
+	if (bucket) {
+	    return bucket;
 	}
 
-	j++;
-	bix = (original_bix + j) & new_store->last_slot;
-#else
-	j = 0;
-#endif
-	
-	for (; j <= new_store->last_slot; j++) {
-            new_bucket     = &new_store->buckets[bix];
-	    expected_hv    = atomic_read(&new_bucket->hv);
-	    
-	    if (hatrack_bucket_unreserved(expected_hv)) {
-		if (CAS(&new_bucket->hv, &expected_hv, hv)) {
-		    map        = atomic_read(&map_bucket->neighbor_map);
-		    new_map    = map | (CROWN_HOME_BIT >> j);
-		    CAS(&map_bucket->neighbor_map, &map, new_map);
-		    
-		    break;
-		}
+	crown_excl_migrate(top);
+    }
+}
+
+static inline crown_bucket_t *
+crown_excl_find(crown_t *top, hatrack_hash_t hv)
+{
+    crown_store_t *store;
+
+    store = atomic_load_explicit(&top->store_current, memory_order_relaxed);
+
+    return crown_excl_probe(store, hv, false);
+}
+
+void *
+crown_excl_get(crown_t *self, hatrack_hash_t hv, bool *found)
+{
+    crown_bucket_t *bucket;
+    crown_record_t  record;
+
+    bucket = crown_excl_find(self, hv);
+
+    if (bucket) {
+	record = crown_excl_record(bucket);
+
+	if (record.info & CROWN_EPOCH_MASK) {
+	    if (found) {
+		*found = true;
 	    }
-	    
-	    if (!hatrack_hashes_eq(expected_hv, hv)) {
-		bix = (bix + 1) & new_store->last_slot;
-		continue;
-            }
-	    
-            break;
-        }
 
-#ifdef HATRACK_SKIP_ON_MIGRATIONS
-    found_bucket:
-#endif	
-        candidate_record.info = record.info & CROWN_EPOCH_MASK;
-        candidate_record.item = record.item;
-        expected_record.info  = 0;
-        expected_record.item  = NULL;
+	    return record.item;
+	}
+    }
 
-        CAS(&new_bucket->record,
-	     &expected_record,
-	     candidate_record
-	   );
+    if (found) {
+	*found = false;
+    }
 
-	OR2X64L(&bucket->record, CROWN_F_MOVED);
+    return NULL;
+}
+
+void *
+crown_excl_put(crown_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    crown_bucket_t *bucket;
+    crown_record_t  record;
+
+    bucket = crown_excl_reserve(self, hv);
+    record = crown_excl_record(bucket);
+
+    if (record.info & CROWN_EPOCH_MASK) {
+	crown_excl_set_record(bucket, item, record.info);
+
+	if (found) {
+	    *found = true;
+	}
+
+	return record.item;
     }
 
-    expected_used = 0;
-    
-    CAS(&new_store->used_count,
-         &expected_used,
-         new_used
-       );
+    crown_excl_set_record(bucket, item, CROWN_F_INITED | self->next_epoch++);
+    hatrack_shardctr_add_excl(&self->item_count, 1);
 
-    if (CAS(&top->store_current,
-	     &self,
-	     new_store
-	   )) {
-	if (!self->claimed) {
-	    mmm_retire(self);
+    if (found) {
+	*found = false;
+    }
+
+    return NULL;
+}
+
+void *
+crown_excl_replace(crown_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    crown_bucket_t *bucket;
+    crown_record_t  record;
+
+    bucket = crown_excl_find(self, hv);
+
+    if (bucket) {
+	record = crown_excl_record(bucket);
+
+	if (record.info & CROWN_EPOCH_MASK) {
+	    crown_excl_set_record(bucket, item, record.info);
+
+	    if (found) {
+		*found = true;
+	    }
+
+	    return record.item;
 	}
     }
 
-    return top->store_current;
+    if (found) {
+	*found = false;
+    }
+
+    return NULL;
 }
 
-static inline bool
-crown_help_required(uint64_t count)
+bool
+crown_excl_add(crown_t *self, hatrack_hash_t hv, void *item)
 {
-    if (count == HATRACK_RETRY_THRESHOLD) {
-	return true;
+    crown_bucket_t *bucket;
+
+    bucket = crown_excl_reserve(self, hv);
+
+    if (crown_excl_record(bucket).info & CROWN_EPOCH_MASK) {
+	return false;
     }
-    
-    return false;
+
+    crown_excl_set_record(bucket, item, CROWN_F_INITED | self->next_epoch++);
+    hatrack_shardctr_add_excl(&self->item_count, 1);
+
+    return true;
 }
 
+void *
+crown_excl_remove(crown_t *self, hatrack_hash_t hv, bool *found)
+{
+    crown_bucket_t *bucket;
+    crown_record_t  record;
 
-static inline bool
-crown_need_to_help(crown_t *self) {
-    return (bool)atomic_read(&self->help_needed);
+    bucket = crown_excl_find(self, hv);
+
+    if (bucket) {
+	record = crown_excl_record(bucket);
+
+	if (record.info & CROWN_EPOCH_MASK) {
+	    crown_excl_set_record(bucket, NULL, CROWN_F_INITED);
+	    hatrack_shardctr_add_excl(&self->item_count, -1);
+
+	    if (found) {
+		*found = true;
+	    }
+
+	    return record.item;
+	}
+    }
+
+    if (found) {
+	*found = false;
+    }
+
+    return NULL;
 }
@@ -16,22 +16,268 @@
  *  Name:           dict.c
  *  Description:    High-level dictionary based on Crown.
  *
+ *                  Dictionaries can optionally be put into replicated
+ *                  mode (see hatrack_dict_set_replicated()), intended
+ *                  for tables that are read constantly from every
+ *                  socket, but rarely written.  There, we keep one
+ *                  crown instance per NUMA node, and readers only
+ *                  ever touch the replica on their own node.
+ *
+ *                  Writers are serialized with a mutex, and apply
+ *                  each write to every replica, in node order.  To
+ *                  keep things linearizable while replicas disagree,
+ *                  the writer first publishes the write it's working
+ *                  on (the "pending" write), and only clears it once
+ *                  every replica has it.  Readers check the pending
+ *                  write before going to their replica; if it's for
+ *                  their key, they use it.  So once any reader has
+ *                  seen a new value, every reader that starts later
+ *                  sees it too, regardless of node.
+ *
+ *                  Readers remain lock-free, and only pay for one
+ *                  extra load of a pointer that's almost never
+ *                  written.
+ *
+ *                  Dictionaries can also be made "transactional"
+ *                  (see hatrack_dict_set_transactional()), which lets
+ *                  hatrack_dict_txn_apply() atomically apply a small
+ *                  group of puts and removes, across one or more
+ *                  dictionaries.  That's a multi-word CAS in the
+ *                  style of Harris, Fraser and Pratt, where each
+ *                  "word" is the item in a crown record (see
+ *                  crown_store_cas()).
+ *
+ *                  The transaction descriptor gets one entry per
+ *                  key, holding the item we expect to be there, and
+ *                  the one to replace it with.  We install a pointer
+ *                  to each entry in its record, in a fixed order
+ *                  (sorted by dict, then hash value). If every
+ *                  install works, the transaction succeeds; if any
+ *                  record doesn't hold the expected item, it fails.
+ *                  Either way, we then swap each entry pointer for
+ *                  the new or the old item, respectively.
+ *
+ *                  Installing an entry is itself a two-step
+ *                  operation (RDCSS, in the paper): we first swap in
+ *                  an "install" descriptor, then check that the
+ *                  transaction is still undecided before swapping
+ *                  that for the entry pointer.  Without this, a
+ *                  slow thread could install an entry after the
+ *                  transaction has finished, when the key had gone
+ *                  back to being absent.
+ *
+ *                  Readers that find a descriptor read through it:
+ *                  an install descriptor, or the entry of an
+ *                  undecided or failed transaction, means the old
+ *                  item; the entry of a successful transaction means
+ *                  the new one.  Writers that find one help finish
+ *                  the operation first, so nobody ever waits.
+ *
+ *                  Descriptors are tagged in the low bits of the
+ *                  item pointer (mmm allocations are 16-byte
+ *                  aligned).  The only cost to dictionaries that
+ *                  don't use transactions is testing those bits on
+ *                  reads; their writes go straight to crown, as
+ *                  before.
+ *
+ *                  Finally, a dictionary can be put into an exclusive
+ *                  phase (see hatrack_dict_begin_exclusive()), for
+ *                  bulk loads and rebuilds where the caller knows
+ *                  only one thread is using it.  Gets and writes then
+ *                  go to crown's exclusive-access operations, which
+ *                  use plain loads and stores, and we skip mmm
+ *                  entirely, freeing replaced items on the spot
+ *                  instead of retiring them.
+ *
+ *                  For dictionaries that live only briefly, there's
+ *                  arena mode (see hatrack_dict_set_arena()), where
+ *                  every item and store comes from a private arena.
+ *                  Retiring memory is then nearly free, and tearing
+ *                  the dictionary down doesn't touch items at all,
+ *                  unless there's a free handler to call; the arena
+ *                  just gets released in one go, once mmm says no
+ *                  thread can still be reading from it.
+ *
+ *                  Dictionaries that get built once and then only
+ *                  read can be frozen (see hatrack_dict_freeze()),
+ *                  which copies them into a compact, immutable table
+ *                  whose lookups need no atomics and no mmm.
+ *
  *  Author:         John Viega, john@zork.org
  */
 
 #include <hatrack.h>
 
 // clang-format off
-static hatrack_hash_t hatrack_dict_get_hash_value(hatrack_dict_t *, void *);
+static hatrack_hash_t hatrack_dict_hash_key      (uint32_t,
+						  hatrack_hash_info_t *,
+						  void *);
 static void           hatrack_dict_record_eject  (hatrack_dict_item_t *,
 						  hatrack_dict_t *);
+static void          *hatrack_dict_excl_get      (hatrack_dict_t *,
+						  hatrack_hash_t, bool *);
+static void           hatrack_dict_excl_put      (hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_excl_replace  (hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_excl_add      (hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_excl_remove   (hatrack_dict_t *,
+						  hatrack_hash_t);
+static void          *hatrack_dict_replicated_get(hatrack_dict_t *,
+						  hatrack_hash_t, bool *);
+static void           hatrack_dict_replicated_put(hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_replicated_replace(hatrack_dict_t *,
+						      hatrack_hash_t,
+						      void *, void *);
+static bool           hatrack_dict_replicated_add(hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_replicated_remove(hatrack_dict_t *,
+						     hatrack_hash_t);
+static bool           hatrack_dict_replicated_apply(hatrack_dict_t *,
+						    hatrack_hash_t,
+						    hatrack_dict_item_t *);
+static void           hatrack_dict_place_replicas(hatrack_dict_t *);
+static bool           hatrack_dict_txn_single    (hatrack_dict_t *,
+						  hatrack_hash_t, void *,
+						  void *, uint64_t);
+static bool           hatrack_dict_txn_run       (hatrack_dict_txn_t *);
+static void          *hatrack_dict_txn_install   (hatrack_dict_txn_entry_t *);
+static void           hatrack_dict_txn_complete  (hatrack_dict_txn_install_t *);
+static void           hatrack_dict_txn_help      (void *);
+static hatrack_view_t *hatrack_dict_txn_fix_view (hatrack_view_t *,
+						  uint64_t *);
+static void           hatrack_dict_scan_one      (hatrack_hash_t, void *,
+						  void *);
+static void           hatrack_dict_extract_one   (hatrack_hash_t, void *,
+						  void *);
+static bool           hatrack_dict_frozen_insert (hatrack_dict_frozen_t *,
+						  hatrack_hash_t,
+						  hatrack_dict_item_t);
+
+typedef struct {
+    hatrack_dict_t          *dict;
+    hatrack_dict_scan_hook_t hook;
+    void                    *arg;
+    uint64_t                 count;
+} hatrack_dict_scan_ctx_t;
+
+/* The low bits of a record's item tell us whether it holds an item,
+ * or one of the transaction descriptors.
+ */
+#define HATRACK_DICT_TXN_ENTRY_TAG   0x1
+#define HATRACK_DICT_TXN_INSTALL_TAG 0x2
+#define HATRACK_DICT_TXN_TAG_MASK    0x3
+
+enum
+{
+    HATRACK_DICT_OP_PUT,
+    HATRACK_DICT_OP_REPLACE,
+    HATRACK_DICT_OP_ADD,
+    HATRACK_DICT_OP_REMOVE
+};
+
+static inline uint64_t
+hatrack_dict_txn_tag(void *item)
+{
+    return ((uint64_t)item) & HATRACK_DICT_TXN_TAG_MASK;
+}
+
+static inline void *
+hatrack_dict_txn_untag(void *item)
+{
+    return (void *)(((uint64_t)item) & ~HATRACK_DICT_TXN_TAG_MASK);
+}
+
+static inline void *
+hatrack_dict_txn_add_tag(void *ptr, uint64_t tag)
+{
+    return (void *)(((uint64_t)ptr) | tag);
+}
+
+/* Returns the item that a descriptor stands for; see the comment at
+ * the top of this file.
+ */
+static inline hatrack_dict_item_t *
+hatrack_dict_txn_resolve(void *item)
+{
+    hatrack_dict_txn_install_t *install;
+    hatrack_dict_txn_entry_t   *entry;
+
+    if (hatrack_dict_txn_tag(item) == HATRACK_DICT_TXN_INSTALL_TAG) {
+	install = hatrack_dict_txn_untag(item);
+
+	return install->entry->old_item;
+    }
+
+    entry = hatrack_dict_txn_untag(item);
+
+    if (atomic_load(&entry->txn->status) == HATRACK_DICT_TXN_SUCCEEDED) {
+	return entry->new_item;
+    }
+
+    return entry->old_item;
+}
+
+static inline void *
+hatrack_dict_txn_read(hatrack_dict_t *dict, hatrack_hash_t hv)
+{
+    crown_store_t *store;
+
+    store = atomic_read(&dict->crown_instance.store_current);
+
+    return crown_store_get(store, hv, NULL);
+}
+
+static inline bool
+hatrack_dict_txn_cas(hatrack_dict_t *dict,
+		     hatrack_hash_t  hv,
+		     void           *expected,
+		     void           *item)
+{
+    crown_store_t *store;
+
+    store = atomic_read(&dict->crown_instance.store_current);
+
+    return crown_store_cas(store, &dict->crown_instance, hv, expected, item, 0);
+}
+
+static inline hatrack_hash_t
+hatrack_dict_get_hash_value(hatrack_dict_t *self, void *key)
+{
+    return hatrack_dict_hash_key(self->key_type, &self->hash_info, key);
+}
+
+static inline crown_t *
+hatrack_dict_local_crown(hatrack_dict_t *self)
+{
+    uint64_t node;
+
+    if (!self->replicas) {
+	return &self->crown_instance;
+    }
+
+    node = hatrack_numa_current_node();
+
+    if (node >= self->num_replicas) {
+	node %= self->num_replicas;
+    }
+
+    return self->replicas[node];
+}
 
 hatrack_dict_t *
 hatrack_dict_new(uint32_t key_type)
 {
     hatrack_dict_t *ret;
 
-    ret = (hatrack_dict_t *)malloc(sizeof(hatrack_dict_t));
+    ret = (hatrack_dict_t *)hatrack_malloc(sizeof(hatrack_dict_t));
 
     hatrack_dict_init(ret, key_type);
 
@@ -65,6 +311,16 @@ hatrack_dict_init(hatrack_dict_t *self, uint32_t key_type)
     self->key_return_hook                = NULL;
     self->val_return_hook                = NULL;
     self->slow_views                     = false;
+    self->replicas                       = NULL;
+    self->replica_stores                 = NULL;
+    self->num_replicas                   = 0;
+    self->transactional                  = false;
+    self->exclusive                      = false;
+    self->arena                          = NULL;
+    self->membudget                      = NULL;
+    self->record_allocator               = NULL;
+
+    atomic_store(&self->pending, NULL);
 
     return;
 }
@@ -81,7 +337,7 @@ hatrack_dict_cleanup(hatrack_dict_t *self)
     if (self->free_handler) {
         store = atomic_load(&self->crown_instance.store_current);
 
-        for (i = 0; i <= store->last_slot; i++) {
+        for (i = 0; i <= store->last_slot + store->stash_len; i++) {
             bucket = &store->buckets[i];
             hv     = atomic_load(&bucket->hv);
 
@@ -91,7 +347,8 @@ hatrack_dict_cleanup(hatrack_dict_t *self)
 
             record = atomic_load(&bucket->record);
 
-            if (!record.info) {
+            // Removed items leave the bucket initialized, but empty.
+            if (!record.info || !record.item) {
                 continue;
             }
 
@@ -101,6 +358,27 @@ hatrack_dict_cleanup(hatrack_dict_t *self)
 
     mmm_retire(atomic_load(&self->crown_instance.store_current));
 
+    if (self->replicas) {
+	for (i = 1; i < self->num_replicas; i++) {
+	    crown_delete(self->replicas[i]);
+	}
+
+	hatrack_free(self->replicas,
+		     sizeof(crown_t *) * self->num_replicas);
+	hatrack_free(self->replica_stores,
+		     sizeof(crown_store_t *) * self->num_replicas);
+	pthread_mutex_destroy(&self->write_mutex);
+    }
+
+    /* Items that got replaced or removed while we were running have
+     * their free handler calls parked in the arena; make them before
+     * the dictionary goes away.
+     */
+    if (self->arena) {
+	hatrack_arena_run_cleanups(self->arena);
+	hatrack_arena_retire(self->arena);
+    }
+
     return;
 }
 
@@ -109,7 +387,7 @@ hatrack_dict_delete(hatrack_dict_t *self)
 {
     hatrack_dict_cleanup(self);
 
-    free(self);
+    hatrack_free(self, sizeof(hatrack_dict_t));
 
     return;
 }
@@ -146,6 +424,116 @@ hatrack_dict_set_free_handler(hatrack_dict_t *self, hatrack_mem_hook_t func)
     return;
 }
 
+/* Items, and the stores they live in, come from this allocator from
+ * now on (NULL means the global one).  Like replication, this has to
+ * be set up while the dictionary is empty and before it's shared, and
+ * if you want both, set the allocator first.  Views still come from
+ * the global allocator, since they belong to the caller.
+ */
+void
+hatrack_dict_set_allocator(hatrack_dict_t *self, hatrack_allocator_t *allocator)
+{
+    if (self->replicas || self->exclusive || self->membudget
+	|| (self->arena
+	    && allocator != hatrack_arena_allocator(self->arena))) {
+	abort();
+    }
+
+    crown_set_allocator(&self->crown_instance, allocator);
+
+    self->record_allocator = allocator;
+
+    return;
+}
+
+/* Puts the dictionary's stores and items under a memory budget (see
+ * membudget.h). The same rules apply as for
+ * hatrack_dict_set_allocator(), and it can't be combined with arena
+ * mode.  Once the budget is at its hard limit, hatrack_dict_put() and
+ * hatrack_dict_add() fail, returning false, until enough gets removed
+ * (and reclaimed).  Transactions aren't held to the limit.
+ *
+ * The budget can be shared with other structures, but it has to
+ * outlive all of them.
+ */
+void
+hatrack_dict_set_membudget(hatrack_dict_t *self, hatrack_membudget_t *budget)
+{
+    if (self->arena || self->membudget) {
+	abort();
+    }
+
+    hatrack_dict_set_allocator(self, hatrack_membudget_store_allocator(budget));
+
+    self->record_allocator = hatrack_membudget_record_allocator(budget);
+    self->membudget        = budget;
+
+    return;
+}
+
+hatrack_membudget_t *
+hatrack_dict_get_membudget(hatrack_dict_t *self)
+{
+    return self->membudget;
+}
+
+/* Arena mode has to be turned on while the dictionary is empty, and
+ * before it's shared.  Once on, it stays on.  Like
+ * hatrack_dict_set_allocator(), it has to come before replication.
+ */
+void
+hatrack_dict_set_arena(hatrack_dict_t *self, bool value)
+{
+    if (!value) {
+	if (self->arena) {
+	    abort();
+	}
+	return;
+    }
+
+    if (self->arena) {
+	return;
+    }
+
+    if (self->membudget) {
+	abort();
+    }
+
+    self->arena = hatrack_arena_new(0);
+
+    hatrack_dict_set_allocator(self, hatrack_arena_allocator(self->arena));
+
+    return;
+}
+
+bool
+hatrack_dict_get_arena(hatrack_dict_t *self)
+{
+    return self->arena != NULL;
+}
+
+/* Bounds the probing in the underlying table (see
+ * crown_set_bounded_probes()).  The same rules apply as for
+ * hatrack_dict_set_allocator().
+ */
+void
+hatrack_dict_set_bounded_probes(hatrack_dict_t *self, bool value)
+{
+    if (self->replicas || self->exclusive) {
+	abort();
+    }
+
+    crown_set_bounded_probes(&self->crown_instance, value);
+
+    return;
+}
+
+bool
+hatrack_dict_get_bounded_probes(hatrack_dict_t *self)
+{
+    return crown_get_bounded_probes(&self->crown_instance);
+}
+
 void
 hatrack_dict_set_key_return_hook(hatrack_dict_t *self, hatrack_mem_hook_t func)
 {
@@ -190,6 +578,157 @@ hatrack_dict_get_sorted_views(hatrack_dict_t *self)
     return self->sorted_views;
 }
 
+/* Turning on replication has to happen before the dictionary has any
+ * items in it, and before it's shared with other threads.  Once on,
+ * it stays on.
+ *
+ * We make one replica per NUMA node that's online; on a single-node
+ * machine, that's just the one crown instance we already have.
+ */
+void
+hatrack_dict_set_replicated(hatrack_dict_t *self, bool value)
+{
+    uint64_t i;
+
+    if (!value) {
+	if (self->replicas) {
+	    abort();
+	}
+	return;
+    }
+
+    if (self->replicas) {
+	return;
+    }
+
+    if (self->transactional || self->exclusive
+	|| crown_len(&self->crown_instance)) {
+	abort();
+    }
+
+    self->num_replicas   = hatrack_numa_node_count();
+    self->replicas       = (crown_t **)hatrack_malloc(sizeof(crown_t *)
+						      * self->num_replicas);
+    self->replica_stores = (crown_store_t **)hatrack_zalloc(
+	self->num_replicas * sizeof(crown_store_t *));
+    self->replicas[0]    = &self->crown_instance;
+
+    for (i = 1; i < self->num_replicas; i++) {
+	self->replicas[i] = crown_new();
+	crown_set_allocator(self->replicas[i],
+			    self->crown_instance.allocator);
+	crown_set_bounded_probes(self->replicas[i],
+				 crown_get_bounded_probes(&self->crown_instance));
+    }
+
+    pthread_mutex_init(&self->write_mutex, NULL);
+    hatrack_dict_place_replicas(self);
+
+    return;
+}
+
+bool
+hatrack_dict_get_replicated(hatrack_dict_t *self)
+{
+    return self->replicas != NULL;
+}
+
+/* This needs to be set before the dictionary is shared with other
+ * threads, since non-transactional writes don't look for descriptors.
+ * It can't be combined with replication.
+ *
+ * Note that views are not atomic with respect to transactions; a view
+ * taken while a transaction is being applied may see some of its
+ * operations, but not others.
+ */
+void
+hatrack_dict_set_transactional(hatrack_dict_t *self, bool value)
+{
+    if (value && self->replicas) {
+	abort();
+    }
+
+    self->transactional = value;
+
+    return;
+}
+
+bool
+hatrack_dict_get_transactional(hatrack_dict_t *self)
+{
+    return self->transactional;
+}
+
+/* Starts an exclusive phase.  Until hatrack_dict_end_exclusive() is
+ * called, the caller guarantees that only one thread uses the
+ * dictionary, and that nothing else holds on to items it has gotten
+ * out of it (since replaced and removed items get freed immediately,
+ * after the free handler is called).
+ *
+ * Gets, puts, replaces, adds and removes are the operations that get
+ * faster; views and hash range scans still work, via the regular
+ * path.
+ *
+ * Any hand-off between threads, into or out of the phase, needs to be
+ * through something that synchronizes (a mutex, a thread join, etc).
+ * Replicated dictionaries don't support this.
+ */
+void
+hatrack_dict_begin_exclusive(hatrack_dict_t *self)
+{
+    if (self->replicas || self->exclusive) {
+	abort();
+    }
+
+    self->exclusive = true;
+
+    return;
+}
+
+/* Everything in the exclusive phase was written with plain stores.
+ * Re-publishing the current store with a sequentially consistent
+ * store means any reader that loads it afterward sees all of it.
+ */
+void
+hatrack_dict_end_exclusive(hatrack_dict_t *self)
+{
+    crown_store_t *store;
+
+    if (!self->exclusive) {
+	abort();
+    }
+
+    self->exclusive = false;
+    store           = atomic_load_explicit(&self->crown_instance.store_current,
+					   memory_order_relaxed);
+
+    atomic_store(&self->crown_instance.store_current, store);
+
+    return;
+}
+
+bool
+hatrack_dict_get_exclusive(hatrack_dict_t *self)
+{
+    return self->exclusive;
+}
+
+/* With a memory budget, writes run any soft-limit callback that's
+ * owed before they start (see hatrack_membudget_poll()), and writes
+ * that could grow the dictionary fail while it's at its hard limit.
+ */
+static inline bool
+hatrack_dict_budget_ok(hatrack_dict_t *self, bool grows)
+{
+    if (!self->membudget) {
+	return true;
+    }
+
+    hatrack_membudget_poll(self->membudget);
+
+    return !grows || !hatrack_membudget_at_hard_limit(self->membudget);
+}
+
 void *
 hatrack_dict_get(hatrack_dict_t *self, void *key, bool *found)
 {
@@ -200,11 +739,23 @@ hatrack_dict_get(hatrack_dict_t *self, void *key, bool *found)
     
     hv = hatrack_dict_get_hash_value(self, key);
 
+    if (self->exclusive) {
+	return hatrack_dict_excl_get(self, hv, found);
+    }
+
+    if (self->replicas) {
+	return hatrack_dict_replicated_get(self, hv, found);
+    }
+
     mmm_start_basic_op();
 
     store = atomic_read(&self->crown_instance.store_current);
     item  = crown_store_get(store, hv, found);
 
+    if (hatrack_dict_txn_tag(item)) {
+	item = hatrack_dict_txn_resolve(item);
+    }
+
     if (!item) {
         if (found) {
             *found = false;
@@ -235,7 +786,7 @@ hatrack_dict_get(hatrack_dict_t *self, void *key, bool *found)
  * We could do two layers of MMM, but instead we just lift it out here,
  * and skip directly to the crown_store() calls.
  */
-void
+bool
 hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
 {
     hatrack_hash_t       hv;
@@ -243,11 +794,31 @@ hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
     hatrack_dict_item_t *old_item;
     crown_store_t    *store;
 
+    if (!hatrack_dict_budget_ok(self, true)) {
+	return false;
+    }
+
     hv = hatrack_dict_get_hash_value(self, key);
 
+    if (self->exclusive) {
+	hatrack_dict_excl_put(self, hv, key, value);
+	return true;
+    }
+
+    if (self->replicas) {
+	hatrack_dict_replicated_put(self, hv, key, value);
+	return true;
+    }
+
+    if (self->transactional) {
+	hatrack_dict_txn_single(self, hv, key, value, HATRACK_DICT_OP_PUT);
+	return true;
+    }
+
     mmm_start_basic_op();
 
-    new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    new_item        = mmm_alloc_committed_with(self->record_allocator,
+					       sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
     store           = atomic_read(&self->crown_instance.store_current);
@@ -271,7 +842,7 @@ hatrack_dict_put(hatrack_dict_t *self, void *key, void *value)
 
     mmm_end_op();
 
-    return;
+    return true;
 }
 
 bool
@@ -282,11 +853,30 @@ hatrack_dict_replace(hatrack_dict_t *self, void *key, void *value)
     hatrack_dict_item_t *old_item;
     crown_store_t    *store;
 
+    hatrack_dict_budget_ok(self, false);
+
     hv = hatrack_dict_get_hash_value(self, key);
 
+    if (self->exclusive) {
+	return hatrack_dict_excl_replace(self, hv, key, value);
+    }
+
+    if (self->replicas) {
+	return hatrack_dict_replicated_replace(self, hv, key, value);
+    }
+
+    if (self->transactional) {
+	return hatrack_dict_txn_single(self,
+				       hv,
+				       key,
+				       value,
+				       HATRACK_DICT_OP_REPLACE);
+    }
+
     mmm_start_basic_op();
 
-    new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    new_item        = mmm_alloc_committed_with(self->record_allocator,
+					       sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
     store           = atomic_read(&self->crown_instance.store_current);
@@ -324,11 +914,28 @@ hatrack_dict_add(hatrack_dict_t *self, void *key, void *value)
     hatrack_dict_item_t *new_item;
     crown_store_t    *store;
 
+    if (!hatrack_dict_budget_ok(self, true)) {
+	return false;
+    }
+
     hv = hatrack_dict_get_hash_value(self, key);
 
+    if (self->exclusive) {
+	return hatrack_dict_excl_add(self, hv, key, value);
+    }
+
+    if (self->replicas) {
+	return hatrack_dict_replicated_add(self, hv, key, value);
+    }
+
+    if (self->transactional) {
+	return hatrack_dict_txn_single(self, hv, key, value, HATRACK_DICT_OP_ADD);
+    }
+
     mmm_start_basic_op();
 
-    new_item        = mmm_alloc_committed(sizeof(hatrack_dict_item_t));
+    new_item        = mmm_alloc_committed_with(self->record_allocator,
+					       sizeof(hatrack_dict_item_t));
     new_item->key   = key;
     new_item->value = value;
     store           = atomic_read(&self->crown_instance.store_current);
@@ -352,8 +959,26 @@ hatrack_dict_remove(hatrack_dict_t *self, void *key)
     hatrack_dict_item_t *old_item;
     crown_store_t    *store;
 
+    hatrack_dict_budget_ok(self, false);
+
     hv = hatrack_dict_get_hash_value(self, key);
 
+    if (self->exclusive) {
+	return hatrack_dict_excl_remove(self, hv);
+    }
+
+    if (self->replicas) {
+	return hatrack_dict_replicated_remove(self, hv);
+    }
+
+    if (self->transactional) {
+	return hatrack_dict_txn_single(self,
+				       hv,
+				       key,
+				       NULL,
+				       HATRACK_DICT_OP_REMOVE);
+    }
+
     mmm_start_basic_op();
 
     store = atomic_read(&self->crown_instance.store_current);
@@ -390,14 +1015,18 @@ hatrack_dict_keys_base(hatrack_dict_t *self, uint64_t *num, bool sort)
     mmm_start_basic_op();
 
     if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
+	view = crown_view_slow(hatrack_dict_local_crown(self), num, sort);
     }
     else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
+	view = crown_view_fast(hatrack_dict_local_crown(self), num, sort);
+    }
+
+    if (self->transactional) {
+	view = hatrack_dict_txn_fix_view(view, num);
     }
     
     alloc_len = sizeof(hatrack_dict_key_t) * *num;
-    ret       = (hatrack_dict_key_t *)malloc(alloc_len);
+    ret       = (hatrack_dict_key_t *)hatrack_malloc(alloc_len);
 
     if (self->key_return_hook) {
 	for (i = 0; i < *num; i++) {
@@ -416,7 +1045,7 @@ hatrack_dict_keys_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_end_op();
 
-    free(view);
+    hatrack_free(view, 0);
 
     return ret;
 }
@@ -433,14 +1062,18 @@ hatrack_dict_values_base(hatrack_dict_t *self, uint64_t *num, bool sort)
     mmm_start_basic_op();
 
     if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
+	view = crown_view_slow(hatrack_dict_local_crown(self), num, sort);
     }
     else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
+	view = crown_view_fast(hatrack_dict_local_crown(self), num, sort);
+    }
+
+    if (self->transactional) {
+	view = hatrack_dict_txn_fix_view(view, num);
     }
 
     alloc_len = sizeof(hatrack_dict_value_t) * *num;
-    ret       = (hatrack_dict_value_t *)malloc(alloc_len);
+    ret       = (hatrack_dict_value_t *)hatrack_malloc(alloc_len);
 
     if (self->val_return_hook) {
 	for (i = 0; i < *num; i++) {
@@ -458,7 +1091,7 @@ hatrack_dict_values_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_end_op();
     
-    free(view);
+    hatrack_free(view, 0);
 
     return ret;
 }
@@ -475,14 +1108,18 @@ hatrack_dict_items_base(hatrack_dict_t *self, uint64_t *num, bool sort)
     mmm_start_basic_op();
     
     if (self->slow_views) {
-	view = crown_view_slow(&self->crown_instance, num, sort);
+	view = crown_view_slow(hatrack_dict_local_crown(self), num, sort);
     }
     else {
-	view = crown_view_fast(&self->crown_instance, num, sort);
+	view = crown_view_fast(hatrack_dict_local_crown(self), num, sort);
+    }
+
+    if (self->transactional) {
+	view = hatrack_dict_txn_fix_view(view, num);
     }
 
     alloc_len = sizeof(hatrack_dict_item_t) * *num;
-    ret       = (hatrack_dict_item_t *)malloc(alloc_len);
+    ret       = (hatrack_dict_item_t *)hatrack_malloc(alloc_len);
 
     for (i = 0; i < *num; i++) {
 	item         = (hatrack_dict_item_t *)view[i].item;
@@ -499,7 +1136,7 @@ hatrack_dict_items_base(hatrack_dict_t *self, uint64_t *num, bool sort)
 
     mmm_end_op();
     
-    free(view);
+    hatrack_free(view, 0);
 
     return ret;
 }
@@ -558,34 +1195,120 @@ hatrack_dict_items_nosort(hatrack_dict_t *self, uint64_t *num)
     return hatrack_dict_items_base(self, num, false);
 }
 
-static hatrack_hash_t
-hatrack_dict_get_hash_value(hatrack_dict_t *self, void *key)
+/* These call the hook on every item whose hash position (see
+ * hatrack_hash_position()) falls in the inclusive range [lo, hi], and
+ * return the number of items passed to the hook.  To split a dict
+ * into 2^k shards, shard s is the range [s << (64 - k), ((s + 1) <<
+ * (64 - k)) - 1].
+ *
+ * Only the buckets that the range maps to get looked at, so scanning
+ * one shard out of 64 costs about 1/64th of a full view.
+ *
+ * As with the fast views, this isn't a consistent snapshot.  Items
+ * added or removed while the scan is running may or may not be seen.
+ *
+ * The scan calls the key and value return hooks, just like views do.
+ * The extract variant removes each item it hands to the hook, and
+ * does not call the return hooks or the free handler, since
+ * ownership passes to the caller.  Extracting from a replicated dict
+ * is not supported.
+ */
+uint64_t
+hatrack_dict_scan_hash_range(hatrack_dict_t          *self,
+			     uint64_t                 lo,
+			     uint64_t                 hi,
+			     hatrack_dict_scan_hook_t hook,
+			     void                    *arg)
 {
-    hatrack_hash_t hv;
-    int32_t        offset;
-    uint8_t       *loc_to_hash;
+    hatrack_dict_scan_ctx_t ctx;
+    crown_t                *crown;
+    crown_store_t          *store;
 
-    switch (self->key_type) {
-    case HATRACK_DICT_KEY_TYPE_OBJ_CUSTOM:
-        return (*self->hash_info.custom_hash)(key);
+    ctx.dict  = self;
+    ctx.hook  = hook;
+    ctx.arg   = arg;
+    ctx.count = 0;
 
-    case HATRACK_DICT_KEY_TYPE_INT:
-        return hash_int((uint64_t)key);
+    mmm_start_basic_op();
 
-    case HATRACK_DICT_KEY_TYPE_REAL:
-        return hash_double(*(double *)key);
+    crown = hatrack_dict_local_crown(self);
+    store = atomic_read(&crown->store_current);
 
-    case HATRACK_DICT_KEY_TYPE_CSTR:
-        return hash_cstr((char *)key);
+    crown_store_scan(store, crown, lo, hi, hatrack_dict_scan_one, &ctx);
 
-    case HATRACK_DICT_KEY_TYPE_PTR:
-        return hash_pointer(key);
+    mmm_end_op();
 
-    default:
-        break;
-    }
+    return ctx.count;
+}
+
+uint64_t
+hatrack_dict_extract_hash_range(hatrack_dict_t          *self,
+				uint64_t                 lo,
+				uint64_t                 hi,
+				hatrack_dict_scan_hook_t hook,
+				void                    *arg)
+{
+    hatrack_dict_scan_ctx_t ctx;
+    crown_store_t          *store;
+
+    if (self->replicas) {
+	abort();
+    }
+
+    ctx.dict  = self;
+    ctx.hook  = hook;
+    ctx.arg   = arg;
+    ctx.count = 0;
+
+    mmm_start_basic_op();
 
-    offset = self->hash_info.offsets.cache_offset;
+    store = atomic_read(&self->crown_instance.store_current);
+
+    crown_store_scan(store,
+		     &self->crown_instance,
+		     lo,
+		     hi,
+		     hatrack_dict_extract_one,
+		     &ctx);
+
+    mmm_end_op();
+
+    return ctx.count;
+}
+
+/* Shared by dictionaries and frozen dictionaries, which hash keys
+ * the same way.
+ */
+static hatrack_hash_t
+hatrack_dict_hash_key(uint32_t             key_type,
+		      hatrack_hash_info_t *info,
+		      void                *key)
+{
+    hatrack_hash_t hv;
+    int32_t        offset;
+    uint8_t       *loc_to_hash;
+
+    switch (key_type) {
+    case HATRACK_DICT_KEY_TYPE_OBJ_CUSTOM:
+        return (*info->custom_hash)(key);
+
+    case HATRACK_DICT_KEY_TYPE_INT:
+        return hash_int((uint64_t)key);
+
+    case HATRACK_DICT_KEY_TYPE_REAL:
+        return hash_double(*(double *)key);
+
+    case HATRACK_DICT_KEY_TYPE_CSTR:
+        return hash_cstr((char *)key);
+
+    case HATRACK_DICT_KEY_TYPE_PTR:
+        return hash_pointer(key);
+
+    default:
+        break;
+    }
+
+    offset = info->offsets.cache_offset;
 
     if (offset != (int32_t)HATRACK_DICT_NO_CACHE) {
         hv = *(hatrack_hash_t *)(((uint8_t *)key) + offset);
@@ -597,11 +1320,11 @@ hatrack_dict_get_hash_value(hatrack_dict_t *self, void *key)
 
     loc_to_hash = (uint8_t *)key;
     
-    if (self->hash_info.offsets.hash_offset) {
-	loc_to_hash += self->hash_info.offsets.hash_offset;
+    if (info->offsets.hash_offset) {
+	loc_to_hash += info->offsets.hash_offset;
     }
 
-    switch (self->key_type) {
+    switch (key_type) {
     case HATRACK_DICT_KEY_TYPE_OBJ_INT:
         hv = hash_int((uint64_t)loc_to_hash);
         break;
@@ -637,3 +1360,1154 @@ hatrack_dict_record_eject(hatrack_dict_item_t *record,
 
     return;
 }
+
+/* Items made during an exclusive phase come from mmm_alloc(), so that
+ * they can be retired like any other item later on.  We don't commit
+ * them (that would bump the global epoch); instead, they get the
+ * current epoch, which is all mmm needs to see.
+ */
+static inline hatrack_dict_item_t *
+hatrack_dict_excl_item_new(hatrack_dict_t *self, void *key, void *value)
+{
+    hatrack_dict_item_t *item;
+
+    item        = mmm_alloc_with(self->record_allocator,
+				 sizeof(hatrack_dict_item_t));
+    item->key   = key;
+    item->value = value;
+
+    atomic_store_explicit(&mmm_get_header(item)->write_epoch,
+			  atomic_load_explicit(&mmm_epoch,
+					       memory_order_relaxed),
+			  memory_order_relaxed);
+
+    return item;
+}
+
+static inline void
+hatrack_dict_excl_item_free(hatrack_dict_t *self, hatrack_dict_item_t *item)
+{
+    if (self->free_handler) {
+	hatrack_dict_record_eject(item, self);
+    }
+
+    mmm_retire_unused(item);
+
+    return;
+}
+
+static void *
+hatrack_dict_excl_get(hatrack_dict_t *self, hatrack_hash_t hv, bool *found)
+{
+    hatrack_dict_item_t *item;
+
+    item = crown_excl_get(&self->crown_instance, hv, found);
+
+    if (!item) {
+	return NULL;
+    }
+
+    if (self->val_return_hook) {
+	(*self->val_return_hook)(self, item->value);
+    }
+
+    return item->value;
+}
+
+static void
+hatrack_dict_excl_put(hatrack_dict_t *self,
+		      hatrack_hash_t  hv,
+		      void           *key,
+		      void           *value)
+{
+    hatrack_dict_item_t *old_item;
+
+    old_item = crown_excl_put(&self->crown_instance,
+			      hv,
+			      hatrack_dict_excl_item_new(self, key, value),
+			      NULL);
+
+    if (old_item) {
+	hatrack_dict_excl_item_free(self, old_item);
+    }
+
+    return;
+}
+
+static bool
+hatrack_dict_excl_replace(hatrack_dict_t *self,
+			  hatrack_hash_t  hv,
+			  void           *key,
+			  void           *value)
+{
+    hatrack_dict_item_t *new_item;
+    hatrack_dict_item_t *old_item;
+
+    if (!crown_excl_get(&self->crown_instance, hv, NULL)) {
+	return false;
+    }
+
+    new_item = hatrack_dict_excl_item_new(self, key, value);
+    old_item = crown_excl_replace(&self->crown_instance, hv, new_item, NULL);
+
+    hatrack_dict_excl_item_free(self, old_item);
+
+    return true;
+}
+
+static bool
+hatrack_dict_excl_add(hatrack_dict_t *self,
+		      hatrack_hash_t  hv,
+		      void           *key,
+		      void           *value)
+{
+    if (crown_excl_get(&self->crown_instance, hv, NULL)) {
+	return false;
+    }
+
+    return crown_excl_add(&self->crown_instance,
+			  hv,
+			  hatrack_dict_excl_item_new(self, key, value));
+}
+
+static bool
+hatrack_dict_excl_remove(hatrack_dict_t *self, hatrack_hash_t hv)
+{
+    hatrack_dict_item_t *old_item;
+
+    old_item = crown_excl_remove(&self->crown_instance, hv, NULL);
+
+    if (!old_item) {
+	return false;
+    }
+
+    hatrack_dict_excl_item_free(self, old_item);
+
+    return true;
+}
+
+static void *
+hatrack_dict_replicated_get(hatrack_dict_t *self, hatrack_hash_t hv, bool *found)
+{
+    hatrack_dict_pending_t *pending;
+    hatrack_dict_item_t    *item;
+    crown_store_t          *store;
+    void                   *ret;
+
+    mmm_start_basic_op();
+
+    // This load needs to happen before we look at our replica.
+    pending = atomic_load(&self->pending);
+
+    if (pending && hatrack_hashes_eq(pending->hv, hv)) {
+	item = pending->item;
+    }
+    else {
+	store = atomic_read(&hatrack_dict_local_crown(self)->store_current);
+	item  = crown_store_get(store, hv, NULL);
+    }
+
+    if (!item) {
+	return hatrack_not_found_w_mmm(found);
+    }
+
+    ret = item->value;
+
+    if (self->val_return_hook) {
+	(*self->val_return_hook)(self, ret);
+    }
+
+    return hatrack_found_w_mmm(found, ret);
+}
+
+static void
+hatrack_dict_replicated_put(hatrack_dict_t *self,
+			    hatrack_hash_t  hv,
+			    void           *key,
+			    void           *value)
+{
+    hatrack_dict_item_t *new_item;
+
+    pthread_mutex_lock(&self->write_mutex);
+    mmm_start_basic_op();
+
+    new_item        = mmm_alloc_committed_with(self->record_allocator,
+					       sizeof(hatrack_dict_item_t));
+    new_item->key   = key;
+    new_item->value = value;
+
+    hatrack_dict_replicated_apply(self, hv, new_item);
+
+    mmm_end_op();
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return;
+}
+
+/* Since writers are serialized, and every replica is identical
+ * between writes, the writer can check replica 0 to decide whether a
+ * conditional write succeeds.
+ */
+static bool
+hatrack_dict_replicated_replace(hatrack_dict_t *self,
+				hatrack_hash_t  hv,
+				void           *key,
+				void           *value)
+{
+    hatrack_dict_item_t *new_item;
+    crown_store_t       *store;
+    bool                 found;
+
+    pthread_mutex_lock(&self->write_mutex);
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->crown_instance.store_current);
+
+    crown_store_get(store, hv, &found);
+
+    if (found) {
+	new_item        = mmm_alloc_committed_with(self->record_allocator,
+						   sizeof(hatrack_dict_item_t));
+	new_item->key   = key;
+	new_item->value = value;
+
+	hatrack_dict_replicated_apply(self, hv, new_item);
+    }
+
+    mmm_end_op();
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return found;
+}
+
+static bool
+hatrack_dict_replicated_add(hatrack_dict_t *self,
+			    hatrack_hash_t  hv,
+			    void           *key,
+			    void           *value)
+{
+    hatrack_dict_item_t *new_item;
+    crown_store_t       *store;
+    bool                 found;
+
+    pthread_mutex_lock(&self->write_mutex);
+    mmm_start_basic_op();
+
+    store = atomic_read(&self->crown_instance.store_current);
+
+    crown_store_get(store, hv, &found);
+
+    if (!found) {
+	new_item        = mmm_alloc_committed_with(self->record_allocator,
+						   sizeof(hatrack_dict_item_t));
+	new_item->key   = key;
+	new_item->value = value;
+
+	hatrack_dict_replicated_apply(self, hv, new_item);
+    }
+
+    mmm_end_op();
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return !found;
+}
+
+static bool
+hatrack_dict_replicated_remove(hatrack_dict_t *self, hatrack_hash_t hv)
+{
+    bool ret;
+
+    pthread_mutex_lock(&self->write_mutex);
+    mmm_start_basic_op();
+
+    ret = hatrack_dict_replicated_apply(self, hv, NULL);
+
+    mmm_end_op();
+    pthread_mutex_unlock(&self->write_mutex);
+
+    return ret;
+}
+
+/* Must be called with the write mutex held, inside an mmm operation.
+ * If item is NULL, this is a remove.
+ *
+ * Every replica stores the same hatrack_dict_item_t, so we only need
+ * to retire the old item once.  Returns true if there was an old
+ * item.
+ */
+static bool
+hatrack_dict_replicated_apply(hatrack_dict_t      *self,
+			      hatrack_hash_t       hv,
+			      hatrack_dict_item_t *item)
+{
+    hatrack_dict_pending_t *pending;
+    hatrack_dict_item_t    *old_item;
+    hatrack_dict_item_t    *replica_old_item;
+    crown_store_t          *store;
+    crown_t                *replica;
+    uint64_t                i;
+
+    pending       = mmm_alloc_committed_with(self->record_allocator,
+					     sizeof(hatrack_dict_pending_t));
+    pending->hv   = hv;
+    pending->item = item;
+    old_item      = NULL;
+
+    atomic_store(&self->pending, pending);
+
+    for (i = 0; i < self->num_replicas; i++) {
+	replica = self->replicas[i];
+	store   = atomic_read(&replica->store_current);
+
+	if (item) {
+	    replica_old_item = crown_store_put(store, replica, hv, item, NULL, 0);
+	}
+	else {
+	    replica_old_item = crown_store_remove(store, replica, hv, NULL, 0);
+	}
+
+	if (!i) {
+	    old_item = replica_old_item;
+	}
+    }
+
+    atomic_store(&self->pending, NULL);
+    mmm_retire(pending);
+
+    hatrack_dict_place_replicas(self);
+
+    if (!old_item) {
+	return false;
+    }
+
+    if (self->free_handler) {
+	mmm_add_cleanup_handler(old_item,
+				(mmm_cleanup_func)hatrack_dict_record_eject,
+				self);
+    }
+
+    mmm_retire(old_item);
+
+    return true;
+}
+
+/* Whenever a replica's store changes (i.e., after a migration), ask
+ * the kernel to move it to the replica's node.  Called with the write
+ * mutex held (or before the dict is shared).
+ */
+static void
+hatrack_dict_place_replicas(hatrack_dict_t *self)
+{
+    crown_store_t *store;
+    uint64_t       i;
+    uint64_t       len;
+
+    if (self->num_replicas < 2) {
+	return;
+    }
+
+    for (i = 0; i < self->num_replicas; i++) {
+	store = atomic_read(&self->replicas[i]->store_current);
+
+	if (store == self->replica_stores[i]) {
+	    continue;
+	}
+
+	len = sizeof(crown_store_t)
+	    + sizeof(crown_bucket_t) * (store->last_slot + 1
+					+ store->stash_len);
+
+	hatrack_numa_place(store, len, i);
+
+	self->replica_stores[i] = store;
+    }
+
+    return;
+}
+
+/* Atomically applies a group of puts and removes, which may span
+ * multiple (transactional) dictionaries.  Every key may only appear
+ * once.
+ *
+ * Since the operations are unconditional, if the transaction fails
+ * (because some other thread changed one of the keys between our
+ * reading it and installing our entry), we just read the current
+ * items again and retry.  That only happens when some other write
+ * succeeded, so we're still lock-free.
+ */
+void
+hatrack_dict_txn_apply(hatrack_dict_txn_op_t *ops, uint64_t num_ops)
+{
+    hatrack_dict_txn_t       *txn;
+    hatrack_dict_txn_entry_t *entry;
+    hatrack_dict_txn_op_t    *op;
+    hatrack_hash_t            hvs[HATRACK_DICT_TXN_MAX_OPS];
+    uint64_t                  order[HATRACK_DICT_TXN_MAX_OPS];
+    uint64_t                  i, j;
+    uint64_t                  tmp;
+    void                     *cur;
+
+    if (!num_ops) {
+	return;
+    }
+
+    if (num_ops > HATRACK_DICT_TXN_MAX_OPS) {
+	abort();
+    }
+
+    /* Entries get installed in a fixed order, so that two
+     * transactions can never each be waiting on the other.  There
+     * are at most a handful of them, so insertion sort is fine.
+     */
+    for (i = 0; i < num_ops; i++) {
+	if (!ops[i].dict->transactional) {
+	    abort();
+	}
+
+	hvs[i]   = hatrack_dict_get_hash_value(ops[i].dict, ops[i].key);
+	order[i] = i;
+
+	for (j = i; j > 0; j--) {
+	    op = &ops[order[j - 1]];
+
+	    if (op->dict < ops[order[j]].dict) {
+		break;
+	    }
+
+	    if (op->dict == ops[order[j]].dict) {
+		if (hatrack_hashes_eq(hvs[order[j - 1]], hvs[order[j]])) {
+		    abort();
+		}
+		if (!hatrack_hash_gt(hvs[order[j - 1]], hvs[order[j]])) {
+		    break;
+		}
+	    }
+
+	    tmp          = order[j];
+	    order[j]     = order[j - 1];
+	    order[j - 1] = tmp;
+	}
+    }
+
+    mmm_start_basic_op();
+
+    while (true) {
+	txn = mmm_alloc_committed(sizeof(hatrack_dict_txn_t)
+				  + sizeof(hatrack_dict_txn_entry_t) * num_ops);
+
+	txn->num_entries = num_ops;
+
+	for (i = 0; i < num_ops; i++) {
+	    op          = &ops[order[i]];
+	    entry       = &txn->entries[i];
+	    entry->hv   = hvs[order[i]];
+	    entry->dict = op->dict;
+	    entry->txn  = txn;
+
+	    if (!op->remove) {
+		entry->new_item = mmm_alloc_committed_with(
+		    op->dict->record_allocator,
+		    sizeof(hatrack_dict_item_t));
+		entry->new_item->key   = op->key;
+		entry->new_item->value = op->value;
+	    }
+
+	    while (true) {
+		cur = hatrack_dict_txn_read(entry->dict, entry->hv);
+
+		if (!hatrack_dict_txn_tag(cur)) {
+		    break;
+		}
+
+		hatrack_dict_txn_help(cur);
+	    }
+
+	    entry->old_item = cur;
+	}
+
+	if (hatrack_dict_txn_run(txn)) {
+	    break;
+	}
+
+	// Nobody ever saw our new items; they're only visible on success.
+	for (i = 0; i < num_ops; i++) {
+	    if (txn->entries[i].new_item) {
+		mmm_retire_unused(txn->entries[i].new_item);
+	    }
+	}
+
+	mmm_retire(txn);
+    }
+
+    for (i = 0; i < num_ops; i++) {
+	entry = &txn->entries[i];
+
+	if (!entry->old_item) {
+	    continue;
+	}
+
+	if (entry->dict->free_handler) {
+	    mmm_add_cleanup_handler(entry->old_item,
+				    (mmm_cleanup_func)hatrack_dict_record_eject,
+				    entry->dict);
+	}
+
+	mmm_retire(entry->old_item);
+    }
+
+    mmm_retire(txn);
+    mmm_end_op();
+
+    return;
+}
+
+/* Single-key writes on a transactional dict.  These can't blindly
+ * overwrite a record, since it might hold a descriptor; we help
+ * finish any transaction we find, then CAS in our new item.
+ */
+static bool
+hatrack_dict_txn_single(hatrack_dict_t *self,
+			hatrack_hash_t  hv,
+			void           *key,
+			void           *value,
+			uint64_t        op)
+{
+    hatrack_dict_item_t *new_item;
+    hatrack_dict_item_t *old_item;
+
+    mmm_start_basic_op();
+
+    if (op == HATRACK_DICT_OP_REMOVE) {
+	new_item = NULL;
+    }
+    else {
+	new_item        = mmm_alloc_committed_with(self->record_allocator,
+						   sizeof(hatrack_dict_item_t));
+	new_item->key   = key;
+	new_item->value = value;
+    }
+
+    while (true) {
+	old_item = hatrack_dict_txn_read(self, hv);
+
+	if (hatrack_dict_txn_tag(old_item)) {
+	    hatrack_dict_txn_help(old_item);
+	    continue;
+	}
+
+	switch (op) {
+	case HATRACK_DICT_OP_ADD:
+	    if (old_item) {
+		goto fail;
+	    }
+	    break;
+	case HATRACK_DICT_OP_REPLACE:
+	case HATRACK_DICT_OP_REMOVE:
+	    if (!old_item) {
+		goto fail;
+	    }
+	    break;
+	default:
+	    break;
+	}
+
+	if (hatrack_dict_txn_cas(self, hv, old_item, new_item)) {
+	    break;
+	}
+    }
+
+    if (old_item) {
+	if (self->free_handler) {
+	    mmm_add_cleanup_handler(old_item,
+				    (mmm_cleanup_func)hatrack_dict_record_eject,
+				    self);
+	}
+
+	mmm_retire(old_item);
+    }
+
+    mmm_end_op();
+
+    return true;
+
+ fail:
+    if (new_item) {
+	mmm_retire_unused(new_item);
+    }
+
+    mmm_end_op();
+
+    return false;
+}
+
+/* The multi-word CAS itself.  Any thread may run this on any
+ * transaction it runs into, and they all come to the same decision.
+ */
+static bool
+hatrack_dict_txn_run(hatrack_dict_txn_t *txn)
+{
+    hatrack_dict_txn_entry_t *entry;
+    hatrack_dict_txn_entry_t *other;
+    uint64_t                  status;
+    uint64_t                  expected;
+    uint64_t                  i;
+    void                     *cur;
+    void                     *installed;
+
+    status = atomic_load(&txn->status);
+
+    if (status == HATRACK_DICT_TXN_UNDECIDED) {
+	status = HATRACK_DICT_TXN_SUCCEEDED;
+
+	for (i = 0; i < txn->num_entries; i++) {
+	    entry     = &txn->entries[i];
+	    installed = hatrack_dict_txn_add_tag(entry, HATRACK_DICT_TXN_ENTRY_TAG);
+
+	    while (true) {
+		cur = hatrack_dict_txn_install(entry);
+
+		if (cur == installed || cur == entry->old_item) {
+		    break;
+		}
+
+		if (hatrack_dict_txn_tag(cur) == HATRACK_DICT_TXN_ENTRY_TAG) {
+		    other = hatrack_dict_txn_untag(cur);
+		    hatrack_dict_txn_run(other->txn);
+		    continue;
+		}
+
+		status = HATRACK_DICT_TXN_FAILED;
+		goto decide;
+	    }
+	}
+
+    decide:
+	expected = HATRACK_DICT_TXN_UNDECIDED;
+
+	CAS(&txn->status, &expected, status);
+
+	status = atomic_load(&txn->status);
+    }
+
+    for (i = 0; i < txn->num_entries; i++) {
+	entry     = &txn->entries[i];
+	installed = hatrack_dict_txn_add_tag(entry, HATRACK_DICT_TXN_ENTRY_TAG);
+
+	hatrack_dict_txn_cas(entry->dict,
+			     entry->hv,
+			     installed,
+			     status == HATRACK_DICT_TXN_SUCCEEDED ?
+			     entry->new_item : entry->old_item);
+    }
+
+    return status == HATRACK_DICT_TXN_SUCCEEDED;
+}
+
+/* Tries to get the entry installed in its record, if the record still
+ * holds the expected item.  Returns the old item if we did the
+ * install; otherwise, whatever else we found in the record (which can
+ * be this entry, if another thread installed it).  Never returns an
+ * install descriptor; we finish those off when we see them.
+ *
+ * Each attempt uses a freshly allocated install descriptor, so that
+ * a thread finishing off a stale one can't mistake it for a newer
+ * one.
+ */
+static void *
+hatrack_dict_txn_install(hatrack_dict_txn_entry_t *entry)
+{
+    hatrack_dict_txn_install_t *install;
+    void                       *tagged;
+    void                       *cur;
+
+    install        = mmm_alloc_committed_with(entry->dict->record_allocator,
+					      sizeof(hatrack_dict_txn_install_t));
+    install->entry = entry;
+    tagged         = hatrack_dict_txn_add_tag(install,
+					      HATRACK_DICT_TXN_INSTALL_TAG);
+
+    while (true) {
+	if (hatrack_dict_txn_cas(entry->dict,
+				 entry->hv,
+				 entry->old_item,
+				 tagged)) {
+	    hatrack_dict_txn_complete(install);
+	    mmm_retire(install);
+
+	    return entry->old_item;
+	}
+
+	cur = hatrack_dict_txn_read(entry->dict, entry->hv);
+
+	if (hatrack_dict_txn_tag(cur) == HATRACK_DICT_TXN_INSTALL_TAG) {
+	    hatrack_dict_txn_complete(hatrack_dict_txn_untag(cur));
+	    continue;
+	}
+
+	if (cur == entry->old_item) {
+	    continue;
+	}
+
+	mmm_retire_unused(install);
+
+	return cur;
+    }
+}
+
+static void
+hatrack_dict_txn_complete(hatrack_dict_txn_install_t *install)
+{
+    hatrack_dict_txn_entry_t *entry;
+    void                     *item;
+
+    entry = install->entry;
+
+    if (atomic_load(&entry->txn->status) == HATRACK_DICT_TXN_UNDECIDED) {
+	item = hatrack_dict_txn_add_tag(entry, HATRACK_DICT_TXN_ENTRY_TAG);
+    }
+    else {
+	item = entry->old_item;
+    }
+
+    hatrack_dict_txn_cas(entry->dict,
+			 entry->hv,
+			 hatrack_dict_txn_add_tag(install,
+						  HATRACK_DICT_TXN_INSTALL_TAG),
+			 item);
+
+    return;
+}
+
+static void
+hatrack_dict_txn_help(void *item)
+{
+    hatrack_dict_txn_entry_t *entry;
+
+    if (hatrack_dict_txn_tag(item) == HATRACK_DICT_TXN_INSTALL_TAG) {
+	hatrack_dict_txn_complete(hatrack_dict_txn_untag(item));
+	return;
+    }
+
+    entry = hatrack_dict_txn_untag(item);
+
+    hatrack_dict_txn_run(entry->txn);
+
+    return;
+}
+
+/* Replaces any descriptors in a view with the items they stand for,
+ * dropping the ones that stand for keys that aren't there.
+ */
+static hatrack_view_t *
+hatrack_dict_txn_fix_view(hatrack_view_t *view, uint64_t *num)
+{
+    uint64_t i;
+    uint64_t n;
+
+    n = 0;
+
+    for (i = 0; i < *num; i++) {
+	if (hatrack_dict_txn_tag(view[i].item)) {
+	    view[i].item = hatrack_dict_txn_resolve(view[i].item);
+
+	    if (!view[i].item) {
+		continue;
+	    }
+	}
+
+	view[n++] = view[i];
+    }
+
+    *num = n;
+
+    return view;
+}
+
+static void
+hatrack_dict_scan_one(hatrack_hash_t hv, void *record_item, void *arg)
+{
+    hatrack_dict_scan_ctx_t *ctx;
+    hatrack_dict_item_t     *item;
+
+    ctx  = (hatrack_dict_scan_ctx_t *)arg;
+    item = (hatrack_dict_item_t *)record_item;
+
+    if (hatrack_dict_txn_tag(item)) {
+	item = hatrack_dict_txn_resolve(item);
+
+	if (!item) {
+	    return;
+	}
+    }
+
+    if (ctx->dict->key_return_hook) {
+	(*ctx->dict->key_return_hook)(ctx->dict, item->key);
+    }
+
+    if (ctx->dict->val_return_hook) {
+	(*ctx->dict->val_return_hook)(ctx->dict, item->value);
+    }
+
+    (*ctx->hook)(ctx->arg, item->key, item->value);
+
+    ctx->count++;
+
+    return;
+}
+
+/* We remove whatever item is current for the hash value, which might
+ * not be the one the scan saw, if it was overwritten in the meantime.
+ */
+static void
+hatrack_dict_extract_one(hatrack_hash_t hv, void *record_item, void *arg)
+{
+    hatrack_dict_scan_ctx_t *ctx;
+    hatrack_dict_t          *dict;
+    hatrack_dict_item_t     *item;
+    crown_store_t           *store;
+
+    ctx  = (hatrack_dict_scan_ctx_t *)arg;
+    dict = ctx->dict;
+
+    if (dict->transactional) {
+	while (true) {
+	    item = hatrack_dict_txn_read(dict, hv);
+
+	    if (hatrack_dict_txn_tag(item)) {
+		hatrack_dict_txn_help(item);
+		continue;
+	    }
+
+	    if (!item) {
+		return;
+	    }
+
+	    if (hatrack_dict_txn_cas(dict, hv, item, NULL)) {
+		break;
+	    }
+	}
+    }
+    else {
+	store = atomic_read(&dict->crown_instance.store_current);
+	item  = crown_store_remove(store, &dict->crown_instance, hv, NULL, 0);
+
+	if (!item) {
+	    return;
+	}
+    }
+
+    (*ctx->hook)(ctx->arg, item->key, item->value);
+
+    ctx->count++;
+
+    mmm_retire(item);
+
+    return;
+}
+
+/* Frozen dictionaries.
+ *
+ * hatrack_dict_freeze() copies the same consistent snapshot that a
+ * consistent view would get into a bucketized cuckoo table.  We build
+ * it from the hash values stored in crown's buckets, so no key gets
+ * hashed again.
+ *
+ * Each key has two candidate buckets, one picked by each 64-bit half
+ * of its hash value.  To insert, we take any open slot in either
+ * bucket; if both are full, we evict an item from one of them into
+ * its other bucket, and so on, up to HATRACK_DICT_FROZEN_MAX_KICKS
+ * times.  If that doesn't work, we start over with more buckets.  We
+ * size the table for a 90% load to start with, which with four slots
+ * per bucket nearly always works the first time.
+ *
+ * The build runs on the calling thread.  We've thought about
+ * splitting it up across threads, but it isn't worth it: a
+ * placement is usually a couple of loads and stores into a bucket
+ * that's already in cache, so the whole build goes about as fast as
+ * memory can take it; copying items out of crown already costs about
+ * as much; and a freeze is a one-time cost for a table that's meant
+ * to be read many times.  Going parallel would also need the two
+ * candidate buckets of a key to fall in the same thread's range,
+ * which they generally don't, so every insertion would need atomics
+ * (or a second, serial pass for anything that crosses ranges), and
+ * any thread's failure would still force everyone to start over.
+ *
+ * Lookups check at most two buckets, with plain loads, and since the
+ * table never changes, they don't need mmm either.  The keys and
+ * values are the same pointers that were in the dictionary, so they
+ * need to stay valid for as long as the frozen copy is in use.  The
+ * return hooks get called as for the dictionary, but with the frozen
+ * copy as their first argument.
+ */
+#ifdef HAVE___INT128_T
+static inline uint64_t
+hatrack_dict_frozen_word(hatrack_hash_t hv, uint64_t which)
+{
+    return which ? (uint64_t)(hv >> 64) : (uint64_t)hv;
+}
+
+// Maps the word onto [0, num_buckets) without a division.
+static inline uint64_t
+hatrack_dict_frozen_index(hatrack_dict_frozen_t *self,
+			  hatrack_hash_t         hv,
+			  uint64_t               which)
+{
+    __uint128_t n;
+
+    n = (__uint128_t)hatrack_dict_frozen_word(hv, which) * self->num_buckets;
+
+    return (uint64_t)(n >> 64);
+}
+#else
+static inline uint64_t
+hatrack_dict_frozen_word(hatrack_hash_t hv, uint64_t which)
+{
+    return which ? hv.w2 : hv.w1;
+}
+
+static inline uint64_t
+hatrack_dict_frozen_index(hatrack_dict_frozen_t *self,
+			  hatrack_hash_t         hv,
+			  uint64_t               which)
+{
+    return hatrack_dict_frozen_word(hv, which) % self->num_buckets;
+}
+#endif
+
+hatrack_dict_frozen_t *
+hatrack_dict_freeze(hatrack_dict_t *self)
+{
+    hatrack_dict_frozen_t *ret;
+    hatrack_dict_item_t   *item;
+    hatrack_dict_item_t   *items;
+    hatrack_hash_t        *hashes;
+    crown_store_t         *store;
+    crown_bucket_t        *bucket;
+    crown_record_t         record;
+    uint64_t               end;
+    uint64_t               n;
+    uint64_t               i;
+
+    mmm_start_basic_op();
+
+    store  = crown_store_claim(hatrack_dict_local_crown(self));
+    end    = store->last_slot + 1 + store->stash_len;
+    hashes = (hatrack_hash_t *)hatrack_malloc(sizeof(hatrack_hash_t) * end);
+    items  = (hatrack_dict_item_t *)hatrack_malloc(
+	sizeof(hatrack_dict_item_t) * end);
+    n      = 0;
+
+    for (i = 0; i < end; i++) {
+	bucket = &store->buckets[i];
+	record = atomic_read(&bucket->record);
+
+	if (!(record.info & CROWN_EPOCH_MASK)) {
+	    continue;
+	}
+
+	item = (hatrack_dict_item_t *)record.item;
+
+	if (hatrack_dict_txn_tag(item)) {
+	    item = hatrack_dict_txn_resolve(item);
+
+	    if (!item) {
+		continue;
+	    }
+	}
+
+	hashes[n] = atomic_read(&bucket->hv);
+	items[n]  = *item;
+	n++;
+    }
+
+    mmm_retire(store);
+    mmm_end_op();
+
+    ret                  = (hatrack_dict_frozen_t *)hatrack_zalloc(
+	sizeof(hatrack_dict_frozen_t));
+    ret->item_count      = n;
+    ret->key_type        = self->key_type;
+    ret->hash_info       = self->hash_info;
+    ret->key_return_hook = self->key_return_hook;
+    ret->val_return_hook = self->val_return_hook;
+    ret->num_buckets     = (n * 10 + HATRACK_DICT_FROZEN_SLOTS * 9 - 1)
+	/ (HATRACK_DICT_FROZEN_SLOTS * 9);
+
+    if (!ret->num_buckets) {
+	ret->num_buckets = 1;
+    }
+
+    while (true) {
+	// The extra line lets us align the buckets to a cache line.
+	ret->alloc_len = sizeof(hatrack_dict_frozen_bucket_t)
+	    * ret->num_buckets + 64;
+	ret->mem       = hatrack_zalloc(ret->alloc_len);
+	ret->buckets   = (hatrack_dict_frozen_bucket_t *)
+	    (((uintptr_t)ret->mem + 63) & ~(uintptr_t)63);
+
+	for (i = 0; i < n; i++) {
+	    if (!hatrack_dict_frozen_insert(ret, hashes[i], items[i])) {
+		break;
+	    }
+	}
+
+	if (i == n) {
+	    break;
+	}
+
+	hatrack_free(ret->mem, ret->alloc_len);
+
+	ret->num_buckets += (ret->num_buckets >> 3) + 1;
+    }
+
+    hatrack_free(hashes, sizeof(hatrack_hash_t) * end);
+    hatrack_free(items, sizeof(hatrack_dict_item_t) * end);
+
+    return ret;
+}
+
+void *
+hatrack_dict_frozen_get(hatrack_dict_frozen_t *self, void *key, bool *found)
+{
+    hatrack_hash_t                hv;
+    hatrack_dict_frozen_bucket_t *bucket;
+    uint64_t                      which;
+    uint64_t                      i;
+
+    hv = hatrack_dict_hash_key(self->key_type, &self->hash_info, key);
+
+    for (which = 0; which < 2; which++) {
+	bucket = &self->buckets[hatrack_dict_frozen_index(self, hv, which)];
+
+	for (i = 0; i < HATRACK_DICT_FROZEN_SLOTS; i++) {
+	    if (!hatrack_hashes_eq(hv, bucket->hv[i])) {
+		continue;
+	    }
+
+	    if (found) {
+		*found = true;
+	    }
+
+	    if (self->val_return_hook) {
+		(*self->val_return_hook)(self, bucket->items[i].value);
+	    }
+
+	    return bucket->items[i].value;
+	}
+    }
+
+    if (found) {
+	*found = false;
+    }
+
+    return NULL;
+}
+
+uint64_t
+hatrack_dict_frozen_len(hatrack_dict_frozen_t *self)
+{
+    return self->item_count;
+}
+
+/* Returns the items in no particular order. */
+hatrack_dict_item_t *
+hatrack_dict_frozen_items(hatrack_dict_frozen_t *self, uint64_t *num)
+{
+    hatrack_dict_item_t          *ret;
+    hatrack_dict_frozen_bucket_t *bucket;
+    uint64_t                      n;
+    uint64_t                      i;
+    uint64_t                      j;
+
+    ret = (hatrack_dict_item_t *)hatrack_malloc(sizeof(hatrack_dict_item_t)
+						* self->item_count);
+    n   = 0;
+
+    for (i = 0; i < self->num_buckets; i++) {
+	bucket = &self->buckets[i];
+
+	for (j = 0; j < HATRACK_DICT_FROZEN_SLOTS; j++) {
+	    if (hatrack_bucket_unreserved(bucket->hv[j])) {
+		continue;
+	    }
+
+	    ret[n++] = bucket->items[j];
+
+	    if (self->key_return_hook) {
+		(*self->key_return_hook)(self, bucket->items[j].key);
+	    }
+	    if (self->val_return_hook) {
+		(*self->val_return_hook)(self, bucket->items[j].value);
+	    }
+	}
+    }
+
+    *num = n;
+
+    return ret;
+}
+
+void
+hatrack_dict_frozen_delete(hatrack_dict_frozen_t *self)
+{
+    hatrack_free(self->mem, self->alloc_len);
+    hatrack_free(self, sizeof(hatrack_dict_frozen_t));
+
+    return;
+}
+
+/* Returns false if we gave up, in which case some item (not
+ * necessarily this one) didn't make it into the table, and the caller
+ * needs to start over.
+ */
+static bool
+hatrack_dict_frozen_insert(hatrack_dict_frozen_t *self,
+			   hatrack_hash_t         hv,
+			   hatrack_dict_item_t    item)
+{
+    hatrack_dict_frozen_bucket_t *bucket;
+    hatrack_hash_t                evicted_hv;
+    hatrack_dict_item_t           evicted_item;
+    uint64_t                      bix;
+    uint64_t                      which;
+    uint64_t                      kicks;
+    uint64_t                      i;
+
+    bix = hatrack_dict_frozen_index(self, hv, 0);
+
+    for (kicks = 0; kicks <= HATRACK_DICT_FROZEN_MAX_KICKS; kicks++) {
+	for (which = 0; which < 2; which++) {
+	    bucket = &self->buckets[hatrack_dict_frozen_index(self, hv, which)];
+
+	    for (i = 0; i < HATRACK_DICT_FROZEN_SLOTS; i++) {
+		if (hatrack_bucket_unreserved(bucket->hv[i])) {
+		    bucket->hv[i]    = hv;
+		    bucket->items[i] = item;
+
+		    return true;
+		}
+	    }
+	}
+
+	// Both buckets are full, so evict someone from bix, picking
+	// the slot with a few bits of our hash, so we don't cycle.
+	bucket           = &self->buckets[bix];
+	i                = (hatrack_dict_frozen_word(hv, 1) + kicks)
+	    % HATRACK_DICT_FROZEN_SLOTS;
+	evicted_hv       = bucket->hv[i];
+	evicted_item     = bucket->items[i];
+	bucket->hv[i]    = hv;
+	bucket->items[i] = item;
+	hv               = evicted_hv;
+	item             = evicted_item;
+
+	if (hatrack_dict_frozen_index(self, hv, 0) == bix) {
+	    bix = hatrack_dict_frozen_index(self, hv, 1);
+	}
+	else {
+	    bix = hatrack_dict_frozen_index(self, hv, 0);
+	}
+    }
+
+    return false;
+}
@@ -0,0 +1,842 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           intset.c
+ *  Description:    A compact, lock-free set of 32-bit integers.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#include <string.h>
+
+typedef _Atomic(hatrack_intset_container_t *) hatrack_intset_slot_t;
+
+/* Set operations keep some combination of: items only in the first
+ * set, items in both, and items only in the second set.
+ */
+enum {
+    HATRACK_INTSET_KEEP_LEFT  = 0x01,
+    HATRACK_INTSET_KEEP_BOTH  = 0x02,
+    HATRACK_INTSET_KEEP_RIGHT = 0x04
+};
+
+/* Working space for the set operations, so we're not putting 40K on
+ * the stack.  values needs room for two full arrays.
+ */
+typedef struct {
+    uint64_t left[HATRACK_INTSET_BITMAP_WORDS];
+    uint64_t right[HATRACK_INTSET_BITMAP_WORDS];
+    uint64_t result[HATRACK_INTSET_BITMAP_WORDS];
+    uint16_t values[HATRACK_INTSET_ARRAY_MAX * 2];
+} hatrack_intset_scratch_t;
+
+// clang-format off
+static hatrack_intset_slot_t      *hatrack_intset_slot        (hatrack_intset_t *,
+							       uint32_t, bool);
+static bool                        hatrack_intset_array_find  (hatrack_intset_container_t *,
+							       uint16_t, uint32_t *);
+static hatrack_intset_container_t *hatrack_intset_array_new   (uint16_t *, uint32_t);
+static hatrack_intset_container_t *hatrack_intset_array_insert(hatrack_intset_container_t *,
+							       uint16_t, uint32_t);
+static hatrack_intset_container_t *hatrack_intset_array_remove(hatrack_intset_container_t *,
+							       uint32_t);
+static hatrack_intset_container_t *hatrack_intset_bitmap_new  (uint64_t *, uint32_t);
+static hatrack_intset_t           *hatrack_intset_combine     (hatrack_intset_t *,
+							       hatrack_intset_t *,
+							       uint32_t);
+static hatrack_intset_container_t *hatrack_intset_combine_chunk(hatrack_intset_container_t *,
+								hatrack_intset_container_t *,
+								uint32_t,
+								hatrack_intset_scratch_t *);
+// clang-format on
+
+static inline uint16_t *
+hatrack_intset_values(hatrack_intset_container_t *container)
+{
+    return (uint16_t *)container->contents;
+}
+
+static inline _Atomic uint64_t *
+hatrack_intset_words(hatrack_intset_container_t *container)
+{
+    return (_Atomic uint64_t *)container->contents;
+}
+
+hatrack_intset_t *
+hatrack_intset_new(void)
+{
+    hatrack_intset_t *ret;
+
+    ret = (hatrack_intset_t *)hatrack_malloc(sizeof(hatrack_intset_t));
+
+    hatrack_intset_init(ret);
+
+    return ret;
+}
+
+void
+hatrack_intset_init(hatrack_intset_t *self)
+{
+    uint64_t i;
+
+    for (i = 0; i < 256; i++) {
+        atomic_store(&self->pages[i], NULL);
+    }
+
+    hatrack_shardctr_init(&self->item_count, 0);
+
+    return;
+}
+
+// Like the other cleanup functions, this assumes nobody else is
+// still using the set.
+void
+hatrack_intset_cleanup(hatrack_intset_t *self)
+{
+    hatrack_intset_page_t      *page;
+    hatrack_intset_container_t *container;
+    uint64_t                    i, j;
+
+    for (i = 0; i < 256; i++) {
+        page = atomic_load(&self->pages[i]);
+
+        if (!page) {
+            continue;
+        }
+
+        for (j = 0; j < 256; j++) {
+            container = atomic_load(&page->chunks[j]);
+
+            if (container) {
+                mmm_retire_unused(container);
+            }
+        }
+
+        hatrack_free(page, sizeof(hatrack_intset_page_t));
+    }
+
+    return;
+}
+
+void
+hatrack_intset_delete(hatrack_intset_t *self)
+{
+    hatrack_intset_cleanup(self);
+    hatrack_free(self, sizeof(hatrack_intset_t));
+
+    return;
+}
+
+bool
+hatrack_intset_contains(hatrack_intset_t *self, uint32_t item)
+{
+    hatrack_intset_slot_t      *slot;
+    hatrack_intset_container_t *cur;
+    uint16_t                    low;
+    uint32_t                    ix;
+    bool                        ret;
+
+    low = (uint16_t)item;
+
+    mmm_start_basic_op();
+
+    slot = hatrack_intset_slot(self, item >> 16, false);
+
+    if (!slot || !(cur = atomic_read(slot))) {
+        mmm_end_op();
+        return false;
+    }
+
+    if (cur->kind == HATRACK_INTSET_BITMAP) {
+        ret = (atomic_read(&hatrack_intset_words(cur)[low >> 6])
+               >> (low & 63))
+            & 1;
+    }
+    else {
+        ret = hatrack_intset_array_find(cur, low, &ix);
+    }
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Returns true if the item wasn't already in the set.
+ *
+ * Bitmaps get updated in place.  Otherwise, we build a new container
+ * with the item in it, and try to swap it in; if someone else swapped
+ * in a different container first, we start over with that one.
+ */
+bool
+hatrack_intset_add(hatrack_intset_t *self, uint32_t item)
+{
+    hatrack_intset_slot_t      *slot;
+    hatrack_intset_container_t *cur;
+    hatrack_intset_container_t *candidate;
+    uint16_t                    low;
+    uint32_t                    ix;
+    uint64_t                    bit;
+
+    low = (uint16_t)item;
+    bit = 1ULL << (low & 63);
+
+    mmm_start_basic_op();
+
+    slot = hatrack_intset_slot(self, item >> 16, true);
+    cur  = atomic_read(slot);
+
+    while (true) {
+        if (cur && cur->kind == HATRACK_INTSET_BITMAP) {
+            if (atomic_fetch_or(&hatrack_intset_words(cur)[low >> 6], bit)
+                & bit) {
+                mmm_end_op();
+                return false;
+            }
+
+            atomic_fetch_add(&cur->cardinality, 1);
+            break;
+        }
+
+        if (!cur) {
+            candidate = hatrack_intset_array_new(&low, 1);
+        }
+        else {
+            if (hatrack_intset_array_find(cur, low, &ix)) {
+                mmm_end_op();
+                return false;
+            }
+
+            candidate = hatrack_intset_array_insert(cur, low, ix);
+        }
+
+        if (CAS(slot, &cur, candidate)) {
+            if (cur) {
+                mmm_retire(cur);
+            }
+            break;
+        }
+
+        mmm_retire_unused(candidate);
+    }
+
+    hatrack_shardctr_add(&self->item_count, 1);
+
+    mmm_end_op();
+
+    return true;
+}
+
+// Returns true if the item was in the set.
+bool
+hatrack_intset_remove(hatrack_intset_t *self, uint32_t item)
+{
+    hatrack_intset_slot_t      *slot;
+    hatrack_intset_container_t *cur;
+    hatrack_intset_container_t *candidate;
+    uint16_t                    low;
+    uint32_t                    ix;
+    uint64_t                    bit;
+
+    low = (uint16_t)item;
+    bit = 1ULL << (low & 63);
+
+    mmm_start_basic_op();
+
+    slot = hatrack_intset_slot(self, item >> 16, false);
+
+    if (!slot) {
+        mmm_end_op();
+        return false;
+    }
+
+    cur = atomic_read(slot);
+
+    while (true) {
+        if (!cur) {
+            mmm_end_op();
+            return false;
+        }
+
+        if (cur->kind == HATRACK_INTSET_BITMAP) {
+            if (!(atomic_fetch_and(&hatrack_intset_words(cur)[low >> 6], ~bit)
+                  & bit)) {
+                mmm_end_op();
+                return false;
+            }
+
+            atomic_fetch_sub(&cur->cardinality, 1);
+            break;
+        }
+
+        if (!hatrack_intset_array_find(cur, low, &ix)) {
+            mmm_end_op();
+            return false;
+        }
+
+        if (cur->cardinality == 1) {
+            candidate = NULL;
+        }
+        else {
+            candidate = hatrack_intset_array_remove(cur, ix);
+        }
+
+        if (CAS(slot, &cur, candidate)) {
+            mmm_retire(cur);
+            break;
+        }
+
+        if (candidate) {
+            mmm_retire_unused(candidate);
+        }
+    }
+
+    hatrack_shardctr_add(&self->item_count, -1);
+
+    mmm_end_op();
+
+    return true;
+}
+
+uint64_t
+hatrack_intset_len(hatrack_intset_t *self)
+{
+    return hatrack_shardctr_read(&self->item_count);
+}
+
+/* Returns the items in ascending order, in memory from
+ * hatrack_malloc(), which the caller should free with
+ * hatrack_free(items, sizeof(uint32_t) * num).  Returns NULL if the
+ * set is empty.
+ *
+ * As with the set operations, each chunk is read as of when we get
+ * to it.
+ */
+uint32_t *
+hatrack_intset_items(hatrack_intset_t *self, uint64_t *num)
+{
+    hatrack_intset_page_t      *page;
+    hatrack_intset_container_t *container;
+    uint32_t                   *ret;
+    uint16_t                   *values;
+    uint64_t                    word;
+    uint64_t                    cap;
+    uint64_t                    new_cap;
+    uint64_t                    n;
+    uint64_t                    i, j, k;
+    uint32_t                    high;
+
+    n   = 0;
+    cap = hatrack_shardctr_read_approx(&self->item_count) + 16;
+    ret = (uint32_t *)hatrack_malloc(sizeof(uint32_t) * cap);
+
+    mmm_start_basic_op();
+
+    for (i = 0; i < 256; i++) {
+        page = atomic_read(&self->pages[i]);
+
+        if (!page) {
+            continue;
+        }
+
+        for (j = 0; j < 256; j++) {
+            container = atomic_read(&page->chunks[j]);
+
+            if (!container) {
+                continue;
+            }
+
+            high = (uint32_t)((i << 24) | (j << 16));
+
+            /* A bitmap's cardinality gets updated separately from its
+             * bits, so a racing add and remove can briefly wrap it
+             * below zero.  We only trust it for arrays, where it
+             * never changes; bitmaps grow the buffer bit by bit,
+             * below.
+             */
+            if (container->kind == HATRACK_INTSET_ARRAY) {
+                if (n + container->cardinality > cap) {
+                    new_cap = (cap << 1) + container->cardinality;
+                    ret     = (uint32_t *)hatrack_realloc(ret,
+                                                      sizeof(uint32_t) * cap,
+                                                      sizeof(uint32_t)
+                                                          * new_cap);
+                    cap     = new_cap;
+                }
+
+                values = hatrack_intset_values(container);
+
+                for (k = 0; k < container->cardinality; k++) {
+                    ret[n++] = high | values[k];
+                }
+                continue;
+            }
+
+            for (k = 0; k < HATRACK_INTSET_BITMAP_WORDS; k++) {
+                word = atomic_read(&hatrack_intset_words(container)[k]);
+
+                // Bitmaps can change under us, so we still need to check.
+                while (word) {
+                    if (n == cap) {
+                        ret = (uint32_t *)hatrack_realloc(
+                            ret,
+                            sizeof(uint32_t) * cap,
+                            sizeof(uint32_t) * (cap << 1));
+                        cap <<= 1;
+                    }
+                    ret[n++] = high | (k << 6) | __builtin_ctzll(word);
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    mmm_end_op();
+
+    *num = n;
+
+    if (!n) {
+        hatrack_free(ret, sizeof(uint32_t) * cap);
+        return NULL;
+    }
+
+    return (uint32_t *)hatrack_realloc(ret,
+                                       sizeof(uint32_t) * cap,
+                                       sizeof(uint32_t) * n);
+}
+
+// Items in self that aren't in other.
+hatrack_intset_t *
+hatrack_intset_difference(hatrack_intset_t *self, hatrack_intset_t *other)
+{
+    return hatrack_intset_combine(self, other, HATRACK_INTSET_KEEP_LEFT);
+}
+
+hatrack_intset_t *
+hatrack_intset_union(hatrack_intset_t *self, hatrack_intset_t *other)
+{
+    return hatrack_intset_combine(self,
+                                  other,
+                                  HATRACK_INTSET_KEEP_LEFT
+                                      | HATRACK_INTSET_KEEP_BOTH
+                                      | HATRACK_INTSET_KEEP_RIGHT);
+}
+
+hatrack_intset_t *
+hatrack_intset_intersection(hatrack_intset_t *self, hatrack_intset_t *other)
+{
+    return hatrack_intset_combine(self, other, HATRACK_INTSET_KEEP_BOTH);
+}
+
+// Items in exactly one of the two sets.
+hatrack_intset_t *
+hatrack_intset_disjunction(hatrack_intset_t *self, hatrack_intset_t *other)
+{
+    return hatrack_intset_combine(self,
+                                  other,
+                                  HATRACK_INTSET_KEEP_LEFT
+                                      | HATRACK_INTSET_KEEP_RIGHT);
+}
+
+static hatrack_intset_slot_t *
+hatrack_intset_slot(hatrack_intset_t *self, uint32_t chunk, bool create)
+{
+    hatrack_intset_page_t *page;
+    hatrack_intset_page_t *expected;
+
+    page = atomic_read(&self->pages[chunk >> 8]);
+
+    if (!page) {
+        if (!create) {
+            return NULL;
+        }
+
+        page     = hatrack_zalloc(sizeof(hatrack_intset_page_t));
+        expected = NULL;
+
+        if (!CAS(&self->pages[chunk >> 8], &expected, page)) {
+            hatrack_free(page, sizeof(hatrack_intset_page_t));
+            page = expected;
+        }
+    }
+
+    return &page->chunks[chunk & 0xff];
+}
+
+/* Binary search.  On failure, *ix is where the value would get
+ * inserted.
+ */
+static bool
+hatrack_intset_array_find(hatrack_intset_container_t *container,
+                          uint16_t                    value,
+                          uint32_t                   *ix)
+{
+    uint16_t *values;
+    uint32_t  low;
+    uint32_t  high;
+    uint32_t  mid;
+
+    values = hatrack_intset_values(container);
+    low    = 0;
+    high   = container->cardinality;
+
+    while (low < high) {
+        mid = (low + high) >> 1;
+
+        if (values[mid] < value) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    *ix = low;
+
+    return low < container->cardinality && values[low] == value;
+}
+
+static hatrack_intset_container_t *
+hatrack_intset_array_new(uint16_t *values, uint32_t n)
+{
+    hatrack_intset_container_t *ret;
+
+    ret = mmm_alloc_committed(sizeof(hatrack_intset_container_t)
+                              + sizeof(uint16_t) * n);
+
+    ret->kind = HATRACK_INTSET_ARRAY;
+
+    atomic_store(&ret->cardinality, n);
+    memcpy(hatrack_intset_values(ret), values, sizeof(uint16_t) * n);
+
+    return ret;
+}
+
+// Once an array would go over HATRACK_INTSET_ARRAY_MAX, we switch to
+// a bitmap.
+static hatrack_intset_container_t *
+hatrack_intset_array_insert(hatrack_intset_container_t *container,
+                            uint16_t                    value,
+                            uint32_t                    ix)
+{
+    hatrack_intset_container_t *ret;
+    uint16_t                   *old_values;
+    uint16_t                   *new_values;
+    _Atomic uint64_t           *words;
+    uint32_t                    n;
+    uint32_t                    i;
+
+    n          = container->cardinality;
+    old_values = hatrack_intset_values(container);
+
+    if (n >= HATRACK_INTSET_ARRAY_MAX) {
+        ret = hatrack_intset_bitmap_new(NULL, n + 1);
+
+        words = hatrack_intset_words(ret);
+
+        for (i = 0; i < n; i++) {
+            atomic_fetch_or_explicit(&words[old_values[i] >> 6],
+                                     1ULL << (old_values[i] & 63),
+                                     memory_order_relaxed);
+        }
+
+        atomic_fetch_or_explicit(&words[value >> 6],
+                                 1ULL << (value & 63),
+                                 memory_order_relaxed);
+
+        return ret;
+    }
+
+    ret = mmm_alloc_committed(sizeof(hatrack_intset_container_t)
+                              + sizeof(uint16_t) * (n + 1));
+
+    ret->kind  = HATRACK_INTSET_ARRAY;
+    new_values = hatrack_intset_values(ret);
+
+    atomic_store(&ret->cardinality, n + 1);
+
+    memcpy(new_values, old_values, sizeof(uint16_t) * ix);
+    new_values[ix] = value;
+    memcpy(new_values + ix + 1, old_values + ix, sizeof(uint16_t) * (n - ix));
+
+    return ret;
+}
+
+static hatrack_intset_container_t *
+hatrack_intset_array_remove(hatrack_intset_container_t *container, uint32_t ix)
+{
+    hatrack_intset_container_t *ret;
+    uint16_t                   *old_values;
+    uint16_t                   *new_values;
+    uint32_t                    n;
+
+    n          = container->cardinality;
+    old_values = hatrack_intset_values(container);
+    ret        = mmm_alloc_committed(sizeof(hatrack_intset_container_t)
+                              + sizeof(uint16_t) * (n - 1));
+    ret->kind  = HATRACK_INTSET_ARRAY;
+    new_values = hatrack_intset_values(ret);
+
+    atomic_store(&ret->cardinality, n - 1);
+
+    memcpy(new_values, old_values, sizeof(uint16_t) * ix);
+    memcpy(new_values + ix,
+           old_values + ix + 1,
+           sizeof(uint16_t) * (n - ix - 1));
+
+    return ret;
+}
+
+// Passing NULL for words gives an empty bitmap.
+static hatrack_intset_container_t *
+hatrack_intset_bitmap_new(uint64_t *words, uint32_t cardinality)
+{
+    hatrack_intset_container_t *ret;
+
+    ret = mmm_alloc_committed(sizeof(hatrack_intset_container_t)
+                              + sizeof(uint64_t) * HATRACK_INTSET_BITMAP_WORDS);
+
+    ret->kind = HATRACK_INTSET_BITMAP;
+
+    atomic_store(&ret->cardinality, cardinality);
+
+    if (words) {
+        memcpy(ret->contents,
+               words,
+               sizeof(uint64_t) * HATRACK_INTSET_BITMAP_WORDS);
+    }
+
+    return ret;
+}
+
+static hatrack_intset_t *
+hatrack_intset_combine(hatrack_intset_t *left,
+                       hatrack_intset_t *right,
+                       uint32_t          keep)
+{
+    hatrack_intset_t           *ret;
+    hatrack_intset_scratch_t   *scratch;
+    hatrack_intset_page_t      *left_page;
+    hatrack_intset_page_t      *right_page;
+    hatrack_intset_container_t *left_chunk;
+    hatrack_intset_container_t *right_chunk;
+    hatrack_intset_container_t *chunk;
+    uint64_t                    i, j;
+
+    ret     = hatrack_intset_new();
+    scratch = hatrack_malloc(sizeof(hatrack_intset_scratch_t));
+
+    mmm_start_basic_op();
+
+    for (i = 0; i < 256; i++) {
+        left_page  = atomic_read(&left->pages[i]);
+        right_page = atomic_read(&right->pages[i]);
+
+        if (!left_page && !right_page) {
+            continue;
+        }
+
+        if (!left_page && !(keep & HATRACK_INTSET_KEEP_RIGHT)) {
+            continue;
+        }
+
+        if (!right_page && !(keep & HATRACK_INTSET_KEEP_LEFT)) {
+            continue;
+        }
+
+        for (j = 0; j < 256; j++) {
+            left_chunk  = left_page ? atomic_read(&left_page->chunks[j]) : NULL;
+            right_chunk = right_page ? atomic_read(&right_page->chunks[j])
+                                     : NULL;
+            chunk       = hatrack_intset_combine_chunk(left_chunk,
+                                                 right_chunk,
+                                                 keep,
+                                                 scratch);
+            if (!chunk) {
+                continue;
+            }
+
+            atomic_store(hatrack_intset_slot(ret, (i << 8) | j, true), chunk);
+            hatrack_shardctr_add(&ret->item_count, chunk->cardinality);
+        }
+    }
+
+    mmm_end_op();
+
+    hatrack_free(scratch, sizeof(hatrack_intset_scratch_t));
+
+    return ret;
+}
+
+/* When neither side is a bitmap, we merge the two sorted arrays.
+ * Otherwise, we turn any array into a bitmap, and combine the bitmaps
+ * a word at a time.
+ *
+ * We read bitmaps from the input sets with plain loads, so the
+ * compiler can vectorize the loops; on the platforms we support,
+ * that's no different from a relaxed atomic load.
+ */
+static hatrack_intset_container_t *
+hatrack_intset_combine_chunk(hatrack_intset_container_t *left,
+                             hatrack_intset_container_t *right,
+                             uint32_t                    keep,
+                             hatrack_intset_scratch_t   *scratch)
+{
+    uint16_t *lvals;
+    uint16_t *rvals;
+    uint32_t  ln;
+    uint32_t  rn;
+    uint32_t  li;
+    uint32_t  ri;
+    uint32_t  n;
+    uint64_t *lwords;
+    uint64_t *rwords;
+    uint64_t  lmask;
+    uint64_t  bmask;
+    uint64_t  rmask;
+    uint64_t  i;
+
+    if (!left && !right) {
+        return NULL;
+    }
+
+    if ((!left || left->kind == HATRACK_INTSET_ARRAY)
+        && (!right || right->kind == HATRACK_INTSET_ARRAY)) {
+        lvals = left ? hatrack_intset_values(left) : NULL;
+        rvals = right ? hatrack_intset_values(right) : NULL;
+        ln    = left ? left->cardinality : 0;
+        rn    = right ? right->cardinality : 0;
+        li    = 0;
+        ri    = 0;
+        n     = 0;
+
+        while (li < ln && ri < rn) {
+            if (lvals[li] < rvals[ri]) {
+                if (keep & HATRACK_INTSET_KEEP_LEFT) {
+                    scratch->values[n++] = lvals[li];
+                }
+                li++;
+            }
+            else if (lvals[li] > rvals[ri]) {
+                if (keep & HATRACK_INTSET_KEEP_RIGHT) {
+                    scratch->values[n++] = rvals[ri];
+                }
+                ri++;
+            }
+            else {
+                if (keep & HATRACK_INTSET_KEEP_BOTH) {
+                    scratch->values[n++] = lvals[li];
+                }
+                li++;
+                ri++;
+            }
+        }
+
+        if (keep & HATRACK_INTSET_KEEP_LEFT) {
+            while (li < ln) {
+                scratch->values[n++] = lvals[li++];
+            }
+        }
+
+        if (keep & HATRACK_INTSET_KEEP_RIGHT) {
+            while (ri < rn) {
+                scratch->values[n++] = rvals[ri++];
+            }
+        }
+
+        if (!n) {
+            return NULL;
+        }
+
+        if (n <= HATRACK_INTSET_ARRAY_MAX) {
+            return hatrack_intset_array_new(scratch->values, n);
+        }
+
+        memset(scratch->result, 0, sizeof(scratch->result));
+
+        for (i = 0; i < n; i++) {
+            scratch->result[scratch->values[i] >> 6]
+                |= 1ULL << (scratch->values[i] & 63);
+        }
+
+        return hatrack_intset_bitmap_new(scratch->result, n);
+    }
+
+    if (left && left->kind == HATRACK_INTSET_BITMAP) {
+        lwords = left->contents;
+    }
+    else {
+        lwords = scratch->left;
+
+        memset(lwords, 0, sizeof(scratch->left));
+
+        for (i = 0; left && i < left->cardinality; i++) {
+            lvals = hatrack_intset_values(left);
+            lwords[lvals[i] >> 6] |= 1ULL << (lvals[i] & 63);
+        }
+    }
+
+    if (right && right->kind == HATRACK_INTSET_BITMAP) {
+        rwords = right->contents;
+    }
+    else {
+        rwords = scratch->right;
+
+        memset(rwords, 0, sizeof(scratch->right));
+
+        for (i = 0; right && i < right->cardinality; i++) {
+            rvals = hatrack_intset_values(right);
+            rwords[rvals[i] >> 6] |= 1ULL << (rvals[i] & 63);
+        }
+    }
+
+    lmask = (keep & HATRACK_INTSET_KEEP_LEFT) ? ~0ULL : 0;
+    bmask = (keep & HATRACK_INTSET_KEEP_BOTH) ? ~0ULL : 0;
+    rmask = (keep & HATRACK_INTSET_KEEP_RIGHT) ? ~0ULL : 0;
+
+    for (i = 0; i < HATRACK_INTSET_BITMAP_WORDS; i++) {
+        scratch->result[i] = (lwords[i] & ~rwords[i] & lmask)
+                           | (lwords[i] & rwords[i] & bmask)
+                           | (~lwords[i] & rwords[i] & rmask);
+    }
+
+    n = 0;
+
+    for (i = 0; i < HATRACK_INTSET_BITMAP_WORDS; i++) {
+        n += __builtin_popcountll(scratch->result[i]);
+    }
+
+    if (!n) {
+        return NULL;
+    }
+
+    if (n > HATRACK_INTSET_ARRAY_MAX) {
+        return hatrack_intset_bitmap_new(scratch->result, n);
+    }
+
+    n = 0;
+
+    for (i = 0; i < HATRACK_INTSET_BITMAP_WORDS; i++) {
+        lmask = scratch->result[i];
+
+        while (lmask) {
+            scratch->values[n++] = (i << 6) | __builtin_ctzll(lmask);
+            lmask &= lmask - 1;
+        }
+    }
+
+    return hatrack_intset_array_new(scratch->values, n);
+}
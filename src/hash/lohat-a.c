@@ -65,7 +65,7 @@ lohat_a_new(void)
 {
     lohat_a_t *ret;
 
-    ret = (lohat_a_t *)malloc(sizeof(lohat_a_t));
+    ret = (lohat_a_t *)hatrack_malloc(sizeof(lohat_a_t));
 
     lohat_a_init(ret);
 
@@ -137,7 +137,7 @@ void
 lohat_a_delete(lohat_a_t *self)
 {
     lohat_a_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(lohat_a_t));
 
     return;
 }
@@ -252,7 +252,7 @@ lohat_a_view(lohat_a_t *self, uint64_t *out_num, bool sort)
         end = store->hist_end;
     }
 
-    view = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * (end - cur));
+    view = (hatrack_view_t *)hatrack_malloc(sizeof(hatrack_view_t) * (end - cur));
     p    = view;
 
     while (cur < end) {
@@ -287,13 +287,13 @@ lohat_a_view(lohat_a_t *self, uint64_t *out_num, bool sort)
     *out_num  = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, 0);
         mmm_end_op();
 
         return NULL;
     }
 
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, 0, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
         /* Since we're keeping history buckets somewhat ordered, an
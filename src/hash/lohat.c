@@ -51,7 +51,7 @@ lohat_new(void)
 {
     lohat_t *ret;
 
-    ret = (lohat_t *)malloc(sizeof(lohat_t));
+    ret = (lohat_t *)hatrack_malloc(sizeof(lohat_t));
 
     lohat_init(ret);
 
@@ -63,7 +63,7 @@ lohat_new_size(char size)
 {
     lohat_t *ret;
 
-    ret = (lohat_t *)malloc(sizeof(lohat_t));
+    ret = (lohat_t *)hatrack_malloc(sizeof(lohat_t));
 
     lohat_init_size(ret, size);
 
@@ -166,7 +166,7 @@ void
 lohat_delete(lohat_t *self)
 {
     lohat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(lohat_t));
 
     return;
 }
@@ -339,7 +339,7 @@ lohat_view(lohat_t *self, uint64_t *out_num, bool sort)
     store = self->store_current;
     cur   = store->hist_buckets;
     end   = cur + (store->last_slot + 1);
-    view  = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * (end - cur));
+    view  = (hatrack_view_t *)hatrack_malloc(sizeof(hatrack_view_t) * (end - cur));
     p     = view;
 
     while (cur < end) {
@@ -404,14 +404,14 @@ lohat_view(lohat_t *self, uint64_t *out_num, bool sort)
     // If there are no items, instead of realloc'ing down, free the
     // memory and return NULL.
     if (!num_items) {
-        free(view);
+        hatrack_free(view, 0);
         mmm_end_op();
 
         return NULL;
     }
 
     // Size down to the actual used size.
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, 0, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
         // Unordered buckets should be in random order, so quicksort
@@ -159,7 +159,7 @@ oldhat_new(void)
 {
     oldhat_t *ret;
 
-    ret = (oldhat_t *)malloc(sizeof(oldhat_t));
+    ret = (oldhat_t *)hatrack_malloc(sizeof(oldhat_t));
 
     oldhat_init(ret);
 
@@ -171,7 +171,7 @@ oldhat_new_size(char size)
 {
     oldhat_t *ret;
 
-    ret = (oldhat_t *)malloc(sizeof(oldhat_t));
+    ret = (oldhat_t *)hatrack_malloc(sizeof(oldhat_t));
 
     oldhat_init_size(ret, size);
 
@@ -248,7 +248,7 @@ void
 oldhat_delete(oldhat_t *self)
 {
     oldhat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(oldhat_t));
 
     return;
 }
@@ -447,7 +447,7 @@ oldhat_view(oldhat_t *self, uint64_t *num, bool sort)
 
     store     = atomic_read(&self->store_current);
     alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
 
     for (i = 0; i <= store->last_slot; i++) {
@@ -466,13 +466,13 @@ oldhat_view(oldhat_t *self, uint64_t *num, bool sort)
     *num      = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, alloc_len);
         mmm_end_op();
 
         return NULL;
     }
 
-    view = realloc(view, *num * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, alloc_len, *num * sizeof(hatrack_view_t));
 
     if (sort) {
         qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
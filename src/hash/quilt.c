@@ -0,0 +1,1092 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           quilt.c
+ *  Description:    Quilt: Unbounded, In-place, Lazily Tiled
+ *
+ *                  A witchhat-style table whose buckets live in
+ *                  fixed-size segments under an extendible-hashing
+ *                  directory, so that growth only ever migrates one
+ *                  segment at a time.
+ *
+ *                  See quilt.h for an overview.  Operations within a
+ *                  segment work just like operations on a witchhat
+ *                  store, so we mainly comment on the segment and
+ *                  directory management here.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+// clang-format off
+static quilt_segment_t *quilt_segment_new    (uint64_t, uint64_t, uint64_t);
+static quilt_dir_t     *quilt_dir_new        (uint64_t);
+static quilt_segment_t *quilt_segment_lookup (quilt_t *, hatrack_hash_t);
+static void            *quilt_segment_get    (quilt_segment_t *, hatrack_hash_t,
+					      bool *);
+static void            *quilt_segment_put    (quilt_segment_t *, quilt_t *,
+					      hatrack_hash_t, void *, bool *);
+static void            *quilt_segment_replace(quilt_segment_t *, quilt_t *,
+					      hatrack_hash_t, void *, bool *);
+static bool             quilt_segment_add    (quilt_segment_t *, quilt_t *,
+					      hatrack_hash_t, void *);
+static void            *quilt_segment_remove (quilt_segment_t *, quilt_t *,
+					      hatrack_hash_t, bool *);
+static void             quilt_segment_migrate(quilt_segment_t *, quilt_t *);
+static void             quilt_dir_fixup      (quilt_segment_t *, quilt_t *);
+static void             quilt_dir_grow       (quilt_dir_t *, quilt_t *);
+static int              quilt_view_hv_cmp    (const void *, const void *);
+
+typedef struct {
+    hatrack_hash_t hv;
+    hatrack_view_t view;
+} quilt_view_item_t;
+
+// clang-format on
+
+quilt_t *
+quilt_new(void)
+{
+    quilt_t *ret;
+
+    ret = (quilt_t *)hatrack_malloc(sizeof(quilt_t));
+
+    quilt_init(ret);
+
+    return ret;
+}
+
+quilt_t *
+quilt_new_size(char size)
+{
+    quilt_t *ret;
+
+    ret = (quilt_t *)hatrack_malloc(sizeof(quilt_t));
+
+    quilt_init_size(ret, size);
+
+    return ret;
+}
+
+void
+quilt_init(quilt_t *self)
+{
+    quilt_init_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+/* If the requested size fits in a single segment, we start with a
+ * one-entry directory.  Otherwise, we pre-split, so that we start
+ * with as many full-sized segments as it takes.
+ */
+void
+quilt_init_size(quilt_t *self, char size)
+{
+    quilt_dir_t *dir;
+    uint64_t     depth;
+    uint64_t     seg_len;
+    uint64_t     i;
+
+    if (size > (ssize_t)(sizeof(intptr_t) * 8)) {
+	abort();
+    }
+
+    if (size < HATRACK_MIN_SIZE_LOG) {
+	abort();
+    }
+
+    if (size <= QUILT_SEGMENT_SIZE_LOG) {
+	depth   = 0;
+	seg_len = 1 << size;
+    }
+    else {
+	depth   = size - QUILT_SEGMENT_SIZE_LOG;
+	seg_len = QUILT_SEGMENT_SIZE;
+    }
+
+    dir = quilt_dir_new(depth);
+
+    for (i = 0; i <= dir->last_entry; i++) {
+	atomic_store(&dir->segments[i], quilt_segment_new(seg_len, depth, i));
+    }
+
+    self->next_epoch = 1;
+
+    atomic_store(&self->dir, dir);
+    atomic_store(&self->item_count, 0);
+
+    return;
+}
+
+/* Cleanup assumes no other threads are using the table, in which
+ * case every directory entry points to a live segment, and every
+ * segment is referenced from exactly one entry whose index is the
+ * segment's prefix.
+ */
+void
+quilt_cleanup(quilt_t *self)
+{
+    quilt_dir_t     *dir;
+    quilt_segment_t *segment;
+    uint64_t         i;
+
+    dir = atomic_load(&self->dir);
+
+    for (i = 0; i <= dir->last_entry; i++) {
+	segment = atomic_load(&dir->segments[i]);
+	segment = hatrack_pflag_clear(segment, QUILT_F_FROZEN);
+
+	if (segment->prefix == i) {
+	    mmm_retire(segment);
+	}
+    }
+
+    mmm_retire(dir);
+
+    return;
+}
+
+void
+quilt_delete(quilt_t *self)
+{
+    quilt_cleanup(self);
+    hatrack_free(self, sizeof(quilt_t));
+
+    return;
+}
+
+void *
+quilt_get(quilt_t *self, hatrack_hash_t hv, bool *found)
+{
+    void            *ret;
+    quilt_segment_t *segment;
+
+    mmm_start_basic_op();
+
+    segment = quilt_segment_lookup(self, hv);
+    ret     = quilt_segment_get(segment, hv, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+quilt_put(quilt_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    void            *ret;
+    quilt_segment_t *segment;
+
+    mmm_start_basic_op();
+
+    segment = quilt_segment_lookup(self, hv);
+    ret     = quilt_segment_put(segment, self, hv, item, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+quilt_replace(quilt_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    void            *ret;
+    quilt_segment_t *segment;
+
+    mmm_start_basic_op();
+
+    segment = quilt_segment_lookup(self, hv);
+    ret     = quilt_segment_replace(segment, self, hv, item, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+bool
+quilt_add(quilt_t *self, hatrack_hash_t hv, void *item)
+{
+    bool             ret;
+    quilt_segment_t *segment;
+
+    mmm_start_basic_op();
+
+    segment = quilt_segment_lookup(self, hv);
+    ret     = quilt_segment_add(segment, self, hv, item);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+void *
+quilt_remove(quilt_t *self, hatrack_hash_t hv, bool *found)
+{
+    void            *ret;
+    quilt_segment_t *segment;
+
+    mmm_start_basic_op();
+
+    segment = quilt_segment_lookup(self, hv);
+    ret     = quilt_segment_remove(segment, self, hv, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+uint64_t
+quilt_len(quilt_t *self)
+{
+    return atomic_read(&self->item_count);
+}
+
+hatrack_view_t *
+quilt_view(quilt_t *self, uint64_t *num, bool sort)
+{
+    hatrack_view_t *ret;
+
+    mmm_start_basic_op();
+
+    ret = quilt_view_no_mmm(self, num, sort);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Like witchhat, this view is not a consistent snapshot.  But since
+ * segments migrate independently, we could see the same item twice
+ * if its segment finishes migrating between the time we read the
+ * old segment and the time we read the new one.  So we collect hash
+ * values too, and drop duplicates before returning.
+ *
+ * To visit each segment once, for every directory entry we walk
+ * forward past any segment that has finished migrating, and only
+ * take the segment we land on if the entry is the lowest one that
+ * references it (i.e., the entry index is the segment's prefix).
+ * Directory entries never hold segments deeper than the directory,
+ * so the segment we land on can't be deeper either. But if it has
+ * migrated by the time we get to it (or we stopped because it's as
+ * deep as our directory, which must then be stale), we take all of
+ * its descendants from here.
+ */
+hatrack_view_t *
+quilt_view_no_mmm(quilt_t *self, uint64_t *num, bool sort)
+{
+    quilt_dir_t       *dir;
+    quilt_segment_t   *stack[sizeof(uint64_t) * 8 + 1];
+    quilt_segment_t   *segment;
+    quilt_segment_t   *split;
+    quilt_bucket_t    *cur;
+    quilt_bucket_t    *end;
+    quilt_record_t     record;
+    quilt_view_item_t *items;
+    quilt_view_item_t *p;
+    hatrack_view_t    *view;
+    uint64_t           alloc_len;
+    uint64_t           new_len;
+    uint64_t           num_items;
+    uint64_t           i, j;
+    int                sp;
+
+    dir       = atomic_read(&self->dir);
+    alloc_len = HATRACK_MIN_SIZE;
+    items     = (quilt_view_item_t *)hatrack_malloc(alloc_len * sizeof(*items));
+    num_items = 0;
+
+    for (i = 0; i <= dir->last_entry; i++) {
+	segment = atomic_read(&dir->segments[i]);
+	segment = hatrack_pflag_clear(segment, QUILT_F_FROZEN);
+
+	while (atomic_read(&segment->migrated) && segment->depth < dir->depth) {
+	    split   = atomic_read(&segment->next[1]);
+	    segment = split ? segment->next[(i >> segment->depth) & 1]
+	                    : segment->next[0];
+	}
+
+	if (segment->prefix != i) {
+	    continue;
+	}
+
+	sp          = 0;
+	stack[sp++] = segment;
+
+	while (sp) {
+	    segment = stack[--sp];
+
+	    if (atomic_read(&segment->migrated)) {
+		stack[sp++] = atomic_read(&segment->next[0]);
+		split       = atomic_read(&segment->next[1]);
+
+		if (split) {
+		    stack[sp++] = split;
+		}
+		continue;
+	    }
+
+	    if (num_items + segment->last_slot + 1 > alloc_len) {
+		new_len   = hatrack_round_up_to_power_of_2(num_items
+							   + segment->last_slot
+							   + 1);
+		items     = hatrack_realloc(items,
+					    alloc_len * sizeof(*items),
+					    new_len * sizeof(*items));
+		alloc_len = new_len;
+	    }
+
+	    p   = items + num_items;
+	    cur = segment->buckets;
+	    end = cur + (segment->last_slot + 1);
+
+	    while (cur < end) {
+		record             = atomic_read(&cur->record);
+		p->view.sort_epoch = record.info & QUILT_EPOCH_MASK;
+
+		if (!p->view.sort_epoch) {
+		    cur++;
+		    continue;
+		}
+
+		p->view.item = record.item;
+		p->hv        = atomic_read(&cur->hv);
+
+		p++;
+		cur++;
+	    }
+
+	    num_items = p - items;
+	}
+    }
+
+    if (!num_items) {
+	hatrack_free(items, alloc_len * sizeof(*items));
+	*num = 0;
+
+	return NULL;
+    }
+
+    qsort(items, num_items, sizeof(quilt_view_item_t), quilt_view_hv_cmp);
+
+    view = (hatrack_view_t *)hatrack_malloc(num_items * sizeof(hatrack_view_t));
+    j    = 0;
+
+    for (i = 0; i < num_items; i++) {
+	if (i && hatrack_hashes_eq(items[i].hv, items[i - 1].hv)) {
+	    continue;
+	}
+	view[j++] = items[i].view;
+    }
+
+    hatrack_free(items, alloc_len * sizeof(*items));
+
+    *num = j;
+
+    if (sort) {
+	qsort(view, j, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
+    }
+
+    return view;
+}
+
+static quilt_segment_t *
+quilt_segment_new(uint64_t size, uint64_t depth, uint64_t prefix)
+{
+    quilt_segment_t *segment;
+    uint64_t         alloc_len;
+
+    alloc_len = sizeof(quilt_segment_t) + sizeof(quilt_bucket_t) * size;
+    segment   = (quilt_segment_t *)mmm_alloc_committed(alloc_len);
+
+    segment->depth     = depth;
+    segment->prefix    = prefix;
+    segment->last_slot = size - 1;
+    segment->threshold = hatrack_compute_table_threshold(size);
+
+    return segment;
+}
+
+static quilt_dir_t *
+quilt_dir_new(uint64_t depth)
+{
+    quilt_dir_t *dir;
+    uint64_t     num_entries;
+    uint64_t     alloc_len;
+
+    num_entries = 1ULL << depth;
+    alloc_len   = sizeof(quilt_dir_t)
+	        + sizeof(_Atomic(quilt_segment_t *)) * num_entries;
+    dir         = (quilt_dir_t *)mmm_alloc_committed(alloc_len);
+
+    dir->depth      = depth;
+    dir->last_entry = num_entries - 1;
+
+    return dir;
+}
+
+/* The directory entry might be frozen, or might point to a segment
+ * that's already been migrated, and is waiting for the directory to
+ * be fixed up.  Readers are fine with either.  Writers will find
+ * every bucket in a migrated segment marked as moving, will help
+ * finish the migration (including the directory fix-up), and then
+ * come back here.
+ */
+static quilt_segment_t *
+quilt_segment_lookup(quilt_t *self, hatrack_hash_t hv)
+{
+    quilt_dir_t     *dir;
+    quilt_segment_t *segment;
+
+    dir     = atomic_read(&self->dir);
+    segment = atomic_read(&dir->segments[quilt_dir_index(hv, dir->last_entry)]);
+
+    return hatrack_pflag_clear(segment, QUILT_F_FROZEN);
+}
+
+static void *
+quilt_segment_get(quilt_segment_t *self, hatrack_hash_t hv1, bool *found)
+{
+    uint64_t        bix;
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    quilt_bucket_t *bucket;
+    quilt_record_t  record;
+
+    bix = hatrack_bucket_index(hv1, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    break;
+	}
+
+	if (!hatrack_hashes_eq(hv1, hv2)) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	record = atomic_read(&bucket->record);
+
+	if (record.info & QUILT_EPOCH_MASK) {
+	    return hatrack_found(found, record.item);
+	}
+	break;
+    }
+
+    return hatrack_not_found(found);
+}
+
+static void *
+quilt_segment_put(quilt_segment_t *self,
+		  quilt_t         *top,
+		  hatrack_hash_t   hv1,
+		  void            *item,
+		  bool            *found)
+{
+    void           *old_item;
+    bool            new_item;
+    uint64_t        bix;
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    quilt_bucket_t *bucket;
+    quilt_record_t  record;
+    quilt_record_t  candidate;
+
+    bix = hatrack_bucket_index(hv1, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    if (CAS(&bucket->hv, &hv2, hv1)) {
+		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		    goto migrate_and_retry;
+		}
+
+		goto found_bucket;
+	    }
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    goto found_bucket;
+	}
+
+	bix = (bix + 1) & self->last_slot;
+	continue;
+    }
+
+ migrate_and_retry:
+    quilt_segment_migrate(self, top);
+    self = quilt_segment_lookup(top, hv1);
+
+    return quilt_segment_put(self, top, hv1, item, found);
+
+ found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (record.info & QUILT_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    if (record.info & QUILT_EPOCH_MASK) {
+	if (found) {
+	    *found = true;
+	}
+
+	old_item       = record.item;
+	new_item       = false;
+	candidate.info = record.info;
+    }
+    else {
+	if (found) {
+	    *found = false;
+	}
+
+	old_item       = NULL;
+	new_item       = true;
+	candidate.info = QUILT_F_INITED | top->next_epoch++;
+    }
+
+    candidate.item = item;
+
+    if (CAS(&bucket->record, &record, candidate)) {
+	if (new_item) {
+	    atomic_fetch_add(&top->item_count, 1);
+	}
+
+	return old_item;
+    }
+
+    if (record.info & QUILT_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    // Another writer beat us; we sequence ourselves right before it.
+    return item;
+}
+
+static void *
+quilt_segment_replace(quilt_segment_t *self,
+		      quilt_t         *top,
+		      hatrack_hash_t   hv1,
+		      void            *item,
+		      bool            *found)
+{
+    uint64_t        bix;
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    quilt_bucket_t *bucket;
+    quilt_record_t  record;
+    quilt_record_t  candidate;
+
+    bix = hatrack_bucket_index(hv1, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    goto not_found;
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    goto found_bucket;
+	}
+
+	bix = (bix + 1) & self->last_slot;
+	continue;
+    }
+
+ not_found:
+    return hatrack_not_found(found);
+
+ found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (record.info & QUILT_F_MOVING) {
+    migrate_and_retry:
+	quilt_segment_migrate(self, top);
+	self = quilt_segment_lookup(top, hv1);
+
+	return quilt_segment_replace(self, top, hv1, item, found);
+    }
+
+    if (!(record.info & QUILT_EPOCH_MASK)) {
+	goto not_found;
+    }
+
+    candidate.item = item;
+    candidate.info = record.info;
+
+    if (!CAS(&bucket->record, &record, candidate)) {
+	if (record.info & QUILT_F_MOVING) {
+	    goto migrate_and_retry;
+	}
+
+	goto not_found;
+    }
+
+    return hatrack_found(found, record.item);
+}
+
+static bool
+quilt_segment_add(quilt_segment_t *self,
+		  quilt_t         *top,
+		  hatrack_hash_t   hv1,
+		  void            *item)
+{
+    uint64_t        bix;
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    quilt_bucket_t *bucket;
+    quilt_record_t  record;
+    quilt_record_t  candidate;
+
+    bix = hatrack_bucket_index(hv1, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    if (CAS(&bucket->hv, &hv2, hv1)) {
+		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		    goto migrate_and_retry;
+		}
+		goto found_bucket;
+	    }
+	}
+
+	if (!hatrack_hashes_eq(hv1, hv2)) {
+	    bix = (bix + 1) & self->last_slot;
+	    continue;
+	}
+
+	goto found_bucket;
+    }
+
+ migrate_and_retry:
+    quilt_segment_migrate(self, top);
+    self = quilt_segment_lookup(top, hv1);
+
+    return quilt_segment_add(self, top, hv1, item);
+
+ found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (record.info & QUILT_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    if (record.info & QUILT_EPOCH_MASK) {
+	return false;
+    }
+
+    candidate.item = item;
+    candidate.info = QUILT_F_INITED | top->next_epoch++;
+
+    if (CAS(&bucket->record, &record, candidate)) {
+	atomic_fetch_add(&top->item_count, 1);
+	return true;
+    }
+
+    if (record.info & QUILT_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    return false;
+}
+
+static void *
+quilt_segment_remove(quilt_segment_t *self,
+		     quilt_t         *top,
+		     hatrack_hash_t   hv1,
+		     bool            *found)
+{
+    void           *old_item;
+    uint64_t        bix;
+    uint64_t        i;
+    hatrack_hash_t  hv2;
+    quilt_bucket_t *bucket;
+    quilt_record_t  record;
+    quilt_record_t  candidate;
+
+    bix = hatrack_bucket_index(hv1, self->last_slot);
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[bix];
+	hv2    = atomic_read(&bucket->hv);
+
+	if (hatrack_bucket_unreserved(hv2)) {
+	    break;
+	}
+
+	if (hatrack_hashes_eq(hv1, hv2)) {
+	    goto found_bucket;
+	}
+
+	bix = (bix + 1) & self->last_slot;
+	continue;
+    }
+
+    return hatrack_not_found(found);
+
+ found_bucket:
+    record = atomic_read(&bucket->record);
+
+    if (record.info & QUILT_F_MOVING) {
+    migrate_and_retry:
+	quilt_segment_migrate(self, top);
+	self = quilt_segment_lookup(top, hv1);
+
+	return quilt_segment_remove(self, top, hv1, found);
+    }
+
+    if (!(record.info & QUILT_EPOCH_MASK)) {
+	return hatrack_not_found(found);
+    }
+
+    old_item       = record.item;
+    candidate.item = NULL;
+    candidate.info = QUILT_F_INITED;
+
+    if (CAS(&bucket->record, &record, candidate)) {
+	atomic_fetch_sub(&top->item_count, 1);
+
+	return hatrack_found(found, old_item);
+    }
+
+    if (record.info & QUILT_F_MOVING) {
+	goto migrate_and_retry;
+    }
+
+    return hatrack_not_found(found);
+}
+
+/* Migrating a segment is a witchhat migration, scoped to one segment,
+ * except for how we pick the destination:
+ *
+ * 1) If the segment is still smaller than QUILT_SEGMENT_SIZE, or if
+ *    it's mostly full of deleted items, we replace it with a single
+ *    segment of whatever size hatrack_new_size() suggests, with the
+ *    same depth and prefix.
+ *
+ * 2) Otherwise, we split it into two full-sized segments, one level
+ *    deeper, based on the next bit of the directory hash.
+ *
+ * Every thread that helps computes the same live item counts (bucket
+ * records can't change once they're marked as moving), so they all
+ * make the same choice.
+ *
+ * Once the items are moved, we mark the segment as migrated, and
+ * then point the directory at the new segment(s).
+ */
+static void
+quilt_segment_migrate(quilt_segment_t *self, quilt_t *top)
+{
+    quilt_segment_t *new_segments[2];
+    quilt_segment_t *candidate_segment;
+    quilt_segment_t *target;
+    quilt_bucket_t  *bucket;
+    quilt_bucket_t  *new_bucket;
+    quilt_record_t   record;
+    quilt_record_t   candidate_record;
+    quilt_record_t   expected_record;
+    hatrack_hash_t   expected_hv;
+    hatrack_hash_t   hv;
+    uint64_t         new_used[2];
+    uint64_t         expected_used;
+    uint64_t         new_size;
+    uint64_t         num_segments;
+    uint64_t         bit;
+    uint64_t         bix;
+    uint64_t         i, j;
+
+    if (atomic_read(&self->migrated)) {
+	goto fix_directory;
+    }
+
+    new_used[0] = 0;
+    new_used[1] = 0;
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[i];
+	record = atomic_read(&bucket->record);
+
+	if (!(record.info & QUILT_F_MOVING)) {
+	    OR2X64L(&bucket->record, QUILT_F_MOVING);
+	    record = atomic_read(&bucket->record);
+	}
+
+	if (record.info & QUILT_EPOCH_MASK) {
+	    hv = atomic_read(&bucket->hv);
+	    new_used[quilt_split_bit(hv, self->depth)]++;
+	}
+	else {
+	    if (!(record.info & QUILT_F_MOVED)) {
+		OR2X64L(&bucket->record, QUILT_F_MOVED);
+	    }
+	}
+    }
+
+    new_size = hatrack_new_size(self->last_slot, new_used[0] + new_used[1]);
+
+    if (new_size <= QUILT_SEGMENT_SIZE) {
+	num_segments = 1;
+	new_used[0] += new_used[1];
+    }
+    else {
+	num_segments = 2;
+	new_size     = QUILT_SEGMENT_SIZE;
+    }
+
+    for (j = 0; j < num_segments; j++) {
+	new_segments[j] = atomic_read(&self->next[j]);
+
+	if (new_segments[j]) {
+	    continue;
+	}
+
+	if (num_segments == 1) {
+	    candidate_segment = quilt_segment_new(new_size,
+						  self->depth,
+						  self->prefix);
+	}
+	else {
+	    candidate_segment = quilt_segment_new(new_size,
+						  self->depth + 1,
+						  self->prefix
+						  | (j << self->depth));
+	}
+
+	if (!CAS(&self->next[j], &new_segments[j], candidate_segment)) {
+	    mmm_retire_unused(candidate_segment);
+	}
+	else {
+	    new_segments[j] = candidate_segment;
+	}
+    }
+
+    for (i = 0; i <= self->last_slot; i++) {
+	bucket = &self->buckets[i];
+	record = atomic_read(&bucket->record);
+
+	if (record.info & QUILT_F_MOVED) {
+	    continue;
+	}
+
+	hv     = atomic_read(&bucket->hv);
+	bit    = (num_segments == 1) ? 0 : quilt_split_bit(hv, self->depth);
+	target = new_segments[bit];
+	bix    = hatrack_bucket_index(hv, target->last_slot);
+
+	for (j = 0; j <= target->last_slot; j++) {
+	    new_bucket  = &target->buckets[bix];
+	    expected_hv = atomic_read(&new_bucket->hv);
+
+	    if (hatrack_bucket_unreserved(expected_hv)) {
+		if (CAS(&new_bucket->hv, &expected_hv, hv)) {
+		    break;
+		}
+	    }
+
+	    if (!hatrack_hashes_eq(expected_hv, hv)) {
+		bix = (bix + 1) & target->last_slot;
+		continue;
+	    }
+
+	    break;
+	}
+
+	candidate_record.info = record.info & QUILT_EPOCH_MASK;
+	candidate_record.item = record.item;
+	expected_record.info  = 0;
+	expected_record.item  = NULL;
+
+	CAS(&new_bucket->record, &expected_record, candidate_record);
+	OR2X64L(&bucket->record, QUILT_F_MOVED);
+    }
+
+    for (j = 0; j < num_segments; j++) {
+	expected_used = 0;
+
+	CAS(&new_segments[j]->used_count, &expected_used, new_used[j]);
+    }
+
+    atomic_store(&self->migrated, true);
+
+ fix_directory:
+    quilt_dir_fixup(self, top);
+
+    return;
+}
+
+/* Swing every entry in the current directory that points to a
+ * migrated segment over to its replacement.  For a segment of depth
+ * d with prefix p, those are the entries p, p + 2^d, p + 2*2^d, ...
+ *
+ * If we're splitting, the directory needs to be at least one level
+ * deeper than the segment, so we may need to double it first.  And
+ * if we find an entry frozen, someone's doubling the directory, so
+ * we help, then start over on the new directory.
+ *
+ * Entries only ever move forward, so if our CAS fails because
+ * someone else already updated the entry, there's nothing to do.
+ *
+ * Once we've gotten through a directory, and it's still the current
+ * one, no current entry can point to the old segment, and nothing
+ * can ever put it back (doubling only copies from the current
+ * directory).  Anyone still holding the segment got it inside their
+ * mmm reservation, so it's safe to retire.  We just have to make
+ * sure only one thread does it.
+ */
+static void
+quilt_dir_fixup(quilt_segment_t *self, quilt_t *top)
+{
+    quilt_dir_t     *dir;
+    quilt_segment_t *expected;
+    quilt_segment_t *split;
+    quilt_segment_t *candidate;
+    uint64_t         i;
+    bool             expected_retired;
+
+    split = atomic_read(&self->next[1]);
+
+    while (true) {
+	dir = atomic_read(&top->dir);
+
+	if (split && dir->depth <= self->depth) {
+	    quilt_dir_grow(dir, top);
+	    continue;
+	}
+
+	for (i = self->prefix; i <= dir->last_entry; i += (1ULL << self->depth)) {
+	    expected  = self;
+	    candidate = split ? self->next[(i >> self->depth) & 1]
+		              : self->next[0];
+
+	    if (!CAS(&dir->segments[i], &expected, candidate)) {
+		if (hatrack_pflag_test(expected, QUILT_F_FROZEN)) {
+		    quilt_dir_grow(dir, top);
+		    break;
+		}
+	    }
+	}
+
+	if (atomic_read(&top->dir) == dir) {
+	    break;
+	}
+    }
+
+    expected_retired = false;
+
+    if (CAS(&self->retired, &expected_retired, true)) {
+	mmm_retire(self);
+    }
+
+    return;
+}
+
+/* Doubling the directory is a tiny migration of its own: freeze all
+ * the entries, agree on a new directory, copy each entry i into i and
+ * i + 2^depth, then swing the top-level pointer.
+ */
+static void
+quilt_dir_grow(quilt_dir_t *self, quilt_t *top)
+{
+    quilt_dir_t     *new_dir;
+    quilt_dir_t     *candidate_dir;
+    quilt_segment_t *segment;
+    quilt_segment_t *expected;
+    uint64_t         num_entries;
+    uint64_t         i;
+
+    if (atomic_read(&top->dir) != self) {
+	return;
+    }
+
+    new_dir = atomic_read(&self->dir_next);
+
+    if (new_dir) {
+	goto help_copy;
+    }
+
+    for (i = 0; i <= self->last_entry; i++) {
+	segment = atomic_read(&self->segments[i]);
+
+	while (!hatrack_pflag_test(segment, QUILT_F_FROZEN)) {
+	    if (CAS(&self->segments[i],
+		    &segment,
+		    hatrack_pflag_set(segment, QUILT_F_FROZEN))) {
+		break;
+	    }
+	}
+    }
+
+    candidate_dir = quilt_dir_new(self->depth + 1);
+
+    if (!CAS(&self->dir_next, &new_dir, candidate_dir)) {
+	mmm_retire_unused(candidate_dir);
+    }
+    else {
+	new_dir = candidate_dir;
+    }
+
+ help_copy:
+    num_entries = self->last_entry + 1;
+
+    for (i = 0; i <= self->last_entry; i++) {
+	segment  = atomic_read(&self->segments[i]);
+	segment  = hatrack_pflag_clear(segment, QUILT_F_FROZEN);
+	expected = NULL;
+
+	CAS(&new_dir->segments[i], &expected, segment);
+
+	expected = NULL;
+
+	CAS(&new_dir->segments[i + num_entries], &expected, segment);
+    }
+
+    if (CAS(&top->dir, &self, new_dir)) {
+	mmm_retire(self);
+    }
+
+    return;
+}
+
+static int
+quilt_view_hv_cmp(const void *b1, const void *b2)
+{
+    quilt_view_item_t *item1;
+    quilt_view_item_t *item2;
+
+    item1 = (quilt_view_item_t *)b1;
+    item2 = (quilt_view_item_t *)b2;
+
+    if (hatrack_hashes_eq(item1->hv, item2->hv)) {
+	return 0;
+    }
+
+    if (hatrack_hash_gt(item1->hv, item2->hv)) {
+	return 1;
+    }
+
+    return -1;
+}
@@ -37,7 +37,7 @@ refhat_new(void)
 {
     refhat_t *ret;
 
-    ret = (refhat_t *)malloc(sizeof(refhat_t));
+    ret = (refhat_t *)hatrack_malloc(sizeof(refhat_t));
 
     refhat_init(ret);
 
@@ -81,7 +81,7 @@ refhat_init_size(refhat_t *self, char size)
     self->used_count = 0;
     self->item_count = 0;
     self->next_epoch = 1;
-    self->buckets    = (refhat_bucket_t *)calloc(len, sizeof(refhat_bucket_t));
+    self->buckets    = (refhat_bucket_t *)hatrack_zalloc(len * sizeof(refhat_bucket_t));
 
     return;
 }
@@ -99,7 +99,7 @@ refhat_init_size(refhat_t *self, char size)
 void
 refhat_cleanup(refhat_t *self)
 {
-    free(self->buckets);
+    hatrack_free(self->buckets, (self->last_slot + 1) * sizeof(refhat_bucket_t));
 
     return;
 }
@@ -115,7 +115,7 @@ void
 refhat_delete(refhat_t *self)
 {
     refhat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(refhat_t));
 
     return;
 }
@@ -493,7 +493,7 @@ refhat_view(refhat_t *self, uint64_t *num, bool sort)
     refhat_bucket_t *cur;
     refhat_bucket_t *end;
 
-    view = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * self->item_count);
+    view = (hatrack_view_t *)hatrack_malloc(sizeof(hatrack_view_t) * self->item_count);
     p    = view;
     cur  = self->buckets;
     end  = cur + (self->last_slot + 1);
@@ -551,7 +551,7 @@ refhat_migrate(refhat_t *self)
     bucket_size   = sizeof(refhat_bucket_t);
     num_buckets   = hatrack_new_size(self->last_slot, self->item_count + 1);
     new_last_slot = num_buckets - 1;
-    new_buckets   = (refhat_bucket_t *)calloc(num_buckets, bucket_size);
+    new_buckets   = (refhat_bucket_t *)hatrack_zalloc(num_buckets * bucket_size);
 
     for (n = 0; n <= self->last_slot; n++) {
         cur = &self->buckets[n];
@@ -576,7 +576,7 @@ refhat_migrate(refhat_t *self)
         }
     }
 
-    free(self->buckets);
+    hatrack_free(self->buckets, (self->last_slot + 1) * bucket_size);
 
     self->used_count = self->item_count;
     self->buckets    = new_buckets;
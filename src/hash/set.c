@@ -31,7 +31,7 @@ hatrack_set_new(uint32_t item_type)
 {
     hatrack_set_t *ret;
 
-    ret = (hatrack_set_t *)malloc(sizeof(hatrack_set_t));
+    ret = (hatrack_set_t *)hatrack_malloc(sizeof(hatrack_set_t));
 
     hatrack_set_init(ret, item_type);
 
@@ -63,6 +63,8 @@ hatrack_set_init(hatrack_set_t *self, uint32_t item_type)
     self->hash_info.offsets.cache_offset = HATRACK_DICT_NO_CACHE;
     self->free_handler                   = NULL;
     self->pre_return_hook                = NULL;
+    self->arena                          = NULL;
+    self->membudget                      = NULL;
 
     return;
 }
@@ -100,6 +102,12 @@ hatrack_set_cleanup(hatrack_set_t *self)
 
     woolhat_cleanup(&self->woolhat_instance);
 
+    // See hatrack_dict_cleanup().
+    if (self->arena) {
+        hatrack_arena_run_cleanups(self->arena);
+        hatrack_arena_retire(self->arena);
+    }
+
     return;
 }
 
@@ -108,7 +116,7 @@ hatrack_set_delete(hatrack_set_t *self)
 {
     hatrack_set_cleanup(self);
 
-    free(self);
+    hatrack_free(self, sizeof(hatrack_set_t));
 
     return;
 }
@@ -148,6 +156,85 @@ hatrack_set_set_free_handler(hatrack_set_t *self, hatrack_mem_hook_t func)
     return;
 }
 
+/* Records and stores come from this allocator from now on (NULL
+ * means the global one). The set must be empty, and not yet shared.
+ * Views still come from the global allocator.
+ */
+void
+hatrack_set_set_allocator(hatrack_set_t *self, hatrack_allocator_t *allocator)
+{
+    if (self->membudget
+        || (self->arena
+            && allocator != hatrack_arena_allocator(self->arena))) {
+        abort();
+    }
+
+    woolhat_set_allocator(&self->woolhat_instance, allocator);
+
+    return;
+}
+
+/* See hatrack_dict_set_membudget(). At the hard limit,
+ * hatrack_set_put() and hatrack_set_add() leave the set alone, and
+ * return false.
+ */
+void
+hatrack_set_set_membudget(hatrack_set_t *self, hatrack_membudget_t *budget)
+{
+    if (self->arena || self->membudget) {
+        abort();
+    }
+
+    hatrack_set_set_allocator(self, hatrack_membudget_store_allocator(budget));
+    woolhat_set_record_allocator(&self->woolhat_instance,
+                                 hatrack_membudget_record_allocator(budget));
+
+    self->membudget = budget;
+
+    return;
+}
+
+hatrack_membudget_t *
+hatrack_set_get_membudget(hatrack_set_t *self)
+{
+    return self->membudget;
+}
+
+/* Puts all records and stores in a private arena, which gets released
+ * in one go when the set is deleted (see arena.h).  Same rules as
+ * hatrack_set_set_allocator(), and once on, it stays on.
+ */
+void
+hatrack_set_set_arena(hatrack_set_t *self, bool value)
+{
+    if (!value) {
+        if (self->arena) {
+            abort();
+        }
+        return;
+    }
+
+    if (self->arena) {
+        return;
+    }
+
+    if (self->membudget) {
+        abort();
+    }
+
+    self->arena = hatrack_arena_new(0);
+
+    hatrack_set_set_allocator(self, hatrack_arena_allocator(self->arena));
+
+    return;
+}
+
+bool
+hatrack_set_get_arena(hatrack_set_t *self)
+{
+    return self->arena != NULL;
+}
+
 void
 hatrack_set_set_return_hook(hatrack_set_t *self, hatrack_mem_hook_t func)
 {
@@ -168,11 +255,28 @@ hatrack_set_contains(hatrack_set_t *self, void *item)
     return ret;
 }
 
+// See hatrack_dict_budget_ok().
+static inline bool
+hatrack_set_budget_ok(hatrack_set_t *self, bool grows)
+{
+    if (!self->membudget) {
+        return true;
+    }
+
+    hatrack_membudget_poll(self->membudget);
+
+    return !grows || !hatrack_membudget_at_hard_limit(self->membudget);
+}
+
 bool
 hatrack_set_put(hatrack_set_t *self, void *item)
 {
     bool ret;
 
+    if (!hatrack_set_budget_ok(self, true)) {
+        return false;
+    }
+
     woolhat_put(&self->woolhat_instance,
                 hatrack_set_get_hash_value(self, item),
                 item,
@@ -184,6 +288,10 @@ hatrack_set_put(hatrack_set_t *self, void *item)
 bool
 hatrack_set_add(hatrack_set_t *self, void *item)
 {
+    if (!hatrack_set_budget_ok(self, true)) {
+        return false;
+    }
+
     return woolhat_add(&self->woolhat_instance,
                        hatrack_set_get_hash_value(self, item),
                        item);
@@ -194,6 +302,8 @@ hatrack_set_remove(hatrack_set_t *self, void *item)
 {
     bool ret;
 
+    hatrack_set_budget_ok(self, false);
+
     woolhat_remove(&self->woolhat_instance,
                    hatrack_set_get_hash_value(self, item),
                    &ret);
@@ -212,7 +322,7 @@ hatrack_set_items_base(hatrack_set_t *self, uint64_t *num, bool sort)
     epoch = mmm_start_linearized_op();
 
     view = woolhat_view_epoch(&self->woolhat_instance, num, epoch);
-    ret  = malloc(sizeof(void *) * *num);
+    ret  = hatrack_malloc(sizeof(void *) * *num);
 
     if (sort) {
         qsort(view,
@@ -236,7 +346,7 @@ hatrack_set_items_base(hatrack_set_t *self, uint64_t *num, bool sort)
 
     mmm_end_op();
 
-    free(view);
+    hatrack_free(view, 0);
 
     return (void *)ret;
 }
@@ -301,8 +411,8 @@ hatrack_set_is_eq(hatrack_set_t *set1, hatrack_set_t *set2)
 finished:
     mmm_end_op();
 
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -377,8 +487,8 @@ hatrack_set_is_superset(hatrack_set_t *set1, hatrack_set_t *set2, bool proper)
 finished:
     mmm_end_op();
 
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -446,8 +556,8 @@ hatrack_set_is_disjoint(hatrack_set_t *set1, hatrack_set_t *set2)
 finished:
     mmm_end_op();
 
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -511,8 +621,8 @@ hatrack_set_difference(hatrack_set_t *set1, hatrack_set_t *set2)
 
     mmm_end_op();
 
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -589,8 +699,8 @@ hatrack_set_union(hatrack_set_t *set1, hatrack_set_t *set2)
 
     mmm_end_op();
 
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -667,8 +777,8 @@ hatrack_set_intersection(hatrack_set_t *set1, hatrack_set_t *set2)
     }
 
     mmm_end_op();
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
@@ -740,8 +850,8 @@ hatrack_set_disjunction(hatrack_set_t *set1, hatrack_set_t *set2)
     }
 
     mmm_end_op();
-    free(view1);
-    free(view2);
+    hatrack_free(view1, 0);
+    hatrack_free(view2, 0);
 
     return ret;
 }
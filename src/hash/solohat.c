@@ -0,0 +1,686 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           solohat.c
+ *  Description:    A single-writer, multi-reader table, with no locks
+ *                  and no CAS anywhere.
+ *
+ *                  The structure is the same as swimcap's; see
+ *                  swimcap.c for the general approach, and solohat.h
+ *                  for how the writer and readers stay consistent
+ *                  without 128-bit atomics.
+ *
+ *  Author:         John Viega, john@zork.org
+ *
+ */
+
+#include <hatrack.h>
+
+#ifdef HATRACK_COMPILE_ALL_ALGORITHMS
+
+// clang-format off
+static solohat_store_t *solohat_store_new    (uint64_t);
+static void            *solohat_store_get    (solohat_store_t *,
+					      hatrack_hash_t, bool *);
+static void            *solohat_store_put    (solohat_store_t *,
+					      solohat_t *, hatrack_hash_t,
+					      void *, bool *);
+static void            *solohat_store_replace(solohat_store_t *,
+					      hatrack_hash_t, void *, bool *);
+static bool             solohat_store_add    (solohat_store_t *,
+					      solohat_t *, hatrack_hash_t,
+					      void *);
+static void            *solohat_store_remove (solohat_store_t *,
+					      solohat_t *, hatrack_hash_t,
+					      bool *);
+static void             solohat_migrate      (solohat_t *);
+// clang-format on
+
+/* Everything the writer loads was stored by the writer itself, so
+ * its loads can all be relaxed.  The interesting ordering is in the
+ * stores, and on the read side, in solohat_bucket_read().
+ */
+static inline solohat_store_t *
+solohat_writer_store(solohat_t *self)
+{
+    return atomic_load_explicit(&self->store_current, memory_order_relaxed);
+}
+
+static inline uint64_t
+solohat_writer_epoch(solohat_bucket_t *bucket)
+{
+    return atomic_load_explicit(&bucket->epoch, memory_order_relaxed);
+}
+
+static inline void *
+solohat_writer_item(solohat_bucket_t *bucket)
+{
+    return atomic_load_explicit(&bucket->item, memory_order_relaxed);
+}
+
+static inline void
+solohat_count_add(solohat_t *self, int64_t n)
+{
+    uint64_t count;
+
+    count = atomic_load_explicit(&self->item_count, memory_order_relaxed);
+
+    atomic_store_explicit(&self->item_count, count + n, memory_order_relaxed);
+
+    return;
+}
+
+/* Puts an item into a bucket that doesn't currently have one. The
+ * fence keeps the epoch from becoming visible before the item (and,
+ * along with the fence in solohat_bucket_clear(), keeps the item from
+ * becoming visible before an earlier remove).
+ */
+static inline void
+solohat_bucket_fill(solohat_bucket_t *bucket, void *item, uint64_t epoch)
+{
+    atomic_store_explicit(&bucket->item, item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&bucket->epoch, epoch, memory_order_relaxed);
+
+    return;
+}
+
+static inline void
+solohat_bucket_clear(solohat_bucket_t *bucket)
+{
+    atomic_store_explicit(&bucket->epoch, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    return;
+}
+
+/* The reader's side of the protocol described in solohat.h.  If the
+ * epoch changed while we were reading the item, then the bucket was
+ * cleared at some point after our first load, and the item (if it
+ * was re-added) was stored after that.  Either way, there was a
+ * moment during this call when the bucket was empty, so we can
+ * report a miss without retrying, which keeps readers wait free.
+ *
+ * If the epoch didn't change, the item we read is either the one that
+ * went with that epoch, or a replacement, both of which were current
+ * at the time we read them.
+ */
+static inline bool
+solohat_bucket_read(solohat_bucket_t *bucket, void **item, uint64_t *epoch)
+{
+    uint64_t first;
+
+    first = atomic_load_explicit(&bucket->epoch, memory_order_acquire);
+
+    if (!first) {
+        return false;
+    }
+
+    *item = atomic_load_explicit(&bucket->item, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&bucket->epoch, memory_order_relaxed) != first) {
+        return false;
+    }
+
+    if (epoch) {
+        *epoch = first;
+    }
+
+    return true;
+}
+
+solohat_t *
+solohat_new(void)
+{
+    solohat_t *ret;
+
+    ret = (solohat_t *)hatrack_malloc(sizeof(solohat_t));
+
+    solohat_init(ret);
+
+    return ret;
+}
+
+solohat_t *
+solohat_new_size(char size)
+{
+    solohat_t *ret;
+
+    ret = (solohat_t *)hatrack_malloc(sizeof(solohat_t));
+
+    solohat_init_size(ret, size);
+
+    return ret;
+}
+
+void
+solohat_init(solohat_t *self)
+{
+    solohat_init_size(self, HATRACK_MIN_SIZE_LOG);
+
+    return;
+}
+
+void
+solohat_init_size(solohat_t *self, char size)
+{
+    solohat_store_t *store;
+    uint64_t         len;
+
+    if (size > (ssize_t)(sizeof(intptr_t) * 8)) {
+        abort();
+    }
+
+    if (size < HATRACK_MIN_SIZE_LOG) {
+        abort();
+    }
+
+    len              = 1 << size;
+    store            = solohat_store_new(len);
+    self->next_epoch = 1; // 0 is reserved for empty buckets.
+
+    atomic_store(&self->item_count, 0);
+    atomic_store(&self->store_current, store);
+
+    return;
+}
+
+void
+solohat_cleanup(solohat_t *self)
+{
+    mmm_retire(atomic_load(&self->store_current));
+
+    return;
+}
+
+void
+solohat_delete(solohat_t *self)
+{
+    solohat_cleanup(self);
+    hatrack_free(self, sizeof(solohat_t));
+
+    return;
+}
+
+/* solohat_get()
+ *
+ * As with swimcap, readers only need mmm to keep the store alive; the
+ * acquire load of the store pointer pairs with the release store at
+ * the end of solohat_migrate(), so that everything the writer put in
+ * the store is visible.
+ */
+void *
+solohat_get(solohat_t *self, hatrack_hash_t hv, bool *found)
+{
+    solohat_store_t *store;
+    void            *ret;
+
+    mmm_start_basic_op();
+
+    store = atomic_load_explicit(&self->store_current, memory_order_acquire);
+    ret   = solohat_store_get(store, hv, found);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* The write operations must only be called from one thread at a time
+ * (see solohat.h).  The writer never needs to register with mmm
+ * (beyond having a thread ID), since it's the only thread that ever
+ * retires a store.
+ */
+void *
+solohat_put(solohat_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    return solohat_store_put(solohat_writer_store(self), self, hv, item, found);
+}
+
+void *
+solohat_replace(solohat_t *self, hatrack_hash_t hv, void *item, bool *found)
+{
+    return solohat_store_replace(solohat_writer_store(self), hv, item, found);
+}
+
+bool
+solohat_add(solohat_t *self, hatrack_hash_t hv, void *item)
+{
+    return solohat_store_add(solohat_writer_store(self), self, hv, item);
+}
+
+void *
+solohat_remove(solohat_t *self, hatrack_hash_t hv, bool *found)
+{
+    return solohat_store_remove(solohat_writer_store(self), self, hv, found);
+}
+
+uint64_t
+solohat_len(solohat_t *self)
+{
+    return atomic_load_explicit(&self->item_count, memory_order_relaxed);
+}
+
+/* solohat_view()
+ *
+ * Views are not consistent; each bucket is read independently, the
+ * same way solohat_get() reads it.  Epochs are unique, though, so a
+ * sorted view is in true insertion order.
+ */
+hatrack_view_t *
+solohat_view(solohat_t *self, uint64_t *num, bool sort)
+{
+    hatrack_view_t   *view;
+    solohat_store_t  *store;
+    hatrack_view_t   *p;
+    solohat_bucket_t *cur;
+    solohat_bucket_t *end;
+    void             *item;
+    uint64_t          epoch;
+    uint64_t          count;
+    uint64_t          last_slot;
+    uint64_t          alloc_len;
+
+    mmm_start_basic_op();
+
+    store     = atomic_load_explicit(&self->store_current, memory_order_acquire);
+    last_slot = store->last_slot;
+    alloc_len = sizeof(hatrack_view_t) * (last_slot + 1);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
+    p         = view;
+    cur       = store->buckets;
+    end       = cur + (last_slot + 1);
+    count     = 0;
+
+    while (cur < end) {
+        if (solohat_bucket_read(cur, &item, &epoch)) {
+            p->item       = item;
+            p->sort_epoch = epoch;
+
+            count++;
+            p++;
+        }
+
+        cur++;
+    }
+
+    mmm_end_op();
+
+    *num = count;
+
+    if (!count) {
+        hatrack_free(view, alloc_len);
+
+        return NULL;
+    }
+
+    view = (hatrack_view_t *)hatrack_realloc(view, alloc_len, sizeof(hatrack_view_t) * count);
+
+    if (sort) {
+        qsort(view, count, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
+    }
+
+    return view;
+}
+
+static solohat_store_t *
+solohat_store_new(uint64_t size)
+{
+    solohat_store_t *ret;
+    uint64_t         alloc_len;
+
+    alloc_len = sizeof(solohat_store_t);
+    alloc_len += size * sizeof(solohat_bucket_t);
+    ret            = (solohat_store_t *)mmm_alloc_committed(alloc_len);
+    ret->last_slot = size - 1;
+    ret->threshold = hatrack_compute_table_threshold(size);
+
+    return ret;
+}
+
+static void *
+solohat_store_get(solohat_store_t *self, hatrack_hash_t hv, bool *found)
+{
+    uint64_t          bix;
+    uint64_t          last_slot;
+    uint64_t          i;
+    solohat_bucket_t *cur;
+    void             *item;
+
+    last_slot = self->last_slot;
+    bix       = hatrack_bucket_index(hv, last_slot);
+
+    for (i = 0; i <= last_slot; i++) {
+        cur = &self->buckets[bix];
+
+        if (hatrack_hashes_eq(hv, cur->hv)) {
+            if (solohat_bucket_read(cur, &item, NULL)) {
+                if (found) {
+                    *found = true;
+                }
+
+                return item;
+            }
+
+            if (found) {
+                *found = false;
+            }
+
+            return NULL;
+        }
+
+        if (hatrack_bucket_unreserved(cur->hv)) {
+            if (found) {
+                *found = false;
+            }
+
+            return NULL;
+        }
+
+        bix = (bix + 1) & last_slot;
+    }
+    __builtin_unreachable();
+}
+
+static void *
+solohat_store_put(solohat_store_t *self,
+                  solohat_t       *top,
+                  hatrack_hash_t   hv,
+                  void            *item,
+                  bool            *found)
+{
+    uint64_t          bix;
+    uint64_t          i;
+    uint64_t          last_slot;
+    solohat_bucket_t *cur;
+    void             *ret;
+
+    last_slot = self->last_slot;
+    bix       = hatrack_bucket_index(hv, last_slot);
+
+    for (i = 0; i <= last_slot; i++) {
+        cur = &self->buckets[bix];
+
+        if (hatrack_hashes_eq(hv, cur->hv)) {
+            if (!solohat_writer_epoch(cur)) {
+                solohat_bucket_fill(cur, item, top->next_epoch++);
+                solohat_count_add(top, 1);
+
+                if (found) {
+                    *found = false;
+                }
+
+                return NULL;
+            }
+
+            ret = solohat_writer_item(cur);
+
+            atomic_store_explicit(&cur->item, item, memory_order_release);
+
+            if (found) {
+                *found = true;
+            }
+
+            return ret;
+        }
+
+        if (hatrack_bucket_unreserved(cur->hv)) {
+            if (self->used_count + 1 == self->threshold) {
+                solohat_migrate(top);
+
+                return solohat_store_put(solohat_writer_store(top),
+                                         top,
+                                         hv,
+                                         item,
+                                         found);
+            }
+
+            self->used_count++;
+
+            cur->hv = hv;
+            solohat_bucket_fill(cur, item, top->next_epoch++);
+            solohat_count_add(top, 1);
+
+            if (found) {
+                *found = false;
+            }
+
+            return NULL;
+        }
+
+        bix = (bix + 1) & last_slot;
+    }
+    __builtin_unreachable();
+}
+
+static void *
+solohat_store_replace(solohat_store_t *self,
+                      hatrack_hash_t   hv,
+                      void            *item,
+                      bool            *found)
+{
+    uint64_t          bix;
+    uint64_t          i;
+    uint64_t          last_slot;
+    solohat_bucket_t *cur;
+    void             *ret;
+
+    last_slot = self->last_slot;
+    bix       = hatrack_bucket_index(hv, last_slot);
+
+    for (i = 0; i <= last_slot; i++) {
+        cur = &self->buckets[bix];
+
+        if (hatrack_hashes_eq(hv, cur->hv)) {
+            if (!solohat_writer_epoch(cur)) {
+                if (found) {
+                    *found = false;
+                }
+
+                return NULL;
+            }
+
+            ret = solohat_writer_item(cur);
+
+            atomic_store_explicit(&cur->item, item, memory_order_release);
+
+            if (found) {
+                *found = true;
+            }
+
+            return ret;
+        }
+
+        if (hatrack_bucket_unreserved(cur->hv)) {
+            if (found) {
+                *found = false;
+            }
+
+            return NULL;
+        }
+
+        bix = (bix + 1) & last_slot;
+    }
+    __builtin_unreachable();
+}
+
+static bool
+solohat_store_add(solohat_store_t *self,
+                  solohat_t       *top,
+                  hatrack_hash_t   hv,
+                  void            *item)
+{
+    uint64_t          bix;
+    uint64_t          i;
+    uint64_t          last_slot;
+    solohat_bucket_t *cur;
+
+    last_slot = self->last_slot;
+    bix       = hatrack_bucket_index(hv, last_slot);
+
+    for (i = 0; i <= last_slot; i++) {
+        cur = &self->buckets[bix];
+
+        if (hatrack_hashes_eq(hv, cur->hv)) {
+            if (solohat_writer_epoch(cur)) {
+                return false;
+            }
+
+            solohat_bucket_fill(cur, item, top->next_epoch++);
+            solohat_count_add(top, 1);
+
+            return true;
+        }
+
+        if (hatrack_bucket_unreserved(cur->hv)) {
+            if (self->used_count + 1 == self->threshold) {
+                solohat_migrate(top);
+
+                return solohat_store_add(solohat_writer_store(top),
+                                         top,
+                                         hv,
+                                         item);
+            }
+
+            self->used_count++;
+
+            cur->hv = hv;
+            solohat_bucket_fill(cur, item, top->next_epoch++);
+            solohat_count_add(top, 1);
+
+            return true;
+        }
+
+        bix = (bix + 1) & last_slot;
+    }
+    __builtin_unreachable();
+}
+
+static void *
+solohat_store_remove(solohat_store_t *self,
+                     solohat_t       *top,
+                     hatrack_hash_t   hv,
+                     bool            *found)
+{
+    uint64_t          bix;
+    uint64_t          i;
+    uint64_t          last_slot;
+    solohat_bucket_t *cur;
+
+    last_slot = self->last_slot;
+    bix       = hatrack_bucket_index(hv, last_slot);
+
+    for (i = 0; i <= last_slot; i++) {
+        cur = &self->buckets[bix];
+
+        if (hatrack_hashes_eq(hv, cur->hv)) {
+            if (!solohat_writer_epoch(cur)) {
+                if (found) {
+                    *found = false;
+                }
+
+                return NULL;
+            }
+
+            solohat_bucket_clear(cur);
+            solohat_count_add(top, -1);
+
+            if (found) {
+                *found = true;
+            }
+
+            return solohat_writer_item(cur);
+        }
+
+        if (hatrack_bucket_unreserved(cur->hv)) {
+            if (found) {
+                *found = false;
+            }
+
+            return NULL;
+        }
+
+        bix = (bix + 1) & last_slot;
+    }
+    __builtin_unreachable();
+}
+
+/* Nobody else can see the new store until we publish it, so we fill
+ * it in with relaxed stores, and let the release store of
+ * store_current order all of them at once.  Readers still in the old
+ * store see it exactly as it was, since we never write to it again.
+ */
+static void
+solohat_migrate(solohat_t *self)
+{
+    solohat_store_t  *cur_store;
+    solohat_store_t  *new_store;
+    solohat_bucket_t *cur;
+    solohat_bucket_t *target;
+    uint64_t          epoch;
+    uint64_t          new_size;
+    uint64_t          cur_last_slot;
+    uint64_t          new_last_slot;
+    uint64_t          i, n, bix;
+
+    cur_store     = solohat_writer_store(self);
+    cur_last_slot = cur_store->last_slot;
+    new_size      = hatrack_new_size(cur_last_slot, solohat_len(self) + 1);
+    new_last_slot = new_size - 1;
+    new_store     = solohat_store_new(new_size);
+
+    for (n = 0; n <= cur_last_slot; n++) {
+        cur   = &cur_store->buckets[n];
+        epoch = solohat_writer_epoch(cur);
+
+        if (!epoch) {
+            continue;
+        }
+
+        bix = hatrack_bucket_index(cur->hv, new_last_slot);
+
+        for (i = 0; i < new_size; i++) {
+            target = &new_store->buckets[bix];
+
+            if (hatrack_bucket_unreserved(target->hv)) {
+                target->hv = cur->hv;
+
+                atomic_store_explicit(&target->item,
+                                      solohat_writer_item(cur),
+                                      memory_order_relaxed);
+                atomic_store_explicit(&target->epoch,
+                                      epoch,
+                                      memory_order_relaxed);
+                break;
+            }
+
+            bix = (bix + 1) & new_last_slot;
+        }
+    }
+
+    new_store->used_count = solohat_len(self);
+
+    atomic_store_explicit(&self->store_current,
+                          new_store,
+                          memory_order_release);
+
+    // As in swimcap, this has to come after the new store is installed.
+    mmm_retire(cur_store);
+
+    return;
+}
+
+#endif
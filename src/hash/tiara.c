@@ -57,7 +57,7 @@ tiara_new(void)
 {
     tiara_t *ret;
 
-    ret = (tiara_t *)malloc(sizeof(tiara_t));
+    ret = (tiara_t *)hatrack_malloc(sizeof(tiara_t));
 
     tiara_init(ret);
 
@@ -69,7 +69,7 @@ tiara_new_size(char size)
 {
     tiara_t *ret;
 
-    ret = (tiara_t *)malloc(sizeof(tiara_t));
+    ret = (tiara_t *)hatrack_malloc(sizeof(tiara_t));
 
     tiara_init_size(ret, size);
 
@@ -120,7 +120,7 @@ void
 tiara_delete(tiara_t *self)
 {
     tiara_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(tiara_t));
 
     return;
 }
@@ -227,7 +227,7 @@ tiara_view(tiara_t *self, uint64_t *num, bool ignored)
 
     store     = atomic_read(&self->store_current);
     alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = store->buckets;
     end       = cur + (store->last_slot + 1);
@@ -251,13 +251,13 @@ tiara_view(tiara_t *self, uint64_t *num, bool ignored)
     *num      = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, alloc_len);
         mmm_end_op();
 	
         return NULL;
     }
 
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, alloc_len, num_items * sizeof(hatrack_view_t));
 
     mmm_end_op();
     
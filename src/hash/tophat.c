@@ -53,7 +53,7 @@ static void *tophat_migrate_to_woolhat (tophat_t *);
  */
 extern newshat_store_t  *newshat_store_new (uint64_t);
 extern ballcap_store_t  *ballcap_store_new (uint64_t);
-extern woolhat_store_t  *woolhat_store_new (uint64_t);
+extern woolhat_store_t  *woolhat_store_new (uint64_t, hatrack_allocator_t *);
 
 static inline void *
 tophat_migrate(tophat_t *self)
@@ -77,7 +77,7 @@ tophat_new_fast_mx(void)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_fast_mx(ret);
 
@@ -89,7 +89,7 @@ tophat_new_fast_wf(void)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_fast_wf(ret);
 
@@ -101,7 +101,7 @@ tophat_new_cst_mx(void)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_cst_mx(ret);
 
@@ -113,7 +113,7 @@ tophat_new_cst_wf(void)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_cst_wf(ret);
 
@@ -125,7 +125,7 @@ tophat_new_fast_mx_size(char size)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_fast_mx_size(ret, size);
 
@@ -137,7 +137,7 @@ tophat_new_fast_wf_size(char size)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_fast_wf_size(ret, size);
 
@@ -149,7 +149,7 @@ tophat_new_cst_mx_size(char size)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_cst_mx_size(ret, size);
 
@@ -161,7 +161,7 @@ tophat_new_cst_wf_size(char size)
 {
     tophat_t *ret;
 
-    ret = (tophat_t *)malloc(sizeof(tophat_t));
+    ret = (tophat_t *)hatrack_malloc(sizeof(tophat_t));
 
     tophat_init_cst_wf_size(ret, size);
 
@@ -195,7 +195,7 @@ void
 tophat_delete(tophat_t *self)
 {
     tophat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(tophat_t));
 
     return;
 }
@@ -912,7 +912,7 @@ tophat_view(tophat_t *self, uint64_t *num, bool sort)
      */
     alloc_len = sizeof(hatrack_view_t) * (ctx->last_slot + 1);
     n         = 0;
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = ctx->buckets;
     end       = cur + (ctx->last_slot + 1);
@@ -1064,7 +1064,7 @@ tophat_migrate_to_newshat(tophat_t *self)
     
 
     ctx                      = self->st_table;
-    new_table                = (newshat_t *)malloc(sizeof(newshat_t));
+    new_table                = (newshat_t *)hatrack_malloc(sizeof(newshat_t));
     new_table->store_current = newshat_store_new(ctx->last_slot + 1);
 
     for (n = 0; n <= ctx->last_slot; n++) {
@@ -1140,10 +1140,11 @@ tophat_migrate_to_witchhat(tophat_t *self)
     uint64_t            i, n, bix;
 
     ctx                      = self->st_table;
-    new_table                = (witchhat_t *)malloc(sizeof(witchhat_t));
+    new_table                = (witchhat_t *)hatrack_malloc(sizeof(witchhat_t));
     new_table->store_current = witchhat_store_new(ctx->last_slot + 1);
     new_table->next_epoch    = ctx->next_epoch;
-    new_table->item_count    = ctx->item_count;
+
+    hatrack_shardctr_init(&new_table->item_count, ctx->item_count);
 
     for (n = 0; n <= ctx->last_slot; n++) {
 	cur_bucket = &ctx->buckets[n];
@@ -1219,7 +1220,7 @@ tophat_migrate_to_ballcap(tophat_t *self)
 
 
     ctx                      = self->st_table;
-    new_table                = (ballcap_t *)malloc(sizeof(ballcap_t));
+    new_table                = (ballcap_t *)hatrack_malloc(sizeof(ballcap_t));
     new_table->store_current = ballcap_store_new(ctx->last_slot + 1);
     record_len               = sizeof(ballcap_record_t);
 
@@ -1287,14 +1288,17 @@ tophat_migrate_to_woolhat(tophat_t *self)
     woolhat_state_t     new_state;
     uint64_t            n, i, bix, record_len;
 
-    ctx                      = self->st_table;
-    new_table                = (woolhat_t *)malloc(sizeof(woolhat_t));
-    new_table->store_current = woolhat_store_new(ctx->last_slot + 1);
-    record_len               = sizeof(woolhat_record_t);
-    new_table->cleanup_func  = NULL;
-    new_table->cleanup_aux   = NULL;
+    ctx                         = self->st_table;
+    new_table                   = (woolhat_t *)hatrack_malloc(sizeof(woolhat_t));
+    new_table->store_current    = woolhat_store_new(ctx->last_slot + 1, NULL);
+    new_table->allocator        = NULL;
+    new_table->record_allocator = NULL;
+    record_len                  = sizeof(woolhat_record_t);
+    new_table->cleanup_func     = NULL;
+    new_table->cleanup_aux      = NULL;
     
     atomic_store(&new_table->help_needed, 0);
+    hatrack_shardctr_init(&new_table->item_count, ctx->item_count);
 
     for (n = 0; n <= ctx->last_slot; n++) {
 	cur_bucket = &ctx->buckets[n];
@@ -49,7 +49,7 @@ witchhat_new(void)
 {
     witchhat_t *ret;
 
-    ret = (witchhat_t *)malloc(sizeof(witchhat_t));
+    ret = (witchhat_t *)hatrack_malloc(sizeof(witchhat_t));
 
     witchhat_init(ret);
 
@@ -61,7 +61,7 @@ witchhat_new_size(char size)
 {
     witchhat_t *ret;
 
-    ret = (witchhat_t *)malloc(sizeof(witchhat_t));
+    ret = (witchhat_t *)hatrack_malloc(sizeof(witchhat_t));
 
     witchhat_init_size(ret, size);
 
@@ -95,7 +95,7 @@ witchhat_init_size(witchhat_t *self, char size)
     self->next_epoch = 1;
     
     atomic_store(&self->store_current, store);
-    atomic_store(&self->item_count, 0);
+    hatrack_shardctr_init(&self->item_count, 0);
 
     return;
 }
@@ -112,7 +112,7 @@ void
 witchhat_delete(witchhat_t *self)
 {
     witchhat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(witchhat_t));
 
     return;
 }
@@ -200,7 +200,14 @@ witchhat_remove(witchhat_t *self, hatrack_hash_t hv, bool *found)
 uint64_t
 witchhat_len(witchhat_t *self)
 {
-    return atomic_read(&self->item_count);
+    return hatrack_shardctr_read(&self->item_count);
+}
+
+// See hatrack_shardctr_read_approx() for how far off this can be.
+uint64_t
+witchhat_len_approx(witchhat_t *self)
+{
+    return hatrack_shardctr_read_approx(&self->item_count);
 }
 
 hatrack_view_t *
@@ -234,7 +241,7 @@ witchhat_view_no_mmm(witchhat_t *self, uint64_t *num, bool sort)
 
     store     = atomic_read(&self->store_current);
     alloc_len = sizeof(hatrack_view_t) * (store->last_slot + 1);
-    view      = (hatrack_view_t *)malloc(alloc_len);
+    view      = (hatrack_view_t *)hatrack_malloc(alloc_len);
     p         = view;
     cur       = store->buckets;
     end       = cur + (store->last_slot + 1);
@@ -258,12 +265,12 @@ witchhat_view_no_mmm(witchhat_t *self, uint64_t *num, bool sort)
     *num      = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, alloc_len);
 	
         return NULL;
     }
 
-    view = realloc(view, num_items * sizeof(hatrack_view_t));
+    view = hatrack_realloc(view, alloc_len, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
 	qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
@@ -277,12 +284,19 @@ witchhat_store_new(uint64_t size)
 {
     witchhat_store_t *store;
     uint64_t        alloc_len;
+    uint64_t        threshold;
 
+    threshold = hatrack_compute_table_threshold(size);
     alloc_len = sizeof(witchhat_store_t) + sizeof(witchhat_bucket_t) * size;
+    alloc_len += hatrack_budget_alloc_len(threshold);
     store     = (witchhat_store_t *)mmm_alloc_committed(alloc_len);
 
     store->last_slot  = size - 1;
-    store->threshold  = hatrack_compute_table_threshold(size);
+    store->threshold  = threshold;
+
+    if (hatrack_budget_alloc_len(threshold)) {
+	store->budget = (hatrack_shard_t *)&store->buckets[size];
+    }
 
     return store;
 }
@@ -357,7 +371,9 @@ witchhat_store_put(witchhat_store_t *self,
 	
 	if (hatrack_bucket_unreserved(hv2)) {
 	    if (LCAS(&bucket->hv, &hv2, hv1, WITCHHAT_CTR_BUCKET_ACQUIRE)) {
-		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		if (hatrack_budget_claim(self->budget,
+					 &self->used_count,
+					 self->threshold)) {
 		    goto migrate_and_retry;
 		}
 		
@@ -452,7 +468,7 @@ witchhat_store_put(witchhat_store_t *self,
 
     if (LCAS(&bucket->record, &record, candidate, WITCHHAT_CTR_REC_INSTALL)) {
         if (new_item) {
-            atomic_fetch_add(&top->item_count, 1);
+            hatrack_shardctr_add(&top->item_count, 1);
         }
 	
         return old_item;
@@ -619,7 +635,9 @@ witchhat_store_add(witchhat_store_t *self,
 	
 	if (hatrack_bucket_unreserved(hv2)) {
 	    if (LCAS(&bucket->hv, &hv2, hv1, WITCHHAT_CTR_BUCKET_ACQUIRE)) {
-		if (atomic_fetch_add(&self->used_count, 1) >= self->threshold) {
+		if (hatrack_budget_claim(self->budget,
+					 &self->used_count,
+					 self->threshold)) {
 		    goto migrate_and_retry;
 		}
 		goto found_bucket;
@@ -670,7 +688,7 @@ found_bucket:
     candidate.info = WITCHHAT_F_INITED | top->next_epoch++;
 
     if (LCAS(&bucket->record, &record, candidate, WITCHHAT_CTR_REC_INSTALL)) {
-	atomic_fetch_add(&top->item_count, 1);
+	hatrack_shardctr_add(&top->item_count, 1);
         return true;
     }
     
@@ -754,7 +772,7 @@ found_bucket:
     candidate.info = WITCHHAT_F_INITED;
 
     if (LCAS(&bucket->record, &record, candidate, WITCHHAT_CTR_DEL)) {
-        atomic_fetch_sub(&top->item_count, 1);
+        hatrack_shardctr_add(&top->item_count, -1);
 
         if (found) {
             *found = true;
@@ -32,7 +32,8 @@
 
 // Needs to be non-static because tophat needs it; nonetheless, do not
 // export this explicitly; it's effectively a "friend" function not public.
-       woolhat_store_t *woolhat_store_new    (uint64_t);
+       woolhat_store_t *woolhat_store_new    (uint64_t,
+					      hatrack_allocator_t *);
 static void            *woolhat_store_get    (woolhat_store_t *, hatrack_hash_t,
 					      bool *);
 static void            *woolhat_store_put    (woolhat_store_t *, woolhat_t *,
@@ -93,7 +94,7 @@ woolhat_new(void)
 {
     woolhat_t *ret;
 
-    ret = (woolhat_t *)malloc(sizeof(woolhat_t));
+    ret = (woolhat_t *)hatrack_malloc(sizeof(woolhat_t));
 
     woolhat_init(ret);
 
@@ -105,7 +106,7 @@ woolhat_new_size(char size)
 {
     woolhat_t *ret;
 
-    ret = (woolhat_t *)malloc(sizeof(woolhat_t));
+    ret = (woolhat_t *)hatrack_malloc(sizeof(woolhat_t));
 
     woolhat_init_size(ret, size);
 
@@ -135,14 +136,16 @@ woolhat_init_size(woolhat_t *self, char size)
     }
 
     len   = 1 << size;
-    store = woolhat_store_new(len);
+    store = woolhat_store_new(len, NULL);
 
     atomic_store(&self->help_needed, 0);
-    atomic_store(&self->item_count, 0);
+    hatrack_shardctr_init(&self->item_count, 0);
     atomic_store(&self->store_current, store);
 
     self->cleanup_func = NULL;
     self->cleanup_aux  = NULL;
+    self->allocator        = NULL;
+    self->record_allocator = NULL;
 
     return;
 }
@@ -178,7 +181,7 @@ void
 woolhat_delete(woolhat_t *self)
 {
     woolhat_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(woolhat_t));
 
     return;
 }
@@ -222,6 +225,51 @@ woolhat_set_cleanup_func(woolhat_t *self, mmm_cleanup_func func, void *aux)
     return;
 }
 
+/* woolhat_set_allocator()
+ *
+ * Stores and records come from this allocator from now on (NULL
+ * means the global one).  Like the cleanup function, this needs to
+ * be set before the table is shared; the table also has to be empty,
+ * since we swap out the initial store for a new one of the same size.
+ */
+void
+woolhat_set_allocator(woolhat_t *self, hatrack_allocator_t *allocator)
+{
+    woolhat_store_t *store;
+
+    if (woolhat_len(self)) {
+        abort();
+    }
+
+    store                  = atomic_load(&self->store_current);
+    self->allocator        = allocator;
+    self->record_allocator = allocator;
+
+    atomic_store(&self->store_current,
+                 woolhat_store_new(store->last_slot + 1, allocator));
+    mmm_retire_unused(store);
+
+    return;
+}
+
+/* woolhat_set_record_allocator()
+ *
+ * Like woolhat_set_allocator(), but only for records; call it after
+ * that, if the two should differ.  Memory budgets (membudget.h) use
+ * this, since they count stores and records separately.
+ */
+void
+woolhat_set_record_allocator(woolhat_t *self, hatrack_allocator_t *allocator)
+{
+    if (woolhat_len(self)) {
+        abort();
+    }
+
+    self->record_allocator = allocator;
+
+    return;
+}
+
 void *
 woolhat_get(woolhat_t *self, hatrack_hash_t hv, bool *found)
 {
@@ -305,7 +353,14 @@ woolhat_remove(woolhat_t *self, hatrack_hash_t hv, bool *found)
 uint64_t
 woolhat_len(woolhat_t *self)
 {
-    return atomic_read(&self->item_count);
+    return hatrack_shardctr_read(&self->item_count);
+}
+
+// See hatrack_shardctr_read_approx() for how far off this can be.
+uint64_t
+woolhat_len_approx(woolhat_t *self)
+{
+    return hatrack_shardctr_read_approx(&self->item_count);
 }
 
 hatrack_view_t *
@@ -326,7 +381,7 @@ woolhat_view(woolhat_t *self, uint64_t *out_num, bool sort)
     store = self->store_current;
     cur   = store->hist_buckets;
     end   = cur + (store->last_slot + 1);
-    view  = (hatrack_view_t *)malloc(sizeof(hatrack_view_t) * (end - cur));
+    view  = (hatrack_view_t *)hatrack_malloc(sizeof(hatrack_view_t) * (end - cur));
     p     = view;
 
     while (cur < end) {
@@ -369,13 +424,13 @@ woolhat_view(woolhat_t *self, uint64_t *out_num, bool sort)
     *out_num  = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, 0);
         mmm_end_op();
 
         return NULL;
     }
 
-    view = (hatrack_view_t *)realloc(view, num_items * sizeof(hatrack_view_t));
+    view = (hatrack_view_t *)hatrack_realloc(view, 0, num_items * sizeof(hatrack_view_t));
 
     if (sort) {
         qsort(view, num_items, sizeof(hatrack_view_t), hatrack_quicksort_cmp);
@@ -417,7 +472,7 @@ woolhat_view_epoch(woolhat_t *self, uint64_t *out_num, uint64_t epoch)
     cur       = store->hist_buckets;
     end       = cur + (store->last_slot + 1);
     alloc_len = sizeof(hatrack_set_view_t);
-    view      = (hatrack_set_view_t *)calloc(end - cur, alloc_len);
+    view      = (hatrack_set_view_t *)hatrack_zalloc((end - cur) * alloc_len);
     p         = view;
 
     while (cur < end) {
@@ -462,28 +517,35 @@ woolhat_view_epoch(woolhat_t *self, uint64_t *out_num, uint64_t epoch)
     *out_num  = num_items;
 
     if (!num_items) {
-        free(view);
+        hatrack_free(view, 0);
 
         return NULL;
     }
 
     alloc_len = num_items * sizeof(hatrack_set_view_t);
-    view      = (hatrack_set_view_t *)realloc(view, alloc_len);
+    view      = (hatrack_set_view_t *)hatrack_realloc(view, 0, alloc_len);
 
     return view;
 }
 
 woolhat_store_t *
-woolhat_store_new(uint64_t size)
+woolhat_store_new(uint64_t size, hatrack_allocator_t *allocator)
 {
     woolhat_store_t *store;
     uint64_t         sz;
+    uint64_t         threshold;
 
-    sz    = sizeof(woolhat_store_t) + sizeof(woolhat_history_t) * size;
-    store = (woolhat_store_t *)mmm_alloc_committed(sz);
+    threshold = hatrack_compute_table_threshold(size);
+    sz        = sizeof(woolhat_store_t) + sizeof(woolhat_history_t) * size;
+    sz += hatrack_budget_alloc_len(threshold);
+    store     = (woolhat_store_t *)mmm_alloc_committed_with(allocator, sz);
 
     store->last_slot = size - 1;
-    store->threshold = hatrack_compute_table_threshold(size);
+    store->threshold = threshold;
+
+    if (hatrack_budget_alloc_len(threshold)) {
+	store->budget = (hatrack_shard_t *)&store->hist_buckets[size];
+    }
 
     return store;
 }
@@ -543,7 +605,6 @@ woolhat_store_put(woolhat_store_t *self,
 {
     uint64_t           bix;
     uint64_t           i;
-    uint64_t           used_count;
     hatrack_hash_t     hv2;
     woolhat_history_t *bucket;
     woolhat_record_t  *head;
@@ -561,9 +622,9 @@ woolhat_store_put(woolhat_store_t *self,
 
         if (hatrack_bucket_unreserved(hv2)) {
             if (CAS(&bucket->hv, &hv2, hv1)) {
-                used_count = atomic_fetch_add(&self->used_count, 1);
-
-                if (used_count >= self->threshold) {
+                if (hatrack_budget_claim(self->budget,
+                                         &self->used_count,
+                                         self->threshold)) {
                     goto migrate_and_retry;
                 }
 
@@ -653,7 +714,8 @@ found_history_bucket:
 	deletion_below = false;
     }
     
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = mmm_alloc_with(top->record_allocator,
+				     sizeof(woolhat_record_t));
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
@@ -679,7 +741,7 @@ found_history_bucket:
     }
 
     if (!head) {
-        atomic_fetch_add(&top->item_count, 1);
+        hatrack_shardctr_add(&top->item_count, 1);
 	return hatrack_not_found(found);
     }
 
@@ -690,7 +752,7 @@ found_history_bucket:
 	 * the length, because we re-inserted in the same breath.
 	 */
 	if (!(state.flags & WOOLHAT_F_DELETE_HELP)) {
-	    atomic_fetch_add(&top->item_count, 1);	
+	    hatrack_shardctr_add(&top->item_count, 1);	
 	}
 	return hatrack_not_found(found);
     }
@@ -791,7 +853,8 @@ migrate_and_retry:
 	 * return failure.
 	 */
 
-	newhead          = mmm_alloc(sizeof(woolhat_record_t));
+	newhead          = mmm_alloc_with(top->record_allocator,
+					  sizeof(woolhat_record_t));
 	newhead->next    = head;
 	newhead->deleted = true;
 	candidate.head   = newhead;
@@ -823,7 +886,8 @@ migrate_and_retry:
         goto not_found;
     }
 
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = mmm_alloc_with(top->record_allocator,
+				     sizeof(woolhat_record_t));
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
@@ -874,7 +938,6 @@ woolhat_store_add(woolhat_store_t *self,
 {
     uint64_t           bix;
     uint64_t           i;
-    uint64_t           used_count;
     hatrack_hash_t     hv2;
     woolhat_history_t *bucket;
     woolhat_record_t  *head;
@@ -890,9 +953,9 @@ woolhat_store_add(woolhat_store_t *self,
 
         if (hatrack_bucket_unreserved(hv2)) {
             if (CAS(&bucket->hv, &hv2, hv1)) {
-                used_count = atomic_fetch_add(&self->used_count, 1);
-
-                if (used_count >= self->threshold) {
+                if (hatrack_budget_claim(self->budget,
+                                         &self->used_count,
+                                         self->threshold)) {
                     goto migrate_and_retry;
                 }
 
@@ -947,7 +1010,8 @@ found_history_bucket:
         return false;
     }
 
-    newhead         = mmm_alloc(sizeof(woolhat_record_t));
+    newhead         = mmm_alloc_with(top->record_allocator,
+				     sizeof(woolhat_record_t));
     newhead->next   = head;
     newhead->item   = item;
     candidate.head  = newhead;
@@ -981,7 +1045,7 @@ found_history_bucket:
         return false;
     }
 
-    atomic_fetch_add(&top->item_count, 1);
+    hatrack_shardctr_add(&top->item_count, 1);
 
     mmm_commit_write     (newhead);
     woolhat_new_insertion(newhead);
@@ -1084,7 +1148,8 @@ migrate_and_retry:
 	deleting_for_ourselves = true;
     }
     
-    newhead            = mmm_alloc(sizeof(woolhat_record_t));
+    newhead            = mmm_alloc_with(top->record_allocator,
+					sizeof(woolhat_record_t));
     newhead->next      = head;
     newhead->deleted   = true; // ->item is 0'd out by mmm_alloc.
     candidate.head     = newhead;
@@ -1167,7 +1232,7 @@ migrate_and_retry:
 	     */
 	    mmm_commit_write(newhead);	    
 	    mmm_retire(state.state.head);
-	    atomic_fetch_sub(&top->item_count, 1);
+	    hatrack_shardctr_add(&top->item_count, -1);
 	    
 	    if (deleting_for_ourselves) {
 		return hatrack_found(found, NULL);
@@ -1195,7 +1260,7 @@ migrate_and_retry:
     // Here, the initial delete was successful.
     mmm_commit_write(newhead);
     mmm_retire(head);
-    atomic_fetch_sub(&top->item_count, 1);
+    hatrack_shardctr_add(&top->item_count, -1);
 
     return hatrack_found(found, NULL);
 }
@@ -1290,7 +1355,7 @@ woolhat_store_migrate(woolhat_store_t *self, woolhat_t *top)
             new_size = hatrack_new_size(self->last_slot, new_used);
         }
 
-        candidate_store = woolhat_store_new(new_size);
+        candidate_store = woolhat_store_new(new_size, top->allocator);
 
         if (!CAS(&self->store_next,
                   &new_store,
@@ -1302,6 +1367,10 @@ woolhat_store_migrate(woolhat_store_t *self, woolhat_t *top)
         }
     }
 
+    hatrack_prefault(new_store->hist_buckets,
+                     sizeof(woolhat_history_t) * (new_store->last_slot + 1),
+                     &new_store->prefault);
+
     for (i = 0; i <= self->last_slot; i++) {
         cur   = &self->hist_buckets[i];
         state.state = atomic_read(&cur->state);
@@ -60,7 +60,7 @@ static const unholy_u moved_cell  = { .cell = { NULL, CAPQ_MOVING | CAPQ_MOVED }
 
 
 
-static capq_store_t *capq_new_store(uint64_t);
+static capq_store_t *capq_new_store(uint64_t, bool);
 static void          capq_migrate  (capq_store_t *, capq_t *);
 
 void
@@ -78,8 +78,9 @@ capq_init_size(capq_t *self, uint64_t size)
 	size = CAPQ_MINIMUM_SIZE;
     }
     
-    self->store         = capq_new_store(size);
-    self->len           = 0;
+    self->store         = capq_new_store(size, false);
+
+    hatrack_qstats_init(&self->stats, 1);
     
     self->store->dequeue_index = 1L<<32;
     self->store->enqueue_index = 1L<<32;
@@ -98,7 +99,7 @@ capq_new_size(uint64_t size)
 {
     capq_t *ret;
 
-    ret = (capq_t *)malloc(sizeof(capq_t));
+    ret = (capq_t *)hatrack_malloc(sizeof(capq_t));
     capq_init_size(ret, size);
 
     return ret;
@@ -121,7 +122,7 @@ void
 capq_delete(capq_t *self)
 {
     capq_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(capq_t));
 
     return;
 }
@@ -231,8 +232,13 @@ capq_enqueue(capq_t *self, void *item)
 		continue;
 	    }
 
+	    if (store->stamps) {
+		atomic_store_explicit(&store->stamps[capq_ix(cur_ix, sz)],
+				      hatrack_qstats_stamp(&self->stats, cur_ix),
+				      memory_order_relaxed);
+	    }
+
 	    if (CAS(cell, &expected, candidate)) {
-		atomic_fetch_add(&self->len, 1);
 		mmm_end_op();
 
 		return cur_ix;
@@ -497,6 +503,7 @@ capq_cap(capq_t *self, uint64_t epoch)
     uint64_t      cur_ix;
     uint64_t      candidate_ix;
     uint64_t      sz;    
+    uint64_t      stamp;
     capq_cell_t  *cell;
     capq_item_t   expected;
     capq_item_t   candidate;
@@ -551,6 +558,12 @@ capq_cap(capq_t *self, uint64_t epoch)
 	     * capq_top() will do it for us.  However, let's do it
 	     * anyway, just to avoid unnecessary retries in top().
 	     */
+	    if (store->stamps) {
+		stamp = atomic_load_explicit(&store->stamps[capq_ix(cur_ix, sz)],
+					     memory_order_relaxed);
+		hatrack_qstats_record(&self->stats, stamp);
+	    }
+	    
 	    candidate_ix = cur_ix + 1;
 	    CAS(&store->dequeue_index, &cur_ix, candidate_ix);
 	    
@@ -598,17 +611,111 @@ capq_dequeue(capq_t *self, bool *found)
     }
 }
 
+/* The length is the distance between the enqueue and dequeue
+ * indices; see hq_len().
+ */
+int64_t
+capq_len(capq_t *self)
+{
+    capq_store_t *store;
+    uint64_t      enqueue_ix;
+    uint64_t      dequeue_ix;
+    int64_t       ret;
+
+    mmm_start_basic_op();
+
+    store      = atomic_read(&self->store);
+    dequeue_ix = atomic_read(&store->dequeue_index);
+    enqueue_ix = atomic_read(&store->enqueue_index);
+    ret        = hatrack_qstats_depth(enqueue_ix, dequeue_ix, store->size);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Same rules as hq_set_sample_rate(): rate is rounded up to a power
+ * of two, 0 turns sampling off, and this must be called before the
+ * queue is used.
+ */
+void
+capq_set_sample_rate(capq_t *self, uint64_t rate)
+{
+    capq_store_t *store;
+    uint64_t      size;
+
+    store = atomic_read(&self->store);
+    size  = store->size;
+
+    if (atomic_read(&store->enqueue_index) != (1L << 32) ||
+	atomic_read(&store->next_store)) {
+	abort();
+    }
+
+    if (rate) {
+	hatrack_qstats_init(&self->stats, rate);
+    }
+
+    if ((rate != 0) == (store->stamps != NULL)) {
+	return;
+    }
+
+    self->store                = capq_new_store(size, rate != 0);
+    self->store->dequeue_index = 1L << 32;
+    self->store->enqueue_index = 1L << 32;
+
+    mmm_retire_unused(store);
+
+    return;
+}
+
+void
+capq_stats(capq_t *self, hatrack_qstats_snapshot_t *snap)
+{
+    capq_store_t *store;
+    uint64_t      enqueue_ix;
+    uint64_t      dequeue_ix;
+
+    mmm_start_basic_op();
+
+    store      = atomic_read(&self->store);
+    dequeue_ix = atomic_read(&store->dequeue_index);
+    enqueue_ix = atomic_read(&store->enqueue_index);
+
+    hatrack_qstats_snapshot(&self->stats, snap);
+
+    snap->depth    = hatrack_qstats_depth(enqueue_ix, dequeue_ix, store->size);
+    snap->capacity = store->size;
+
+    if (!store->stamps) {
+	snap->sample_rate = 0;
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
 static capq_store_t *
-capq_new_store(uint64_t size)
+capq_new_store(uint64_t size, bool stamps)
 {
     capq_store_t *ret;
     uint64_t    alloc_len;
 
     alloc_len = sizeof(capq_store_t) + sizeof(capq_cell_t) * size;
+
+    if (stamps) {
+	alloc_len += sizeof(uint64_t) * size;
+    }
+    
     ret       = (capq_store_t *)mmm_alloc_committed(alloc_len);
     
     ret->size = size;
 
+    if (stamps) {
+	ret->stamps = (_Atomic uint64_t *)&ret->cells[size];
+    }
+
     return ret;
 }
 
@@ -692,7 +799,7 @@ capq_migrate(capq_store_t *store, capq_t *top)
 
     // Phase 2: agree on the new store.
     expected_store = NULL;
-    next_store     = capq_new_store(store->size << 1);
+    next_store     = capq_new_store(store->size << 1, store->stamps != NULL);
 
     atomic_store(&next_store->enqueue_index, CAPQ_STORE_INITIALIZING);
     atomic_store(&next_store->dequeue_index, CAPQ_STORE_INITIALIZING);
@@ -725,6 +832,12 @@ capq_migrate(capq_store_t *store, capq_t *top)
 	    continue;
 	}
 
+	// The timestamp has to land before the item does.
+	if (store->stamps) {
+	    atomic_store(&next_store->stamps[n],
+			 atomic_load(&store->stamps[i]));
+	}
+
 	expected_item        = empty_cell;
 	candidate_item.item  = old_item.item;
 	candidate_item.state = capq_clear_moving(old_item.state);
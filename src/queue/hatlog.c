@@ -0,0 +1,426 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hatlog.c
+ *  Description:    A logger that formats into a logring, and has a
+ *                  background thread drain it to a file.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static void *hatlog_drain     (void *);
+static void  hatlog_write_all (hatlog_t *, uint64_t);
+static bool  hatlog_open      (hatlog_t *);
+static void  hatlog_rotate    (hatlog_t *);
+
+hatlog_t *
+hatlog_new(const char *path, uint64_t ring_size, uint64_t msg_size)
+{
+    hatlog_t *ret;
+
+    ret = (hatlog_t *)hatrack_malloc(sizeof(hatlog_t));
+
+    hatlog_init(ret, path, ring_size, msg_size);
+
+    return ret;
+}
+
+/* ring_size is the number of messages the ring can hold before the
+ * oldest ones start getting dropped; msg_size is the most bytes a
+ * single message can take. Longer messages get truncated.
+ */
+void
+hatlog_init(hatlog_t *self,
+	    const char *path,
+	    uint64_t    ring_size,
+	    uint64_t    msg_size)
+{
+    uint64_t path_len;
+
+    if (msg_size < 2) {
+	abort();
+    }
+
+    path_len = strlen(path) + 1;
+
+    self->ring          = logring_new(ring_size, msg_size);
+    self->path          = (char *)hatrack_malloc(path_len);
+    self->fd            = -1;
+    self->msg_size      = msg_size;
+    self->batch_size    = HATLOG_DEFAULT_BATCH_SIZE;
+    self->max_file_size = 0;
+    self->max_files     = 0;
+    self->file_size     = 0;
+    self->batch         = NULL;
+    self->iov           = NULL;
+    self->running       = false;
+
+    memcpy(self->path, path, path_len);
+
+    atomic_store(&self->stop, false);
+    atomic_store(&self->written, 0);
+    atomic_store(&self->write_errors, 0);
+
+    return;
+}
+
+void
+hatlog_cleanup(hatlog_t *self)
+{
+    hatlog_stop(self);
+
+    logring_delete(self->ring);
+    hatrack_free(self->path, strlen(self->path) + 1);
+
+    return;
+}
+
+void
+hatlog_delete(hatlog_t *self)
+{
+    hatlog_cleanup(self);
+    hatrack_free(self, sizeof(hatlog_t));
+
+    return;
+}
+
+// These two need to be called before hatlog_start().
+void
+hatlog_set_batch_size(hatlog_t *self, uint64_t batch_size)
+{
+    if (self->running || !batch_size) {
+	abort();
+    }
+
+    if (batch_size > IOV_MAX) {
+	batch_size = IOV_MAX;
+    }
+
+    self->batch_size = batch_size;
+
+    return;
+}
+
+/* A max_file_size of 0 turns off rotation.  If max_files is 0, we
+ * don't keep old files around; the log just gets truncated when it
+ * reaches max_file_size.
+ */
+void
+hatlog_set_rotation(hatlog_t *self, uint64_t max_file_size, uint64_t max_files)
+{
+    if (self->running) {
+	abort();
+    }
+
+    self->max_file_size = max_file_size;
+    self->max_files     = max_files;
+
+    return;
+}
+
+/* Opens the log file (appending, if it exists), and starts the drain
+ * thread.  Returns false if the file couldn't be opened.
+ */
+bool
+hatlog_start(hatlog_t *self)
+{
+    if (self->running) {
+	return true;
+    }
+
+    if (!hatlog_open(self)) {
+	return false;
+    }
+
+    self->batch = (char *)hatrack_malloc(self->batch_size * self->msg_size);
+    self->iov   = (struct iovec *)hatrack_malloc(sizeof(struct iovec)
+						 * self->batch_size);
+
+    if (pthread_create(&self->drain_thread, NULL, hatlog_drain, self)) {
+	hatlog_stop(self);
+
+	return false;
+    }
+
+    self->running = true;
+
+    return true;
+}
+
+/* Stops the drain thread, after it's written out everything that was
+ * in the ring, and closes the file.  Anything logged after this starts
+ * may or may not make it to the file.
+ */
+void
+hatlog_stop(hatlog_t *self)
+{
+    if (self->running) {
+	atomic_store(&self->stop, true);
+	pthread_join(self->drain_thread, NULL);
+	self->running = false;
+    }
+
+    if (self->fd != -1) {
+	close(self->fd);
+	self->fd = -1;
+    }
+
+    /* The batch size can change before the next start, so the buffers
+     * get reallocated then.
+     */
+    if (self->batch) {
+	hatrack_free(self->batch, self->batch_size * self->msg_size);
+	hatrack_free(self->iov, sizeof(struct iovec) * self->batch_size);
+
+	self->batch = NULL;
+	self->iov   = NULL;
+    }
+
+    return;
+}
+
+void
+hatlog_write(hatlog_t *self, void *msg, uint64_t len)
+{
+    logring_enqueue(self->ring, msg, len);
+
+    return;
+}
+
+/* We format right into the ring entry.  vsnprintf() always leaves
+ * room for a null byte, which we don't write out.  If the message
+ * gets truncated, we make sure it still ends with a newline.
+ */
+void
+hatlog_printf(hatlog_t *self, const char *fmt, ...)
+{
+    va_list  args;
+    uint64_t ix;
+    char    *data;
+    int      len;
+
+    data = logring_reserve(self->ring, &ix);
+
+    va_start(args, fmt);
+    len = vsnprintf(data, self->msg_size, fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+	len = 0;
+    }
+    else {
+	if ((uint64_t)len >= self->msg_size) {
+	    len           = self->msg_size - 1;
+	    data[len - 1] = '\n';
+	}
+    }
+
+    logring_commit(self->ring, ix, (uint64_t)len);
+
+    return;
+}
+
+uint64_t
+hatlog_dropped(hatlog_t *self)
+{
+    return logring_dropped(self->ring);
+}
+
+uint64_t
+hatlog_written(hatlog_t *self)
+{
+    return atomic_read(&self->written);
+}
+
+uint64_t
+hatlog_write_errors(hatlog_t *self)
+{
+    return atomic_read(&self->write_errors);
+}
+
+static void *
+hatlog_drain(void *arg)
+{
+    hatlog_t       *self;
+    uint64_t        n;
+    uint64_t        len;
+    uint64_t        num_bytes;
+    char           *p;
+    struct timespec sleep_time;
+
+    self               = (hatlog_t *)arg;
+    sleep_time.tv_sec  = 0;
+    sleep_time.tv_nsec = HATLOG_DRAIN_SLEEP_NS;
+
+    mmm_register_thread();
+
+    while (true) {
+	n         = 0;
+	num_bytes = 0;
+	p         = self->batch;
+
+	while (n < self->batch_size && logring_dequeue(self->ring, p, &len)) {
+	    self->iov[n].iov_base = p;
+	    self->iov[n].iov_len  = len;
+
+	    num_bytes += len;
+	    p         += self->msg_size;
+	    n++;
+	}
+
+	if (!n) {
+	    if (atomic_read(&self->stop)) {
+		break;
+	    }
+
+	    nanosleep(&sleep_time, NULL);
+	    continue;
+	}
+
+	if (self->max_file_size && self->file_size &&
+	    self->file_size + num_bytes > self->max_file_size) {
+	    hatlog_rotate(self);
+	}
+
+	hatlog_write_all(self, n);
+
+	self->file_size += num_bytes;
+	atomic_fetch_add(&self->written, n);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* writev() can return early (e.g., on a signal, or a full disk); we
+ * keep going from where it left off.  If we get an actual error, we
+ * count it and give up on the batch, rather than block producers
+ * behind a broken file.
+ */
+static void
+hatlog_write_all(hatlog_t *self, uint64_t n)
+{
+    struct iovec *iov;
+    ssize_t       ret;
+
+    iov = self->iov;
+
+    while (n) {
+	ret = writev(self->fd, iov, (int)n);
+
+	if (ret < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+
+	    atomic_fetch_add(&self->write_errors, 1);
+	    return;
+	}
+
+	while (n && (size_t)ret >= iov->iov_len) {
+	    ret -= iov->iov_len;
+	    iov++;
+	    n--;
+	}
+
+	if (n) {
+	    iov->iov_base  = ((char *)iov->iov_base) + ret;
+	    iov->iov_len  -= ret;
+	}
+    }
+
+    return;
+}
+
+static bool
+hatlog_open(hatlog_t *self)
+{
+    struct stat info;
+
+    self->fd = open(self->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (self->fd == -1) {
+	return false;
+    }
+
+    if (!fstat(self->fd, &info)) {
+	self->file_size = (uint64_t)info.st_size;
+    }
+    else {
+	self->file_size = 0;
+    }
+
+    return true;
+}
+
+static void
+hatlog_rotate(hatlog_t *self)
+{
+    uint64_t i;
+    size_t   len;
+    char    *from;
+    char    *to;
+
+    close(self->fd);
+
+    if (!self->max_files) {
+	self->fd = open(self->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+	goto reopened;
+    }
+
+    len  = strlen(self->path) + 22;
+    from = (char *)hatrack_malloc(len);
+    to   = (char *)hatrack_malloc(len);
+
+    for (i = self->max_files - 1; i > 0; i--) {
+	snprintf(from, len, "%s.%lu", self->path, (unsigned long)i);
+	snprintf(to, len, "%s.%lu", self->path, (unsigned long)(i + 1));
+	rename(from, to);
+    }
+
+    snprintf(to, len, "%s.1", self->path);
+    rename(self->path, to);
+
+    hatrack_free(from, len);
+    hatrack_free(to, len);
+
+    self->fd = open(self->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+ reopened:
+    self->file_size = 0;
+
+    if (self->fd == -1) {
+	atomic_fetch_add(&self->write_errors, 1);
+    }
+
+    return;
+}
@@ -36,6 +36,8 @@
 #define HATRING_MAX_SLEEP_TIME 999999999
 
 
+static void hatring_record_dwell(hatring_t *, uint64_t);
+
 hatring_t *
 hatring_new(uint64_t num_buckets)
 {
@@ -49,7 +51,7 @@ hatring_new(uint64_t num_buckets)
     }
 
     alloc_len = sizeof(hatring_cell_t) * num_buckets;
-    ret       = (hatring_t *)calloc(1,sizeof(hatring_t) + alloc_len);
+    ret       = (hatring_t *)hatrack_zalloc(sizeof(hatring_t) + alloc_len);
 
     /* We start the epochs up high so that we can be confident when
      * dequeuing whether the cell was enqueued, when we see an epoch
@@ -95,6 +97,10 @@ hatring_cleanup(hatring_t *self)
 	}
     }
 
+    if (self->stamps) {
+	hatrack_free(self->stamps, self->size * sizeof(uint64_t));
+    }
+
     return;
 }
 
@@ -102,7 +108,7 @@ void
 hatring_delete(hatring_t *self)
 {
     hatring_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(hatring_t));
 
     return;
 }
@@ -180,13 +186,23 @@ hatring_enqueue(hatring_t *self, void *item)
 	expected    = atomic_read(&self->cells[ix]);
 	cell_epoch  = hatring_cell_epoch(expected.state);
 
+	if (self->stamps) {
+	    atomic_store_explicit(&self->stamps[ix],
+				  hatrack_qstats_stamp(&self->stats,
+						       write_epoch),
+				  memory_order_relaxed);
+	}
+	
 	while (cell_epoch < write_epoch) {
 	    candidate.state = HATRING_ENQUEUED | write_epoch;
 
 	    if (CAS(&self->cells[ix], &expected, candidate)) {
-		if (hatring_is_enqueued(expected.state) &&
-		    self->drop_handler) {
-		    (*self->drop_handler)(expected.item);
+		if (hatring_is_enqueued(expected.state)) {
+		    atomic_fetch_add(&self->drops, 1);
+
+		    if (self->drop_handler) {
+			(*self->drop_handler)(expected.item);
+		    }
 		}
 		
 		return write_epoch;
@@ -251,6 +267,10 @@ hatring_dequeue(hatring_t *self, bool *found)
 	     */
 	    if (CAS(&self->cells[ix], &expected, candidate)) {
 		if (cell_epoch == read_epoch) {
+		    if (self->stamps) {
+			hatring_record_dwell(self, ix);
+		    }
+		    
 		    return hatrack_found(found, expected.item);
 		}
 
@@ -261,9 +281,12 @@ hatring_dequeue(hatring_t *self, bool *found)
 		 * also why we need to apply the drop handler during
 		 * clean-up.
 		 */
-		    if (self->drop_handler &&
-			hatring_is_enqueued(expected.state)) {
-			(*self->drop_handler)(expected.item);
+		    if (hatring_is_enqueued(expected.state)) {
+			atomic_fetch_add(&self->drops, 1);
+
+			if (self->drop_handler) {
+			    (*self->drop_handler)(expected.item);
+			}
 		    }
 
 		    if ((read_epoch + 1) == write_epoch) {
@@ -347,6 +370,10 @@ hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint32_t *epoch)
 	     */
 	    if (CAS(&self->cells[ix], &expected, candidate)) {
 		if (cell_epoch == read_epoch) {
+		    if (self->stamps) {
+			hatring_record_dwell(self, ix);
+		    }
+		    
 		    *epoch = read_epoch;
 		    return hatrack_found(found, expected.item);
 		}
@@ -358,9 +385,12 @@ hatring_dequeue_w_epoch(hatring_t *self, bool *found, uint32_t *epoch)
 		 * also why we need to apply the drop handler during
 		 * clean-up.
 		 */
-		    if (self->drop_handler &&
-			hatring_is_enqueued(expected.state)) {
-			(*self->drop_handler)(expected.item);
+		    if (hatring_is_enqueued(expected.state)) {
+			atomic_fetch_add(&self->drops, 1);
+
+			if (self->drop_handler) {
+			    (*self->drop_handler)(expected.item);
+			}
 		    }
 		    return hatrack_not_found(found);
 		}
@@ -442,3 +472,75 @@ hatring_set_drop_handler(hatring_t *self, hatring_drop_handler func)
 
     return;
 }
+
+/* The number of items that were overwritten (or otherwise ejected)
+ * before anyone dequeued them.  Counted whether or not there's a drop
+ * handler.
+ */
+uint64_t
+hatring_drops(hatring_t *self)
+{
+    return atomic_read(&self->drops);
+}
+
+/* Turns on dwell-time sampling for one in every 'rate' items (rounded
+ * up to a power of two), or turns it off if rate is 0.  Like the
+ * drop handler, this should be set before the ring is shared.
+ *
+ * A dequeue that only gets its item because a lapping write failed
+ * to eject it doesn't record a sample, since the timestamp in the
+ * side array belongs to the writer by then.
+ */
+void
+hatring_set_sample_rate(hatring_t *self, uint64_t rate)
+{
+    if (!rate) {
+	if (self->stamps) {
+	    hatrack_free(self->stamps, self->size * sizeof(uint64_t));
+	    self->stamps = NULL;
+	}
+
+	return;
+    }
+
+    hatrack_qstats_init(&self->stats, rate);
+
+    if (!self->stamps) {
+	self->stamps = (_Atomic uint64_t *)hatrack_zalloc(self->size * sizeof(uint64_t));
+    }
+
+    return;
+}
+
+void
+hatring_stats(hatring_t *self, hatrack_qstats_snapshot_t *snap)
+{
+    uint64_t epochs;
+
+    epochs = atomic_read(&self->epochs);
+
+    hatrack_qstats_snapshot(&self->stats, snap);
+
+    snap->depth    = hatrack_qstats_depth(hatring_enqueue_epoch(epochs),
+					  hatring_dequeue_epoch(epochs),
+					  self->size);
+    snap->capacity = self->size;
+
+    if (!self->stamps) {
+	snap->sample_rate = 0;
+    }
+
+    return;
+}
+
+static void
+hatring_record_dwell(hatring_t *self, uint64_t ix)
+{
+    uint64_t stamp;
+
+    stamp = atomic_load_explicit(&self->stamps[ix], memory_order_relaxed);
+
+    hatrack_qstats_record(&self->stats, stamp);
+
+    return;
+}
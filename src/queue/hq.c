@@ -127,8 +127,9 @@ static const union {
 
 
 
-static hq_store_t *hq_new_store(uint64_t);
+static hq_store_t *hq_new_store(uint64_t, bool);
 static uint64_t    hq_migrate  (hq_store_t *, hq_t *);
+static void        hq_record_dwell(hq_t *, hq_store_t *, uint64_t);
 
 #define HQ_DEFAULT_SIZE 1024
 #define HQ_MINIMUM_SIZE 128
@@ -148,8 +149,9 @@ hq_init_size(hq_t *self, uint64_t size)
 	size = HQ_MINIMUM_SIZE;
     }
     
-    self->store         = hq_new_store(size);
-    self->len           = 0;
+    self->store         = hq_new_store(size, false);
+    
+    hatrack_qstats_init(&self->stats, 1);
     
     self->store->dequeue_index = size;
     self->store->enqueue_index = size;
@@ -168,7 +170,7 @@ hq_new_size(uint64_t size)
 {
     hq_t *ret;
 
-    ret = (hq_t *)malloc(sizeof(hq_t));
+    ret = (hq_t *)hatrack_malloc(sizeof(hq_t));
     hq_init_size(ret, size);
 
     return ret;
@@ -191,7 +193,7 @@ void
 hq_delete(hq_t *self)
 {
     hq_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(hq_t));
 
     return;
 }
@@ -266,8 +268,13 @@ hq_enqueue(hq_t *self, void *item)
 	    
 	    candidate.state = hq_set_used(cur_ix);
 
+	    if (store->stamps) {
+		atomic_store_explicit(&store->stamps[hq_ix(cur_ix, sz)],
+				      hatrack_qstats_stamp(&self->stats, cur_ix),
+				      memory_order_relaxed);
+	    }
+
 	    if (CAS(cell, &expected, candidate)) {
-		atomic_fetch_add(&self->len, 1);
 		mmm_end_op();
 
 		return;
@@ -361,7 +368,10 @@ hq_dequeue(hq_t *self, bool *found)
 		continue;
 	    }
 
-	    atomic_fetch_sub(&self->len, 1);	    
+	    if (store->stamps) {
+		hq_record_dwell(self, store, cur_ix);
+	    }
+	    
 	    return hatrack_found_w_mmm(found, expected.item);
 	}
 	
@@ -417,7 +427,10 @@ hq_dequeue(hq_t *self, bool *found)
 	    goto migrate_then_possibly_dequeue;
 	}
 
-	atomic_fetch_sub(&self->len, 1);
+	if (store->stamps) {
+	    hq_record_dwell(self, store, cur_ix);
+	}
+	
 	return hatrack_found_w_mmm(found, ret);
     }
 }
@@ -431,7 +444,7 @@ hq_view(hq_t *self)
 
     mmm_start_basic_op();
 
-    ret = (hq_view_t *)malloc(sizeof(hq_view_t));
+    ret = (hq_view_t *)hatrack_malloc(sizeof(hq_view_t));
 
     while (true) {
 	store    = atomic_read(&self->store);
@@ -484,22 +497,132 @@ hq_view_delete(hq_view_t *view)
 {
     mmm_retire(view->store);
 
-    free(view);
+    hatrack_free(view, 0);
+
+    return;
+}
+
+/* The length is the distance between the enqueue and dequeue
+ * indices, which means enqueues and dequeues don't have to fight
+ * over a shared counter.  It can be a little high when enqueuers
+ * have skipped cells, but it never goes over the store size.
+ */
+int64_t
+hq_len(hq_t *self)
+{
+    hq_store_t *store;
+    uint64_t    enqueue_ix;
+    uint64_t    dequeue_ix;
+    int64_t     ret;
+
+    mmm_start_basic_op();
+
+    store      = atomic_read(&self->store);
+    dequeue_ix = atomic_read(&store->dequeue_index) & ~HQ_MOVING;
+    enqueue_ix = atomic_read(&store->enqueue_index);
+    ret        = hatrack_qstats_depth(enqueue_ix, dequeue_ix, store->size);
+
+    mmm_end_op();
+
+    return ret;
+}
+
+/* Turns on dwell-time sampling for one in every 'rate' items (rounded
+ * up to a power of two), or turns it off if rate is 0.  The
+ * timestamps live alongside the cells, so we swap in a fresh store;
+ * that means this has to be called before the queue is used.
+ */
+void
+hq_set_sample_rate(hq_t *self, uint64_t rate)
+{
+    hq_store_t *store;
+    uint64_t    size;
+
+    store = atomic_read(&self->store);
+    size  = store->size;
+
+    if (atomic_read(&store->enqueue_index) != size ||
+	atomic_read(&store->next_store)) {
+	abort();
+    }
+
+    if (rate) {
+	hatrack_qstats_init(&self->stats, rate);
+    }
+    
+    if ((rate != 0) == (store->stamps != NULL)) {
+	return;
+    }
+
+    self->store                = hq_new_store(size, rate != 0);
+    self->store->dequeue_index = size;
+    self->store->enqueue_index = size;
+
+    mmm_retire_unused(store);
+
+    return;
+}
+
+void
+hq_stats(hq_t *self, hatrack_qstats_snapshot_t *snap)
+{
+    hq_store_t *store;
+    uint64_t    enqueue_ix;
+    uint64_t    dequeue_ix;
+
+    mmm_start_basic_op();
+
+    store      = atomic_read(&self->store);
+    dequeue_ix = atomic_read(&store->dequeue_index) & ~HQ_MOVING;
+    enqueue_ix = atomic_read(&store->enqueue_index);
+
+    hatrack_qstats_snapshot(&self->stats, snap);
+
+    snap->depth    = hatrack_qstats_depth(enqueue_ix, dequeue_ix, store->size);
+    snap->capacity = store->size;
+
+    if (!store->stamps) {
+	snap->sample_rate = 0;
+    }
+
+    mmm_end_op();
+
+    return;
+}
+
+static void
+hq_record_dwell(hq_t *self, hq_store_t *store, uint64_t ix)
+{
+    uint64_t stamp;
+
+    stamp = atomic_load_explicit(&store->stamps[hq_ix(ix, store->size)],
+				 memory_order_relaxed);
+
+    hatrack_qstats_record(&self->stats, stamp);
 
     return;
 }
 
 static hq_store_t *
-hq_new_store(uint64_t size)
+hq_new_store(uint64_t size, bool stamps)
 {
     hq_store_t *ret;
     uint64_t    alloc_len;
 
     alloc_len = sizeof(hq_store_t) + sizeof(hq_cell_t) * size;
+
+    if (stamps) {
+	alloc_len += sizeof(uint64_t) * size;
+    }
+    
     ret       = (hq_store_t *)mmm_alloc_committed(alloc_len);
     
     ret->size = size;
 
+    if (stamps) {
+	ret->stamps = (_Atomic uint64_t *)&ret->cells[size];
+    }
+
     return ret;
 }
 
@@ -550,8 +673,11 @@ hq_migrate(hq_store_t *store, hq_t *top)
 	}
     }
 
+    /* The cell for (highest - size) is the one highest is sitting in,
+     * so the range can't start any earlier than the epoch after it.
+     */
     n      = highest;
-    lowest = (highest - store->size); // Anything lower than this is a skip.
+    lowest = (highest - store->size + 1); // Anything lower than this is a skip.
     
 
     // When starting at the highest epoch, the lowest non-skipped
@@ -574,7 +700,7 @@ hq_migrate(hq_store_t *store, hq_t *top)
     }
 
     expected_store = NULL;
-    next_store     = hq_new_store(store->size << 1);
+    next_store     = hq_new_store(store->size << 1, store->stamps != NULL);
 
     atomic_store(&next_store->enqueue_index, HQ_STORE_INITIALIZING);
     atomic_store(&next_store->dequeue_index, HQ_STORE_INITIALIZING);    
@@ -584,6 +710,10 @@ hq_migrate(hq_store_t *store, hq_t *top)
 	next_store = expected_store;
     }
 
+    hatrack_prefault(next_store->cells,
+		     sizeof(hq_cell_t) * next_store->size,
+		     &next_store->prefault);
+
     i = lowest;
     n = 0;
 
@@ -606,6 +736,14 @@ hq_migrate(hq_store_t *store, hq_t *top)
 	    continue;
 	}
 	
+	/* The timestamp has to land before the item does, since
+	 * dequeuers in the new store read it after the cell.
+	 */
+	if (store->stamps) {
+	    atomic_store(&next_store->stamps[n],
+			 atomic_load(&store->stamps[hq_ix(i, store->size)]));
+	}
+	
 	expected_item        = empty_cell;
 	candidate_item.item  = old_item.item;
 	candidate_item.state = hq_set_used(n + next_store->size);
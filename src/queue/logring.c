@@ -35,7 +35,7 @@ logring_new(uint64_t ring_size, uint64_t entry_size)
 {
     logring_t *ret;
 
-    ret = (logring_t *)calloc(1, sizeof(logring_t));
+    ret = (logring_t *)hatrack_zalloc(sizeof(logring_t));
 
     logring_init(ret, ring_size, entry_size);
 
@@ -55,7 +55,10 @@ logring_init(logring_t *self, uint64_t ring_size, uint64_t entry_size)
     
     n = hatrack_round_up_to_power_of_2(ring_size);
 
-    if (n > HATRACK_THREADS_MAX) {
+    /* The entry array needs room for a full ring, plus one entry
+     * per thread that might be in the middle of an enqueue.
+     */
+    if (n < HATRACK_THREADS_MAX) {
 	m = hatrack_round_up_to_power_of_2(HATRACK_THREADS_MAX << 1);
     }
 
@@ -65,10 +68,11 @@ logring_init(logring_t *self, uint64_t ring_size, uint64_t entry_size)
 
     l                = sizeof(logring_entry_t) + entry_size;
     self->ring       = hatring_new(n);
-    self->entries    = (logring_entry_t *)calloc(m, l);
+    self->entries    = (logring_entry_t *)hatrack_zalloc(m * l);
     self->last_entry = m - 1;
     self->entry_ix   = 0;
     self->entry_len  = entry_size;
+    self->dropped    = 0;
     
     return;
 }
@@ -77,7 +81,9 @@ void
 logring_cleanup(logring_t *self)
 {
     hatring_delete(self->ring);
-    free(self->entries);
+    hatrack_free(self->entries,
+		 (self->last_entry + 1)
+		     * (sizeof(logring_entry_t) + self->entry_len));
 
     return;
 }
@@ -87,13 +93,40 @@ logring_delete(logring_t *self)
 {
     logring_cleanup(self);
 
-    free(self);
+    hatrack_free(self, sizeof(logring_t));
 
     return;
 }
 
 void
 logring_enqueue(logring_t *self, void *item, uint64_t len)
+{
+    uint64_t ix;
+    char    *data;
+
+    if (len > self->entry_len) {
+	len = self->entry_len;
+    }
+
+    data = logring_reserve(self, &ix);
+
+    memcpy(data, item, len);
+    logring_commit(self, ix, len);
+
+    return;
+}
+
+/* Enqueuing in two steps, so that callers can format directly into
+ * the entry, instead of formatting into a buffer that we then copy.
+ *
+ * logring_reserve() claims an entry, and returns a pointer to its
+ * data, which has room for entry_size bytes (as passed to
+ * logring_init()).  The entry isn't visible to dequeuers until it's
+ * passed to logring_commit(), along with the number of bytes
+ * written.  Every reserve must be followed by a commit.
+ */
+char *
+logring_reserve(logring_t *self, uint64_t *ix_out)
 {
     uint64_t             ix;
     uint64_t             byte_ix;
@@ -102,10 +135,6 @@ logring_enqueue(logring_t *self, void *item, uint64_t len)
     logring_entry_info_t candidate;
     logring_entry_t     *cur;
 
-    if (len > self->entry_len) {
-	len = self->entry_len;
-    }
-
     logring_view_help_if_needed(self);
 	
     while (true) {
@@ -131,7 +160,22 @@ logring_enqueue(logring_t *self, void *item, uint64_t len)
 	}
     }
 
-    memcpy(cur->data, item, len);
+    *ix_out = ix;
+
+    return cur->data;
+}
+
+void
+logring_commit(logring_t *self, uint64_t ix, uint64_t len)
+{
+    logring_entry_info_t candidate;
+    logring_entry_t     *cur;
+
+    if (len > self->entry_len) {
+	len = self->entry_len;
+    }
+
+    cur = logring_get_entry(self, ix);
     
     candidate.write_epoch = hatring_enqueue(self->ring, (void *)ix);
     candidate.state       = LOGRING_ENQUEUE_DONE;
@@ -142,6 +186,16 @@ logring_enqueue(logring_t *self, void *item, uint64_t len)
     return;
 }
 
+/* The number of committed entries that got overwritten before they
+ * were dequeued, either in the ring, or (for a dequeuer that was too
+ * slow) in the entry array.
+ */
+uint64_t
+logring_dropped(logring_t *self)
+{
+    return hatring_drops(self->ring) + atomic_read(&self->dropped);
+}
+
 bool
 logring_dequeue(logring_t *self, void *output, uint64_t *len)
 {
@@ -174,6 +228,9 @@ logring_dequeue(logring_t *self, void *output, uint64_t *len)
 		goto safely_dequeue;
 	    }
 	}
+
+	// The entry got reused before we could read it.
+	atomic_fetch_add(&self->dropped, 1);
     }
 
  safely_dequeue:
@@ -310,7 +367,7 @@ logring_view(logring_t *self, bool lax_view)
 	entry = &ret->cells[i];
 
 	if (entry->value) {
-	    free(entry->value);
+	    hatrack_free(entry->value, entry->len);
 	}
     }
     
@@ -352,7 +409,7 @@ logring_view_delete(logring_view_t *view)
 	view->next_ix++;
 
 	if (cur->value) {
-	    free(cur->value);
+	    hatrack_free(cur->value, cur->len);
 	}
     }
     
@@ -363,6 +420,171 @@ logring_view_delete(logring_view_t *view)
     return;
 }
 
+/* If from_oldest is true, the follower starts at the oldest entry
+ * that's still in the ring.  Otherwise, it only sees entries enqueued
+ * after this call.
+ */
+void
+logring_follower_init(logring_follower_t *follower,
+		      logring_t          *self,
+		      bool                from_oldest)
+{
+    uint64_t epochs;
+    uint32_t head;
+    uint32_t tail;
+
+    epochs = atomic_read(&self->ring->epochs);
+    head   = hatring_enqueue_epoch(epochs);
+
+    follower->ring       = self;
+    follower->next_epoch = head;
+
+    if (!from_oldest) {
+	return;
+    }
+
+    // Epochs start at the ring size, so this can't wrap.
+    tail = head - self->ring->size;
+
+    if (hatring_dequeue_epoch(epochs) > tail) {
+	tail = hatring_dequeue_epoch(epochs);
+    }
+
+    if (tail < head) {
+	follower->next_epoch = tail;
+    }
+
+    return;
+}
+
+/* Copies the follower's next entry into output (which needs room for
+ * entry_size bytes), and moves past it.  Returns false if there's
+ * nothing new to read, or if the next entry's enqueue hasn't finished
+ * yet; either way, calling again later will pick up where we left
+ * off.
+ *
+ * *missed gets the number of entries the follower skipped during this
+ * call, because they were overwritten or dequeued before it could
+ * read them.  That's set whether or not we return an entry.  It's
+ * really a count of ring epochs, and an enqueuer that loses a race
+ * can burn an epoch without putting anything in it, so under heavy
+ * contention, this can run a little high.
+ *
+ * We never write to shared memory here.  The ring cells and entry
+ * info are 128-bit values, but instead of reading them with 128-bit
+ * atomics (which, on x86, means a lock cmpxchg16b, taking the cache
+ * line away from producers), we read them a 64-bit word at a time,
+ * and re-check the word that identifies the write afterward, since
+ * epochs don't repeat.
+ */
+bool
+logring_follow(logring_follower_t *follower,
+	       void               *output,
+	       uint64_t           *len,
+	       uint64_t           *missed)
+{
+    logring_t            *self;
+    _Atomic uint64_t     *cell;
+    _Atomic uint64_t     *info_word;
+    uint32_t              rix;
+    uint32_t              head;
+    uint64_t              state;
+    uint64_t              entry_ix;
+    uint64_t              word;
+    uint64_t              n;
+    logring_entry_info_t  info;
+    logring_entry_t      *entry;
+
+    self    = follower->ring;
+    *missed = 0;
+
+    while (true) {
+	rix  = follower->next_epoch;
+	head = hatring_enqueue_epoch(atomic_read(&self->ring->epochs));
+
+	if (rix >= head) {
+	    return false;
+	}
+
+	// If the ring lapped us, jump to the oldest cell still in it.
+	if (head - rix > self->ring->size) {
+	    *missed              += head - rix - self->ring->size;
+	    rix                   = head - self->ring->size;
+	    follower->next_epoch  = rix;
+	}
+
+	/* The item is the first word of the cell, and the state
+	 * (which holds the epoch) is the second.
+	 */
+	cell = (_Atomic uint64_t *)logring_get_ringcell(self, rix);
+
+	do {
+	    state    = atomic_load_explicit(&cell[1], memory_order_acquire);
+	    entry_ix = atomic_load_explicit(&cell[0], memory_order_relaxed);
+	    atomic_thread_fence(memory_order_acquire);
+	} while (state != atomic_load_explicit(&cell[1],
+					       memory_order_relaxed));
+
+	// The enqueuer for this epoch hasn't written the cell yet.
+	if (hatring_cell_epoch(state) < rix) {
+	    return false;
+	}
+
+	if ((hatring_cell_epoch(state) > rix) || !hatring_is_enqueued(state)) {
+	    goto skip_entry;
+	}
+
+	/* The first word of the info is the write epoch and the state;
+	 * the view ID doesn't matter to us.
+	 */
+	entry     = logring_get_entry(self, entry_ix);
+	info_word = (_Atomic uint64_t *)&entry->info;
+	word      = atomic_load_explicit(info_word, memory_order_acquire);
+
+	memcpy(&info, &word, sizeof(uint64_t));
+
+	/* The enqueuer puts the item in the ring before it sets the
+	 * entry's write epoch, so an older epoch most likely means the
+	 * commit isn't done.  It could also mean the entry got
+	 * reclaimed already, but then we'll see the newer epoch (or
+	 * get lapped) the next time around.
+	 */
+	if (info.write_epoch < rix) {
+	    return false;
+	}
+
+	if (info.write_epoch > rix) {
+	    goto skip_entry;
+	}
+
+	n = entry->len;
+
+	if (n > self->entry_len) {
+	    n = self->entry_len;
+	}
+
+	memcpy(output, entry->data, n);
+	atomic_thread_fence(memory_order_acquire);
+
+	word = atomic_load_explicit(info_word, memory_order_relaxed);
+
+	memcpy(&info, &word, sizeof(uint64_t));
+
+	if (info.write_epoch != rix) {
+	    goto skip_entry;
+	}
+
+	*len                 = n;
+	follower->next_epoch = rix + 1;
+
+	return true;
+
+    skip_entry:
+	*missed              += 1;
+	follower->next_epoch  = rix + 1;
+    }
+}
+
 static void
 logring_view_help_if_needed(logring_t *self)
 {
@@ -390,6 +612,7 @@ logring_view_help_if_needed(logring_t *self)
     view_info = atomic_read(&self->view_state);
 
     if (!view_info.view) {
+	mmm_end_op();
 	return;
     }
 
@@ -550,7 +773,7 @@ logring_view_help_if_needed(logring_t *self)
 	 * correct item gets installed, so it's not a problem.
 	 */
 
-	contents     = (char *)malloc(data_entry->len);
+	contents     = (char *)hatrack_malloc(data_entry->len);
 	exp_contents = NULL;
 	
 	memcpy(contents, data_entry->data, exp_len);
@@ -559,7 +782,7 @@ logring_view_help_if_needed(logring_t *self)
 	if (!CAS(&cur_view_entry->value,
 		 (void **)&exp_contents,
 		 (void *)contents)) {
-	    free(contents);
+	    hatrack_free(contents, data_entry->len);
 	}
 
 	/* Now we have to flip VIEW_RESERVE off, if no other thread has,
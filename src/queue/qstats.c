@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           qstats.c
+ *  Description:    Optional depth and dwell-time telemetry for hq,
+ *                  capq and hatring.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+/* The rate gets rounded up to a power of two, so that deciding
+ * whether to sample is a mask of the epoch.
+ */
+void
+hatrack_qstats_init(hatrack_qstats_t *stats, uint64_t rate)
+{
+    uint64_t i;
+
+    stats->sample_mask = hatrack_round_up_to_power_of_2(rate) - 1;
+
+    atomic_store(&stats->samples, 0);
+    atomic_store(&stats->dwell_total, 0);
+    atomic_store(&stats->dwell_max, 0);
+
+    for (i = 0; i < HATRACK_QSTATS_BUCKETS; i++) {
+	atomic_store(&stats->hist[i], 0);
+    }
+
+    return;
+}
+
+void
+hatrack_qstats_record(hatrack_qstats_t *stats, uint64_t stamp)
+{
+    uint64_t now;
+    uint64_t dwell;
+    uint64_t max;
+    uint64_t bucket;
+
+    if (!stamp) {
+	return;
+    }
+
+    now = hatrack_qstats_now();
+
+    // A stamp can be from a different CPU's idea of now.
+    dwell = (now > stamp) ? now - stamp : 0;
+
+    if (dwell) {
+	bucket = 64 - __builtin_clzll(dwell);
+
+	if (bucket >= HATRACK_QSTATS_BUCKETS) {
+	    bucket = HATRACK_QSTATS_BUCKETS - 1;
+	}
+    }
+    else {
+	bucket = 0;
+    }
+
+    atomic_fetch_add_explicit(&stats->hist[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->samples, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->dwell_total,
+			      dwell,
+			      memory_order_relaxed);
+
+    max = atomic_load_explicit(&stats->dwell_max, memory_order_relaxed);
+
+    while (dwell > max) {
+	if (CAS(&stats->dwell_max, &max, dwell)) {
+	    break;
+	}
+    }
+
+    return;
+}
+
+/* Fills in everything but depth and capacity, which the queue knows
+ * how to compute.
+ */
+void
+hatrack_qstats_snapshot(hatrack_qstats_t          *stats,
+			hatrack_qstats_snapshot_t *snap)
+{
+    uint64_t i;
+
+    snap->sample_rate    = stats->sample_mask + 1;
+    snap->samples        = atomic_load(&stats->samples);
+    snap->dwell_total_ns = atomic_load(&stats->dwell_total);
+    snap->dwell_max_ns   = atomic_load(&stats->dwell_max);
+
+    for (i = 0; i < HATRACK_QSTATS_BUCKETS; i++) {
+	snap->dwell_hist[i] = atomic_load(&stats->hist[i]);
+    }
+
+    return;
+}
+
+/* Returns an upper bound, in ns, on the dwell time at the given
+ * percentile (0 through 100), based on the histogram buckets.
+ */
+uint64_t
+hatrack_qstats_percentile(hatrack_qstats_snapshot_t *snap, double pct)
+{
+    uint64_t i;
+    uint64_t total;
+    uint64_t target;
+    uint64_t seen;
+
+    total = 0;
+
+    for (i = 0; i < HATRACK_QSTATS_BUCKETS; i++) {
+	total += snap->dwell_hist[i];
+    }
+
+    if (!total) {
+	return 0;
+    }
+
+    target = (uint64_t)((pct / 100.0) * total);
+
+    if (target >= total) {
+	target = total - 1;
+    }
+
+    seen = 0;
+
+    for (i = 0; i < HATRACK_QSTATS_BUCKETS - 1; i++) {
+	seen += snap->dwell_hist[i];
+
+	if (seen > target) {
+	    return i ? (1ULL << i) - 1 : 0;
+	}
+    }
+
+    return snap->dwell_max_ns;
+}
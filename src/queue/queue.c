@@ -25,13 +25,21 @@ static const queue_item_t empty_cell      = { NULL, QUEUE_EMPTY };
 static const queue_item_t too_slow_marker = { NULL, QUEUE_TOOSLOW };
 
 static queue_segment_t *
-queue_new_segment(uint64_t num_cells)
+queue_new_segment(queue_t *self, uint64_t num_cells)
 {
-    queue_segment_t *ret;
-    uint64_t         len;
+    queue_segment_t     *ret;
+    hatrack_allocator_t *allocator;
+    uint64_t             len;
+
+    if (self->membudget) {
+	allocator = hatrack_membudget_store_allocator(self->membudget);
+    }
+    else {
+	allocator = NULL;
+    }
 
     len       = sizeof(queue_segment_t) + sizeof(queue_item_t) * num_cells;
-    ret       = mmm_alloc_committed(len);
+    ret       = mmm_alloc_committed_with(allocator, len);
     ret->size = num_cells;
 
     return ret;
@@ -60,7 +68,8 @@ queue_init_size(queue_t *self, char size_log)
     
     seg_cells                  = 1 << size_log;
     self->default_segment_size = seg_cells;
-    initial_segment            = queue_new_segment(seg_cells);
+    self->membudget            = NULL;
+    initial_segment            = queue_new_segment(self, seg_cells);
     segments.enqueue_segment   = initial_segment;
     segments.dequeue_segment   = initial_segment;
 
@@ -82,7 +91,7 @@ queue_new_size(char size)
 {
     queue_t *ret;
 
-    ret = (queue_t *)malloc(sizeof(queue_t));
+    ret = (queue_t *)hatrack_malloc(sizeof(queue_t));
     queue_init_size(ret, size);
 
     return ret;
@@ -118,7 +127,37 @@ void
 queue_delete(queue_t *self)
 {
     queue_cleanup(self);
-    free(self);
+    hatrack_free(self, sizeof(queue_t));
+
+    return;
+}
+
+/* Segments come out of the budget's store allocation from now on (see
+ * membudget.h).  The queue must be empty, and not yet shared, since
+ * we swap out the initial segment.
+ *
+ * While the budget is at its hard limit, queue_enqueue() returns
+ * false whenever it would need a new segment, without enqueueing.
+ * Dequeues still work, and are what frees segments up.
+ */
+void
+queue_set_membudget(queue_t *self, hatrack_membudget_t *budget)
+{
+    queue_seg_ptrs_t segments;
+    queue_segment_t *old_segment;
+
+    if (queue_len(self) || self->membudget) {
+	abort();
+    }
+
+    segments                 = atomic_load(&self->segments);
+    old_segment              = segments.enqueue_segment;
+    self->membudget          = budget;
+    segments.enqueue_segment = queue_new_segment(self, old_segment->size);
+    segments.dequeue_segment = segments.enqueue_segment;
+
+    atomic_store(&self->segments, segments);
+    mmm_retire_unused(old_segment);
 
     return;
 }
@@ -131,7 +170,7 @@ queue_delete(queue_t *self)
  * increasing the "step" value exponentially (dequeue ops only
  * ever increase in steps of 1).
  */
-void
+bool
 queue_enqueue(queue_t *self, void *item)
 {
     queue_seg_ptrs_t  segments;
@@ -149,6 +188,10 @@ queue_enqueue(queue_t *self, void *item)
     uint64_t          new_size;
     
     step = 1;
+
+    if (self->membudget) {
+	hatrack_membudget_poll(self->membudget);
+    }
     
     mmm_start_basic_op();
 
@@ -171,7 +214,7 @@ queue_enqueue(queue_t *self, void *item)
 	    mmm_end_op();
 
 	    atomic_fetch_add(&self->len, 1);
-	    return;
+	    return true;
 	}
 	step <<= 1;
 	cur_ix = atomic_fetch_add(&segment->enqueue_index, step);
@@ -208,7 +251,16 @@ queue_enqueue(queue_t *self, void *item)
 	}
     }
 
-    new_segment                = queue_new_segment(new_size);
+    if (self->membudget && hatrack_membudget_at_hard_limit(self->membudget)) {
+	if (need_help) {
+	    atomic_fetch_sub(&self->help_needed, 1);
+	}
+	mmm_end_op();
+
+	return false;
+    }
+
+    new_segment                = queue_new_segment(self, new_size);
     new_segment->enqueue_index = 1;
     expected_segment           = NULL;
     
@@ -242,7 +294,7 @@ queue_enqueue(queue_t *self, void *item)
 	mmm_end_op();
 	atomic_fetch_add(&self->len, 1);
 	
-	return;
+	return true;
     }
     segment = new_segment;
     cur_ix  = atomic_fetch_add(&segment->enqueue_index, step);
@@ -262,6 +314,10 @@ queue_dequeue(queue_t *self, bool *found)
     uint64_t         head_ix;
     void            *ret;
 
+    if (self->membudget) {
+	hatrack_membudget_poll(self->membudget);
+    }
+
     mmm_start_basic_op();
 
     segments = atomic_read(&self->segments);
@@ -0,0 +1,447 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           queue_set.c
+ *  Description:    A set of hq instances that consumers can dequeue
+ *                  from as a group, without polling every member.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+/* Where this thread should start its next search. It's shared across
+ * all sets, which is fine, since it's only a hint.
+ */
+static __thread uint64_t queue_set_next = 0;
+
+static void  queue_set_mark_ready (queue_set_t *, uint64_t);
+static void  queue_set_clear_ready(queue_set_t *, uint64_t);
+static void  queue_set_clear_word (queue_set_t *, uint64_t);
+static void  queue_set_wake       (queue_set_t *, int);
+static void  queue_set_sleep      (queue_set_t *, uint32_t, uint64_t);
+
+queue_set_t *
+queue_set_new(uint64_t max_queues)
+{
+    queue_set_t *ret;
+
+    ret = (queue_set_t *)hatrack_malloc(sizeof(queue_set_t));
+    queue_set_init(ret, max_queues);
+
+    return ret;
+}
+
+void
+queue_set_init(queue_set_t *self, uint64_t max_queues)
+{
+    uint64_t num_words;
+
+    if (!max_queues || max_queues > QUEUE_SET_MAX_QUEUES) {
+	abort();
+    }
+
+    num_words        = (max_queues + 63) >> 6;
+    self->ready      = (_Atomic uint64_t *)hatrack_zalloc(num_words * sizeof(uint64_t));
+    self->queues     = (_Atomic(hq_t *) *)hatrack_zalloc(max_queues * sizeof(hq_t *));
+    self->max_queues = max_queues;
+
+    atomic_store(&self->summary, 0);
+    atomic_store(&self->num_queues, 0);
+    atomic_store(&self->waiters, 0);
+    atomic_store(&self->futex, 0);
+
+    return;
+}
+
+/* This does not delete the member queues; the caller still owns
+ * them.
+ */
+void
+queue_set_cleanup(queue_set_t *self)
+{
+    hatrack_free(self->ready, ((self->max_queues + 63) >> 6) * sizeof(uint64_t));
+    hatrack_free(self->queues, self->max_queues * sizeof(hq_t *));
+
+    return;
+}
+
+void
+queue_set_delete(queue_set_t *self)
+{
+    queue_set_cleanup(self);
+    hatrack_free(self, sizeof(queue_set_t));
+
+    return;
+}
+
+/* Returns the index of the queue in the set, which is what gets
+ * passed to queue_set_enqueue(), and what queue_set_dequeue_any()
+ * reports back.  Items already in the queue are picked up.
+ */
+uint64_t
+queue_set_add(queue_set_t *self, hq_t *queue)
+{
+    uint64_t ix;
+
+    ix = atomic_fetch_add(&self->num_queues, 1);
+
+    if (ix >= self->max_queues) {
+	abort();
+    }
+
+    atomic_store(&self->queues[ix], queue);
+
+    if (hq_len(queue)) {
+	queue_set_mark_ready(self, ix);
+	queue_set_wake(self, 1);
+    }
+
+    return ix;
+}
+
+/* Takes a queue out of the set, and returns it (or NULL if it was
+ * already removed).  Anything left in it stays there, where
+ * consumers of the set won't see it.  The caller still owns the
+ * queue, but a consumer that picked it just before it got removed
+ * can still be dequeuing from it, so don't delete it until the
+ * consumers are quiet.
+ */
+hq_t *
+queue_set_remove(queue_set_t *self, uint64_t ix)
+{
+    hq_t *ret;
+
+    if (ix >= atomic_read(&self->num_queues)) {
+	abort();
+    }
+
+    ret = atomic_exchange(&self->queues[ix], NULL);
+
+    if (ret) {
+	queue_set_clear_ready(self, ix);
+    }
+
+    return ret;
+}
+
+// Returns NULL if the queue has been removed.
+hq_t *
+queue_set_get(queue_set_t *self, uint64_t ix)
+{
+    if (ix >= atomic_read(&self->num_queues)) {
+	abort();
+    }
+
+    return atomic_read(&self->queues[ix]);
+}
+
+void
+queue_set_enqueue(queue_set_t *self, uint64_t ix, void *item)
+{
+    hq_t *queue;
+
+    queue = queue_set_get(self, ix);
+
+    if (!queue) {
+	abort();
+    }
+
+    hq_enqueue(queue, item);
+    queue_set_mark_ready(self, ix);
+
+    if (atomic_read(&self->waiters)) {
+	queue_set_wake(self, 1);
+    }
+
+    return;
+}
+
+/* Finds the first bit set at or above position 'start', wrapping
+ * around to the bottom of the word if there isn't one.  The word must
+ * be non-zero.
+ */
+static inline uint64_t
+queue_set_find_from(uint64_t word, uint64_t start)
+{
+    uint64_t high;
+
+    high = word & (0xffffffffffffffff << start);
+
+    if (high) {
+	return __builtin_ctzll(high);
+    }
+
+    return __builtin_ctzll(word);
+}
+
+/* If ix is non-NULL, it gets the index of the queue the item came
+ * from.
+ */
+void *
+queue_set_dequeue_any(queue_set_t *self, bool *found, uint64_t *ix)
+{
+    uint64_t summary;
+    uint64_t word;
+    uint64_t start;
+    uint64_t w;
+    uint64_t n;
+    hq_t    *queue;
+    void    *item;
+    bool     f;
+
+    start = queue_set_next;
+
+    if (start >= self->max_queues) {
+	start = 0;
+    }
+
+    while (true) {
+	summary = atomic_read(&self->summary);
+
+	if (!summary) {
+	    return hatrack_not_found(found);
+	}
+
+	w    = queue_set_find_from(summary, start >> 6);
+	word = atomic_read(&self->ready[w]);
+
+	if (!word) {
+	    queue_set_clear_word(self, w);
+	    continue;
+	}
+
+	/* If nothing's ready past our starting point in its word, go
+	 * on to the next ready word, rather than wrapping around to the
+	 * bottom of this one; that might be this word again, if it's
+	 * the only one.
+	 */
+	if (w == (start >> 6)
+	    && !(word & (0xffffffffffffffff << (start & 63)))) {
+	    start = ((w + 1) & 63) << 6;
+	    continue;
+	}
+
+	if (w == (start >> 6)) {
+	    n = (w << 6) | queue_set_find_from(word, start & 63);
+	}
+	else {
+	    n = (w << 6) | __builtin_ctzll(word);
+	}
+
+	queue = atomic_read(&self->queues[n]);
+
+	/* Removed. Its bit got cleared, but an enqueue that was
+	 * already under way may have set it again.
+	 */
+	if (!queue) {
+	    queue_set_clear_ready(self, n);
+	    continue;
+	}
+
+	item = hq_dequeue(queue, &f);
+
+	if (!f) {
+	    /* Looks empty. Once the bit is clear, any enqueuer that
+	     * comes along will set it again, so trying one more time
+	     * covers anybody that got in before we cleared it.
+	     */
+	    queue_set_clear_ready(self, n);
+	    item = hq_dequeue(queue, &f);
+
+	    if (!f) {
+		continue;
+	    }
+
+	    queue_set_mark_ready(self, n);
+	}
+
+	queue_set_next = n + 1;
+
+	if (ix) {
+	    *ix = n;
+	}
+
+	return hatrack_found(found, item);
+    }
+}
+
+/* Like queue_set_dequeue_any(), but if every queue is empty, block
+ * until something gets enqueued, or until timeout_ns passes (0 means
+ * no timeout).
+ *
+ * This can return with nothing, even without a timeout, if another
+ * consumer beat us to the item we were woken for, or if somebody
+ * called queue_set_wake_all(), so callers should be ready to loop.
+ */
+void *
+queue_set_dequeue_wait(queue_set_t *self,
+		       bool        *found,
+		       uint64_t    *ix,
+		       uint64_t     timeout_ns)
+{
+    uint32_t seq;
+    void    *item;
+    bool     f;
+
+    item = queue_set_dequeue_any(self, &f, ix);
+
+    if (f) {
+	return hatrack_found(found, item);
+    }
+
+    /* Enqueuers only look at 'waiters' after they've set their
+     * ready bit, so once we've announced ourselves, either our
+     * second look will find the item, or the enqueuer will bump the
+     * futex word past 'seq' and wake us.
+     */
+    atomic_fetch_add(&self->waiters, 1);
+
+    seq  = atomic_read(&self->futex);
+    item = queue_set_dequeue_any(self, &f, ix);
+
+    if (!f) {
+	queue_set_sleep(self, seq, timeout_ns);
+	item = queue_set_dequeue_any(self, &f, ix);
+    }
+
+    atomic_fetch_sub(&self->waiters, 1);
+
+    if (f) {
+	return hatrack_found(found, item);
+    }
+
+    return hatrack_not_found(found);
+}
+
+// For shutting down; every blocked consumer returns.
+void
+queue_set_wake_all(queue_set_t *self)
+{
+    queue_set_wake(self, INT32_MAX);
+
+    return;
+}
+
+static void
+queue_set_mark_ready(queue_set_t *self, uint64_t ix)
+{
+    uint64_t w;
+    uint64_t bit;
+
+    w   = ix >> 6;
+    bit = 1ULL << (ix & 63);
+
+    // Only write when the bit is clear, to keep the line shared.
+    if (!(atomic_read(&self->ready[w]) & bit)) {
+	atomic_fetch_or(&self->ready[w], bit);
+    }
+
+    if (!(atomic_read(&self->summary) & (1ULL << w))) {
+	atomic_fetch_or(&self->summary, 1ULL << w);
+    }
+
+    return;
+}
+
+// If clearing the bit empties out the ready word, clear its summary bit.
+static void
+queue_set_clear_ready(queue_set_t *self, uint64_t ix)
+{
+    uint64_t w;
+    uint64_t bit;
+    uint64_t old;
+
+    w   = ix >> 6;
+    bit = 1ULL << (ix & 63);
+    old = atomic_fetch_and(&self->ready[w], ~bit);
+
+    if (!(old & ~bit)) {
+	queue_set_clear_word(self, w);
+    }
+
+    return;
+}
+
+/* An enqueuer may have set a bit in the ready word after we decided
+ * it was empty, and then seen the summary bit still set, so we put
+ * the summary bit back if the word picked anything up.
+ */
+static void
+queue_set_clear_word(queue_set_t *self, uint64_t w)
+{
+    atomic_fetch_and(&self->summary, ~(1ULL << w));
+
+    if (atomic_read(&self->ready[w])) {
+	atomic_fetch_or(&self->summary, 1ULL << w);
+    }
+
+    return;
+}
+
+static void
+queue_set_wake(queue_set_t *self, int n)
+{
+    atomic_fetch_add(&self->futex, 1);
+
+#ifdef __linux__
+    syscall(SYS_futex, &self->futex, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#endif
+
+    return;
+}
+
+/* Without futexes, we just nap for a bit; a timeout of 0 becomes a
+ * millisecond.
+ */
+static void
+queue_set_sleep(queue_set_t *self, uint32_t seq, uint64_t timeout_ns)
+{
+    struct timespec ts;
+
+#ifdef __linux__
+    if (timeout_ns) {
+	ts.tv_sec  = timeout_ns / 1000000000;
+	ts.tv_nsec = timeout_ns % 1000000000;
+    }
+
+    syscall(SYS_futex,
+	    &self->futex,
+	    FUTEX_WAIT_PRIVATE,
+	    seq,
+	    timeout_ns ? &ts : NULL,
+	    NULL,
+	    0);
+#else
+    if (!timeout_ns || timeout_ns > 1000000) {
+	timeout_ns = 1000000;
+    }
+
+    ts.tv_sec  = 0;
+    ts.tv_nsec = timeout_ns;
+
+    nanosleep(&ts, NULL);
+#endif
+
+    return;
+}
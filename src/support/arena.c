@@ -0,0 +1,279 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           arena.c
+ *  Description:    Bump-allocated arenas, for data structures that
+ *                  get torn down all at once.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/arena.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Everything we hand out is 16-byte aligned, same as mmm's headers.
+#define HATRACK_ARENA_ALIGN(n) (((n) + 15) & ~((uint64_t)15))
+
+static void  *hatrack_arena_alloc_hook  (size_t, void *);
+static void  *hatrack_arena_realloc_hook(void *, size_t, size_t, void *);
+static void   hatrack_arena_free_hook   (void *, size_t, void *);
+static bool   hatrack_arena_retire_hook (void *, void *);
+static void   hatrack_arena_release     (void *, void *);
+static void   hatrack_arena_free_chunks (hatrack_arena_chunk_t *);
+static void  *hatrack_arena_alloc_large (hatrack_arena_t *, uint64_t);
+
+hatrack_arena_t *
+hatrack_arena_new(uint64_t chunk_size)
+{
+    hatrack_arena_t *ret;
+
+    ret = (hatrack_arena_t *)hatrack_malloc(sizeof(hatrack_arena_t));
+
+    hatrack_arena_init(ret, chunk_size);
+
+    return ret;
+}
+
+// A chunk_size of 0 gets the default, HATRACK_ARENA_CHUNK_SIZE.
+void
+hatrack_arena_init(hatrack_arena_t *self, uint64_t chunk_size)
+{
+    if (!chunk_size) {
+        chunk_size = HATRACK_ARENA_CHUNK_SIZE;
+    }
+
+    self->allocator.alloc   = hatrack_arena_alloc_hook;
+    self->allocator.zalloc  = hatrack_arena_alloc_hook;
+    self->allocator.realloc = hatrack_arena_realloc_hook;
+    self->allocator.free    = hatrack_arena_free_hook;
+    self->allocator.retire  = hatrack_arena_retire_hook;
+    self->allocator.arg     = self;
+    self->chunk_size        = HATRACK_ARENA_ALIGN(chunk_size);
+
+    atomic_store(&self->chunks, NULL);
+    atomic_store(&self->large, NULL);
+    atomic_store(&self->deferred, NULL);
+
+    return;
+}
+
+/* Releases everything right away, after running any deferred cleanup
+ * handlers. Only call this directly when no other thread could
+ * possibly be looking at memory from the arena; otherwise, use
+ * hatrack_arena_retire().
+ */
+void
+hatrack_arena_cleanup(hatrack_arena_t *self)
+{
+    hatrack_arena_run_cleanups(self);
+    hatrack_arena_free_chunks(atomic_load(&self->chunks));
+    hatrack_arena_free_chunks(atomic_load(&self->large));
+
+    return;
+}
+
+void
+hatrack_arena_delete(hatrack_arena_t *self)
+{
+    hatrack_arena_cleanup(self);
+    hatrack_free(self, sizeof(hatrack_arena_t));
+
+    return;
+}
+
+/* Deletes the arena once every thread that might currently be in the
+ * middle of an operation on it is done. We do that by retiring a
+ * (non-arena) placeholder through mmm, with a cleanup handler that
+ * does the actual deletion.
+ */
+void
+hatrack_arena_retire(hatrack_arena_t *self)
+{
+    void *placeholder;
+
+    placeholder = mmm_alloc_committed(0);
+
+    mmm_add_cleanup_handler(placeholder, hatrack_arena_release, self);
+    mmm_retire(placeholder);
+
+    return;
+}
+
+/* Runs the cleanup handlers for any memory that's been retired so
+ * far. The structure that owns the arena will generally want to call
+ * this itself when it's being torn down, while the objects its
+ * handlers reference still exist.
+ */
+void
+hatrack_arena_run_cleanups(hatrack_arena_t *self)
+{
+    mmm_header_t *cell;
+    mmm_header_t *next;
+
+    cell = atomic_exchange(&self->deferred, NULL);
+
+    while (cell) {
+        next = cell->next;
+        (*cell->cleanup)(&cell->data, cell->cleanup_aux);
+        cell = next;
+    }
+
+    return;
+}
+
+/* The fast path is a single fetch-and-add on the current chunk. When
+ * that runs off the end, we try to install a fresh chunk; if someone
+ * else beats us to it, we toss ours and try again on theirs.
+ */
+void *
+hatrack_arena_alloc(hatrack_arena_t *self, size_t size)
+{
+    hatrack_arena_chunk_t *chunk;
+    hatrack_arena_chunk_t *new_chunk;
+    uint64_t               len;
+    uint64_t               offset;
+
+    len = HATRACK_ARENA_ALIGN(size);
+
+    if (len > (self->chunk_size >> 2)) {
+        return hatrack_arena_alloc_large(self, len);
+    }
+
+    chunk = atomic_load(&self->chunks);
+
+    while (true) {
+        if (chunk) {
+            offset = atomic_fetch_add(&chunk->offset, len);
+
+            if (offset + len <= chunk->size) {
+                return &chunk->data[offset];
+            }
+        }
+
+        new_chunk = (hatrack_arena_chunk_t *)hatrack_zalloc(
+            sizeof(hatrack_arena_chunk_t) + self->chunk_size);
+
+        new_chunk->next   = chunk;
+        new_chunk->size   = self->chunk_size;
+        new_chunk->offset = len;
+
+        if (CAS(&self->chunks, &chunk, new_chunk)) {
+            return new_chunk->data;
+        }
+
+        hatrack_free(new_chunk,
+                     sizeof(hatrack_arena_chunk_t) + self->chunk_size);
+    }
+}
+
+static void *
+hatrack_arena_alloc_large(hatrack_arena_t *self, uint64_t len)
+{
+    hatrack_arena_chunk_t *chunk;
+
+    chunk         = (hatrack_arena_chunk_t *)hatrack_zalloc(
+        sizeof(hatrack_arena_chunk_t) + len);
+    chunk->size   = len;
+    chunk->offset = len;
+    chunk->next   = atomic_load(&self->large);
+
+    while (!CAS(&self->large, &chunk->next, chunk))
+        ;
+
+    return chunk->data;
+}
+
+// Chunks come from hatrack_zalloc(), and we never reuse memory, so
+// everything we hand out is already zeroed.
+static void *
+hatrack_arena_alloc_hook(size_t size, void *arg)
+{
+    return hatrack_arena_alloc((hatrack_arena_t *)arg, size);
+}
+
+/* Nothing in the library reallocs memory from a per-structure
+ * allocator, but we support it for callers that know the old size.
+ */
+static void *
+hatrack_arena_realloc_hook(void  *ptr,
+                           size_t old_size,
+                           size_t new_size,
+                           void  *arg)
+{
+    void *ret;
+
+    if (ptr && !old_size) {
+        abort();
+    }
+
+    ret = hatrack_arena_alloc((hatrack_arena_t *)arg, new_size);
+
+    if (ptr) {
+        memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    return ret;
+}
+
+static void
+hatrack_arena_free_hook(void *ptr, size_t size, void *arg)
+{
+    return;
+}
+
+static bool
+hatrack_arena_retire_hook(void *header, void *arg)
+{
+    hatrack_arena_t *self;
+    mmm_header_t    *cell;
+
+    self = (hatrack_arena_t *)arg;
+    cell = (mmm_header_t *)header;
+
+    if (!cell->cleanup) {
+        return true;
+    }
+
+    cell->next = atomic_load(&self->deferred);
+
+    while (!CAS(&self->deferred, &cell->next, cell))
+        ;
+
+    return true;
+}
+
+static void
+hatrack_arena_release(void *placeholder, void *arena)
+{
+    hatrack_arena_delete((hatrack_arena_t *)arena);
+
+    return;
+}
+
+static void
+hatrack_arena_free_chunks(hatrack_arena_chunk_t *chunk)
+{
+    hatrack_arena_chunk_t *next;
+
+    while (chunk) {
+        next = chunk->next;
+        hatrack_free(chunk, sizeof(hatrack_arena_chunk_t) + chunk->size);
+        chunk = next;
+    }
+
+    return;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           hatalloc.c
+ *  Description:    Pluggable allocators; the default one just calls
+ *                  into the C library.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/hatalloc.h>
+
+#include <stdlib.h>
+
+static void *
+hatrack_libc_alloc(size_t size, void *arg)
+{
+    return malloc(size);
+}
+
+static void *
+hatrack_libc_zalloc(size_t size, void *arg)
+{
+    return calloc(1, size);
+}
+
+static void *
+hatrack_libc_realloc(void *ptr, size_t old_size, size_t new_size, void *arg)
+{
+    return realloc(ptr, new_size);
+}
+
+static void
+hatrack_libc_free(void *ptr, size_t size, void *arg)
+{
+    free(ptr);
+
+    return;
+}
+
+hatrack_allocator_t hatrack_default_allocator = {
+    .alloc   = hatrack_libc_alloc,
+    .zalloc  = hatrack_libc_zalloc,
+    .realloc = hatrack_libc_realloc,
+    .free    = hatrack_libc_free,
+    .arg     = NULL,
+    .retire  = NULL
+};
+
+_Atomic(hatrack_allocator_t *) hatrack_global_allocator
+    = &hatrack_default_allocator;
+
+// Passing NULL goes back to the default.
+void
+hatrack_set_allocator(hatrack_allocator_t *allocator)
+{
+    if (!allocator) {
+        allocator = &hatrack_default_allocator;
+    }
+
+    if (!allocator->alloc || !allocator->zalloc || !allocator->realloc
+        || !allocator->free) {
+        abort();
+    }
+
+    atomic_store(&hatrack_global_allocator, allocator);
+
+    return;
+}
+
+hatrack_allocator_t *
+hatrack_get_allocator(void)
+{
+    return atomic_load(&hatrack_global_allocator);
+}
@@ -23,6 +23,14 @@
 
 #include <hatrack.h>
 
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+__thread uint64_t hatrack_numa_node     = 0;
+__thread uint64_t hatrack_numa_node_ttl = 0;
+uint64_t          hatrack_numa_forced_nodes = 0;
+
 /* Used when using quicksort to sort the contents of a hash table
  * 'view' by insertion time (the sort_epoch field).
  */
@@ -37,3 +45,109 @@ hatrack_quicksort_cmp(const void *bucket1, const void *bucket2)
 
     return item1->sort_epoch - item2->sort_epoch;
 }
+
+/* The sysfs file lists the nodes that are online as a set of ranges,
+ * e.g., "0-1" or "0,2-3"; the last number is the highest node id.
+ */
+uint64_t
+hatrack_numa_node_count(void)
+{
+    FILE    *f;
+    int      c;
+    uint64_t n;
+    uint64_t last;
+
+    if (hatrack_numa_forced_nodes) {
+	if (hatrack_numa_forced_nodes > HATRACK_NUMA_MAX_NODES) {
+	    return HATRACK_NUMA_MAX_NODES;
+	}
+	return hatrack_numa_forced_nodes;
+    }
+
+    f = fopen("/sys/devices/system/node/online", "r");
+
+    if (!f) {
+	return 1;
+    }
+
+    n = 0;
+
+    while ((c = fgetc(f)) != EOF) {
+	if (c >= '0' && c <= '9') {
+	    n = n * 10 + (c - '0');
+	    continue;
+	}
+	if (c == ',' || c == '-') {
+	    n = 0;
+	    continue;
+	}
+	break;
+    }
+
+    fclose(f);
+
+    last = n + 1;
+
+    if (last > HATRACK_NUMA_MAX_NODES) {
+	return HATRACK_NUMA_MAX_NODES;
+    }
+
+    return last;
+}
+
+uint64_t
+hatrack_numa_refresh_node(void)
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu;
+    unsigned int node;
+
+    if (!syscall(SYS_getcpu, &cpu, &node, NULL)) {
+	hatrack_numa_node = node % HATRACK_NUMA_MAX_NODES;
+    }
+#endif
+
+    hatrack_numa_node_ttl = HATRACK_NUMA_NODE_REFRESH;
+
+    return hatrack_numa_node;
+}
+
+/* Ask the kernel to prefer the given node for the pages backing a
+ * piece of memory, moving any pages that are already faulted in.
+ * This is advisory; if it fails, the memory stays where it is.
+ *
+ * mbind() works on whole pages, so we only cover the pages that lie
+ * entirely inside the allocation.
+ */
+#define HATRACK_MPOL_PREFERRED 1
+#define HATRACK_MPOL_MF_MOVE   (1 << 1)
+
+void
+hatrack_numa_place(void *addr, uint64_t len, uint64_t node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    uint64_t page_size;
+    uint64_t start;
+    uint64_t end;
+    uint64_t mask;
+
+    page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    start     = ((uint64_t)addr + page_size - 1) & ~(page_size - 1);
+    end       = ((uint64_t)addr + len) & ~(page_size - 1);
+    mask      = 1ULL << node;
+
+    if (end <= start) {
+	return;
+    }
+
+    syscall(SYS_mbind,
+	    start,
+	    end - start,
+	    HATRACK_MPOL_PREFERRED,
+	    &mask,
+	    HATRACK_NUMA_MAX_NODES + 1,
+	    HATRACK_MPOL_MF_MOVE);
+#endif
+
+    return;
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           idalloc.c
+ *  Description:    A lock-free allocator for small integer IDs.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/idalloc.h>
+#include <hatrack/hatalloc.h>
+
+#include <stdlib.h>
+
+#define IDALLOC_FULL 0xffffffffffffffffULL
+
+static void    idalloc_set_full  (idalloc_t *, uint64_t, uint64_t);
+static void    idalloc_clear_full(idalloc_t *, uint64_t, uint64_t);
+static int64_t idalloc_scan      (idalloc_t *);
+static void    idalloc_raise_hwm (idalloc_t *, uint64_t);
+
+static inline _Atomic uint64_t *
+idalloc_word(idalloc_t *self, uint64_t level, uint64_t ix)
+{
+    return &self->words[self->offsets[level] + ix];
+}
+
+idalloc_t *
+idalloc_new(uint64_t capacity)
+{
+    idalloc_t *ret;
+
+    ret = (idalloc_t *)hatrack_malloc(sizeof(idalloc_t));
+    idalloc_init(ret, capacity);
+
+    return ret;
+}
+
+/* Bits past the end of each level start out set, so that they look
+ * like IDs (or words) that are permanently in use.
+ */
+void
+idalloc_init(idalloc_t *self, uint64_t capacity)
+{
+    uint64_t level;
+    uint64_t bits;
+    uint64_t num_words;
+    uint64_t total;
+    uint64_t extra;
+
+    if (!capacity) {
+	abort();
+    }
+
+    bits  = capacity;
+    total = 0;
+    level = 0;
+
+    while (true) {
+	if (level == IDALLOC_MAX_LEVELS) {
+	    abort();
+	}
+
+	num_words            = (bits + 63) >> 6;
+	self->offsets[level] = total;
+	total += num_words;
+	level++;
+
+	if (num_words == 1) {
+	    break;
+	}
+
+	bits = num_words;
+    }
+
+    self->capacity   = capacity;
+    self->num_levels = level;
+    self->words      = (_Atomic uint64_t *)hatrack_zalloc(total * sizeof(uint64_t));
+
+    atomic_store(&self->high_water, 0);
+
+    bits = capacity;
+
+    for (level = 0; level < self->num_levels; level++) {
+	num_words = (bits + 63) >> 6;
+	extra     = bits & 63;
+
+	if (extra) {
+	    atomic_store(idalloc_word(self, level, num_words - 1),
+			 IDALLOC_FULL << extra);
+	}
+
+	bits = num_words;
+    }
+
+    return;
+}
+
+void
+idalloc_cleanup(idalloc_t *self)
+{
+    // The top level is always a single word.
+    hatrack_free(self->words,
+		 (self->offsets[self->num_levels - 1] + 1) * sizeof(uint64_t));
+
+    return;
+}
+
+void
+idalloc_delete(idalloc_t *self)
+{
+    idalloc_cleanup(self);
+    hatrack_free(self, sizeof(idalloc_t));
+
+    return;
+}
+
+// Returns -1 if every ID is in use.
+int64_t
+idalloc_get(idalloc_t *self)
+{
+    uint64_t level;
+    uint64_t ix;
+    uint64_t word;
+    uint64_t bit;
+    uint64_t old;
+    int64_t  ret;
+
+    while (true) {
+	level = self->num_levels - 1;
+	ix    = 0;
+
+	while (true) {
+	    word = atomic_read(idalloc_word(self, level, ix));
+
+	    if (word == IDALLOC_FULL) {
+		break;
+	    }
+
+	    ix = (ix << 6) | __builtin_ctzll(~word);
+
+	    if (!level) {
+		break;
+	    }
+
+	    level--;
+	}
+
+	if (word == IDALLOC_FULL) {
+	    if (level == self->num_levels - 1) {
+		ret = idalloc_scan(self);
+
+		if (ret >= 0) {
+		    idalloc_raise_hwm(self, ret);
+		}
+
+		return ret;
+	    }
+
+	    // The bit above this word is behind; fix it and go again.
+	    idalloc_set_full(self, level, ix);
+	    continue;
+	}
+
+	bit = 1ULL << (ix & 63);
+	old = atomic_fetch_or(idalloc_word(self, 0, ix >> 6), bit);
+
+	if (old & bit) {
+	    continue;
+	}
+
+	if ((old | bit) == IDALLOC_FULL) {
+	    idalloc_set_full(self, 0, ix >> 6);
+	}
+
+	idalloc_raise_hwm(self, ix);
+
+	return (int64_t)ix;
+    }
+}
+
+void
+idalloc_put(idalloc_t *self, uint64_t id)
+{
+    uint64_t bit;
+    uint64_t old;
+
+    if (id >= self->capacity) {
+	abort();
+    }
+
+    bit = 1ULL << (id & 63);
+    old = atomic_fetch_and(idalloc_word(self, 0, id >> 6), ~bit);
+
+    // Freeing an ID that isn't in use.
+    if (!(old & bit)) {
+	abort();
+    }
+
+    if (old == IDALLOC_FULL) {
+	idalloc_clear_full(self, 0, id >> 6);
+    }
+
+    return;
+}
+
+bool
+idalloc_in_use(idalloc_t *self, uint64_t id)
+{
+    if (id >= self->capacity) {
+	return false;
+    }
+
+    return atomic_read(idalloc_word(self, 0, id >> 6)) & (1ULL << (id & 63));
+}
+
+/* Word ix at the given level looks full, so set its bit in the level
+ * above, continuing up while that fills words there too.  After each
+ * bit we set, we look at the word again; if an ID got freed before
+ * we set the bit, the thread that freed it may have already tried to
+ * clear it, so we back it out ourselves.
+ */
+static void
+idalloc_set_full(idalloc_t *self, uint64_t level, uint64_t ix)
+{
+    uint64_t bit;
+    uint64_t old;
+
+    while (level + 1 < self->num_levels) {
+	bit = 1ULL << (ix & 63);
+	old = atomic_fetch_or(idalloc_word(self, level + 1, ix >> 6), bit);
+
+	if (atomic_load(idalloc_word(self, level, ix)) != IDALLOC_FULL) {
+	    idalloc_clear_full(self, level, ix);
+	    return;
+	}
+
+	if ((old & bit) || ((old | bit) != IDALLOC_FULL)) {
+	    return;
+	}
+
+	level++;
+	ix >>= 6;
+    }
+
+    return;
+}
+
+/* Word ix at the given level has room, so clear its bit in the level
+ * above.  If that word was full, it isn't any more, so keep going.
+ */
+static void
+idalloc_clear_full(idalloc_t *self, uint64_t level, uint64_t ix)
+{
+    uint64_t bit;
+    uint64_t old;
+
+    while (level + 1 < self->num_levels) {
+	bit = 1ULL << (ix & 63);
+	old = atomic_fetch_and(idalloc_word(self, level + 1, ix >> 6), ~bit);
+
+	if (old != IDALLOC_FULL) {
+	    return;
+	}
+
+	level++;
+	ix >>= 6;
+    }
+
+    return;
+}
+
+/* The slow path, for when the top word says we're out of IDs. Since
+ * the bits above the bottom level can lag, look at every bottom word
+ * before believing it.
+ */
+static int64_t
+idalloc_scan(idalloc_t *self)
+{
+    uint64_t num_words;
+    uint64_t i;
+    uint64_t word;
+    uint64_t bit;
+    uint64_t old;
+
+    num_words = (self->capacity + 63) >> 6;
+
+    for (i = 0; i < num_words; i++) {
+	word = atomic_read(idalloc_word(self, 0, i));
+
+	while (word != IDALLOC_FULL) {
+	    bit = 1ULL << __builtin_ctzll(~word);
+	    old = atomic_fetch_or(idalloc_word(self, 0, i), bit);
+
+	    if (!(old & bit)) {
+		if ((old | bit) == IDALLOC_FULL) {
+		    idalloc_set_full(self, 0, i);
+		}
+
+		return (int64_t)((i << 6) | __builtin_ctzll(bit));
+	    }
+
+	    word = old | bit;
+	}
+    }
+
+    return -1;
+}
+
+static void
+idalloc_raise_hwm(idalloc_t *self, uint64_t id)
+{
+    uint64_t hwm;
+
+    hwm = atomic_read(&self->high_water);
+
+    while (hwm <= id) {
+	if (CAS(&self->high_water, &hwm, id + 1)) {
+	    break;
+	}
+    }
+
+    return;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           membudget.c
+ *  Description:    Memory accounting and limits for individual data
+ *                  structures.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/membudget.h>
+
+#include <stdlib.h>
+
+static void  hatrack_membudget_class_init(hatrack_membudget_class_t *,
+					  hatrack_membudget_t *);
+static void *hatrack_membudget_alloc_hook  (size_t, void *);
+static void *hatrack_membudget_zalloc_hook (size_t, void *);
+static void *hatrack_membudget_realloc_hook(void *, size_t, size_t, void *);
+static void  hatrack_membudget_free_hook   (void *, size_t, void *);
+static bool  hatrack_membudget_retire_hook (void *, void *);
+static void  hatrack_membudget_grew        (hatrack_membudget_t *);
+static void  hatrack_membudget_shrank      (hatrack_membudget_t *);
+
+hatrack_membudget_t *
+hatrack_membudget_new(uint64_t soft_limit, uint64_t hard_limit)
+{
+    hatrack_membudget_t *ret;
+
+    ret = (hatrack_membudget_t *)hatrack_malloc(sizeof(hatrack_membudget_t));
+
+    hatrack_membudget_init(ret, soft_limit, hard_limit);
+
+    return ret;
+}
+
+void
+hatrack_membudget_init(hatrack_membudget_t *self,
+		       uint64_t             soft_limit,
+		       uint64_t             hard_limit)
+{
+    hatrack_membudget_class_init(&self->stores, self);
+    hatrack_membudget_class_init(&self->records, self);
+    hatrack_shardctr_init(&self->retired, 0);
+
+    self->soft_limit   = soft_limit;
+    self->hard_limit   = hard_limit;
+    self->callback     = NULL;
+    self->callback_arg = NULL;
+
+    atomic_store(&self->soft_state, HATRACK_MEMBUDGET_UNDER);
+
+    return;
+}
+
+/* The budget has to outlive everything allocated through it, including
+ * anything still sitting on a retire list, since the free hook needs
+ * it.  The easy way to make sure of that is to only clean up a budget
+ * after mmm_clean_up_before_exit(), or to never clean it up at all.
+ */
+void
+hatrack_membudget_cleanup(hatrack_membudget_t *self)
+{
+    return;
+}
+
+void
+hatrack_membudget_delete(hatrack_membudget_t *self)
+{
+    hatrack_membudget_cleanup(self);
+    hatrack_free(self, sizeof(hatrack_membudget_t));
+
+    return;
+}
+
+void
+hatrack_membudget_set_callback(hatrack_membudget_t   *self,
+			       hatrack_membudget_func func,
+			       void                  *arg)
+{
+    self->callback     = func;
+    self->callback_arg = arg;
+
+    return;
+}
+
+uint64_t
+hatrack_membudget_used(hatrack_membudget_t *self)
+{
+    return hatrack_membudget_store_bytes(self)
+	+ hatrack_membudget_record_bytes(self)
+	+ hatrack_membudget_retired_bytes(self);
+}
+
+uint64_t
+hatrack_membudget_store_bytes(hatrack_membudget_t *self)
+{
+    return hatrack_shardctr_read(&self->stores.live);
+}
+
+uint64_t
+hatrack_membudget_record_bytes(hatrack_membudget_t *self)
+{
+    return hatrack_shardctr_read(&self->records.live);
+}
+
+uint64_t
+hatrack_membudget_retired_bytes(hatrack_membudget_t *self)
+{
+    return hatrack_shardctr_read(&self->retired);
+}
+
+/* Data structures call this at the start of write operations, before
+ * they've started an mmm operation, which is what makes it safe for
+ * the callback to turn around and operate on the same structure.
+ * Only one thread gets to make the call for any given crossing.
+ */
+void
+hatrack_membudget_poll(hatrack_membudget_t *self)
+{
+    uint64_t expected;
+    uint64_t used;
+
+    if (atomic_read(&self->soft_state) != HATRACK_MEMBUDGET_OWED) {
+	return;
+    }
+
+    used     = hatrack_membudget_used_approx(self);
+    expected = HATRACK_MEMBUDGET_OWED;
+
+    if (used < self->soft_limit) {
+	CAS(&self->soft_state, &expected, HATRACK_MEMBUDGET_UNDER);
+	return;
+    }
+
+    if (!CAS(&self->soft_state, &expected, HATRACK_MEMBUDGET_CALLED)) {
+	return;
+    }
+
+    if (self->callback) {
+	(*self->callback)(self, used, self->callback_arg);
+    }
+
+    return;
+}
+
+static void
+hatrack_membudget_class_init(hatrack_membudget_class_t *class,
+			     hatrack_membudget_t       *budget)
+{
+    class->allocator.alloc   = hatrack_membudget_alloc_hook;
+    class->allocator.zalloc  = hatrack_membudget_zalloc_hook;
+    class->allocator.realloc = hatrack_membudget_realloc_hook;
+    class->allocator.free    = hatrack_membudget_free_hook;
+    class->allocator.retire  = hatrack_membudget_retire_hook;
+    class->allocator.arg     = class;
+    class->budget            = budget;
+
+    hatrack_shardctr_init(&class->live, 0);
+
+    return;
+}
+
+static void *
+hatrack_membudget_alloc_hook(size_t size, void *arg)
+{
+    hatrack_membudget_class_t *class;
+
+    class = (hatrack_membudget_class_t *)arg;
+
+    hatrack_shardctr_add_flush(&class->live, size, HATRACK_MEMBUDGET_FLUSH);
+    hatrack_membudget_grew(class->budget);
+
+    return hatrack_malloc(size);
+}
+
+static void *
+hatrack_membudget_zalloc_hook(size_t size, void *arg)
+{
+    hatrack_membudget_class_t *class;
+
+    class = (hatrack_membudget_class_t *)arg;
+
+    hatrack_shardctr_add_flush(&class->live, size, HATRACK_MEMBUDGET_FLUSH);
+    hatrack_membudget_grew(class->budget);
+
+    return hatrack_zalloc(size);
+}
+
+// mmm never reallocs, so this is only here for completeness.
+static void *
+hatrack_membudget_realloc_hook(void  *ptr,
+			       size_t old_size,
+			       size_t new_size,
+			       void  *arg)
+{
+    hatrack_membudget_class_t *class;
+
+    class = (hatrack_membudget_class_t *)arg;
+
+    hatrack_shardctr_add_flush(&class->live,
+			       (int64_t)new_size - (int64_t)old_size,
+			       HATRACK_MEMBUDGET_FLUSH);
+    hatrack_membudget_grew(class->budget);
+
+    return hatrack_realloc(ptr, old_size, new_size);
+}
+
+/* mmm only sets the retire epoch when it retires something, so that
+ * tells us which count the memory is coming out of.
+ */
+static void
+hatrack_membudget_free_hook(void *ptr, size_t size, void *arg)
+{
+    hatrack_membudget_class_t *class;
+    mmm_header_t              *header;
+
+    class  = (hatrack_membudget_class_t *)arg;
+    header = (mmm_header_t *)ptr;
+
+    if (header->retire_epoch) {
+	hatrack_shardctr_add_flush(&class->budget->retired,
+				   -(int64_t)size,
+				   HATRACK_MEMBUDGET_FLUSH);
+    }
+    else {
+	hatrack_shardctr_add_flush(&class->live,
+				   -(int64_t)size,
+				   HATRACK_MEMBUDGET_FLUSH);
+    }
+
+    hatrack_free(ptr, size);
+    hatrack_membudget_shrank(class->budget);
+
+    return;
+}
+
+static bool
+hatrack_membudget_retire_hook(void *ptr, void *arg)
+{
+    hatrack_membudget_class_t *class;
+    mmm_header_t              *header;
+
+    class  = (hatrack_membudget_class_t *)arg;
+    header = (mmm_header_t *)ptr;
+
+    hatrack_shardctr_add_flush(&class->live,
+			       -(int64_t)header->size,
+			       HATRACK_MEMBUDGET_FLUSH);
+    hatrack_shardctr_add_flush(&class->budget->retired,
+			       header->size,
+			       HATRACK_MEMBUDGET_FLUSH);
+
+    return false;
+}
+
+static void
+hatrack_membudget_grew(hatrack_membudget_t *self)
+{
+    uint64_t expected;
+
+    if (!self->soft_limit) {
+	return;
+    }
+
+    if (atomic_read(&self->soft_state) != HATRACK_MEMBUDGET_UNDER) {
+	return;
+    }
+
+    if (hatrack_membudget_used_approx(self) < self->soft_limit) {
+	return;
+    }
+
+    expected = HATRACK_MEMBUDGET_UNDER;
+
+    CAS(&self->soft_state, &expected, HATRACK_MEMBUDGET_OWED);
+
+    return;
+}
+
+// Re-arms the callback once we're back under the soft limit.
+static void
+hatrack_membudget_shrank(hatrack_membudget_t *self)
+{
+    uint64_t expected;
+
+    if (!self->soft_limit) {
+	return;
+    }
+
+    if (atomic_read(&self->soft_state) != HATRACK_MEMBUDGET_CALLED) {
+	return;
+    }
+
+    if (hatrack_membudget_used_approx(self) >= self->soft_limit) {
+	return;
+    }
+
+    expected = HATRACK_MEMBUDGET_CALLED;
+
+    CAS(&self->soft_state, &expected, HATRACK_MEMBUDGET_UNDER);
+
+    return;
+}
@@ -27,9 +27,9 @@
 __thread mmm_header_t  *mmm_retire_list  = NULL;
 __thread pthread_once_t mmm_inited       = PTHREAD_ONCE_INIT;
 _Atomic  uint64_t       mmm_epoch        = HATRACK_EPOCH_FIRST;
-_Atomic  uint64_t       mmm_nexttid      = 0;
 __thread int64_t        mmm_mytid        = -1; 
 __thread uint64_t       mmm_retire_ctr   = 0;
+         idalloc_t      mmm_tids;
 
          uint64_t       mmm_reservations[HATRACK_THREADS_MAX] = { 0, };
 
@@ -41,51 +41,47 @@ static void    mmm_empty(void);
 
 /*
  * We want to avoid overrunning the reservations array that our memory
- * management system uses.
- *
- * In all cases, the first HATRACK_THREADS_MAX threads to register
- * with us get a steadily increasing id. Also, threads will yield
- * their TID altogether if and when they call the mmm thread cleanup
- * routine-- mmm_clean_up_before_exit().
- *
- * The unused ID then goes on a linked list (mmm_free_tids), and
- * doesn't get touched until we run out of TIDs to give out.
+ * management system uses, and we want to keep the part of it that
+ * mmm_empty() has to scan as small as we can.
  *
+ * So thread IDs come from an ID allocator (see idalloc.h), which
+ * always hands out the lowest free ID.  Threads yield their TID when
+ * they call the mmm thread cleanup routine-- mmm_clean_up_before_exit(),
+ * and it's immediately available to the next thread that registers.
+ * That way, the range of TIDs in use only gets as large as the
+ * number of threads that are registered at once.
  */
 
-static _Atomic (mmm_free_tids_t *) mmm_free_tids;
+static pthread_once_t mmm_tids_inited = PTHREAD_ONCE_INIT;
+
+static void
+mmm_tids_init(void)
+{
+    idalloc_init(&mmm_tids, HATRACK_THREADS_MAX);
+
+    return;
+}
 
 /* This grabs an mmm-specific threadid and stashes it in the
  * thread-local variable mmm_mytid.
  * 
  * We have a fixed number of TIDS to give out though (controlled by
- * the preprocessor variable, HATRACK_THREADS_MAX).  We give them out
- * sequentially till they're done, and then we give out ones that have
- * been "given back", which are stored on a stack (mmm_free_tids).
- *
- * If we finally run out, we abort.
+ * the preprocessor variable, HATRACK_THREADS_MAX).  If we finally
+ * run out, we abort.
  */
 void
 mmm_register_thread(void)
 {
-    mmm_free_tids_t *head;
-
     if (mmm_mytid != -1) {
 	return;
     }
-    mmm_mytid = atomic_fetch_add(&mmm_nexttid, 1);
+
+    pthread_once(&mmm_tids_inited, mmm_tids_init);
+
+    mmm_mytid = idalloc_get(&mmm_tids);
     
-    if (mmm_mytid >= HATRACK_THREADS_MAX) {
-	head = atomic_load(&mmm_free_tids);
-	
-	do {
-	    if (!head) {
-		abort();
-	    }
-	} while (!CAS(&mmm_free_tids, &head, head->next));
-	
-	mmm_mytid = head->tid;
-	mmm_retire(head);
+    if (mmm_mytid == -1) {
+	abort();
     }
     
     mmm_reservations[mmm_mytid] = HATRACK_EPOCH_UNRESERVED;
@@ -93,29 +89,31 @@ mmm_register_thread(void)
     return;
 }
 
-// Call when a thread exits to add to the free TID stack.
+// Call when a thread exits to give back its TID.
 static void
 mmm_tid_giveback(void)
 {
-    mmm_free_tids_t *new_head;
-    mmm_free_tids_t *old_head;
-
-    new_head       = mmm_alloc(sizeof(mmm_free_tids_t));
-    new_head->tid  = mmm_mytid;
-    old_head       = atomic_load(&mmm_free_tids);
-
-    do {
-	new_head->next = old_head;
-    } while (!CAS(&mmm_free_tids, &old_head, new_head));
+    idalloc_put(&mmm_tids, mmm_mytid);
+    mmm_mytid = -1;
 
     return;
 }
 
-// This is here for convenience of testing; generally this
-// is not the way to handle tid recyling!
+/* This is here for convenience of testing; generally this is not the
+ * way to handle tid recyling!  Every TID becomes free again, and the
+ * calling thread gets a new one (which will be 0).
+ */
 void mmm_reset_tids(void)
 {
-    atomic_store(&mmm_nexttid, 0);
+    pthread_once(&mmm_tids_inited, mmm_tids_init);
+
+    idalloc_cleanup(&mmm_tids);
+    idalloc_init(&mmm_tids, HATRACK_THREADS_MAX);
+
+    if (mmm_mytid != -1) {
+	mmm_mytid = -1;
+	mmm_register_thread();
+    }
 
     return;
 }
@@ -128,17 +126,21 @@ void mmm_reset_tids(void)
 void
 mmm_clean_up_before_exit(void)
 {
-    if (mmm_mytid == -1) {
-	return;
+    /* A thread can retire things without ever having started an op
+     * (hatrack_rcu_publish() does that, for instance), in which case
+     * it never got a TID, but it still has a list to empty.
+     */
+    if (mmm_mytid != -1) {
+	mmm_end_op();
     }
-
-    mmm_end_op();
     
     while (mmm_retire_list) {
 	mmm_empty();
     }
     
-    mmm_tid_giveback();
+    if (mmm_mytid != -1) {
+	mmm_tid_giveback();
+    }
     
     return;
 }
@@ -184,8 +186,15 @@ mmm_retire(void *ptr)
 	return;
     }
 #endif	
-    
+
     cell->retire_epoch = atomic_load(&mmm_epoch);
+
+    // The allocator may want to take it from here; see hatalloc.h.
+    if (cell->allocator->retire
+	&& (*cell->allocator->retire)(cell, cell->allocator->arg)) {
+	return;
+    }
+
     cell->next         = mmm_retire_list;
     mmm_retire_list    = cell;
 
@@ -223,12 +232,12 @@ mmm_empty(void)
      * to active threads. Even if a new thread comes along, it will
      * not be able to reserve something that's already been retired
      * by the time we call this.
+     *
+     * Since TIDs get handed out lowest-first, this stays close to
+     * the largest number of threads that have been registered at
+     * once.
      */
-    lasttid = atomic_load(&mmm_nexttid);
-    
-    if (lasttid > HATRACK_THREADS_MAX) {
-	lasttid = HATRACK_THREADS_MAX;
-    }
+    lasttid = idalloc_high_water(&mmm_tids);
 
     /* We start out w/ the "lowest" reservation we've seen as
      * HATRACK_EPOCH_MAX.  If this value never changes, then it
@@ -294,7 +303,7 @@ mmm_empty(void)
 	    (*tmp->cleanup)(&tmp->data, tmp->cleanup_aux);
 	}
 	
-	free(tmp);
+	mmm_free_header(tmp);
     }
 
     return;
@@ -0,0 +1,276 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           pool.c
+ *  Description:    A minimal fork-join thread pool.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/pool.h>
+#include <hatrack/hatalloc.h>
+#include <hatrack/mmm.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void *hatrack_pool_worker      (void *);
+static void  hatrack_pool_run_tasks   (hatrack_pool_t *);
+static void  hatrack_pool_default_init(void);
+
+static __thread bool   hatrack_in_pool           = false;
+static pthread_once_t  hatrack_pool_default_once = PTHREAD_ONCE_INIT;
+static hatrack_pool_t *hatrack_default_pool      = NULL;
+
+hatrack_pool_t *
+hatrack_pool_new(uint64_t num_threads)
+{
+    hatrack_pool_t *ret;
+
+    ret = (hatrack_pool_t *)hatrack_malloc(sizeof(hatrack_pool_t));
+
+    hatrack_pool_init(ret, num_threads);
+
+    return ret;
+}
+
+/* num_threads is the number of worker threads to start; the thread
+ * calling hatrack_pool_run() works too.  With 0, jobs just run on
+ * the calling thread.
+ */
+void
+hatrack_pool_init(hatrack_pool_t *self, uint64_t num_threads)
+{
+    uint64_t i;
+
+    pthread_mutex_init(&self->run_mutex, NULL);
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->start, NULL);
+    pthread_cond_init(&self->finished, NULL);
+
+    self->generation  = 0;
+    self->busy        = 0;
+    self->exiting     = false;
+    self->fn          = NULL;
+    self->aux         = NULL;
+    self->num_tasks   = 0;
+    self->next_task   = 0;
+    self->num_threads = num_threads;
+    self->threads     = NULL;
+
+    if (!num_threads) {
+	return;
+    }
+
+    self->threads = (pthread_t *)hatrack_malloc(sizeof(pthread_t)
+						* num_threads);
+
+    for (i = 0; i < num_threads; i++) {
+	if (pthread_create(&self->threads[i],
+			   NULL,
+			   hatrack_pool_worker,
+			   self)) {
+	    abort();
+	}
+    }
+
+    return;
+}
+
+// Must not be called while a job is running.
+void
+hatrack_pool_cleanup(hatrack_pool_t *self)
+{
+    uint64_t i;
+
+    pthread_mutex_lock(&self->mutex);
+    self->exiting = true;
+    pthread_cond_broadcast(&self->start);
+    pthread_mutex_unlock(&self->mutex);
+
+    for (i = 0; i < self->num_threads; i++) {
+	pthread_join(self->threads[i], NULL);
+    }
+
+    if (self->threads) {
+	hatrack_free(self->threads, sizeof(pthread_t) * self->num_threads);
+    }
+
+    pthread_cond_destroy(&self->finished);
+    pthread_cond_destroy(&self->start);
+    pthread_mutex_destroy(&self->mutex);
+    pthread_mutex_destroy(&self->run_mutex);
+
+    return;
+}
+
+void
+hatrack_pool_delete(hatrack_pool_t *self)
+{
+    hatrack_pool_cleanup(self);
+    hatrack_free(self, sizeof(hatrack_pool_t));
+
+    return;
+}
+
+/* The built-in pool gets started the first time someone asks for it,
+ * with HATRACK_POOL_THREADS workers, and lives until the process
+ * exits.
+ */
+hatrack_pool_t *
+hatrack_pool_default(void)
+{
+    pthread_once(&hatrack_pool_default_once, hatrack_pool_default_init);
+
+    return hatrack_default_pool;
+}
+
+// The number of threads that work on a job, counting the caller.
+uint64_t
+hatrack_pool_width(hatrack_pool_t *self)
+{
+    return self->num_threads + 1;
+}
+
+void
+hatrack_pool_run(hatrack_pool_t *self,
+		 uint64_t        num_tasks,
+		 hatrack_pool_fn fn,
+		 void           *aux)
+{
+    uint64_t i;
+
+    if (!num_tasks) {
+	return;
+    }
+
+    if (num_tasks == 1 || !self->num_threads || hatrack_in_pool) {
+	for (i = 0; i < num_tasks; i++) {
+	    (*fn)(i, aux);
+	}
+
+	return;
+    }
+
+    pthread_mutex_lock(&self->run_mutex);
+    pthread_mutex_lock(&self->mutex);
+
+    self->fn        = fn;
+    self->aux       = aux;
+    self->num_tasks = num_tasks;
+    self->busy      = self->num_threads;
+
+    atomic_store(&self->next_task, 0);
+
+    self->generation++;
+
+    pthread_cond_broadcast(&self->start);
+    pthread_mutex_unlock(&self->mutex);
+
+    hatrack_in_pool = true;
+    hatrack_pool_run_tasks(self);
+    hatrack_in_pool = false;
+
+    /* Every worker has to check in before we return, even the ones
+     * that found no tasks left, so that none of them can still be
+     * looking at this job when the next one gets set up.
+     */
+    pthread_mutex_lock(&self->mutex);
+
+    while (self->busy) {
+	pthread_cond_wait(&self->finished, &self->mutex);
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+    pthread_mutex_unlock(&self->run_mutex);
+
+    return;
+}
+
+static void *
+hatrack_pool_worker(void *arg)
+{
+    hatrack_pool_t *self;
+    uint64_t        generation;
+
+    self            = (hatrack_pool_t *)arg;
+    generation      = 0;
+    hatrack_in_pool = true;
+
+    pthread_mutex_lock(&self->mutex);
+
+    while (true) {
+	while (!self->exiting && self->generation == generation) {
+	    pthread_cond_wait(&self->start, &self->mutex);
+	}
+
+	if (self->exiting) {
+	    break;
+	}
+
+	generation = self->generation;
+
+	pthread_mutex_unlock(&self->mutex);
+	hatrack_pool_run_tasks(self);
+	pthread_mutex_lock(&self->mutex);
+
+	if (!--self->busy) {
+	    pthread_cond_signal(&self->finished);
+	}
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+
+    // In case the tasks used anything that registered us with mmm.
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void
+hatrack_pool_run_tasks(hatrack_pool_t *self)
+{
+    uint64_t i;
+
+    while (true) {
+	i = atomic_fetch_add(&self->next_task, 1);
+
+	if (i >= self->num_tasks) {
+	    return;
+	}
+
+	(*self->fn)(i, self->aux);
+    }
+}
+
+static void
+hatrack_pool_default_init(void)
+{
+    long num_threads;
+
+    num_threads = HATRACK_POOL_THREADS;
+
+    if (!num_threads) {
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    }
+
+    if (num_threads < 0) {
+	num_threads = 0;
+    }
+
+    hatrack_default_pool = hatrack_pool_new((uint64_t)num_threads);
+
+    return;
+}
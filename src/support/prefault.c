@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           prefault.c
+ *  Description:    Cooperative prefaulting of large, freshly allocated
+ *                  stores.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/prefault.h>
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void hatrack_prefault_range(uint8_t *, uint8_t *);
+
+static uint64_t     hatrack_page_size = 0;
+static _Atomic bool hatrack_no_populate = false;
+
+/* hatrack_prefault()
+ *
+ * start and len cover the part of the store that gets written during
+ * migration, and cursor is a zero-initialized field in the store that
+ * all helpers share. Threads that show up after all the pieces have
+ * been claimed return right away.
+ */
+void
+hatrack_prefault(void *start, uint64_t len, _Atomic uint64_t *cursor)
+{
+    uint64_t offset;
+    uint64_t end;
+
+    if (!HATRACK_PREFAULT_MIN || len < HATRACK_PREFAULT_MIN) {
+	return;
+    }
+
+    if (!hatrack_page_size) {
+	hatrack_page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    }
+
+    while (true) {
+	offset = atomic_fetch_add(cursor, HATRACK_PREFAULT_CHUNK);
+
+	if (offset >= len) {
+	    return;
+	}
+
+	end = offset + HATRACK_PREFAULT_CHUNK;
+
+	if (end > len) {
+	    end = len;
+	}
+
+	hatrack_prefault_range(((uint8_t *)start) + offset,
+			       ((uint8_t *)start) + end);
+    }
+}
+
+/* madvise() needs page-aligned addresses, so we only hand it the
+ * pages that lie entirely inside the range; the pages at either end
+ * are shared with the neighboring pieces, and get faulted in soon
+ * enough either way.
+ *
+ * If MADV_POPULATE_WRITE fails once (older kernels return EINVAL),
+ * we stop trying it.
+ */
+static void
+hatrack_prefault_range(uint8_t *p, uint8_t *end)
+{
+    uint64_t mask;
+    uint8_t *first;
+    uint8_t *last;
+
+    mask  = hatrack_page_size - 1;
+    first = (uint8_t *)((((uintptr_t)p) + mask) & ~mask);
+    last  = (uint8_t *)(((uintptr_t)end) & ~mask);
+
+    if (first >= last) {
+	return;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    if (!atomic_load_explicit(&hatrack_no_populate, memory_order_relaxed)) {
+	if (!madvise(first, last - first, MADV_POPULATE_WRITE)) {
+	    return;
+	}
+	atomic_store_explicit(&hatrack_no_populate,
+			      true,
+			      memory_order_relaxed);
+    }
+#endif
+
+    while (first < last) {
+	atomic_fetch_add_explicit((_Atomic uint64_t *)first,
+				  0,
+				  memory_order_relaxed);
+	first += hatrack_page_size;
+    }
+
+    return;
+}
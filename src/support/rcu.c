@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2022 John Viega
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *  Name:           rcu.c
+ *  Description:    RCU-style protected pointers, on top of mmm.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <hatrack/rcu.h>
+
+#include <sched.h>
+
+__thread uint64_t hatrack_rcu_depth = 0;
+
+/* initial can be NULL.  The pointer has to be set up before it's
+ * shared with other threads.
+ */
+void
+hatrack_rcu_init(hatrack_rcu_ptr_t *self,
+		 void              *initial,
+		 mmm_cleanup_func   destructor,
+		 void              *aux)
+{
+    self->destructor = destructor;
+    self->aux        = aux;
+
+    atomic_store(&self->ptr, initial);
+
+    return;
+}
+
+// Retires the current object, if any.  No thread may still be using
+// the pointer itself, although readers may still hold the object.
+void
+hatrack_rcu_cleanup(hatrack_rcu_ptr_t *self)
+{
+    void *obj;
+
+    obj = atomic_exchange(&self->ptr, NULL);
+
+    if (obj) {
+	hatrack_rcu_defer_free(obj, self->destructor, self->aux);
+    }
+
+    return;
+}
+
+void
+hatrack_rcu_publish(hatrack_rcu_ptr_t *self, void *obj)
+{
+    void *old;
+
+    old = atomic_exchange(&self->ptr, obj);
+
+    if (old) {
+	hatrack_rcu_defer_free(old, self->destructor, self->aux);
+    }
+
+    return;
+}
+
+/* Like hatrack_rcu_publish(), but hands back the old object instead
+ * of retiring it.  Readers may still be using it, so the caller
+ * should eventually pass it to hatrack_rcu_defer_free().
+ */
+void *
+hatrack_rcu_exchange(hatrack_rcu_ptr_t *self, void *obj)
+{
+    return atomic_exchange(&self->ptr, obj);
+}
+
+/* For read-copy-update loops with more than one writer: load the
+ * current object (inside a read section), build a modified copy, and
+ * try to swap it in.  On success, the old object gets retired; on
+ * failure, the caller still owns obj (which nobody else has seen, so
+ * it can go back through mmm_retire_unused()).
+ */
+bool
+hatrack_rcu_cas(hatrack_rcu_ptr_t *self, void *expected, void *obj)
+{
+    if (!CAS(&self->ptr, &expected, obj)) {
+	return false;
+    }
+
+    if (expected) {
+	hatrack_rcu_defer_free(expected, self->destructor, self->aux);
+    }
+
+    return true;
+}
+
+/* obj must have been allocated through mmm.  destructor can be NULL,
+ * in which case the memory just gets freed.
+ */
+void
+hatrack_rcu_defer_free(void *obj, mmm_cleanup_func destructor, void *aux)
+{
+    if (destructor) {
+	mmm_add_cleanup_handler(obj, destructor, aux);
+    }
+
+    mmm_retire(obj);
+
+    return;
+}
+
+/* Waits until every thread that was in a read section when we were
+ * called has left it (or started a new one).  We bump the epoch, so
+ * that sections that start from here on reserve the new epoch or a
+ * later one, then wait until no reservation is older than it.
+ *
+ * This can't be called from inside a read section, since we'd be
+ * waiting on ourselves.
+ */
+void
+hatrack_rcu_synchronize(void)
+{
+    uint64_t          epoch;
+    uint64_t          lasttid;
+    uint64_t          i;
+    _Atomic uint64_t *reservation;
+
+    if (hatrack_rcu_depth) {
+	abort();
+    }
+
+    epoch   = atomic_fetch_add(&mmm_epoch, 1) + 1;
+    lasttid = idalloc_high_water(&mmm_tids);
+
+    for (i = 0; i < lasttid; i++) {
+	reservation = (_Atomic uint64_t *)&mmm_reservations[i];
+
+	while (atomic_load(reservation) < epoch) {
+	    sched_yield();
+	}
+    }
+
+    return;
+}
@@ -0,0 +1,596 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           apibench.c
+ *
+ *  Description:    Benchmarks for the public hatrack_dict_* and
+ *                  hatrack_set_* interfaces.
+ *
+ *                  The rest of the harness drives the underlying
+ *                  tables through their vtables, with hash values
+ *                  computed before the clock starts, and items that
+ *                  are just integers. That's the right way to compare
+ *                  algorithms, but it leaves out everything the
+ *                  wrappers do on top of the table, which is what
+ *                  applications actually pay for:
+ *
+ *                  - Hashing the key, including following the hash
+ *                    offset and checking the cache for object keys.
+ *                  - Allocating (and later retiring) a record per
+ *                    write; hatrack_dict_item_t for dicts, and the
+ *                    woolhat record that holds the item for sets.
+ *                  - The checks for hooks, arenas, budgets, and so on.
+ *
+ *                  For each table type (dict on crown, set on
+ *                  woolhat) and each kind of key, we replay the same
+ *                  operation schedule three times:
+ *
+ *                  1) Directly against the table, with hash values
+ *                     for every key computed up front (the same way
+ *                     the rest of the harness works).
+ *                  2) Directly against the table, but hashing the key
+ *                     on each operation, exactly as the wrapper would.
+ *                  3) Through the public API.
+ *
+ *                  The difference between 1) and 2) is the cost of
+ *                  hashing, and the difference between 2) and 3) is
+ *                  the cost of the wrapper itself.
+ *
+ *                  The key types are:
+ *
+ *                  - int:  HATRACK_DICT_KEY_TYPE_INT.
+ *                  - cstr: HATRACK_DICT_KEY_TYPE_CSTR, with keys of
+ *                          --key-len characters.
+ *                  - obj:  HATRACK_DICT_KEY_TYPE_OBJ_CSTR, pointing at
+ *                          the same strings, with a cache offset set,
+ *                          so the string only gets hashed once per
+ *                          key.
+ *
+ *                  The workload comes from the custom test flags
+ *                  (operation mix, --num-keys, --num-threads,
+ *                  --total-ops, --prefill-pct and --seed). Views
+ *                  aren't supported here. Sets don't have replace(),
+ *                  so for sets, replaces are done as puts. Every run
+ *                  starts with a fresh table, prefilled with
+ *                  --prefill-pct percent of the keys.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <testhat.h>
+#include <hatrack/gate.h>
+#include <hatrack/dict.h>
+#include <hatrack/set.h>
+#include <hatrack/hash.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+    API_BENCH_GET,
+    API_BENCH_PUT,
+    API_BENCH_ADD,
+    API_BENCH_REPLACE,
+    API_BENCH_REMOVE
+};
+
+enum
+{
+    API_BENCH_KEY_INT,
+    API_BENCH_KEY_CSTR,
+    API_BENCH_KEY_OBJ,
+    API_BENCH_NUM_KEY_KINDS
+};
+
+enum
+{
+    API_BENCH_LEVEL_RAW,
+    API_BENCH_LEVEL_HASHED,
+    API_BENCH_LEVEL_API,
+    API_BENCH_NUM_LEVELS
+};
+
+static char *api_bench_key_names[] = {
+    "int",
+    "cstr",
+    "obj",
+};
+
+static uint32_t api_bench_key_types[] = {
+    HATRACK_DICT_KEY_TYPE_INT,
+    HATRACK_DICT_KEY_TYPE_CSTR,
+    HATRACK_DICT_KEY_TYPE_OBJ_CSTR,
+};
+
+typedef struct {
+    hatrack_hash_t cache;
+    char          *name;
+} api_bench_obj_t;
+
+/* The schedule holds one entry per operation; the operation is in
+ * the upper 32 bits, and the key index in the lower 32.  Thread i
+ * runs the i-th slice of it.
+ */
+typedef struct {
+    bool            is_set;
+    int             key_kind;
+    int             level;
+    uint64_t        ops_per_thread;
+    uint64_t       *schedule;
+    void          **keys;
+    hatrack_hash_t *hashes;
+    crown_t        *crown;
+    woolhat_t      *woolhat;
+    hatrack_dict_t *dict;
+    hatrack_set_t  *set;
+} api_bench_t;
+
+static gate_t          *api_gate;
+static api_bench_t      api_cur;
+static api_bench_obj_t *api_objs;
+static char            *api_strs;
+static void            *api_keys[API_BENCH_NUM_KEY_KINDS];
+
+// Mirrors hatrack_dict_get_hash_value() for the key types we use.
+static inline hatrack_hash_t
+api_bench_hash(int key_kind, void *key)
+{
+    api_bench_obj_t *obj;
+
+    switch (key_kind) {
+    case API_BENCH_KEY_INT:
+        return hash_int((uint64_t)key);
+    case API_BENCH_KEY_CSTR:
+        return hash_cstr((char *)key);
+    default:
+        obj = (api_bench_obj_t *)key;
+
+        if (hatrack_bucket_unreserved(obj->cache)) {
+            obj->cache = hash_cstr(obj->name);
+        }
+
+        return obj->cache;
+    }
+}
+
+static inline hatrack_hash_t
+api_bench_hv(uint64_t ix, void *key)
+{
+    if (api_cur.level == API_BENCH_LEVEL_RAW) {
+        return api_cur.hashes[ix];
+    }
+
+    return api_bench_hash(api_cur.key_kind, key);
+}
+
+static void
+api_bench_dict_op(uint64_t op, uint64_t ix)
+{
+    void          *key;
+    hatrack_hash_t hv;
+
+    key = api_cur.keys[ix];
+
+    if (api_cur.level == API_BENCH_LEVEL_API) {
+        switch (op) {
+        case API_BENCH_GET:
+            hatrack_dict_get(api_cur.dict, key, NULL);
+            return;
+        case API_BENCH_PUT:
+            hatrack_dict_put(api_cur.dict, key, (void *)ix);
+            return;
+        case API_BENCH_ADD:
+            hatrack_dict_add(api_cur.dict, key, (void *)ix);
+            return;
+        case API_BENCH_REPLACE:
+            hatrack_dict_replace(api_cur.dict, key, (void *)ix);
+            return;
+        default:
+            hatrack_dict_remove(api_cur.dict, key);
+            return;
+        }
+    }
+
+    hv = api_bench_hv(ix, key);
+
+    switch (op) {
+    case API_BENCH_GET:
+        crown_get(api_cur.crown, hv, NULL);
+        return;
+    case API_BENCH_PUT:
+        crown_put(api_cur.crown, hv, key, NULL);
+        return;
+    case API_BENCH_ADD:
+        crown_add(api_cur.crown, hv, key);
+        return;
+    case API_BENCH_REPLACE:
+        crown_replace(api_cur.crown, hv, key, NULL);
+        return;
+    default:
+        crown_remove(api_cur.crown, hv, NULL);
+        return;
+    }
+}
+
+static void
+api_bench_set_op(uint64_t op, uint64_t ix)
+{
+    void          *key;
+    hatrack_hash_t hv;
+
+    key = api_cur.keys[ix];
+
+    if (api_cur.level == API_BENCH_LEVEL_API) {
+        switch (op) {
+        case API_BENCH_GET:
+            hatrack_set_contains(api_cur.set, key);
+            return;
+        case API_BENCH_ADD:
+            hatrack_set_add(api_cur.set, key);
+            return;
+        case API_BENCH_PUT:
+        case API_BENCH_REPLACE:
+            hatrack_set_put(api_cur.set, key);
+            return;
+        default:
+            hatrack_set_remove(api_cur.set, key);
+            return;
+        }
+    }
+
+    hv = api_bench_hv(ix, key);
+
+    switch (op) {
+    case API_BENCH_GET:
+        woolhat_get(api_cur.woolhat, hv, NULL);
+        return;
+    case API_BENCH_ADD:
+        woolhat_add(api_cur.woolhat, hv, key);
+        return;
+    case API_BENCH_PUT:
+    case API_BENCH_REPLACE:
+        woolhat_put(api_cur.woolhat, hv, key, NULL);
+        return;
+    default:
+        woolhat_remove(api_cur.woolhat, hv, NULL);
+        return;
+    }
+}
+
+static void *
+api_bench_thread(void *arg)
+{
+    uint64_t *p;
+    uint64_t *end;
+
+    p   = &api_cur.schedule[(uint64_t)arg * api_cur.ops_per_thread];
+    end = p + api_cur.ops_per_thread;
+
+    mmm_register_thread();
+    gate_thread_ready(api_gate);
+
+    if (api_cur.is_set) {
+        for (; p < end; p++) {
+            api_bench_set_op(*p >> 32, *p & 0xffffffff);
+        }
+    }
+    else {
+        for (; p < end; p++) {
+            api_bench_dict_op(*p >> 32, *p & 0xffffffff);
+        }
+    }
+
+    gate_thread_done(api_gate);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void
+api_bench_setup_table(benchmark_t *config)
+{
+    uint64_t i;
+    uint64_t prefill;
+
+    api_cur.crown   = NULL;
+    api_cur.woolhat = NULL;
+    api_cur.dict    = NULL;
+    api_cur.set     = NULL;
+
+    if (api_cur.key_kind == API_BENCH_KEY_OBJ) {
+        for (i = 0; i < config->key_range; i++) {
+            api_objs[i].cache = (hatrack_hash_t){0};
+        }
+    }
+
+    switch (api_cur.level) {
+    case API_BENCH_LEVEL_API:
+        if (api_cur.is_set) {
+            api_cur.set = hatrack_set_new(api_bench_key_types[api_cur.key_kind]);
+        }
+        else {
+            api_cur.dict
+                = hatrack_dict_new(api_bench_key_types[api_cur.key_kind]);
+        }
+
+        if (api_cur.key_kind == API_BENCH_KEY_OBJ) {
+            if (api_cur.is_set) {
+                hatrack_set_set_hash_offset(api_cur.set,
+                                            offsetof(api_bench_obj_t, name));
+                hatrack_set_set_cache_offset(api_cur.set,
+                                             offsetof(api_bench_obj_t, cache));
+            }
+            else {
+                hatrack_dict_set_hash_offset(api_cur.dict,
+                                             offsetof(api_bench_obj_t, name));
+                hatrack_dict_set_cache_offset(api_cur.dict,
+                                              offsetof(api_bench_obj_t, cache));
+            }
+        }
+        break;
+    default:
+        if (api_cur.is_set) {
+            api_cur.woolhat = woolhat_new();
+        }
+        else {
+            api_cur.crown = crown_new();
+        }
+        break;
+    }
+
+    prefill = ((uint64_t)config->key_range * config->prefill_pct) / 100;
+
+    for (i = 0; i < prefill; i++) {
+        if (api_cur.is_set) {
+            api_bench_set_op(API_BENCH_PUT, i);
+        }
+        else {
+            api_bench_dict_op(API_BENCH_PUT, i);
+        }
+    }
+
+    return;
+}
+
+static void
+api_bench_teardown_table(void)
+{
+    if (api_cur.crown) {
+        crown_delete(api_cur.crown);
+    }
+
+    if (api_cur.woolhat) {
+        woolhat_delete(api_cur.woolhat);
+    }
+
+    if (api_cur.dict) {
+        hatrack_dict_delete(api_cur.dict);
+    }
+
+    if (api_cur.set) {
+        hatrack_set_delete(api_cur.set);
+    }
+
+    return;
+}
+
+// Returns the average ns/op per thread, and sets *mops.
+static double
+api_bench_run(benchmark_t *config, int level, double *mops)
+{
+    pthread_t threads[config->num_threads];
+    uint64_t  i;
+    double    elapsed;
+
+    api_cur.level = level;
+
+    api_bench_setup_table(config);
+    gate_init(api_gate, HATRACK_THREADS_MAX);
+
+    for (i = 0; i < config->num_threads; i++) {
+        pthread_create(&threads[i], NULL, api_bench_thread, (void *)i);
+    }
+
+    gate_open(api_gate, config->num_threads);
+
+    for (i = 0; i < config->num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    elapsed = gate_close(api_gate);
+
+    api_bench_teardown_table();
+
+    *mops = ((double)(api_cur.ops_per_thread * config->num_threads))
+          / (elapsed * 1000000);
+
+    return (gate_get_avg(api_gate) * 1000000000.0) / api_cur.ops_per_thread;
+}
+
+static void
+api_bench_prepare_schedule(benchmark_t *config)
+{
+    uint64_t i;
+    uint64_t n;
+    uint64_t op;
+    uint32_t r;
+
+    n                = api_cur.ops_per_thread * config->num_threads;
+    api_cur.schedule = (uint64_t *)malloc(n * sizeof(uint64_t));
+
+    for (i = 0; i < n; i++) {
+        r = test_rand() % 100;
+
+        if (r < config->read_pct) {
+            op = API_BENCH_GET;
+        }
+        else if ((r -= config->read_pct) < config->put_pct) {
+            op = API_BENCH_PUT;
+        }
+        else if ((r -= config->put_pct) < config->add_pct) {
+            op = API_BENCH_ADD;
+        }
+        else if ((r -= config->add_pct) < config->replace_pct) {
+            op = API_BENCH_REPLACE;
+        }
+        else {
+            op = API_BENCH_REMOVE;
+        }
+
+        api_cur.schedule[i] = (op << 32) | (test_rand() % config->key_range);
+    }
+
+    return;
+}
+
+/* Strings are all key_len characters, and only differ in their last
+ * eight, so that hashing them can't stop early.
+ */
+static void
+api_bench_prepare_keys(benchmark_t *config, unsigned int key_len)
+{
+    uint64_t i;
+    uint64_t n;
+    char    *s;
+    void   **int_keys;
+    void   **str_keys;
+    void   **obj_keys;
+
+    n        = config->key_range;
+    api_strs = (char *)malloc(n * (key_len + 1));
+    api_objs = (api_bench_obj_t *)calloc(n, sizeof(api_bench_obj_t));
+    int_keys = (void **)malloc(n * sizeof(void *));
+    str_keys = (void **)malloc(n * sizeof(void *));
+    obj_keys = (void **)malloc(n * sizeof(void *));
+
+    for (i = 0; i < n; i++) {
+        s = &api_strs[i * (key_len + 1)];
+
+        memset(s, 'k', key_len - 8);
+        snprintf(s + key_len - 8, 9, "%08llx", (unsigned long long)i);
+
+        api_objs[i].name = s;
+        int_keys[i]      = (void *)i;
+        str_keys[i]      = s;
+        obj_keys[i]      = &api_objs[i];
+    }
+
+    api_keys[API_BENCH_KEY_INT]  = int_keys;
+    api_keys[API_BENCH_KEY_CSTR] = str_keys;
+    api_keys[API_BENCH_KEY_OBJ]  = obj_keys;
+
+    return;
+}
+
+static void
+api_bench_free_keys(void)
+{
+    int i;
+
+    for (i = 0; i < API_BENCH_NUM_KEY_KINDS; i++) {
+        free(api_keys[i]);
+    }
+
+    free(api_objs);
+    free(api_strs);
+
+    return;
+}
+
+static void
+api_bench_row(benchmark_t *config, bool is_set, int key_kind)
+{
+    hatrack_hash_t *hashes;
+    double          ns[API_BENCH_NUM_LEVELS];
+    double          mops;
+    uint64_t        i;
+    int             level;
+
+    api_cur.is_set   = is_set;
+    api_cur.key_kind = key_kind;
+    api_cur.keys     = (void **)api_keys[key_kind];
+    hashes           = (hatrack_hash_t *)malloc(config->key_range
+                                         * sizeof(hatrack_hash_t));
+    api_cur.hashes   = hashes;
+
+    for (i = 0; i < config->key_range; i++) {
+        hashes[i] = api_bench_hash(key_kind, api_cur.keys[i]);
+    }
+
+    for (level = 0; level < API_BENCH_NUM_LEVELS; level++) {
+        ns[level] = api_bench_run(config, level, &mops);
+    }
+
+    fprintf(stderr,
+            "%-6s %-5s %10.2f %10.2f %10.2f %10.2f %10.3f %8.1f%%\n",
+            is_set ? "set" : "dict",
+            api_bench_key_names[key_kind],
+            ns[API_BENCH_LEVEL_RAW],
+            ns[API_BENCH_LEVEL_HASHED] - ns[API_BENCH_LEVEL_RAW],
+            ns[API_BENCH_LEVEL_API] - ns[API_BENCH_LEVEL_HASHED],
+            ns[API_BENCH_LEVEL_API],
+            mops,
+            100.0 * (ns[API_BENCH_LEVEL_API] - ns[API_BENCH_LEVEL_RAW])
+                / ns[API_BENCH_LEVEL_API]);
+
+    free(hashes);
+
+    return;
+}
+
+void
+run_api_benchmarks(config_info_t *config)
+{
+    benchmark_t *workload;
+    int          key_kind;
+
+    workload = &config->custom;
+
+    if (workload->view_pct || workload->sort_pct) {
+        fprintf(stderr, "API benchmarks don't support views; skipping.\n");
+        return;
+    }
+
+    api_cur.ops_per_thread = workload->total_ops / workload->num_threads;
+    api_gate               = gate_new();
+
+    test_init_rand(workload->seed);
+    api_bench_prepare_schedule(workload);
+    api_bench_prepare_keys(workload, config->key_len);
+
+    fprintf(stderr,
+            "dict / set API benchmarks (%u threads, %u keys, %llu ops, "
+            "cstr length %u)\n",
+            workload->num_threads,
+            workload->key_range,
+            (unsigned long long)(api_cur.ops_per_thread
+                                 * workload->num_threads),
+            config->key_len);
+    fprintf(stderr,
+            "%-6s %-5s %10s %10s %10s %10s %10s %9s\n",
+            "table",
+            "keys",
+            "raw ns/op",
+            "+hash",
+            "+api",
+            "total",
+            "MOps/sec",
+            "overhead");
+
+    for (key_kind = 0; key_kind < API_BENCH_NUM_KEY_KINDS; key_kind++) {
+        api_bench_row(workload, false, key_kind);
+    }
+
+    for (key_kind = 0; key_kind < API_BENCH_NUM_KEY_KINDS; key_kind++) {
+        api_bench_row(workload, true, key_kind);
+    }
+
+    fputc('\n', stderr);
+
+    api_bench_free_keys();
+    free(api_cur.schedule);
+    gate_delete(api_gate);
+
+    return;
+}
@@ -19,7 +19,13 @@
 #define S_WITH        "with"
 #define S_WO          "without"
 #define S_FUNC        "functional-tests"
+#define S_UNIT        "unit-tests"
 #define S_DEFAULT     "run-default-tests"
+#define S_MMM_BENCH   "mmm-bench"
+#define S_API_BENCH   "api-bench"
+#define S_KEY_LEN     "key-len"
+#define S_SWEEP       "sweep"
+#define S_SWEEP_REPS  "sweep-reps"
 #define S_READ_PCT    "read-pct"
 #define S_PUT_PCT     "put-pct"
 #define S_ADD_PCT     "add-pct"
@@ -36,18 +42,21 @@
 #define S_SEED        "seed"
 #define S_HELP        "help"
 
-#define HATRACK_DEFAULT_READ     98
-#define HATRACK_DEFAULT_PUT      1
-#define HATRACK_DEFAULT_ADD      0
-#define HATRACK_DEFAULT_REPLACE  0
-#define HATRACK_DEFAULT_REMOVE   1
-#define HATRACK_DEFAULT_VIEW     0
-#define HATRACK_DEFAULT_SORT     0
-#define HATRACK_DEFAULT_SEED     0 // Random.
-#define HATRACK_DEFAULT_START_SZ HATRACK_MIN_SIZE
-#define HATRACK_DEFAULT_PREFILL  50
-#define HATRACK_DEFAULT_OPS      100000
-#define HATRACK_DEFAULT_NUM_KEYS 1000
+#define HATRACK_DEFAULT_READ       98
+#define HATRACK_DEFAULT_PUT        1
+#define HATRACK_DEFAULT_ADD        0
+#define HATRACK_DEFAULT_REPLACE    0
+#define HATRACK_DEFAULT_REMOVE     1
+#define HATRACK_DEFAULT_VIEW       0
+#define HATRACK_DEFAULT_SORT       0
+#define HATRACK_DEFAULT_SEED       0 // Random.
+#define HATRACK_DEFAULT_START_SZ   HATRACK_MIN_SIZE
+#define HATRACK_DEFAULT_PREFILL    50
+#define HATRACK_DEFAULT_OPS        100000
+#define HATRACK_DEFAULT_NUM_KEYS   1000
+#define HATRACK_DEFAULT_SWEEP_REPS 3
+#define HATRACK_DEFAULT_KEY_LEN    16
+#define HATRACK_MIN_KEY_LEN        8
 
 enum {
     OPT_DEFAULT,
@@ -86,7 +95,13 @@ config_init(config_info_t *config)
 {
     config->run_default_tests  = true;
     config->run_func_tests     = false;
+    config->run_unit_tests     = false;
     config->run_custom_test    = true;
+    config->run_sweep          = false;
+    config->sweep_reps         = HATRACK_DEFAULT_SWEEP_REPS;
+    config->run_mmm_bench      = false;
+    config->run_api_bench      = false;
+    config->key_len            = HATRACK_DEFAULT_KEY_LEN;
     config->custom.read_pct    = HATRACK_DEFAULT_READ;
     config->custom.put_pct     = HATRACK_DEFAULT_PUT;
     config->custom.add_pct     = HATRACK_DEFAULT_ADD;
@@ -155,6 +170,24 @@ usage(void)
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr, "  --with [algorithm]+ | --without [algorithm]+ \n");
     fprintf(stderr, "  --functional-tests (Run functionality tests)\n");
+    fprintf(stderr,
+            "  --unit-tests (Run tests for the support code and the APIs"
+            "\nlayered over the tables)\n");
+    fprintf(stderr, "  --mmm-bench (Run memory manager microbenchmarks)\n");
+    fprintf(stderr,
+            "  --api-bench (Run the custom test workload through the dict"
+            "\nand set APIs, and compare against the raw tables)\n");
+    fprintf(stderr,
+            "  --key-len=<int> (Length of string keys for --api-bench; "
+            "DEFAULT: %d)\n",
+            HATRACK_DEFAULT_KEY_LEN);
+    fprintf(stderr,
+            "  --sweep (Run the custom test over a series of thread counts,"
+            "\nup to --num-threads, which defaults to 2x the cores here; "
+            "CSV goes to stdout)\n");
+    fprintf(stderr,
+            "  --sweep-reps=<int> (Runs per point in a sweep; DEFAULT: %d)\n",
+            HATRACK_DEFAULT_SWEEP_REPS);
     fprintf(stderr,
             "  --run-default-tests (Run default performance tests when running"
             "\nother test types)");
@@ -206,7 +239,10 @@ usage(void)
             "  --seed=<hex-digits> (Set a seed for the rng; "
             "implies --no-rand)\n\n");
 
-    fprintf(stderr, "When you pass --functional-tests or any of the flags ");
+    fprintf(stderr, "When you pass --functional-tests, --unit-tests, ");
+    fprintf(stderr, "--mmm-bench, --api-bench");
+    fprintf(stderr, ", --sweep");
+    fprintf(stderr, " or any of the flags ");
     fprintf(stderr, "for a custom\nperformance test, the default stress ");
     fprintf(stderr, "tests will NOT run\nUNLESS you pass --run-default-tests");
     fprintf(stderr, "\n\n");
@@ -251,12 +287,15 @@ static void
 validate_config(config_info_t *config)
 {
     if (!config->run_custom_test && !config->run_func_tests
-        && !config->run_default_tests) {
+        && !config->run_unit_tests && !config->run_default_tests
+        && !config->run_mmm_bench
+        && !config->run_api_bench && !config->run_sweep) {
         fprintf(stderr, "No tests specified.\n");
         usage();
     }
 
-    if (config->run_custom_test) {
+    if (config->run_custom_test || config->run_sweep
+        || config->run_api_bench) {
         validate_operational_mix(&config->custom);
 
         if (config->custom.start_sz > 32) {
@@ -282,6 +321,18 @@ validate_config(config_info_t *config)
         }
     }
 
+    if (config->run_api_bench && config->key_len < HATRACK_MIN_KEY_LEN) {
+        fprintf(stderr,
+                "String keys must be at least %d characters.\n",
+                HATRACK_MIN_KEY_LEN);
+        usage();
+    }
+
+    if (config->run_sweep && !config->sweep_reps) {
+        fprintf(stderr, "Sweeps need at least one run per point.\n");
+        usage();
+    }
+
     return;
 }
 
@@ -475,7 +526,13 @@ parse_args(int argc, char *argv[])
 {
     int            with_state           = OPT_DEFAULT;
     bool           func_test_provided   = false;
+    bool           unit_test_provided   = false;
     bool           def_tests_provided   = false;
+    bool           mmm_bench_provided   = false;
+    bool           api_bench_provided   = false;
+    bool           key_len_provided     = false;
+    bool           sweep_provided       = false;
+    bool           sweep_reps_provided  = false;
     bool           read_pct_provided    = false;
     bool           put_pct_provided     = false;
     bool           add_pct_provided     = false;
@@ -563,6 +620,22 @@ parse_args(int argc, char *argv[])
             }
 
             try_parse_flag(p, S_FUNC, func_test_provided, &ret->run_func_tests);
+            try_parse_flag(p, S_UNIT, unit_test_provided, &ret->run_unit_tests);
+            try_parse_flag(p,
+                           S_MMM_BENCH,
+                           mmm_bench_provided,
+                           &ret->run_mmm_bench);
+            try_parse_flag(p,
+                           S_API_BENCH,
+                           api_bench_provided,
+                           &ret->run_api_bench);
+            try_parse_int(p, S_KEY_LEN, key_len_provided, &ret->key_len);
+            // Has to come first, since "sweep" is a prefix of it.
+            try_parse_int(p,
+                          S_SWEEP_REPS,
+                          sweep_reps_provided,
+                          &ret->sweep_reps);
+            try_parse_flag(p, S_SWEEP, sweep_provided, &ret->run_sweep);
             try_parse_flag(p,
                            S_DEFAULT,
                            def_tests_provided,
@@ -665,7 +738,9 @@ found_match:
         && !shuffle_provided && !seed_provided) {
         ret->run_custom_test = false;
 
-        if (!ret->run_default_tests && !ret->run_func_tests) {
+        if (!ret->run_default_tests && !ret->run_func_tests
+            && !ret->run_unit_tests && !ret->run_mmm_bench && !ret->run_api_bench
+            && !ret->run_sweep) {
             fprintf(stderr, "Error: No tests specified.\n");
             usage();
         }
@@ -674,7 +749,25 @@ found_match:
         ret->run_custom_test = true;
     }
 
-    if ((ret->run_custom_test || ret->run_func_tests) && !def_tests_provided) {
+    /* A sweep takes its workload from the custom test flags, instead
+     * of running the custom test on its own.
+     */
+    if (ret->run_sweep) {
+        ret->run_custom_test = false;
+
+        if (!num_threads_provided) {
+            ret->custom.num_threads = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+        }
+    }
+
+    /* So do the API benchmarks. */
+    if (ret->run_api_bench) {
+        ret->run_custom_test = false;
+    }
+
+    if ((ret->run_custom_test || ret->run_func_tests || ret->run_unit_tests
+         || ret->run_mmm_bench || ret->run_api_bench || ret->run_sweep)
+        && !def_tests_provided) {
         ret->run_default_tests = false;
     }
 
@@ -0,0 +1,374 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           mmmbench.c
+ *
+ *  Description:    Microbenchmarks for mmm, our memory manager.
+ *
+ *                  Every algorithm in the library pays for mmm on
+ *                  every operation, so its costs set a floor under
+ *                  all the hash table and queue numbers.  These
+ *                  benchmarks measure those costs in isolation:
+ *
+ *                  - mmm_start_basic_op() / mmm_end_op() pairs.
+ *                  - mmm_start_linearized_op() / mmm_end_op() pairs.
+ *                  - mmm_alloc() vs. mmm_alloc_committed() (the
+ *                    latter bumps the global epoch). The memory is
+ *                    handed straight back to free().
+ *                  - mmm_alloc_committed() + mmm_retire() pairs.
+ *                  - The cost of a pass through mmm_empty(). Since
+ *                    that's internal to mmm, we time the retire that
+ *                    triggers it (every HATRACK_RETIRE_FREQ retires).
+ *
+ *                  Each is run over a series of thread counts,
+ *                  doubling up to the number of cores, and then one
+ *                  run at twice the number of cores.
+ *
+ *                  The cost of mmm_empty() depends on two other
+ *                  things, which we also vary:
+ *
+ *                  1) How much of the retire list it has to walk
+ *                     before it finds something it can free. We
+ *                     control this by having each thread hold a
+ *                     reservation while it retires, renewing it
+ *                     every 'backlog' retires, so that about that
+ *                     many records are pinned at any given time.
+ *
+ *                  2) How many TIDs have been handed out, since
+ *                     mmm_empty() scans the reservations of every
+ *                     TID up to the highest one issued. We fake
+ *                     registered threads by taking TIDs from mmm's
+ *                     allocator ourselves, with their reservations
+ *                     marked unreserved, which is exactly what a
+ *                     thread that's registered but idle looks like.
+ *                     Since that raises mmm's high-water mark for
+ *                     good, these runs go last.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include <testhat.h>
+#include <hatrack/gate.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MMM_BENCH_OP_ITERS     2000000
+#define MMM_BENCH_ALLOC_ITERS  500000
+#define MMM_BENCH_RETIRE_ITERS 500000
+#define MMM_BENCH_ALLOC_SIZE   64
+
+enum
+{
+    MMM_BENCH_BASIC_OP,
+    MMM_BENCH_LINEARIZED_OP,
+    MMM_BENCH_ALLOC,
+    MMM_BENCH_ALLOC_COMMITTED,
+    MMM_BENCH_RETIRE
+};
+
+static char *mmm_bench_names[] = {
+    "basic_op",
+    "linearized_op",
+    "alloc",
+    "alloc_committed",
+    "retire",
+};
+
+typedef struct {
+    int      kind;
+    uint64_t iters;
+    uint64_t backlog;
+    uint64_t num_tids;
+} mmm_bench_t;
+
+static gate_t          *mmm_gate;
+static mmm_bench_t      mmm_cur;
+static _Atomic uint64_t mmm_empty_ns;
+static _Atomic uint64_t mmm_empty_count;
+
+// Keeps the compiler from eliding alloc / free pairs.
+static void *volatile   mmm_bench_sink;
+
+static uint64_t
+mmm_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void
+mmm_bench_retire_loop(void)
+{
+    uint64_t i;
+    uint64_t window;
+    uint64_t start;
+    uint64_t total_ns;
+    uint64_t num_empties;
+    void    *p;
+
+    window      = 0;
+    total_ns    = 0;
+    num_empties = 0;
+
+    if (mmm_cur.backlog) {
+        mmm_start_basic_op();
+    }
+
+    /* mmm_retire() runs mmm_empty() on every HATRACK_RETIRE_FREQ-th
+     * call. We're a fresh thread, so our count starts at 0, the same
+     * as mmm's.
+     */
+    for (i = 1; i <= mmm_cur.iters; i++) {
+        p = mmm_alloc_committed(MMM_BENCH_ALLOC_SIZE);
+
+        if (mmm_cur.backlog && ++window == mmm_cur.backlog) {
+            mmm_end_op();
+            mmm_start_basic_op();
+            window = 0;
+        }
+
+        if (i % HATRACK_RETIRE_FREQ) {
+            mmm_retire(p);
+            continue;
+        }
+
+        start = mmm_bench_now();
+        mmm_retire(p);
+        total_ns += mmm_bench_now() - start;
+        num_empties++;
+    }
+
+    if (mmm_cur.backlog) {
+        mmm_end_op();
+    }
+
+    atomic_fetch_add(&mmm_empty_ns, total_ns);
+    atomic_fetch_add(&mmm_empty_count, num_empties);
+
+    return;
+}
+
+static void *
+mmm_bench_thread(void *arg)
+{
+    uint64_t i;
+    void    *p;
+
+    mmm_register_thread();
+    gate_thread_ready(mmm_gate);
+
+    switch (mmm_cur.kind) {
+    case MMM_BENCH_BASIC_OP:
+        for (i = 0; i < mmm_cur.iters; i++) {
+            mmm_start_basic_op();
+            mmm_end_op();
+        }
+        break;
+    case MMM_BENCH_LINEARIZED_OP:
+        for (i = 0; i < mmm_cur.iters; i++) {
+            mmm_start_linearized_op();
+            mmm_end_op();
+        }
+        break;
+    case MMM_BENCH_ALLOC:
+        for (i = 0; i < mmm_cur.iters; i++) {
+            p              = mmm_alloc(MMM_BENCH_ALLOC_SIZE);
+            mmm_bench_sink = p;
+            free(mmm_get_header(p));
+        }
+        break;
+    case MMM_BENCH_ALLOC_COMMITTED:
+        for (i = 0; i < mmm_cur.iters; i++) {
+            p              = mmm_alloc_committed(MMM_BENCH_ALLOC_SIZE);
+            mmm_bench_sink = p;
+            free(mmm_get_header(p));
+        }
+        break;
+    case MMM_BENCH_RETIRE:
+        mmm_bench_retire_loop();
+        break;
+    }
+
+    gate_thread_done(mmm_gate);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static uint64_t mmm_bench_fake_tids[HATRACK_THREADS_MAX];
+static uint64_t mmm_bench_num_fakes;
+
+// Makes it look like num_tids threads have registered.
+static void
+mmm_bench_take_tids(uint64_t num_tids)
+{
+    int64_t tid;
+
+    mmm_bench_num_fakes = 0;
+
+    while (idalloc_high_water(&mmm_tids) < num_tids) {
+        tid = idalloc_get(&mmm_tids);
+
+        if (tid < 0) {
+            break;
+        }
+
+        mmm_reservations[tid] = HATRACK_EPOCH_UNRESERVED;
+        mmm_bench_fake_tids[mmm_bench_num_fakes++] = tid;
+    }
+
+    return;
+}
+
+static void
+mmm_bench_give_back_tids(void)
+{
+    uint64_t i;
+
+    for (i = 0; i < mmm_bench_num_fakes; i++) {
+        idalloc_put(&mmm_tids, mmm_bench_fake_tids[i]);
+    }
+
+    return;
+}
+
+static void
+mmm_bench_run(int kind, uint64_t threads, uint64_t backlog, uint64_t tids)
+{
+    pthread_t threads_arr[threads];
+    uint64_t  i;
+    double    elapsed;
+    double    ns_per_op;
+    double    mops;
+    double    empty_ns;
+
+    switch (kind) {
+    case MMM_BENCH_BASIC_OP:
+    case MMM_BENCH_LINEARIZED_OP:
+        mmm_cur.iters = MMM_BENCH_OP_ITERS;
+        break;
+    case MMM_BENCH_RETIRE:
+        mmm_cur.iters = MMM_BENCH_RETIRE_ITERS;
+        break;
+    default:
+        mmm_cur.iters = MMM_BENCH_ALLOC_ITERS;
+        break;
+    }
+
+    mmm_cur.kind    = kind;
+    mmm_cur.backlog = backlog;
+
+    atomic_store(&mmm_empty_ns, 0);
+    atomic_store(&mmm_empty_count, 0);
+    gate_init(mmm_gate, HATRACK_THREADS_MAX);
+
+    mmm_bench_take_tids(tids);
+
+    for (i = 0; i < threads; i++) {
+        pthread_create(&threads_arr[i], NULL, mmm_bench_thread, NULL);
+    }
+
+    gate_open(mmm_gate, threads);
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(threads_arr[i], NULL);
+    }
+
+    elapsed          = gate_close(mmm_gate);
+    mmm_cur.num_tids = idalloc_high_water(&mmm_tids);
+
+    mmm_bench_give_back_tids();
+
+    ns_per_op = (gate_get_avg(mmm_gate) * 1000000000.0) / mmm_cur.iters;
+    mops      = ((double)(mmm_cur.iters * threads)) / (elapsed * 1000000);
+
+    fprintf(stderr,
+            "%-16s %7llu %7llu %8llu %10.2f %10.3f",
+            mmm_bench_names[kind],
+            (unsigned long long)threads,
+            (unsigned long long)mmm_cur.num_tids,
+            (unsigned long long)backlog,
+            ns_per_op,
+            mops);
+
+    if (kind == MMM_BENCH_RETIRE && atomic_load(&mmm_empty_count)) {
+        empty_ns = ((double)atomic_load(&mmm_empty_ns))
+                 / atomic_load(&mmm_empty_count);
+        fprintf(stderr, " %10.1f\n", empty_ns);
+    }
+    else {
+        fprintf(stderr, " %10s\n", "-");
+    }
+
+    return;
+}
+
+static const uint64_t mmm_bench_backlogs[] = {0, 1024, 16384};
+static const uint64_t mmm_bench_tid_counts[] = {64, 512, HATRACK_THREADS_MAX};
+
+void
+run_mmm_benchmarks(config_info_t *config)
+{
+    uint64_t ncpus;
+    uint64_t max_threads;
+    uint64_t threads;
+    uint64_t tids;
+    uint64_t i;
+    int      kind;
+
+    ncpus       = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = ncpus << 1;
+    mmm_gate    = gate_new();
+
+    fprintf(stderr, "mmm microbenchmarks (%llu cores)\n",
+            (unsigned long long)ncpus);
+    fprintf(stderr,
+            "%-16s %7s %7s %8s %10s %10s %10s\n",
+            "benchmark",
+            "threads",
+            "tids",
+            "backlog",
+            "ns/op",
+            "MOps/sec",
+            "ns/empty");
+
+    for (kind = MMM_BENCH_BASIC_OP; kind <= MMM_BENCH_ALLOC_COMMITTED; kind++) {
+        for (threads = 1; threads < ncpus; threads <<= 1) {
+            mmm_bench_run(kind, threads, 0, 0);
+        }
+        mmm_bench_run(kind, ncpus, 0, 0);
+        mmm_bench_run(kind, max_threads, 0, 0);
+    }
+
+    for (i = 0; i < sizeof(mmm_bench_backlogs) / sizeof(uint64_t); i++) {
+        for (threads = 1; threads < ncpus; threads <<= 1) {
+            mmm_bench_run(MMM_BENCH_RETIRE, threads, mmm_bench_backlogs[i], 0);
+        }
+        mmm_bench_run(MMM_BENCH_RETIRE, ncpus, mmm_bench_backlogs[i], 0);
+        mmm_bench_run(MMM_BENCH_RETIRE, max_threads, mmm_bench_backlogs[i], 0);
+    }
+
+    // Leave room for our own threads to register above the fake ones.
+    for (i = 0; i < sizeof(mmm_bench_tid_counts) / sizeof(uint64_t); i++) {
+        tids = mmm_bench_tid_counts[i];
+
+        if (tids + max_threads > HATRACK_THREADS_MAX) {
+            tids = HATRACK_THREADS_MAX - max_threads;
+        }
+
+        mmm_bench_run(MMM_BENCH_RETIRE, 1, 0, tids);
+
+        if (ncpus > 1) {
+            mmm_bench_run(MMM_BENCH_RETIRE, ncpus, 0, tids);
+        }
+    }
+
+    fputc('\n', stderr);
+    gate_delete(mmm_gate);
+
+    return;
+}
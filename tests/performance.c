@@ -18,6 +18,7 @@
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #define WIN_COL_IOCTL TIOCGWINSZ
 typedef struct winsize wininfo_t;
@@ -561,17 +562,20 @@ time_diff(struct timespec *end, struct timespec *start)
          + ((end->tv_nsec - start->tv_nsec) / 1000000000.0);
 }
 
-static void
-performance_report(char *hat, benchmark_t *config, struct timespec *start)
+/* Returns the time the slowest thread took, and, if fastest is
+ * non-NULL, the time the fastest one took.
+ */
+static double
+get_elapsed(struct timespec *start, double *fastest)
 {
     double cur, min, max;
 
-    min   = 0;
-    max   = 0;
+    min = 0;
+    max = 0;
 
     for (int i = 0; i < HATRACK_THREADS_MAX; i++) {
         if (stop_times[i].tv_sec || stop_times[i].tv_nsec) {
-            cur   = time_diff(&stop_times[i], start);
+            cur = time_diff(&stop_times[i], start);
 
             if (!min || cur < min) {
                 min = cur;
@@ -582,6 +586,20 @@ performance_report(char *hat, benchmark_t *config, struct timespec *start)
         }
     }
 
+    if (fastest) {
+        *fastest = min;
+    }
+
+    return max;
+}
+
+static void
+performance_report(char *hat, benchmark_t *config, struct timespec *start)
+{
+    double min, max;
+
+    max = get_elapsed(start, &min);
+
     fprintf(stderr,
             "%10s time: %.4f sec (fastest: %.4f, avg: %.4f); MOps/sec: %.3f\n",
             hat,
@@ -595,32 +613,113 @@ performance_report(char *hat, benchmark_t *config, struct timespec *start)
 
 #define HB_DEFAULT 16
 
-void
-run_performance_test(benchmark_t *config)
+/* Sets up everything that depends on the number of threads. The
+ * remaining setup only needs to happen once per configuration.
+ */
+static uint64_t
+prepare_thread_split(benchmark_t *config)
 {
-    int             i = 0;
-    unsigned int    j;
-    uint64_t        ops_per_thread;
-    uint32_t        tstep;
-    pthread_t       threads[config->num_threads];
-    struct timespec sspec;
-    alg_info_t     *alg_info;
+    uint64_t ops_per_thread;
+
+    ops_per_thread = config->total_ops / config->num_threads;
+
+    if (config->shuffle) {
+        thread_full_cycles = ops_per_thread / 100;
+        remaining_ops      = ops_per_thread % 100;
+    }
 
+    return ops_per_thread;
+}
+
+static void
+prepare_test(benchmark_t *config)
+{
     key_mod_mask = calculate_num_test_keys(config->key_range) - 1;
 
-    output_test_information(config);
     test_init_rand(config->seed);
     prepare_operational_mix(config);
     precompute_hashes(calculate_num_test_keys(config->key_range));
-    atomic_store(&mmm_nexttid, 0); // Reset thread ids.
 
-    ops_per_thread = config->total_ops / config->num_threads;
+    return;
+}
 
-    if (config->shuffle) {
-        thread_full_cycles = ops_per_thread / 100;
-        remaining_ops      = ops_per_thread % 100;
+/* Runs one algorithm through the configured workload once, leaving
+ * the table in place, and the thread stop times in stop_times[].
+ */
+static void
+run_one_algorithm(benchmark_t     *config,
+                  char            *hat,
+                  alg_info_t      *alg_info,
+                  uint64_t         ops_per_thread,
+                  struct timespec *sspec)
+{
+    unsigned int j;
+    uint32_t     tstep;
+    pthread_t    threads[config->num_threads];
+
+    if (alg_info->hashbytes == HB_DEFAULT) {
+        initialize_dictionary(config, hat);
+    }
+    else {
+        initialize_dictionary64(config, hat);
+    }
+    clear_timestamps();
+    basic_gate_init(&starting_gate);
+
+    for (j = 0; j < config->num_threads; j++) {
+        if (config->shuffle) {
+            tstep = test_rand() & key_mod_mask;
+            if (alg_info->hashbytes == HB_DEFAULT) {
+                pthread_create(&threads[j],
+                               NULL,
+                               shuffle_thread_run,
+                               (void *)(uint64_t)tstep);
+            }
+            else {
+                pthread_create(&threads[j],
+                               NULL,
+                               shuffle_thread_run64,
+                               (void *)(uint64_t)tstep);
+            }
+        }
+        else {
+            if (alg_info->hashbytes == HB_DEFAULT) {
+                pthread_create(&threads[j],
+                               NULL,
+                               rand_thread_run,
+                               (void *)ops_per_thread);
+            }
+            else {
+                pthread_create(&threads[j],
+                               NULL,
+                               rand_thread_run64,
+                               (void *)ops_per_thread);
+            }
+        }
+    }
+
+    basic_gate_open(&starting_gate, config->num_threads, sspec);
+
+    for (j = 0; j < config->num_threads; j++) {
+        pthread_join(threads[j], NULL);
     }
 
+    return;
+}
+
+void
+run_performance_test(benchmark_t *config)
+{
+    int             i = 0;
+    uint64_t        ops_per_thread;
+    struct timespec sspec;
+    alg_info_t     *alg_info;
+
+    output_test_information(config);
+    prepare_test(config);
+
+    ops_per_thread = prepare_thread_split(config);
+
     while (config->hat_list[i]) {
         alg_info = algorithm_info(config->hat_list[i]);
 
@@ -629,60 +728,219 @@ run_performance_test(benchmark_t *config)
             continue;
         }
 
-        if (alg_info->hashbytes == HB_DEFAULT) {
-            initialize_dictionary(config, config->hat_list[i]);
+        run_one_algorithm(config,
+                          config->hat_list[i],
+                          alg_info,
+                          ops_per_thread,
+                          &sspec);
+        performance_report(config->hat_list[i], config, &sspec);
+        testhat_delete(table);
+
+        i++;
+    }
+
+    fputc('\n', stderr);
+
+    return;
+}
+
+/* Scalability sweeps.
+ *
+ * We run the workload over a series of thread counts: doubling from
+ * 1 up to the number of cores, the number of cores itself, and then
+ * the ceiling passed in (by default, twice the number of cores, so
+ * that we see what oversubscription does). Total ops stay fixed, so
+ * this is strong scaling; each thread does its share.
+ *
+ * Each point gets run 'reps' times, each time on a fresh table. For
+ * each point, we report the mean throughput, its standard deviation,
+ * and the min and max, along with the speedup (mean throughput over
+ * the mean throughput with one thread) and the parallel efficiency
+ * (speedup divided by the thread count).
+ *
+ * We also report a 'knee' for each algorithm: the last point before
+ * adding threads stops paying off. Going from a threads to b threads,
+ * the marginal efficiency is the fractional gain in throughput over
+ * the fractional increase in threads; the knee is the point just
+ * before the first step where that drops below SWEEP_KNEE_MARGINAL. If
+ * it never does, the knee is the last point in the series.
+ *
+ * Results go to stdout as CSV, one record per line, so that they can
+ * be fed straight to other tools. Point records have 'point' in the
+ * first column; the knee record for an algorithm has 'knee', and
+ * otherwise repeats the data for the point it picked.
+ */
+
+#define SWEEP_KNEE_MARGINAL 0.5
+#define SWEEP_MAX_POINTS    64
+
+typedef struct {
+    unsigned int threads;
+    double       mean;
+    double       stddev;
+    double       min;
+    double       max;
+} sweep_point_t;
+
+static unsigned int
+sweep_thread_series(unsigned int max_threads, unsigned int *series)
+{
+    unsigned int ncpus;
+    unsigned int n;
+    unsigned int t;
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n     = 0;
+
+    for (t = 1; t < ncpus && t < max_threads; t <<= 1) {
+        series[n++] = t;
+    }
+
+    if (ncpus <= max_threads) {
+        series[n++] = ncpus;
+    }
+
+    if (max_threads > ncpus || !n) {
+        series[n++] = max_threads;
+    }
+
+    return n;
+}
+
+static void
+sweep_output(char          *kind,
+             char          *hat,
+             unsigned int   reps,
+             sweep_point_t *point,
+             double         base)
+{
+    double speedup;
+
+    speedup = point->mean / base;
+
+    printf("%s,%s,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+           kind,
+           hat,
+           point->threads,
+           reps,
+           point->mean,
+           point->stddev,
+           point->min,
+           point->max,
+           speedup,
+           speedup / point->threads);
+
+    return;
+}
+
+static void
+sweep_measure(benchmark_t   *config,
+              char          *hat,
+              alg_info_t    *alg_info,
+              unsigned int   reps,
+              sweep_point_t *point)
+{
+    unsigned int    i;
+    uint64_t        ops_per_thread;
+    double          mops;
+    double          sum;
+    double          sum_sq;
+    double          var;
+    struct timespec sspec;
+
+    config->num_threads = point->threads;
+    ops_per_thread      = prepare_thread_split(config);
+    sum                 = 0;
+    sum_sq              = 0;
+    point->min          = 0;
+    point->max          = 0;
+
+    for (i = 0; i < reps; i++) {
+        run_one_algorithm(config, hat, alg_info, ops_per_thread, &sspec);
+        testhat_delete(table);
+
+        mops = ((double)ops_per_thread * point->threads)
+             / (get_elapsed(&sspec, NULL) * 1000000);
+        sum += mops;
+        sum_sq += mops * mops;
+
+        if (!i || mops < point->min) {
+            point->min = mops;
         }
-        else {
-            initialize_dictionary64(config, config->hat_list[i]);
+        if (!i || mops > point->max) {
+            point->max = mops;
         }
-        clear_timestamps();
-        basic_gate_init(&starting_gate);
-
-        for (j = 0; j < config->num_threads; j++) {
-            if (config->shuffle) {
-                tstep = test_rand() & key_mod_mask;
-                if (alg_info->hashbytes == HB_DEFAULT) {
-                    pthread_create(&threads[j],
-                                   NULL,
-                                   shuffle_thread_run,
-                                   (void *)(uint64_t)tstep);
-                }
-                else {
-                    pthread_create(&threads[j],
-                                   NULL,
-                                   shuffle_thread_run64,
-                                   (void *)(uint64_t)tstep);
-                }
-            }
-            else {
-                if (alg_info->hashbytes == HB_DEFAULT) {
-                    pthread_create(&threads[j],
-                                   NULL,
-                                   rand_thread_run,
-                                   (void *)ops_per_thread);
-                }
-                else {
-                    pthread_create(&threads[j],
-                                   NULL,
-                                   rand_thread_run64,
-                                   (void *)ops_per_thread);
-                }
+    }
+
+    point->mean = sum / reps;
+    var         = 0;
+
+    if (reps > 1) {
+        var = (sum_sq - sum * point->mean) / (reps - 1);
+    }
+
+    point->stddev = var > 0 ? sqrt(var) : 0;
+
+    return;
+}
+
+void
+run_scaling_sweep(benchmark_t *config, unsigned int reps)
+{
+    int           i = 0;
+    unsigned int  j;
+    unsigned int  n;
+    unsigned int  knee;
+    unsigned int  max_threads;
+    unsigned int  series[SWEEP_MAX_POINTS];
+    sweep_point_t points[SWEEP_MAX_POINTS];
+    alg_info_t   *alg_info;
+    double        gain;
+    double        growth;
+
+    max_threads = config->num_threads;
+    n           = sweep_thread_series(max_threads, series);
+
+    output_test_information(config);
+    prepare_test(config);
+
+    printf("record,algorithm,threads,reps,mops_mean,mops_stddev,mops_min,"
+           "mops_max,speedup,efficiency\n");
+
+    while (config->hat_list[i]) {
+        alg_info = algorithm_info(config->hat_list[i]);
+
+        for (j = 0; j < n; j++) {
+            if (series[j] > 1 && !alg_info->threadsafe) {
+                break;
             }
+
+            points[j].threads = series[j];
+            sweep_measure(config, config->hat_list[i], alg_info, reps,
+                          &points[j]);
+            sweep_output("point", config->hat_list[i], reps, &points[j],
+                         points[0].mean);
         }
 
-        basic_gate_open(&starting_gate, config->num_threads, &sspec);
+        for (knee = 0; knee + 1 < j; knee++) {
+            gain   = (points[knee + 1].mean - points[knee].mean)
+                 / points[knee].mean;
+            growth = ((double)(points[knee + 1].threads - points[knee].threads))
+                   / points[knee].threads;
 
-        for (j = 0; j < config->num_threads; j++) {
-            pthread_join(threads[j], NULL);
+            if (gain / growth < SWEEP_KNEE_MARGINAL) {
+                break;
+            }
         }
 
-        performance_report(config->hat_list[i], config, &sspec);
-        testhat_delete(table);
+        sweep_output("knee", config->hat_list[i], reps, &points[knee],
+                     points[0].mean);
+        fflush(stdout);
 
         i++;
     }
 
-    fputc('\n', stderr);
+    config->num_threads = max_threads;
 
     return;
 }
@@ -73,10 +73,26 @@ main(int argc, char *argv[])
         run_performance_test(&config->custom);
     }
 
+    if (config->run_sweep) {
+        run_scaling_sweep(&config->custom, config->sweep_reps);
+    }
+
     if (config->run_func_tests) {
         run_functional_tests(config);
     }
 
+    if (config->run_unit_tests) {
+        run_unit_tests(config);
+    }
+
+    if (config->run_mmm_bench) {
+        run_mmm_benchmarks(config);
+    }
+
+    if (config->run_api_bench) {
+        run_api_benchmarks(config);
+    }
+
     if (config->run_default_tests) {
         run_default_tests(config);
     }
@@ -154,6 +154,25 @@ testhat_new_size(char *name, char sz)
     return ret;
 }
 
+// Crown, with the overflow stash turned on.
+static void
+crown_stash_init(crown_t *self)
+{
+    crown_init(self);
+    crown_set_bounded_probes(self, true);
+
+    return;
+}
+
+static void
+crown_stash_init_size(crown_t *self, char sz)
+{
+    crown_init_size(self, sz);
+    crown_set_bounded_probes(self, true);
+
+    return;
+}
+
 // clang-format off
 hatrack_vtable_t refhat_vtable = {
     .init    = (hatrack_init_func)refhat_init,
@@ -194,6 +213,19 @@ hatrack_vtable_t swimcap_vtable = {
     .view    = (hatrack_view_func)swimcap_view
 };
 
+hatrack_vtable_t solohat_vtable = {
+    .init    = (hatrack_init_func)solohat_init,
+    .init_sz = (hatrack_init_sz_func)solohat_init_size,
+    .get     = (hatrack_get_func)solohat_get,
+    .put     = (hatrack_put_func)solohat_put,
+    .replace = (hatrack_replace_func)solohat_replace,
+    .add     = (hatrack_add_func)solohat_add,
+    .remove  = (hatrack_remove_func)solohat_remove,
+    .delete  = (hatrack_delete_func)solohat_delete,
+    .len     = (hatrack_len_func)solohat_len,
+    .view    = (hatrack_view_func)solohat_view
+};
+
 hatrack_vtable_t newshat_vtable = {
     .init    = (hatrack_init_func)newshat_init,
     .init_sz = (hatrack_init_sz_func)newshat_init_size,    
@@ -376,6 +408,32 @@ hatrack_vtable_t crown_vtable = {
     .view    = (hatrack_view_func)crown_view
 };
 
+hatrack_vtable_t crown_stash_vtable = {
+    .init    = (hatrack_init_func)crown_stash_init,
+    .init_sz = (hatrack_init_sz_func)crown_stash_init_size,
+    .get     = (hatrack_get_func)crown_get,
+    .put     = (hatrack_put_func)crown_put,
+    .replace = (hatrack_replace_func)crown_replace,
+    .add     = (hatrack_add_func)crown_add,
+    .remove  = (hatrack_remove_func)crown_remove,
+    .delete  = (hatrack_delete_func)crown_delete,
+    .len     = (hatrack_len_func)crown_len,
+    .view    = (hatrack_view_func)crown_view
+};
+
+hatrack_vtable_t quilt_vtable = {
+    .init    = (hatrack_init_func)quilt_init,
+    .init_sz = (hatrack_init_sz_func)quilt_init_size,
+    .get     = (hatrack_get_func)quilt_get,
+    .put     = (hatrack_put_func)quilt_put,
+    .replace = (hatrack_replace_func)quilt_replace,
+    .add     = (hatrack_add_func)quilt_add,
+    .remove  = (hatrack_remove_func)quilt_remove,
+    .delete  = (hatrack_delete_func)quilt_delete,
+    .len     = (hatrack_len_func)quilt_len,
+    .view    = (hatrack_view_func)quilt_view
+};
+
 hatrack_vtable_t tiara_vtable = {
     .init    = (hatrack_init_func)tiara_init,
     .init_sz = (hatrack_init_sz_func)tiara_init_size,    
@@ -397,12 +455,15 @@ testhat_init_default_algorithms(void)
     algorithm_register("refhat", &refhat_vtable, sizeof(refhat_t), 16, false);
     algorithm_register("duncecap", &dcap_vtable, sizeof(duncecap_t), 16, true);
     algorithm_register("swimcap", &swimcap_vtable, sizeof(swimcap_t), 16, true);
+    // Only safe with a single writer, which the harness doesn't do.
+    algorithm_register("solohat", &solohat_vtable, sizeof(solohat_t), 16, false);
     algorithm_register("newshat", &newshat_vtable, sizeof(newshat_t), 16, true);
     algorithm_register("ballcap", &ballcap_vtable, sizeof(ballcap_t), 16, true);
     algorithm_register("hihat", &hihat_vtable, sizeof(hihat_t), 16, true);
     algorithm_register("hihat-a", &hihat_a_vtable, sizeof(hihat_t), 16, true);
     algorithm_register("witchhat", &witch_vtable, sizeof(witchhat_t), 16, true);
     algorithm_register("crown", &crown_vtable, sizeof(crown_t), 16, true);
+    algorithm_register("crown-stash", &crown_stash_vtable, sizeof(crown_t), 16, true);
     algorithm_register("oldhat", &oldhat_vtable, sizeof(oldhat_t), 16, true);
     algorithm_register("lohat", &lohat_vtable, sizeof(lohat_t), 16, true);
     algorithm_register("lohat-a", &lohat_a_vtable, sizeof(lohat_a_t), 16, true);
@@ -412,5 +473,6 @@ testhat_init_default_algorithms(void)
     algorithm_register("tophat-cmx", &thcmx_vtable, sizeof(tophat_t), 16, true);
     algorithm_register("tophat-cwf", &thcwf_vtable, sizeof(tophat_t), 16, true);
     algorithm_register("tiara", &tiara_vtable, sizeof(tiara_t), 8, true);
+    algorithm_register("quilt", &quilt_vtable, sizeof(quilt_t), 16, true);
     return;
 }
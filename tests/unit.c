@@ -0,0 +1,79 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit.c
+ *
+ *  Description:    Tests for the parts of hatrack the functional
+ *                  tests can't reach through the testhat vtable:
+ *                  the support code, and the APIs layered over the
+ *                  tables.  Each component's test lives in its own
+ *                  unit_*.c file, and gets registered below.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <stdio.h>
+
+typedef bool (*unit_test_func_t)(void);
+
+typedef struct {
+    char            *name;
+    unit_test_func_t func;
+} unit_test_info_t;
+
+// clang-format off
+static unit_test_info_t unit_tests[] = {
+    {"idalloc",     test_idalloc},
+    {"solohat",     test_solohat},
+    {"dict_excl",   test_dict_excl},
+    {"dict_arena",  test_dict_arena},
+    {"membudget",   test_membudget},
+    {"intset",      test_intset},
+    {"crown_stash", test_crown_stash},
+    {"dict_freeze", test_dict_freeze},
+    {"rcu",         test_rcu},
+    {"logring_follow", test_logring_follow},
+    {"par_views",   test_par_views},
+    {"dict_replica", test_dict_replica},
+    {"dict_txn",    test_dict_txn},
+    {"hash_scan",   test_hash_scan},
+    {"hatlog",      test_hatlog},
+    {"qstats",      test_qstats},
+    {"queue_set",   test_queue_set},
+    {"flex64",      test_flex64},
+    {NULL,          NULL}
+};
+// clang-format on
+
+void
+run_unit_tests(config_info_t *config)
+{
+    unit_test_info_t *cur;
+    uint32_t          failures;
+
+    fprintf(stderr, "[[ Unit tests ]]\n");
+
+    failures = 0;
+
+    for (cur = unit_tests; cur->name; cur++) {
+        fprintf(stderr, "%12s:\t", cur->name);
+        fflush(stderr);
+
+        if ((*cur->func)()) {
+            fprintf(stderr, "pass\n");
+        }
+        else {
+            fprintf(stderr, "FAIL\n");
+            failures++;
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%u unit test(s) failed.\n", failures);
+    }
+
+    return;
+}
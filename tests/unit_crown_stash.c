@@ -0,0 +1,417 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_crown_stash.c
+ *
+ *  Description:    Tests crown's bounded-probe mode with hash values
+ *                  that all share their low 12 bits, so that until
+ *                  the table gets past 4096 buckets, every item has
+ *                  the same home bucket.  That fills the neighborhood
+ *                  and the stash right away, and each time the stash
+ *                  fills, the table doubles.
+ *
+ *                  Growing never overflows the new store's stash,
+ *                  since the items that fit before still fit.
+ *                  Shrinking does: once the table has grown big
+ *                  enough to split the cluster up, we churn through
+ *                  other items until it migrates to a smaller size,
+ *                  where the cluster no longer fits.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <pthread.h>
+
+#define CROWN_STASH_TEST_THREADS 4
+#define CROWN_STASH_TEST_KEYS    400
+#define CROWN_STASH_TEST_LOW     0x5a5
+#define CROWN_STASH_TEST_CHURN   (1 << 16)
+
+/* Above the shared low 12 bits, the next three bits split the keys
+ * into 8 groups, and the rest of the id goes above those.  So with
+ * CROWN_STASH_TEST_KEYS keys, a 16K-bucket table has 4 homes of 100
+ * items, which is more than the neighborhoods and the stash can hold,
+ * and a 32K table has 8 homes of 50, which all fit in their
+ * neighborhoods (assuming 64-bit neighbor maps).
+ */
+static inline hatrack_hash_t
+crown_stash_test_hv(uint64_t id)
+{
+    hatrack_hash_t hv;
+    uint64_t       low;
+
+    low = ((id >> 3) << 15) | ((id & 7) << 12) | CROWN_STASH_TEST_LOW;
+
+#ifdef HAVE___INT128_T
+    hv = ((hatrack_hash_t)(id + 1) << 64) | low;
+#else
+    hv.w1 = low;
+    hv.w2 = id + 1;
+#endif
+
+    return hv;
+}
+
+// Filler hashes never match a cluster key, since their top half is 0.
+static inline hatrack_hash_t
+crown_stash_test_filler_hv(uint64_t i, uint64_t bix)
+{
+    hatrack_hash_t hv;
+    uint64_t       low;
+
+    low = ((i + 1) << 15) | bix;
+
+#ifdef HAVE___INT128_T
+    hv = low;
+#else
+    hv.w1 = low;
+    hv.w2 = 0;
+#endif
+
+    return hv;
+}
+
+// Values get the low bit set on replacement.
+static inline void *
+crown_stash_test_value(uint64_t id, uint64_t gen)
+{
+    return (void *)(((id + 1) << 1) | gen);
+}
+
+static bool
+crown_stash_test_check(crown_t *table, uint64_t start, uint64_t gen)
+{
+    uint64_t id;
+    void    *value;
+    bool     found;
+    bool     removed;
+
+    for (id = start; id < start + CROWN_STASH_TEST_KEYS; id++) {
+        value   = crown_get(table, crown_stash_test_hv(id), &found);
+        removed = gen && (id & 1);
+
+        if (found == removed) {
+            return false;
+        }
+
+        if (found && value != crown_stash_test_value(id, gen)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline bool
+crown_stash_test_overflowed(crown_t *table)
+{
+    crown_store_t *store;
+
+    store = atomic_load(&table->store_current);
+
+    return atomic_load(&store->overflowed);
+}
+
+/* Puts and removes unrelated items, until the table migrates into a
+ * store that overflowed.  Each put uses up a bucket until the next
+ * migration, and since none of them are live by then, the migration
+ * halves the table, from 32K buckets to 16K.
+ *
+ * Each filler item gets a home bucket of its own, away from the
+ * clusters, so that none of them land in the stash; otherwise the
+ * stash would fill before the table got to its threshold, and the
+ * table would double instead.
+ */
+static bool
+crown_stash_test_churn(crown_t *table, bool excl)
+{
+    uint64_t       i;
+    uint64_t       bix;
+    hatrack_hash_t hv;
+
+    if (atomic_load(&table->store_current)->last_slot != 32767) {
+        return false;
+    }
+
+    bix = 0;
+
+    for (i = 0; i < CROWN_STASH_TEST_CHURN; i++) {
+        while (((bix - CROWN_STASH_TEST_LOW) & 4095) < CROWN_MAP_BITS) {
+            bix++;
+        }
+
+        hv = crown_stash_test_filler_hv(i, bix & 32767);
+        bix++;
+
+        if (excl) {
+            crown_excl_put(table, hv, (void *)i, NULL);
+            crown_excl_remove(table, hv, NULL);
+        }
+        else {
+            crown_put(table, hv, (void *)i, NULL);
+            crown_remove(table, hv, NULL);
+        }
+
+        if (crown_stash_test_overflowed(table)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Single-threaded, so that we can look at the current store after
+ * each operation, and be sure we got an overflowed one.  Once we
+ * have, everything has to be there, and operations on the store
+ * (which fall back to linear probing) have to work.
+ */
+static bool
+crown_stash_test_overflow(void)
+{
+    crown_t  *table;
+    uint64_t  id;
+    void     *old;
+    bool      found;
+    bool      ret;
+
+    table = crown_new();
+
+    crown_set_bounded_probes(table, true);
+
+    for (id = 0; id < CROWN_STASH_TEST_KEYS; id++) {
+        crown_put(table,
+                  crown_stash_test_hv(id),
+                  crown_stash_test_value(id, 0),
+                  NULL);
+    }
+
+    ret = crown_stash_test_churn(table, false)
+       && crown_stash_test_check(table, 0, 0);
+
+    for (id = 0; ret && id < CROWN_STASH_TEST_KEYS; id++) {
+        if (id & 1) {
+            old = crown_remove(table, crown_stash_test_hv(id), &found);
+        }
+        else {
+            old = crown_replace(table,
+                                crown_stash_test_hv(id),
+                                crown_stash_test_value(id, 1),
+                                &found);
+        }
+
+        if (!found || old != crown_stash_test_value(id, 0)) {
+            ret = false;
+        }
+    }
+
+    ret = ret && crown_stash_test_check(table, 0, 1)
+       && crown_len(table) == CROWN_STASH_TEST_KEYS / 2;
+
+    crown_delete(table);
+
+    return ret;
+}
+
+typedef struct {
+    crown_t      *table;
+    uint64_t      tid;
+    _Atomic bool *failed;
+} crown_stash_test_arg_t;
+
+/* Each thread puts its own keys, replaces the even ones and removes
+ * the odd ones, checking along the way.  All four threads' keys share
+ * the same home, so they're all fighting over the same neighborhood
+ * and stash, and migrating out from under each other.
+ */
+static void *
+crown_stash_test_thread(void *arg)
+{
+    crown_stash_test_arg_t *my;
+    uint64_t                start;
+    uint64_t                id;
+    void                   *old;
+    bool                    found;
+
+    my    = (crown_stash_test_arg_t *)arg;
+    start = my->tid * CROWN_STASH_TEST_KEYS;
+
+    for (id = start; id < start + CROWN_STASH_TEST_KEYS; id++) {
+        crown_put(my->table,
+                  crown_stash_test_hv(id),
+                  crown_stash_test_value(id, 0),
+                  &found);
+
+        if (found) {
+            goto fail;
+        }
+    }
+
+    if (!crown_stash_test_check(my->table, start, 0)) {
+        goto fail;
+    }
+
+    for (id = start; id < start + CROWN_STASH_TEST_KEYS; id++) {
+        if (id & 1) {
+            old = crown_remove(my->table, crown_stash_test_hv(id), &found);
+        }
+        else {
+            old = crown_put(my->table,
+                            crown_stash_test_hv(id),
+                            crown_stash_test_value(id, 1),
+                            &found);
+        }
+
+        if (!found || old != crown_stash_test_value(id, 0)) {
+            goto fail;
+        }
+    }
+
+    if (!crown_stash_test_check(my->table, start, 1)) {
+        goto fail;
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+
+fail:
+    atomic_store(my->failed, true);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+crown_stash_test_concurrent(void)
+{
+    crown_t                *table;
+    crown_stash_test_arg_t  args[CROWN_STASH_TEST_THREADS];
+    pthread_t               threads[CROWN_STASH_TEST_THREADS];
+    _Atomic bool            failed;
+    uint64_t                i;
+
+    table  = crown_new();
+    failed = false;
+
+    crown_set_bounded_probes(table, true);
+
+    for (i = 0; i < CROWN_STASH_TEST_THREADS; i++) {
+        args[i].table  = table;
+        args[i].tid    = i;
+        args[i].failed = &failed;
+
+        pthread_create(&threads[i], NULL, crown_stash_test_thread, &args[i]);
+    }
+
+    for (i = 0; i < CROWN_STASH_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < CROWN_STASH_TEST_THREADS; i++) {
+        if (!crown_stash_test_check(table, i * CROWN_STASH_TEST_KEYS, 1)) {
+            failed = true;
+        }
+    }
+
+    if (crown_len(table) != CROWN_STASH_TEST_THREADS
+                                * CROWN_STASH_TEST_KEYS / 2) {
+        failed = true;
+    }
+
+    crown_delete(table);
+
+    return !failed;
+}
+
+/* The same thing through the exclusive-access operations, whose
+ * migration places items with the same code as the concurrent one,
+ * but marks nothing.  Afterward, the regular operations need to be
+ * able to find everything.
+ */
+static bool
+crown_stash_test_excl(void)
+{
+    crown_t  *table;
+    uint64_t  id;
+    void     *old;
+    bool      found;
+    bool      ret;
+
+    table = crown_new();
+    ret   = true;
+
+    crown_set_bounded_probes(table, true);
+
+    for (id = 0; id < CROWN_STASH_TEST_KEYS; id++) {
+        if (!crown_excl_add(table,
+                            crown_stash_test_hv(id),
+                            crown_stash_test_value(id, 0))) {
+            ret = false;
+        }
+    }
+
+    if (!crown_stash_test_churn(table, true)) {
+        ret = false;
+    }
+
+    for (id = 0; id < CROWN_STASH_TEST_KEYS; id++) {
+        if (crown_excl_add(table, crown_stash_test_hv(id), NULL)
+            || crown_excl_get(table, crown_stash_test_hv(id), &found)
+                   != crown_stash_test_value(id, 0)
+            || !found) {
+            ret = false;
+        }
+
+        if (id & 1) {
+            old = crown_excl_remove(table, crown_stash_test_hv(id), &found);
+        }
+        else {
+            old = crown_excl_replace(table,
+                                     crown_stash_test_hv(id),
+                                     crown_stash_test_value(id, 1),
+                                     &found);
+        }
+
+        if (!found || old != crown_stash_test_value(id, 0)) {
+            ret = false;
+        }
+    }
+
+    // Put the removed ones back, which has to go through the stash.
+    for (id = 1; id < CROWN_STASH_TEST_KEYS; id += 2) {
+        crown_excl_put(table,
+                       crown_stash_test_hv(id),
+                       crown_stash_test_value(id, 1),
+                       &found);
+
+        if (found) {
+            ret = false;
+        }
+    }
+
+    for (id = 0; id < CROWN_STASH_TEST_KEYS; id++) {
+        if (crown_get(table, crown_stash_test_hv(id), &found)
+                != crown_stash_test_value(id, 1)
+            || !found) {
+            ret = false;
+        }
+    }
+
+    if (crown_len(table) != CROWN_STASH_TEST_KEYS) {
+        ret = false;
+    }
+
+    crown_delete(table);
+
+    return ret;
+}
+
+bool
+test_crown_stash(void)
+{
+    return crown_stash_test_overflow() && crown_stash_test_concurrent()
+        && crown_stash_test_excl();
+}
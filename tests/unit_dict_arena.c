@@ -0,0 +1,147 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_dict_arena.c
+ *
+ *  Description:    Tests hatrack_dict's arena mode: several threads
+ *                  put, replace and remove items, through several
+ *                  migrations, and when the dictionary gets torn
+ *                  down, every item that was ever in it should have
+ *                  gone through the free handler exactly once.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+
+#include <pthread.h>
+
+#define DICT_ARENA_TEST_THREADS 4
+#define DICT_ARENA_TEST_KEYS    20000
+
+/* Each thread owns DICT_ARENA_TEST_KEYS keys.  It puts every one of
+ * them, replaces every one of them, and then removes the odd ones.
+ * Values are key * 2 + generation (0 for the first put, 1 for the
+ * replacement), and frees[] counts how many times the free handler
+ * saw each value.
+ */
+#define DICT_ARENA_TEST_TOTAL (DICT_ARENA_TEST_THREADS * DICT_ARENA_TEST_KEYS)
+
+static _Atomic uint32_t dict_arena_test_frees[DICT_ARENA_TEST_TOTAL * 2];
+
+typedef struct {
+    hatrack_dict_t *dict;
+    uint64_t        tid;
+    _Atomic bool   *failed;
+} dict_arena_test_arg_t;
+
+static void
+dict_arena_test_free(void *dict, void *arg)
+{
+    hatrack_dict_item_t *item;
+    uint64_t             value;
+
+    (void)dict;
+
+    item  = (hatrack_dict_item_t *)arg;
+    value = (uint64_t)item->value;
+
+    if (value < DICT_ARENA_TEST_TOTAL * 2) {
+        atomic_fetch_add(&dict_arena_test_frees[value], 1);
+    }
+
+    return;
+}
+
+static void *
+dict_arena_test_thread(void *arg)
+{
+    dict_arena_test_arg_t *my;
+    uint64_t               start;
+    uint64_t               key;
+    void                  *value;
+    bool                   found;
+
+    my    = (dict_arena_test_arg_t *)arg;
+    start = my->tid * DICT_ARENA_TEST_KEYS;
+
+    for (key = start; key < start + DICT_ARENA_TEST_KEYS; key++) {
+        hatrack_dict_put(my->dict, (void *)key, (void *)(key * 2));
+    }
+
+    for (key = start; key < start + DICT_ARENA_TEST_KEYS; key++) {
+        if (!hatrack_dict_replace(my->dict, (void *)key, (void *)(key * 2 + 1))) {
+            atomic_store(my->failed, true);
+        }
+    }
+
+    for (key = start + 1; key < start + DICT_ARENA_TEST_KEYS; key += 2) {
+        if (!hatrack_dict_remove(my->dict, (void *)key)) {
+            atomic_store(my->failed, true);
+        }
+    }
+
+    for (key = start; key < start + DICT_ARENA_TEST_KEYS; key++) {
+        value = hatrack_dict_get(my->dict, (void *)key, &found);
+
+        if (found != !(key & 1) || (found && value != (void *)(key * 2 + 1))) {
+            atomic_store(my->failed, true);
+            break;
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+bool
+test_dict_arena(void)
+{
+    hatrack_dict_t        *dict;
+    dict_arena_test_arg_t  args[DICT_ARENA_TEST_THREADS];
+    pthread_t              threads[DICT_ARENA_TEST_THREADS];
+    _Atomic bool           failed;
+    uint64_t               i;
+
+    failed = false;
+    dict   = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    hatrack_dict_set_free_handler(dict, dict_arena_test_free);
+    hatrack_dict_set_arena(dict, true);
+
+    if (!hatrack_dict_get_arena(dict)) {
+        failed = true;
+    }
+
+    for (i = 0; i < DICT_ARENA_TEST_TOTAL * 2; i++) {
+        atomic_store(&dict_arena_test_frees[i], 0);
+    }
+
+    for (i = 0; i < DICT_ARENA_TEST_THREADS; i++) {
+        args[i].dict   = dict;
+        args[i].tid    = i;
+        args[i].failed = &failed;
+
+        pthread_create(&threads[i], NULL, dict_arena_test_thread, &args[i]);
+    }
+
+    for (i = 0; i < DICT_ARENA_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The remaining items get freed by the delete, the rest before it.
+    hatrack_dict_delete(dict);
+
+    for (i = 0; i < DICT_ARENA_TEST_TOTAL * 2; i++) {
+        if (atomic_load(&dict_arena_test_frees[i]) != 1) {
+            failed = true;
+            break;
+        }
+    }
+
+    return !failed;
+}
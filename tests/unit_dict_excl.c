@@ -0,0 +1,220 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_dict_excl.c
+ *
+ *  Description:    Tests hatrack_dict's exclusive phase: a single
+ *                  thread fills the dictionary through several
+ *                  migrations, and then, once the phase is over,
+ *                  several threads check that they see all of it,
+ *                  and that the regular, concurrent path still works.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+
+#include <pthread.h>
+
+#define DICT_EXCL_TEST_THREADS 4
+#define DICT_EXCL_TEST_KEYS    50000
+#define DICT_EXCL_TEST_NEW     10000
+
+/* Keys start at 1.  In the exclusive phase, every key gets put twice
+ * (so the second put replaces), and every fifth key gets removed.
+ * Afterward, each thread adds DICT_EXCL_TEST_NEW keys of its own,
+ * above DICT_EXCL_TEST_KEYS.
+ */
+typedef struct {
+    hatrack_dict_t *dict;
+    _Atomic bool    failed;
+} dict_excl_test_t;
+
+typedef struct {
+    dict_excl_test_t *info;
+    uint64_t          tid;
+} dict_excl_test_arg_t;
+
+static inline bool
+dict_excl_test_removed(uint64_t key)
+{
+    return !(key % 5);
+}
+
+static inline void *
+dict_excl_test_value(uint64_t key)
+{
+    return (void *)(key * 3);
+}
+
+static bool
+dict_excl_test_check_old(hatrack_dict_t *dict)
+{
+    uint64_t key;
+    void    *value;
+    bool     found;
+
+    for (key = 1; key <= DICT_EXCL_TEST_KEYS; key++) {
+        value = hatrack_dict_get(dict, (void *)key, &found);
+
+        if (found == dict_excl_test_removed(key)) {
+            return false;
+        }
+
+        if (found && value != dict_excl_test_value(key)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+dict_excl_test_check_new(hatrack_dict_t *dict, uint64_t tid)
+{
+    uint64_t key;
+    uint64_t i;
+    void    *value;
+    bool     found;
+
+    for (i = 0; i < DICT_EXCL_TEST_NEW; i++) {
+        key   = DICT_EXCL_TEST_KEYS + 1 + tid * DICT_EXCL_TEST_NEW + i;
+        value = hatrack_dict_get(dict, (void *)key, &found);
+
+        if (!found || value != dict_excl_test_value(key)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void *
+dict_excl_test_thread(void *arg)
+{
+    dict_excl_test_arg_t *my;
+    hatrack_dict_t       *dict;
+    uint64_t              key;
+    uint64_t              i;
+
+    my   = (dict_excl_test_arg_t *)arg;
+    dict = my->info->dict;
+
+    if (!dict_excl_test_check_old(dict)) {
+        atomic_store(&my->info->failed, true);
+        goto done;
+    }
+
+    for (i = 0; i < DICT_EXCL_TEST_NEW; i++) {
+        key = DICT_EXCL_TEST_KEYS + 1 + my->tid * DICT_EXCL_TEST_NEW + i;
+
+        if (!hatrack_dict_put(dict, (void *)key, dict_excl_test_value(key))) {
+            atomic_store(&my->info->failed, true);
+            goto done;
+        }
+    }
+
+    // Other threads are still adding, so this migrates under us.
+    if (!dict_excl_test_check_old(dict)
+        || !dict_excl_test_check_new(dict, my->tid)) {
+        atomic_store(&my->info->failed, true);
+    }
+
+done:
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+bool
+test_dict_excl(void)
+{
+    dict_excl_test_t     info;
+    dict_excl_test_arg_t args[DICT_EXCL_TEST_THREADS];
+    pthread_t            threads[DICT_EXCL_TEST_THREADS];
+    crown_store_t       *first_store;
+    uint64_t             key;
+    uint64_t             i;
+
+    info.dict   = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+    info.failed = false;
+    first_store = atomic_load(&info.dict->crown_instance.store_current);
+
+    hatrack_dict_begin_exclusive(info.dict);
+
+    if (!hatrack_dict_get_exclusive(info.dict)) {
+        info.failed = true;
+    }
+
+    for (key = 1; key <= DICT_EXCL_TEST_KEYS; key++) {
+        hatrack_dict_put(info.dict, (void *)key, (void *)(key + 1));
+    }
+
+    for (key = 1; key <= DICT_EXCL_TEST_KEYS; key++) {
+        if (!hatrack_dict_replace(info.dict,
+                                  (void *)key,
+                                  dict_excl_test_value(key))) {
+            info.failed = true;
+        }
+
+        if (hatrack_dict_add(info.dict, (void *)key, NULL)) {
+            info.failed = true;
+        }
+    }
+
+    for (key = 5; key <= DICT_EXCL_TEST_KEYS; key += 5) {
+        if (!hatrack_dict_remove(info.dict, (void *)key)) {
+            info.failed = true;
+        }
+    }
+
+    // Make sure the phase actually had to grow the table.
+    if (atomic_load(&info.dict->crown_instance.store_current)
+        == first_store) {
+        info.failed = true;
+    }
+
+    if (!dict_excl_test_check_old(info.dict)) {
+        info.failed = true;
+    }
+
+    hatrack_dict_end_exclusive(info.dict);
+
+    if (hatrack_dict_get_exclusive(info.dict)) {
+        info.failed = true;
+    }
+
+    for (i = 0; i < DICT_EXCL_TEST_THREADS; i++) {
+        args[i].info = &info;
+        args[i].tid  = i;
+
+        pthread_create(&threads[i], NULL, dict_excl_test_thread, &args[i]);
+    }
+
+    for (i = 0; i < DICT_EXCL_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (!dict_excl_test_check_old(info.dict)) {
+        info.failed = true;
+    }
+
+    for (i = 0; i < DICT_EXCL_TEST_THREADS; i++) {
+        if (!dict_excl_test_check_new(info.dict, i)) {
+            info.failed = true;
+        }
+    }
+
+    if (crown_len(&info.dict->crown_instance)
+        != DICT_EXCL_TEST_KEYS - DICT_EXCL_TEST_KEYS / 5
+               + DICT_EXCL_TEST_THREADS * DICT_EXCL_TEST_NEW) {
+        info.failed = true;
+    }
+
+    hatrack_dict_delete(info.dict);
+
+    return !info.failed;
+}
@@ -0,0 +1,195 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_dict_freeze.c
+ *
+ *  Description:    Compares frozen dictionaries against the
+ *                  dictionaries they were frozen from, including one
+ *                  whose keys all land in the same two buckets, so
+ *                  that the build runs out of kicks and has to start
+ *                  over with more buckets.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+#include <hatrack/hash.h>
+
+#include <stdlib.h>
+
+#define DICT_FREEZE_TEST_KEYS      100000
+#define DICT_FREEZE_TEST_CLUSTERED 20
+
+static int
+dict_freeze_test_cmp(const void *a, const void *b)
+{
+    uint64_t ka;
+    uint64_t kb;
+
+    ka = (uint64_t)((hatrack_dict_item_t *)a)->key;
+    kb = (uint64_t)((hatrack_dict_item_t *)b)->key;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/* Checks every key from 1 through max_key against the dictionary,
+ * and then that frozen_items() returns exactly what the dictionary
+ * holds.  The dictionary's values are always the key plus one.
+ */
+static bool
+dict_freeze_test_matches(hatrack_dict_t        *dict,
+                         hatrack_dict_frozen_t *frozen,
+                         uint64_t               max_key)
+{
+    hatrack_dict_item_t *items;
+    uint64_t             num;
+    uint64_t             expected;
+    uint64_t             key;
+    uint64_t             i;
+    void                *value;
+    bool                 found;
+    bool                 frozen_found;
+    bool                 ret;
+
+    expected = 0;
+
+    for (key = 1; key <= max_key; key++) {
+        hatrack_dict_get(dict, (void *)key, &found);
+        value = hatrack_dict_frozen_get(frozen, (void *)key, &frozen_found);
+
+        if (found != frozen_found) {
+            return false;
+        }
+
+        if (found) {
+            if (value != (void *)(key + 1)) {
+                return false;
+            }
+            expected++;
+        }
+    }
+
+    if (hatrack_dict_frozen_len(frozen) != expected) {
+        return false;
+    }
+
+    items = hatrack_dict_frozen_items(frozen, &num);
+    ret   = num == expected;
+
+    qsort(items, num, sizeof(hatrack_dict_item_t), dict_freeze_test_cmp);
+
+    for (i = 0; ret && i < num; i++) {
+        key   = (uint64_t)items[i].key;
+        value = hatrack_dict_get(dict, (void *)key, &found);
+
+        if (!found || value != items[i].value
+            || (i && key == (uint64_t)items[i - 1].key)) {
+            ret = false;
+        }
+    }
+
+    hatrack_free(items, sizeof(hatrack_dict_item_t) * expected);
+
+    return ret;
+}
+
+static bool
+dict_freeze_test_basic(void)
+{
+    hatrack_dict_t        *dict;
+    hatrack_dict_frozen_t *frozen;
+    uint64_t               key;
+    bool                   ret;
+
+    dict = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    for (key = 1; key <= DICT_FREEZE_TEST_KEYS; key++) {
+        hatrack_dict_put(dict, (void *)key, (void *)(key + 1));
+    }
+
+    // Leave some holes, so that some lookups should miss.
+    for (key = 7; key <= DICT_FREEZE_TEST_KEYS; key += 7) {
+        hatrack_dict_remove(dict, (void *)key);
+    }
+
+    frozen = hatrack_dict_freeze(dict);
+
+    // Changes after the freeze shouldn't show up.
+    hatrack_dict_put(dict, (void *)(DICT_FREEZE_TEST_KEYS + 1), NULL);
+    hatrack_dict_remove(dict, (void *)(DICT_FREEZE_TEST_KEYS + 1));
+
+    ret = dict_freeze_test_matches(dict, frozen, DICT_FREEZE_TEST_KEYS + 1);
+
+    hatrack_dict_frozen_delete(frozen);
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+/* Both halves of every key's hash value fall within 1/256th of each
+ * other, at the very bottom of the range, so until the table has
+ * dozens of buckets, every key maps to bucket 0 both ways.  Twenty
+ * keys can't fit in one bucket's four slots, so each attempt ends
+ * when an insert runs out of kicks.
+ */
+static hatrack_hash_t
+dict_freeze_test_clustered_hash(void *key)
+{
+    hatrack_hash_t hv;
+    uint64_t       w1;
+    uint64_t       w2;
+
+    w1 = (uint64_t)key << 56;
+    w2 = ((uint64_t)key << 56) | (1ULL << 55);
+
+#ifdef HAVE___INT128_T
+    hv = ((hatrack_hash_t)w2 << 64) | w1;
+#else
+    hv.w1 = w1;
+    hv.w2 = w2;
+#endif
+
+    return hv;
+}
+
+static bool
+dict_freeze_test_rebuild(void)
+{
+    hatrack_dict_t        *dict;
+    hatrack_dict_frozen_t *frozen;
+    uint64_t               key;
+    uint64_t               first_size;
+    bool                   ret;
+
+    dict = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_OBJ_CUSTOM);
+
+    hatrack_dict_set_custom_hash(dict, dict_freeze_test_clustered_hash);
+
+    for (key = 1; key <= DICT_FREEZE_TEST_CLUSTERED; key++) {
+        hatrack_dict_put(dict, (void *)key, (void *)(key + 1));
+    }
+
+    frozen = hatrack_dict_freeze(dict);
+
+    // The size hatrack_dict_freeze() starts out with.
+    first_size = (DICT_FREEZE_TEST_CLUSTERED * 10
+                  + HATRACK_DICT_FROZEN_SLOTS * 9 - 1)
+               / (HATRACK_DICT_FROZEN_SLOTS * 9);
+
+    ret = frozen->num_buckets > first_size
+       && dict_freeze_test_matches(dict, frozen, DICT_FREEZE_TEST_CLUSTERED);
+
+    hatrack_dict_frozen_delete(frozen);
+    hatrack_dict_delete(dict);
+
+    return ret;
+}
+
+bool
+test_dict_freeze(void)
+{
+    return dict_freeze_test_basic() && dict_freeze_test_rebuild();
+}
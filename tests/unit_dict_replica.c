@@ -0,0 +1,245 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_dict_replica.c
+ *
+ *  Description:    Writes to a replicated dictionary while readers
+ *                  pinned to different nodes read from their own
+ *                  replicas.  We force several replicas, so that this
+ *                  means something on single-node machines.  The
+ *                  writes include removes and overwrites, and enough
+ *                  inserts that every replica migrates more than
+ *                  once.  Readers must never see a value go
+ *                  backwards, and once the writer's done, every
+ *                  replica has to hold exactly what the reference
+ *                  does.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+#include <hatrack/hash.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define DICT_REPLICA_TEST_NODES   4
+#define DICT_REPLICA_TEST_KEYS    20000
+#define DICT_REPLICA_TEST_MAX_KEY (2 * DICT_REPLICA_TEST_KEYS)
+
+/* Values are the key plus a version times DICT_REPLICA_TEST_SPACE.
+ * The writer only ever raises a key's version, so a reader that sees
+ * a lower version than it did before has read something stale.
+ */
+#define DICT_REPLICA_TEST_SPACE   (DICT_REPLICA_TEST_MAX_KEY + 1)
+
+typedef struct {
+    hatrack_dict_t *dict;
+    uint64_t        node;
+    _Atomic bool   *done;
+    _Atomic bool   *failed;
+} dict_replica_test_arg_t;
+
+static inline void *
+dict_replica_test_value(uint64_t key, uint64_t version)
+{
+    return (void *)(key + version * DICT_REPLICA_TEST_SPACE);
+}
+
+static void *
+dict_replica_test_reader(void *arg)
+{
+    dict_replica_test_arg_t *my;
+    uint64_t                *last_version;
+    uint64_t                 key;
+    uint64_t                 value;
+    uint64_t                 version;
+    bool                     found;
+
+    my           = (dict_replica_test_arg_t *)arg;
+    last_version = (uint64_t *)calloc(DICT_REPLICA_TEST_MAX_KEY + 1,
+                                      sizeof(uint64_t));
+
+    // Pin ourselves to our node, so we always read from its replica.
+    hatrack_numa_node     = my->node;
+    hatrack_numa_node_ttl = UINT64_MAX;
+
+    while (!atomic_load(my->done)) {
+        for (key = 1; key <= DICT_REPLICA_TEST_MAX_KEY; key++) {
+            value = (uint64_t)hatrack_dict_get(my->dict, (void *)key, &found);
+
+            if (!found) {
+                continue;
+            }
+
+            version = value / DICT_REPLICA_TEST_SPACE;
+
+            if (value % DICT_REPLICA_TEST_SPACE != key
+                || version < last_version[key]) {
+                atomic_store(my->failed, true);
+            }
+
+            last_version[key] = version;
+        }
+    }
+
+    free(last_version);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Puts the whole first batch of keys (growing every replica from its
+ * initial size), removes every third one, and bumps the version of
+ * every fifth one, which brings back the ones that were removed.
+ * Then it adds a second batch of keys, for another round of
+ * migrations.  ref[] gets
+ * the value every key should end up with, or 0 if it's not there.
+ */
+static void
+dict_replica_test_write(hatrack_dict_t *dict, uint64_t *ref)
+{
+    uint64_t key;
+
+    for (key = 1; key <= DICT_REPLICA_TEST_KEYS; key++) {
+        ref[key] = (uint64_t)dict_replica_test_value(key, 1);
+        hatrack_dict_put(dict, (void *)key, (void *)ref[key]);
+    }
+
+    for (key = 3; key <= DICT_REPLICA_TEST_KEYS; key += 3) {
+        ref[key] = 0;
+        hatrack_dict_remove(dict, (void *)key);
+    }
+
+    for (key = 5; key <= DICT_REPLICA_TEST_KEYS; key += 5) {
+        ref[key] = (uint64_t)dict_replica_test_value(key, 2);
+        hatrack_dict_put(dict, (void *)key, (void *)ref[key]);
+    }
+
+    for (key = DICT_REPLICA_TEST_KEYS + 1; key <= DICT_REPLICA_TEST_MAX_KEY;
+         key++) {
+        ref[key] = (uint64_t)dict_replica_test_value(key, 1);
+        hatrack_dict_add(dict, (void *)key, (void *)ref[key]);
+    }
+
+    return;
+}
+
+// Checks each replica directly, and then through the dict's own get.
+static bool
+dict_replica_test_matches(hatrack_dict_t *dict, uint64_t *ref)
+{
+    hatrack_dict_item_t *item;
+    uint64_t             expected_len;
+    uint64_t             value;
+    uint64_t             key;
+    uint64_t             i;
+    bool                 found;
+    bool                 ret;
+
+    expected_len = 0;
+
+    for (key = 1; key <= DICT_REPLICA_TEST_MAX_KEY; key++) {
+        if (ref[key]) {
+            expected_len++;
+        }
+    }
+
+    ret = true;
+
+    for (i = 0; i < dict->num_replicas; i++) {
+        if (crown_len(dict->replicas[i]) != expected_len) {
+            ret = false;
+        }
+
+        hatrack_numa_node     = i;
+        hatrack_numa_node_ttl = UINT64_MAX;
+
+        for (key = 1; key <= DICT_REPLICA_TEST_MAX_KEY; key++) {
+            item = crown_get(dict->replicas[i], hash_int(key), &found);
+
+            if (found != (ref[key] != 0)
+                || (found && (uint64_t)item->value != ref[key])) {
+                ret = false;
+            }
+
+            value = (uint64_t)hatrack_dict_get(dict, (void *)key, &found);
+
+            if (found != (ref[key] != 0) || (found && value != ref[key])) {
+                ret = false;
+            }
+        }
+    }
+
+    hatrack_numa_node     = 0;
+    hatrack_numa_node_ttl = 0;
+
+    return ret;
+}
+
+bool
+test_dict_replica(void)
+{
+    hatrack_dict_t          *dict;
+    dict_replica_test_arg_t  args[DICT_REPLICA_TEST_NODES];
+    pthread_t                threads[DICT_REPLICA_TEST_NODES];
+    uint64_t                 first_slots[DICT_REPLICA_TEST_NODES];
+    uint64_t                *ref;
+    uint64_t                 i;
+    _Atomic bool             done;
+    _Atomic bool             failed;
+    bool                     ret;
+
+    hatrack_numa_forced_nodes = DICT_REPLICA_TEST_NODES;
+    dict                      = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    hatrack_dict_set_replicated(dict, true);
+    hatrack_numa_forced_nodes = 0;
+
+    if (dict->num_replicas != DICT_REPLICA_TEST_NODES) {
+        hatrack_dict_delete(dict);
+        return false;
+    }
+
+    ref    = (uint64_t *)calloc(DICT_REPLICA_TEST_MAX_KEY + 1,
+                                sizeof(uint64_t));
+    done   = false;
+    failed = false;
+
+    for (i = 0; i < DICT_REPLICA_TEST_NODES; i++) {
+        first_slots[i] = atomic_load(&dict->replicas[i]->store_current)
+                             ->last_slot;
+        args[i].dict   = dict;
+        args[i].node   = i;
+        args[i].done   = &done;
+        args[i].failed = &failed;
+
+        pthread_create(&threads[i], NULL, dict_replica_test_reader, &args[i]);
+    }
+
+    dict_replica_test_write(dict, ref);
+
+    atomic_store(&done, true);
+
+    for (i = 0; i < DICT_REPLICA_TEST_NODES; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ret = !failed && dict_replica_test_matches(dict, ref);
+
+    // Make sure every replica actually grew.
+    for (i = 0; i < DICT_REPLICA_TEST_NODES; i++) {
+        if (atomic_load(&dict->replicas[i]->store_current)->last_slot
+            <= first_slots[i]) {
+            ret = false;
+        }
+    }
+
+    hatrack_dict_delete(dict);
+    free(ref);
+
+    return ret;
+}
@@ -0,0 +1,390 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_dict_txn.c
+ *
+ *  Description:    Runs multi-key transactions across two
+ *                  transactional dictionaries.  The keys come in
+ *                  small groups, split between the two dicts, and
+ *                  every transaction writes either one group or two
+ *                  neighboring ones, so concurrent transactions
+ *                  overlap both completely and partially.  Meanwhile,
+ *                  another thread puts enough other keys to migrate
+ *                  both dictionaries, while transactions are in
+ *                  flight.
+ *
+ *                  Readers check that they never see part of a
+ *                  transaction, and at the end, every group has to
+ *                  hold exactly what the last transaction to win it
+ *                  wrote, and nothing the filler wrote can be
+ *                  missing.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+
+#include <pthread.h>
+
+#define DICT_TXN_TEST_WRITERS    4
+#define DICT_TXN_TEST_READERS    2
+#define DICT_TXN_TEST_GROUPS     8
+#define DICT_TXN_TEST_GROUP_SIZE 4
+#define DICT_TXN_TEST_MIN_TXNS   20000
+#define DICT_TXN_TEST_FILL_KEYS  100000
+#define DICT_TXN_TEST_FILL_BASE  1000
+
+/* Every transaction writes one value to each key in its groups,
+ * which is unique to the transaction:
+ *
+ *   bits 0-5:   the first group it writes.
+ *   bit 6:      set if it also writes the next group.
+ *   bits 8-15:  the writer's id (DICT_TXN_TEST_WRITERS for the
+ *               transaction that sets everything up).
+ *   bits 16-63: the writer's sequence number, plus one.
+ *
+ * The first key in each group always gets the value; each of the
+ * others gets it if the matching bit of the sequence number is set,
+ * and is removed if not.
+ */
+#define DICT_TXN_TEST_SPAN_BIT   (1 << 6)
+
+typedef struct {
+    hatrack_dict_t   *dicts[2];
+    uint64_t          last[DICT_TXN_TEST_WRITERS + 1][DICT_TXN_TEST_GROUPS];
+    _Atomic uint64_t  writers_left;
+    _Atomic bool      filling;
+    _Atomic bool      failed;
+} dict_txn_test_t;
+
+typedef struct {
+    dict_txn_test_t *info;
+    uint64_t         tid;
+} dict_txn_test_arg_t;
+
+static inline uint64_t
+dict_txn_test_value(uint64_t group, bool span, uint64_t tid, uint64_t seq)
+{
+    return group | (span ? DICT_TXN_TEST_SPAN_BIT : 0) | (tid << 8)
+         | ((seq + 1) << 16);
+}
+
+static inline bool
+dict_txn_test_present(uint64_t value, uint64_t pos)
+{
+    return !pos || ((value >> (15 + pos)) & 1);
+}
+
+static inline uint64_t
+dict_txn_test_tid(uint64_t value)
+{
+    return (value >> 8) & 0xff;
+}
+
+// Even positions live in the first dict, odd ones in the second.
+static inline hatrack_dict_t *
+dict_txn_test_dict(dict_txn_test_t *info, uint64_t pos)
+{
+    return info->dicts[pos & 1];
+}
+
+static inline void *
+dict_txn_test_key(uint64_t group, uint64_t pos)
+{
+    return (void *)(group * DICT_TXN_TEST_GROUP_SIZE + pos + 1);
+}
+
+// Checks that a value could legitimately be sitting in a group.
+static bool
+dict_txn_test_value_ok(uint64_t value, uint64_t group)
+{
+    uint64_t first;
+
+    first = value & (DICT_TXN_TEST_SPAN_BIT - 1);
+
+    if (dict_txn_test_tid(value) > DICT_TXN_TEST_WRITERS || !(value >> 16)) {
+        return false;
+    }
+
+    if (first == group) {
+        return true;
+    }
+
+    return (value & DICT_TXN_TEST_SPAN_BIT)
+        && (first + 1) % DICT_TXN_TEST_GROUPS == group;
+}
+
+static uint64_t
+dict_txn_test_fill_ops(dict_txn_test_t       *info,
+                       hatrack_dict_txn_op_t *ops,
+                       uint64_t               group,
+                       uint64_t               value)
+{
+    uint64_t i;
+
+    for (i = 0; i < DICT_TXN_TEST_GROUP_SIZE; i++) {
+        ops[i].dict   = dict_txn_test_dict(info, i);
+        ops[i].key    = dict_txn_test_key(group, i);
+        ops[i].value  = (void *)value;
+        ops[i].remove = !dict_txn_test_present(value, i);
+    }
+
+    return DICT_TXN_TEST_GROUP_SIZE;
+}
+
+static void
+dict_txn_test_apply(dict_txn_test_t *info,
+                    uint64_t         group,
+                    bool             span,
+                    uint64_t         tid,
+                    uint64_t         seq)
+{
+    hatrack_dict_txn_op_t ops[2 * DICT_TXN_TEST_GROUP_SIZE];
+    uint64_t              value;
+    uint64_t              n;
+    uint64_t              next;
+
+    value = dict_txn_test_value(group, span, tid, seq);
+    n     = dict_txn_test_fill_ops(info, ops, group, value);
+
+    info->last[tid][group] = value;
+
+    if (span) {
+        next  = (group + 1) % DICT_TXN_TEST_GROUPS;
+        n    += dict_txn_test_fill_ops(info, &ops[n], next, value);
+
+        info->last[tid][next] = value;
+    }
+
+    hatrack_dict_txn_apply(ops, n);
+
+    return;
+}
+
+/* Keeps going until the filler's done, so that plenty of
+ * transactions run while the dictionaries migrate.
+ */
+static void *
+dict_txn_test_writer(void *arg)
+{
+    dict_txn_test_arg_t *my;
+    uint64_t             seq;
+
+    my = (dict_txn_test_arg_t *)arg;
+
+    for (seq = 0;
+         seq < DICT_TXN_TEST_MIN_TXNS || atomic_load(&my->info->filling);
+         seq++) {
+        dict_txn_test_apply(my->info,
+                            test_rand() % DICT_TXN_TEST_GROUPS,
+                            test_rand() & 1,
+                            my->tid,
+                            seq);
+    }
+
+    atomic_fetch_sub(&my->info->writers_left, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Reads the first key in a group, then the rest of the group, and
+ * then the first key again.  Since every transaction on a group
+ * writes a new value to its first key, if we read the same value
+ * both times, nothing committed in between, and the rest of the
+ * group has to be exactly what that transaction wrote.
+ */
+static void *
+dict_txn_test_reader(void *arg)
+{
+    dict_txn_test_t *info;
+    uint64_t         group;
+    uint64_t         first;
+    uint64_t         again;
+    uint64_t         values[DICT_TXN_TEST_GROUP_SIZE];
+    bool             found[DICT_TXN_TEST_GROUP_SIZE];
+    uint64_t         i;
+
+    info = (dict_txn_test_t *)arg;
+
+    while (atomic_load(&info->writers_left)) {
+        group = test_rand() % DICT_TXN_TEST_GROUPS;
+
+        for (i = 0; i < DICT_TXN_TEST_GROUP_SIZE; i++) {
+            values[i] = (uint64_t)hatrack_dict_get(dict_txn_test_dict(info, i),
+                                                   dict_txn_test_key(group, i),
+                                                   &found[i]);
+        }
+
+        again = (uint64_t)hatrack_dict_get(dict_txn_test_dict(info, 0),
+                                           dict_txn_test_key(group, 0),
+                                           NULL);
+        first = values[0];
+
+        if (!found[0] || !dict_txn_test_value_ok(first, group)) {
+            atomic_store(&info->failed, true);
+            continue;
+        }
+
+        if (first != again) {
+            continue;
+        }
+
+        for (i = 1; i < DICT_TXN_TEST_GROUP_SIZE; i++) {
+            if (found[i] != dict_txn_test_present(first, i)
+                || (found[i] && values[i] != first)) {
+                atomic_store(&info->failed, true);
+            }
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Single-key puts on other keys, alternating between the dicts.
+static void *
+dict_txn_test_filler(void *arg)
+{
+    dict_txn_test_t *info;
+    uint64_t         key;
+    uint64_t         i;
+
+    info = (dict_txn_test_t *)arg;
+
+    for (i = 0; i < DICT_TXN_TEST_FILL_KEYS; i++) {
+        key = DICT_TXN_TEST_FILL_BASE + i;
+
+        hatrack_dict_put(info->dicts[i & 1], (void *)key, (void *)(key + 1));
+    }
+
+    atomic_store(&info->filling, false);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* With everything quiet, each group has to hold all of what the last
+ * transaction that wrote it put there, and that has to be the last
+ * transaction its writer applied to the group.  Since each writer's
+ * transactions happen in order, an earlier one showing up means a
+ * later one got lost.
+ */
+static bool
+dict_txn_test_matches(dict_txn_test_t *info)
+{
+    uint64_t group;
+    uint64_t value;
+    uint64_t expected[2];
+    uint64_t key;
+    uint64_t i;
+    bool     found;
+
+    expected[0] = DICT_TXN_TEST_FILL_KEYS / 2;
+    expected[1] = DICT_TXN_TEST_FILL_KEYS / 2;
+
+    for (group = 0; group < DICT_TXN_TEST_GROUPS; group++) {
+        value = (uint64_t)hatrack_dict_get(info->dicts[0],
+                                           dict_txn_test_key(group, 0),
+                                           &found);
+
+        if (!found || !dict_txn_test_value_ok(value, group)
+            || info->last[dict_txn_test_tid(value)][group] != value) {
+            return false;
+        }
+
+        for (i = 0; i < DICT_TXN_TEST_GROUP_SIZE; i++) {
+            if (dict_txn_test_present(value, i)) {
+                expected[i & 1]++;
+            }
+        }
+
+        for (i = 1; i < DICT_TXN_TEST_GROUP_SIZE; i++) {
+            if ((uint64_t)hatrack_dict_get(dict_txn_test_dict(info, i),
+                                           dict_txn_test_key(group, i),
+                                           &found)
+                    != (dict_txn_test_present(value, i) ? value : 0)
+                || found != dict_txn_test_present(value, i)) {
+                return false;
+            }
+        }
+    }
+
+    for (i = 0; i < DICT_TXN_TEST_FILL_KEYS; i++) {
+        key = DICT_TXN_TEST_FILL_BASE + i;
+
+        if (hatrack_dict_get(info->dicts[i & 1], (void *)key, NULL)
+            != (void *)(key + 1)) {
+            return false;
+        }
+    }
+
+    return crown_len(&info->dicts[0]->crown_instance) == expected[0]
+        && crown_len(&info->dicts[1]->crown_instance) == expected[1];
+}
+
+bool
+test_dict_txn(void)
+{
+    dict_txn_test_t     info;
+    dict_txn_test_arg_t args[DICT_TXN_TEST_WRITERS];
+    pthread_t           threads[DICT_TXN_TEST_WRITERS + DICT_TXN_TEST_READERS
+                                + 1];
+    uint64_t            first_slots[2];
+    uint64_t            group;
+    uint64_t            i;
+    uint64_t            n;
+    bool                ret;
+
+    info.writers_left = DICT_TXN_TEST_WRITERS;
+    info.filling      = true;
+    info.failed       = false;
+
+    for (i = 0; i < 2; i++) {
+        info.dicts[i]  = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+        hatrack_dict_set_transactional(info.dicts[i], true);
+        first_slots[i] = atomic_load(&info.dicts[i]->crown_instance.store_current)
+                             ->last_slot;
+    }
+
+    // Every group starts out written by the setup "writer".
+    for (group = 0; group < DICT_TXN_TEST_GROUPS; group++) {
+        dict_txn_test_apply(&info, group, false, DICT_TXN_TEST_WRITERS, 0);
+    }
+
+    n = 0;
+
+    for (i = 0; i < DICT_TXN_TEST_WRITERS; i++) {
+        args[i].info = &info;
+        args[i].tid  = i;
+
+        pthread_create(&threads[n++], NULL, dict_txn_test_writer, &args[i]);
+    }
+
+    for (i = 0; i < DICT_TXN_TEST_READERS; i++) {
+        pthread_create(&threads[n++], NULL, dict_txn_test_reader, &info);
+    }
+
+    pthread_create(&threads[n++], NULL, dict_txn_test_filler, &info);
+
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ret = !info.failed && dict_txn_test_matches(&info);
+
+    for (i = 0; i < 2; i++) {
+        if (atomic_load(&info.dicts[i]->crown_instance.store_current)->last_slot
+            <= first_slots[i]) {
+            ret = false;
+        }
+
+        hatrack_dict_delete(info.dicts[i]);
+    }
+
+    return ret;
+}
@@ -0,0 +1,464 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_flex64.c
+ *
+ *  Description:    Has several threads write to a flex64 while
+ *                  another one grows it, and then again while it gets
+ *                  shrunk.  Each index has a single writer, and every
+ *                  value records the index it was written to, so
+ *                  readers (and views taken along the way) can tell
+ *                  if anything landed in the wrong place.  Once
+ *                  things are quiet, every index still in the array
+ *                  has to hold the last value written to it, and
+ *                  anything past a shrink has to be gone once the
+ *                  array grows back.
+ *
+ *                  We also check views and flex64_add() against
+ *                  arrays with holes in them, and that flex64_set()
+ *                  aborts when an item has any of its low bits set.
+ *                  That last check runs in a child process.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/flex64.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FLEX64_TEST_WRITERS     4
+#define FLEX64_TEST_READERS     2
+#define FLEX64_TEST_START_SIZE  16
+#define FLEX64_TEST_MAX_SIZE    4096
+#define FLEX64_TEST_MIN_SIZE    1024
+#define FLEX64_TEST_GROW_STEP   97
+#define FLEX64_TEST_SHRINK_STEP 131
+
+typedef struct {
+    flex64_t     *arr;
+    uint64_t      last[FLEX64_TEST_MAX_SIZE];
+    _Atomic bool  resizing;
+    _Atomic bool  writing;
+    _Atomic bool  failed;
+} flex64_test_t;
+
+typedef struct {
+    flex64_test_t *info;
+    uint64_t       tid;
+} flex64_test_arg_t;
+
+/* Items are the index in the upper bits and the writer's pass number
+ * in the low 16 bits, shifted left by three bits, so that the low
+ * bits are free for flex64's state.
+ */
+static inline void *
+flex64_test_item(uint64_t ix, uint64_t pass)
+{
+    return (void *)(((ix << 16) | (pass & 0xffff)) << 3);
+}
+
+static inline uint64_t
+flex64_test_ix(void *item)
+{
+    return ((uint64_t)item) >> 19;
+}
+
+/* Keeps making passes over this thread's indices until a full pass
+ * after the resizing thread is done.
+ */
+static void *
+flex64_test_writer(void *arg)
+{
+    flex64_test_arg_t *my;
+    flex64_test_t     *info;
+    void              *item;
+    uint64_t           pass;
+    uint64_t           i;
+    bool               last_pass;
+
+    my   = (flex64_test_arg_t *)arg;
+    info = my->info;
+
+    for (pass = 0, last_pass = false; !last_pass; pass++) {
+        last_pass = !atomic_load(&info->resizing);
+
+        for (i = my->tid; i < FLEX64_TEST_MAX_SIZE; i += FLEX64_TEST_WRITERS) {
+            item = flex64_test_item(i, pass);
+
+            if (flex64_set(info->arr, i, item)) {
+                info->last[i] = (uint64_t)item;
+            }
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Items that are there at all have to be in the right place.
+static bool
+flex64_test_view_ok(flex64_view_t *view)
+{
+    void    *item;
+    uint64_t len;
+    uint64_t i;
+    int      status;
+
+    len = flex64_view_len(view);
+
+    for (i = 0; i < len; i++) {
+        item = flex64_view_get(view, i, &status);
+
+        if (status == FLEX_OK && flex64_test_ix(item) != i) {
+            return false;
+        }
+
+        if (status != FLEX_OK && (status != FLEX_UNINITIALIZED || item)) {
+            return false;
+        }
+    }
+
+    return flex64_view_get(view, len, &status) == NULL && status == FLEX_OOB;
+}
+
+static void *
+flex64_test_reader(void *arg)
+{
+    flex64_test_t *info;
+    flex64_view_t *view;
+    void          *item;
+    uint64_t       i;
+    uint64_t       n;
+    int            status;
+
+    info = (flex64_test_t *)arg;
+
+    for (n = 0; atomic_load(&info->writing); n++) {
+        i    = test_rand() % FLEX64_TEST_MAX_SIZE;
+        item = flex64_get(info->arr, i, &status);
+
+        if (status == FLEX_OK && flex64_test_ix(item) != i) {
+            atomic_store(&info->failed, true);
+        }
+
+        if (!(n % 1000)) {
+            view = flex64_view(info->arr);
+
+            if (!flex64_test_view_ok(view)) {
+                atomic_store(&info->failed, true);
+            }
+
+            flex64_view_delete(view);
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void
+flex64_test_resize(flex64_test_t *info, bool grow)
+{
+    uint64_t size;
+
+    if (grow) {
+        for (size = FLEX64_TEST_START_SIZE; size < FLEX64_TEST_MAX_SIZE;
+             size += FLEX64_TEST_GROW_STEP) {
+            flex64_grow(info->arr, size);
+        }
+
+        flex64_grow(info->arr, FLEX64_TEST_MAX_SIZE);
+    }
+    else {
+        for (size = FLEX64_TEST_MAX_SIZE; size > FLEX64_TEST_MIN_SIZE;
+             size -= FLEX64_TEST_SHRINK_STEP) {
+            flex64_shrink(info->arr, size);
+        }
+
+        flex64_shrink(info->arr, FLEX64_TEST_MIN_SIZE);
+    }
+
+    return;
+}
+
+// Runs the writers and readers while this thread resizes.
+static bool
+flex64_test_run(flex64_test_t *info, bool grow)
+{
+    flex64_test_arg_t args[FLEX64_TEST_WRITERS];
+    pthread_t         writers[FLEX64_TEST_WRITERS];
+    pthread_t         readers[FLEX64_TEST_READERS];
+    uint64_t          i;
+
+    info->resizing = true;
+    info->writing  = true;
+
+    for (i = 0; i < FLEX64_TEST_READERS; i++) {
+        pthread_create(&readers[i], NULL, flex64_test_reader, info);
+    }
+
+    for (i = 0; i < FLEX64_TEST_WRITERS; i++) {
+        args[i].info = info;
+        args[i].tid  = i;
+
+        pthread_create(&writers[i], NULL, flex64_test_writer, &args[i]);
+    }
+
+    flex64_test_resize(info, grow);
+
+    atomic_store(&info->resizing, false);
+
+    for (i = 0; i < FLEX64_TEST_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+
+    atomic_store(&info->writing, false);
+
+    for (i = 0; i < FLEX64_TEST_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    return !info->failed;
+}
+
+// Every index below len has to hold the last value written to it.
+static bool
+flex64_test_matches(flex64_test_t *info, uint64_t len)
+{
+    uint64_t i;
+    int      status;
+
+    if (flex64_len(info->arr) != len) {
+        return false;
+    }
+
+    for (i = 0; i < len; i++) {
+        if ((uint64_t)flex64_get(info->arr, i, &status) != info->last[i]
+            || status != FLEX_OK) {
+            return false;
+        }
+    }
+
+    return flex64_get(info->arr, len, &status) == NULL && status == FLEX_OOB;
+}
+
+static bool
+flex64_test_resizes(void)
+{
+    flex64_test_t info;
+    uint64_t      i;
+    int           status;
+    bool          ret;
+
+    info.arr    = flex64_new(FLEX64_TEST_START_SIZE);
+    info.failed = false;
+
+    ret = flex64_test_run(&info, true)
+       && flex64_test_matches(&info, FLEX64_TEST_MAX_SIZE)
+       && flex64_test_run(&info, false)
+       && flex64_test_matches(&info, FLEX64_TEST_MIN_SIZE);
+
+    // What got shrunk away has to stay gone when we grow back.
+    flex64_grow(info.arr, FLEX64_TEST_MAX_SIZE);
+
+    for (i = FLEX64_TEST_MIN_SIZE; ret && i < FLEX64_TEST_MAX_SIZE; i++) {
+        if (flex64_get(info.arr, i, &status) || status != FLEX_UNINITIALIZED) {
+            ret = false;
+        }
+    }
+
+    flex64_delete(info.arr);
+
+    return ret;
+}
+
+/* Sets every third cell of arr, starting at 0, to the item for its
+ * index plus offset.
+ */
+static void
+flex64_test_fill(flex64_t *arr, uint64_t len, uint64_t offset)
+{
+    uint64_t i;
+
+    for (i = 0; i < len; i += 3) {
+        flex64_set(arr, i, flex64_test_item(i + offset, 0));
+    }
+
+    return;
+}
+
+/* Checks cells [start, start + len) of a view, where what got filled
+ * from offset start ended up.
+ */
+static bool
+flex64_test_filled(flex64_view_t *view, uint64_t start, uint64_t len)
+{
+    void    *item;
+    uint64_t i;
+    int      status;
+
+    for (i = start; i < start + len; i++) {
+        item = flex64_view_get(view, i, &status);
+
+        if ((i - start) % 3) {
+            if (status != FLEX_UNINITIALIZED) {
+                return false;
+            }
+        }
+        else {
+            if (status != FLEX_OK || flex64_test_ix(item) != i) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// flex64_view_next() has to skip the holes, and then stop.
+static bool
+flex64_test_next(flex64_view_t *view, uint64_t a_len, uint64_t b_len)
+{
+    void    *item;
+    uint64_t start;
+    uint64_t i;
+    bool     found;
+
+    for (i = 0; i < a_len + b_len; i++) {
+        start = i < a_len ? 0 : a_len;
+
+        if ((i - start) % 3) {
+            continue;
+        }
+
+        item = flex64_view_next(view, &found);
+
+        if (!found || flex64_test_ix(item) != i) {
+            return false;
+        }
+    }
+
+    flex64_view_next(view, &found);
+
+    return !found;
+}
+
+static bool
+flex64_test_views(void)
+{
+    flex64_t      *a;
+    flex64_t      *b;
+    flex64_t      *sum;
+    flex64_view_t *view;
+    uint64_t       a_len;
+    uint64_t       b_len;
+    uint64_t       i;
+    int            status;
+    bool           ret;
+
+    a_len = 100;
+    b_len = 50;
+    a     = flex64_new(a_len);
+    b     = flex64_new(b_len);
+
+    flex64_test_fill(a, a_len, 0);
+    flex64_test_fill(b, b_len, a_len);
+
+    view = flex64_view(a);
+    ret  = flex64_view_len(view) == a_len && flex64_test_view_ok(view)
+       && flex64_test_filled(view, 0, a_len)
+       && flex64_test_next(view, a_len, 0);
+
+    flex64_view_delete(view);
+
+    sum  = flex64_add(a, b);
+    view = flex64_view(sum);
+    ret  = ret && flex64_len(sum) == a_len + b_len
+       && flex64_view_len(view) == a_len + b_len
+       && flex64_test_view_ok(view) && flex64_test_filled(view, 0, a_len)
+       && flex64_test_filled(view, a_len, b_len)
+       && flex64_test_next(view, a_len, b_len);
+
+    flex64_view_delete(view);
+
+    // The sum is a copy, so writing to it can't change either side.
+    flex64_set(sum, 1, flex64_test_item(1, 1));
+    flex64_set(sum, a_len + 1, flex64_test_item(a_len + 1, 1));
+
+    ret = ret && flex64_get(sum, 1, NULL) == flex64_test_item(1, 1)
+       && flex64_len(a) == a_len && flex64_len(b) == b_len;
+
+    for (i = 0; ret && i < a_len; i++) {
+        if (flex64_get(a, i, &status) != (i % 3 ? NULL : flex64_test_item(i, 0))
+            || status != (i % 3 ? FLEX_UNINITIALIZED : FLEX_OK)) {
+            ret = false;
+        }
+    }
+
+    for (i = 0; ret && i < b_len; i++) {
+        if (flex64_get(b, i, &status)
+                != (i % 3 ? NULL : flex64_test_item(i + a_len, 0))
+            || status != (i % 3 ? FLEX_UNINITIALIZED : FLEX_OK)) {
+            ret = false;
+        }
+    }
+
+    flex64_delete(a);
+    flex64_delete(b);
+    flex64_delete(sum);
+
+    return ret;
+}
+
+/* flex64_set() has to abort on any item with a low bit set.  We do
+ * each one in a child process, so the abort doesn't take us out.
+ */
+static bool
+flex64_test_aborts(void)
+{
+    flex64_t *arr;
+    pid_t     pid;
+    uint64_t  bit;
+    int       status;
+
+    arr = flex64_new(FLEX64_TEST_START_SIZE);
+
+    for (bit = 1; bit & FLEX64_STATE_MASK; bit <<= 1) {
+        pid = fork();
+
+        if (pid < 0) {
+            flex64_delete(arr);
+            return false;
+        }
+
+        if (!pid) {
+            flex64_set(arr, 0, (void *)(0x1000 | bit));
+            _exit(0);
+        }
+
+        if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status)
+            || WTERMSIG(status) != SIGABRT) {
+            flex64_delete(arr);
+            return false;
+        }
+    }
+
+    flex64_delete(arr);
+
+    return true;
+}
+
+bool
+test_flex64(void)
+{
+    return flex64_test_aborts() && flex64_test_views()
+        && flex64_test_resizes();
+}
@@ -0,0 +1,554 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_hash_scan.c
+ *
+ *  Description:    Checks hash range scans against a reference that
+ *                  just filters every item on hatrack_hash_position().
+ *
+ *                  First we scan a crown store directly, with bounded
+ *                  probes and a cluster of hash values that share a
+ *                  home bucket, so that some items live in the
+ *                  stash.  The ranges are random, or end right at (or
+ *                  right next to) an item's position, so the buckets
+ *                  at the ends of a range hold items on both sides
+ *                  of it.
+ *
+ *                  Then we do the same through the dictionary API,
+ *                  extract a dictionary shard by shard, and finally
+ *                  scan and extract while another thread migrates the
+ *                  table out from under us, once we're partway in.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+#include <hatrack/hash.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_SCAN_TEST_ITEMS       2000
+#define HASH_SCAN_TEST_CLUSTER     100
+#define HASH_SCAN_TEST_CLUSTER_LOW 0x5a5
+#define HASH_SCAN_TEST_RANGES      300
+#define HASH_SCAN_TEST_KEYS        20000
+#define HASH_SCAN_TEST_SHARD_BITS  3
+#define HASH_SCAN_TEST_MAX_KEY     (1 << 20)
+
+typedef struct {
+    uint64_t        num;
+    hatrack_hash_t *hvs;
+    uint64_t       *positions;
+    uint32_t       *seen;
+    bool            failed;
+} hash_scan_test_crown_t;
+
+/* The cluster's hash values all share their low 12 bits, and so
+ * their home bucket, until the table gets past 4096 buckets.
+ */
+static inline hatrack_hash_t
+hash_scan_test_cluster_hv(uint64_t id)
+{
+    hatrack_hash_t hv;
+    uint64_t       low;
+
+    low = (id << 12) | HASH_SCAN_TEST_CLUSTER_LOW;
+
+#ifdef HAVE___INT128_T
+    hv = ((hatrack_hash_t)(id + 1) << 64) | low;
+#else
+    hv.w1 = low;
+    hv.w2 = id + 1;
+#endif
+
+    return hv;
+}
+
+/* Picks a range.  Most of the time, at least one end is an item's
+ * position, or one off from it, so that items right at the edges of
+ * the range land on both sides of it.  The rest are either random,
+ * or a shard of the form the dict API comments describe.
+ */
+static void
+hash_scan_test_range(uint64_t *positions,
+                     uint64_t  num,
+                     uint64_t *lo,
+                     uint64_t *hi)
+{
+    uint64_t tmp;
+    uint64_t bits;
+    uint64_t shard;
+
+    switch (test_rand() % 4) {
+    case 0:
+        *lo = ((uint64_t)test_rand() << 32) | test_rand();
+        *hi = ((uint64_t)test_rand() << 32) | test_rand();
+        break;
+    case 1:
+        bits   = test_rand() % 12 + 1;
+        shard  = test_rand() % (1 << bits);
+        *lo    = shard << (64 - bits);
+        *hi    = ((shard + 1) << (64 - bits)) - 1;
+        return;
+    case 2:
+        *lo = positions[test_rand() % num];
+        *hi = *lo + (test_rand() % 2 ? 0 : (uint64_t)test_rand() << 24);
+        break;
+    default:
+        *lo = positions[test_rand() % num] + test_rand() % 3 - 1;
+        *hi = positions[test_rand() % num] + test_rand() % 3 - 1;
+        break;
+    }
+
+    if (*lo > *hi) {
+        tmp = *lo;
+        *lo = *hi;
+        *hi = tmp;
+    }
+
+    return;
+}
+
+static void
+hash_scan_test_crown_hook(hatrack_hash_t hv, void *item, void *arg)
+{
+    hash_scan_test_crown_t *info;
+    uint64_t                ix;
+
+    info = (hash_scan_test_crown_t *)arg;
+    ix   = (uint64_t)item - 1;
+
+    if (ix >= info->num || !hatrack_hashes_eq(hv, info->hvs[ix])) {
+        info->failed = true;
+        return;
+    }
+
+    info->seen[ix]++;
+
+    return;
+}
+
+static bool
+hash_scan_test_crown_range(crown_t                *crown,
+                           hash_scan_test_crown_t *info,
+                           uint64_t                lo,
+                           uint64_t                hi)
+{
+    crown_store_t *store;
+    uint64_t       i;
+    bool           in_range;
+
+    memset(info->seen, 0, info->num * sizeof(uint32_t));
+
+    mmm_start_basic_op();
+
+    store = atomic_read(&crown->store_current);
+
+    crown_store_scan(store, crown, lo, hi, hash_scan_test_crown_hook, info);
+
+    mmm_end_op();
+
+    for (i = 0; i < info->num; i++) {
+        in_range = info->positions[i] >= lo && info->positions[i] <= hi;
+
+        if (info->seen[i] != (in_range ? 1 : 0)) {
+            return false;
+        }
+    }
+
+    return !info->failed;
+}
+
+static bool
+hash_scan_test_crown(void)
+{
+    hash_scan_test_crown_t info;
+    crown_t               *crown;
+    crown_store_t         *store;
+    uint64_t               lo;
+    uint64_t               hi;
+    uint64_t               i;
+    bool                   stashed;
+    bool                   ret;
+
+    info.num       = HASH_SCAN_TEST_ITEMS + HASH_SCAN_TEST_CLUSTER;
+    info.hvs       = (hatrack_hash_t *)malloc(info.num * sizeof(hatrack_hash_t));
+    info.positions = (uint64_t *)malloc(info.num * sizeof(uint64_t));
+    info.seen      = (uint32_t *)malloc(info.num * sizeof(uint32_t));
+    info.failed    = false;
+    crown          = crown_new();
+
+    crown_set_bounded_probes(crown, true);
+
+    for (i = 0; i < info.num; i++) {
+        if (i < HASH_SCAN_TEST_ITEMS) {
+            info.hvs[i] = hash_int(i);
+        }
+        else {
+            info.hvs[i] = hash_scan_test_cluster_hv(i - HASH_SCAN_TEST_ITEMS);
+        }
+
+        info.positions[i] = hatrack_hash_position(info.hvs[i]);
+
+        crown_put(crown, info.hvs[i], (void *)(i + 1), NULL);
+    }
+
+    // Make sure the cluster actually spilled into the stash.
+    store   = atomic_read(&crown->store_current);
+    stashed = store->stash_len
+           && !hatrack_bucket_unreserved(
+                  atomic_read(&store->buckets[store->last_slot + 1].hv));
+    ret     = stashed
+       && hash_scan_test_crown_range(crown, &info, 0, UINT64_MAX)
+       && hash_scan_test_crown_range(crown, &info, 1, 0);
+
+    for (i = 0; ret && i < HASH_SCAN_TEST_RANGES; i++) {
+        hash_scan_test_range(info.positions, info.num, &lo, &hi);
+
+        ret = hash_scan_test_crown_range(crown, &info, lo, hi);
+    }
+
+    // And ranges that cover just the cluster, or cut into it.
+    for (i = 0; ret && i < HASH_SCAN_TEST_RANGES; i++) {
+        hash_scan_test_range(info.positions + HASH_SCAN_TEST_ITEMS,
+                             HASH_SCAN_TEST_CLUSTER,
+                             &lo,
+                             &hi);
+
+        ret = hash_scan_test_crown_range(crown, &info, lo, hi);
+    }
+
+    crown_delete(crown);
+    free(info.hvs);
+    free(info.positions);
+    free(info.seen);
+
+    return ret;
+}
+
+/* For the dictionary tests, keys are 1 through num, and values are
+ * the key plus one.  Keys above that are ones a test added while it
+ * was scanning, which it may or may not see.
+ */
+typedef struct {
+    uint64_t  num;
+    uint64_t  max_key;
+    uint32_t *seen;
+    bool      failed;
+} hash_scan_test_dict_t;
+
+static inline uint64_t
+hash_scan_test_position(uint64_t key)
+{
+    return hatrack_hash_position(hash_int(key));
+}
+
+static void
+hash_scan_test_dict_hook(void *arg, void *key, void *value)
+{
+    hash_scan_test_dict_t *info;
+
+    info = (hash_scan_test_dict_t *)arg;
+
+    if ((uint64_t)key > info->max_key || !key
+        || (uint64_t)value != (uint64_t)key + 1) {
+        info->failed = true;
+        return;
+    }
+
+    info->seen[(uint64_t)key]++;
+
+    return;
+}
+
+/* Every key we started with that's in range has to have been seen
+ * once, and anything outside it never.  Keys added while scanning may
+ * have been seen once, if they're in range.
+ */
+static bool
+hash_scan_test_dict_check(hash_scan_test_dict_t *info,
+                          uint64_t               lo,
+                          uint64_t               hi,
+                          uint64_t               count)
+{
+    uint64_t key;
+    uint64_t position;
+    uint64_t total;
+    bool     in_range;
+
+    total = 0;
+
+    for (key = 1; key <= info->max_key; key++) {
+        position  = hash_scan_test_position(key);
+        in_range  = position >= lo && position <= hi;
+        total    += info->seen[key];
+
+        if (info->seen[key] > (in_range ? 1 : 0)) {
+            return false;
+        }
+
+        if (key <= info->num && in_range && !info->seen[key]) {
+            return false;
+        }
+    }
+
+    return !info->failed && total == count;
+}
+
+static hatrack_dict_t *
+hash_scan_test_new_dict(uint64_t num)
+{
+    hatrack_dict_t *dict;
+    uint64_t        key;
+
+    dict = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+
+    for (key = 1; key <= num; key++) {
+        hatrack_dict_put(dict, (void *)key, (void *)(key + 1));
+    }
+
+    return dict;
+}
+
+static bool
+hash_scan_test_dict(void)
+{
+    hash_scan_test_dict_t info;
+    hatrack_dict_t       *dict;
+    uint64_t             *positions;
+    uint64_t              lo;
+    uint64_t              hi;
+    uint64_t              count;
+    uint64_t              total;
+    uint64_t              shard;
+    uint64_t              shift;
+    uint64_t              i;
+    bool                  ret;
+
+    info.num     = HASH_SCAN_TEST_KEYS;
+    info.max_key = HASH_SCAN_TEST_KEYS;
+    info.seen    = (uint32_t *)malloc((info.max_key + 1) * sizeof(uint32_t));
+    info.failed  = false;
+    positions    = (uint64_t *)malloc(info.num * sizeof(uint64_t));
+    dict         = hash_scan_test_new_dict(info.num);
+    ret          = true;
+
+    for (i = 0; i < info.num; i++) {
+        positions[i] = hash_scan_test_position(i + 1);
+    }
+
+    for (i = 0; ret && i < HASH_SCAN_TEST_RANGES; i++) {
+        hash_scan_test_range(positions, info.num, &lo, &hi);
+        memset(info.seen, 0, (info.max_key + 1) * sizeof(uint32_t));
+
+        count = hatrack_dict_scan_hash_range(dict,
+                                             lo,
+                                             hi,
+                                             hash_scan_test_dict_hook,
+                                             &info);
+        ret   = hash_scan_test_dict_check(&info, lo, hi, count);
+    }
+
+    /* Extracting every shard has to hand back each item exactly
+     * once, and leave nothing behind.
+     */
+    shift = 64 - HASH_SCAN_TEST_SHARD_BITS;
+    total = 0;
+
+    memset(info.seen, 0, (info.max_key + 1) * sizeof(uint32_t));
+
+    for (shard = 0; ret && shard < (1 << HASH_SCAN_TEST_SHARD_BITS); shard++) {
+        lo     = shard << shift;
+        hi     = ((shard + 1) << shift) - 1;
+        count  = hatrack_dict_extract_hash_range(dict,
+                                                 lo,
+                                                 hi,
+                                                 hash_scan_test_dict_hook,
+                                                 &info);
+        total += count;
+
+        for (i = 1; i <= info.num; i++) {
+            if ((hash_scan_test_position(i) >> shift) == shard
+                && info.seen[i] != 1) {
+                ret = false;
+            }
+        }
+    }
+
+    ret = ret && !info.failed && total == info.num
+       && !crown_len(&dict->crown_instance);
+
+    hatrack_dict_delete(dict);
+    free(positions);
+    free(info.seen);
+
+    return ret;
+}
+
+/* The scan's hook stops on the first item it gets, and has the
+ * migrator add keys until the dictionary has moved to a new store.
+ * Then the scan carries on, in the store it started in.
+ */
+typedef struct {
+    hash_scan_test_dict_t info;
+    hatrack_dict_t       *dict;
+    _Atomic bool          go;
+    _Atomic bool          migrated;
+    bool                  hooked;
+} hash_scan_test_migrate_t;
+
+static void
+hash_scan_test_migrate_hook(void *arg, void *key, void *value)
+{
+    hash_scan_test_migrate_t *mig;
+
+    mig = (hash_scan_test_migrate_t *)arg;
+
+    if (!mig->hooked) {
+        mig->hooked = true;
+        atomic_store(&mig->go, true);
+
+        while (!atomic_load(&mig->migrated)) {
+            continue;
+        }
+    }
+
+    hash_scan_test_dict_hook(&mig->info, key, value);
+
+    return;
+}
+
+static void *
+hash_scan_test_migrator(void *arg)
+{
+    hash_scan_test_migrate_t *mig;
+    crown_store_t            *store;
+    uint64_t                  key;
+
+    mig = (hash_scan_test_migrate_t *)arg;
+
+    while (!atomic_load(&mig->go)) {
+        continue;
+    }
+
+    store = atomic_read(&mig->dict->crown_instance.store_current);
+    key   = mig->info.num;
+
+    while (atomic_read(&mig->dict->crown_instance.store_current) == store
+           && key + 1 < HASH_SCAN_TEST_MAX_KEY) {
+        key++;
+        hatrack_dict_put(mig->dict, (void *)key, (void *)(key + 1));
+    }
+
+    mig->info.max_key = key;
+
+    atomic_store(&mig->migrated, true);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+hash_scan_test_migrate_one(uint64_t lo, uint64_t hi, bool extract)
+{
+    hash_scan_test_migrate_t mig;
+    pthread_t                thread;
+    uint64_t                 count;
+    uint64_t                 key;
+    uint64_t                 position;
+    bool                     found;
+    bool                     ret;
+
+    mig.info.num     = HASH_SCAN_TEST_KEYS;
+    mig.info.max_key = HASH_SCAN_TEST_KEYS;
+    mig.info.seen    = (uint32_t *)calloc(HASH_SCAN_TEST_MAX_KEY,
+                                          sizeof(uint32_t));
+    mig.info.failed  = false;
+    mig.dict         = hash_scan_test_new_dict(mig.info.num);
+    mig.go           = false;
+    mig.migrated     = false;
+    mig.hooked       = false;
+
+    pthread_create(&thread, NULL, hash_scan_test_migrator, &mig);
+
+    if (extract) {
+        count = hatrack_dict_extract_hash_range(mig.dict,
+                                                lo,
+                                                hi,
+                                                hash_scan_test_migrate_hook,
+                                                &mig);
+    }
+    else {
+        count = hatrack_dict_scan_hash_range(mig.dict,
+                                             lo,
+                                             hi,
+                                             hash_scan_test_migrate_hook,
+                                             &mig);
+    }
+
+    // In case the range was empty, and the hook never ran.
+    atomic_store(&mig.go, true);
+    pthread_join(thread, NULL);
+
+    ret = mig.info.max_key + 1 < HASH_SCAN_TEST_MAX_KEY
+       && hash_scan_test_dict_check(&mig.info, lo, hi, count);
+
+    /* After an extract, whatever it handed back has to be gone, and
+     * everything else, including the keys the migrator added, has to
+     * still be there.
+     */
+    for (key = 1; extract && ret && key <= mig.info.max_key; key++) {
+        hatrack_dict_get(mig.dict, (void *)key, &found);
+
+        position = hash_scan_test_position(key);
+
+        if (found == (mig.info.seen[key] != 0)) {
+            ret = false;
+        }
+
+        if (!found && (position < lo || position > hi)) {
+            ret = false;
+        }
+    }
+
+    hatrack_dict_delete(mig.dict);
+    free(mig.info.seen);
+
+    return ret;
+}
+
+static bool
+hash_scan_test_migrate(void)
+{
+    uint64_t shift;
+    uint64_t shard;
+
+    if (!hash_scan_test_migrate_one(0, UINT64_MAX, false)
+        || !hash_scan_test_migrate_one(0, UINT64_MAX, true)) {
+        return false;
+    }
+
+    shift = 64 - HASH_SCAN_TEST_SHARD_BITS;
+
+    for (shard = 0; shard < (1 << HASH_SCAN_TEST_SHARD_BITS); shard += 3) {
+        if (!hash_scan_test_migrate_one(shard << shift,
+                                        ((shard + 1) << shift) - 1,
+                                        shard & 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+test_hash_scan(void)
+{
+    return hash_scan_test_crown() && hash_scan_test_dict()
+        && hash_scan_test_migrate();
+}
@@ -0,0 +1,428 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_hatlog.c
+ *
+ *  Description:    Has several threads log numbered lines through a
+ *                  hatlog with a small ring, and then reads back the
+ *                  files it wrote.  For most of the run, producers
+ *                  wait for the drain thread to keep up, so that
+ *                  plenty gets written; at the end, they don't, so
+ *                  that some lines get dropped.
+ *
+ *                  Every line logged has to have been either written
+ *                  or counted as dropped, and each producer's lines
+ *                  have to show up intact and in order, across every
+ *                  file that's left.  With rotation on, the old files
+ *                  have to get the right names, none past max_files
+ *                  may exist, and each one has to have filled up
+ *                  before it got rotated out.  With max_files at 0,
+ *                  the log just gets truncated.  Finally, we log to
+ *                  /dev/full, to make sure failed writes get counted.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/hatring.h>
+#include <hatrack/hatlog.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HATLOG_TEST_PRODUCERS  4
+#define HATLOG_TEST_LINES      5000
+#define HATLOG_TEST_PACED      4000
+#define HATLOG_TEST_RING_SIZE  64
+#define HATLOG_TEST_MSG_SIZE   16
+#define HATLOG_TEST_LINE_LEN   12
+#define HATLOG_TEST_BATCH_SIZE 16
+#define HATLOG_TEST_MAX_SIZE   4096
+#define HATLOG_TEST_MAX_FILES  3
+#define HATLOG_TEST_PATH_LEN   128
+
+typedef struct {
+    hatlog_t         *log;
+    uint64_t          tid;
+    _Atomic uint64_t *logged;
+} hatlog_test_arg_t;
+
+/* Waits until the drain thread has dealt with all but half a ring's
+ * worth of what's been logged, so the ring doesn't wrap.
+ */
+static void
+hatlog_test_pace(hatlog_test_arg_t *my)
+{
+    while (hatlog_written(my->log) + hatlog_dropped(my->log)
+               + HATLOG_TEST_RING_SIZE / 2
+           < atomic_load(my->logged)) {
+        usleep(100);
+    }
+
+    return;
+}
+
+/* Every line is the producer id and a sequence number, which is
+ * always HATLOG_TEST_LINE_LEN bytes.  Even lines go through
+ * hatlog_printf(), and odd ones through hatlog_write().
+ */
+static void *
+hatlog_test_producer(void *arg)
+{
+    hatlog_test_arg_t *my;
+    char               buf[HATLOG_TEST_MSG_SIZE];
+    uint64_t           i;
+
+    my = (hatlog_test_arg_t *)arg;
+
+    for (i = 0; i < HATLOG_TEST_LINES; i++) {
+        if (i < HATLOG_TEST_PACED && !(i % 8)) {
+            hatlog_test_pace(my);
+        }
+
+        atomic_fetch_add(my->logged, 1);
+
+        if (i & 1) {
+            snprintf(buf, sizeof(buf), "%02u %08u\n", (unsigned)my->tid,
+                     (unsigned)i);
+            hatlog_write(my->log, buf, HATLOG_TEST_LINE_LEN);
+        }
+        else {
+            hatlog_printf(my->log, "%02u %08u\n", (unsigned)my->tid,
+                          (unsigned)i);
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Logs everything, and stops the drain thread, which flushes the ring.
+static void
+hatlog_test_run(hatlog_t *log)
+{
+    hatlog_test_arg_t args[HATLOG_TEST_PRODUCERS];
+    pthread_t         threads[HATLOG_TEST_PRODUCERS];
+    _Atomic uint64_t  logged;
+    uint64_t          i;
+
+    atomic_store(&logged, 0);
+
+    for (i = 0; i < HATLOG_TEST_PRODUCERS; i++) {
+        args[i].log    = log;
+        args[i].tid    = i;
+        args[i].logged = &logged;
+
+        pthread_create(&threads[i], NULL, hatlog_test_producer, &args[i]);
+    }
+
+    for (i = 0; i < HATLOG_TEST_PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    hatlog_stop(log);
+
+    return;
+}
+
+static void
+hatlog_test_name(char *out, char *path, uint64_t n)
+{
+    if (n) {
+        snprintf(out, HATLOG_TEST_PATH_LEN, "%s.%u", path, (unsigned)n);
+    }
+    else {
+        snprintf(out, HATLOG_TEST_PATH_LEN, "%s", path);
+    }
+
+    return;
+}
+
+// Returns -1 if the file doesn't exist.
+static int64_t
+hatlog_test_file_size(char *path, uint64_t n)
+{
+    char        name[HATLOG_TEST_PATH_LEN];
+    struct stat info;
+
+    hatlog_test_name(name, path, n);
+
+    if (stat(name, &info)) {
+        return -1;
+    }
+
+    return (int64_t)info.st_size;
+}
+
+/* Checks that every line in the file is well formed, and comes after
+ * the last line we saw from the same producer.  Adds the number of
+ * lines to *lines.
+ */
+static bool
+hatlog_test_check_file(char     *path,
+                       uint64_t  n,
+                       int64_t  *next_seq,
+                       uint64_t *lines)
+{
+    char     name[HATLOG_TEST_PATH_LEN];
+    char     expected[HATLOG_TEST_MSG_SIZE];
+    char     line[HATLOG_TEST_MSG_SIZE];
+    unsigned tid;
+    unsigned seq;
+    FILE    *f;
+    bool     ret;
+
+    hatlog_test_name(name, path, n);
+
+    f = fopen(name, "r");
+
+    if (!f) {
+        return false;
+    }
+
+    ret = true;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%u %u", &tid, &seq) != 2
+            || tid >= HATLOG_TEST_PRODUCERS) {
+            ret = false;
+            break;
+        }
+
+        snprintf(expected, sizeof(expected), "%02u %08u\n", tid, seq);
+
+        if (strcmp(line, expected) || (int64_t)seq < next_seq[tid]) {
+            ret = false;
+            break;
+        }
+
+        next_seq[tid] = (int64_t)seq + 1;
+        (*lines)++;
+    }
+
+    fclose(f);
+
+    return ret;
+}
+
+// Checks the files from the oldest (path.max_files) to path itself.
+static bool
+hatlog_test_check_files(char *path, uint64_t max_files, uint64_t *lines)
+{
+    int64_t  next_seq[HATLOG_TEST_PRODUCERS];
+    uint64_t i;
+
+    for (i = 0; i < HATLOG_TEST_PRODUCERS; i++) {
+        next_seq[i] = 0;
+    }
+
+    *lines = 0;
+
+    for (i = max_files + 1; i > 0; i--) {
+        if (!hatlog_test_check_file(path, i - 1, next_seq, lines)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static hatlog_t *
+hatlog_test_new(char *path, uint64_t max_file_size, uint64_t max_files)
+{
+    hatlog_t *log;
+
+    log = hatlog_new(path, HATLOG_TEST_RING_SIZE, HATLOG_TEST_MSG_SIZE);
+
+    hatlog_set_batch_size(log, HATLOG_TEST_BATCH_SIZE);
+    hatlog_set_rotation(log, max_file_size, max_files);
+
+    if (!hatlog_start(log)) {
+        hatlog_delete(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+static bool
+hatlog_test_accounted(hatlog_t *log)
+{
+    return hatlog_written(log) + hatlog_dropped(log)
+            == HATLOG_TEST_PRODUCERS * HATLOG_TEST_LINES
+        && !hatlog_write_errors(log);
+}
+
+static void
+hatlog_test_remove(char *path)
+{
+    char     name[HATLOG_TEST_PATH_LEN];
+    uint64_t i;
+
+    for (i = 0; i <= HATLOG_TEST_MAX_FILES + 1; i++) {
+        hatlog_test_name(name, path, i);
+        unlink(name);
+    }
+
+    return;
+}
+
+// Without rotation, every line that got written is in the file.
+static bool
+hatlog_test_plain(char *path)
+{
+    hatlog_t *log;
+    uint64_t  lines;
+    bool      ret;
+
+    log = hatlog_test_new(path, 0, 0);
+
+    if (!log) {
+        return false;
+    }
+
+    hatlog_test_run(log);
+
+    ret = hatlog_test_accounted(log)
+       && hatlog_test_check_files(path, 0, &lines)
+       && lines == hatlog_written(log)
+       && hatlog_test_file_size(path, 1) == -1;
+
+    hatlog_delete(log);
+    hatlog_test_remove(path);
+
+    return ret;
+}
+
+/* A file only gets rotated out when the next batch wouldn't fit, so
+ * every old file has to be within a batch of the maximum size.
+ */
+static bool
+hatlog_test_rotate(char *path)
+{
+    hatlog_t *log;
+    uint64_t  lines;
+    uint64_t  i;
+    int64_t   size;
+    int64_t   min_size;
+    bool      ret;
+
+    log = hatlog_test_new(path, HATLOG_TEST_MAX_SIZE, HATLOG_TEST_MAX_FILES);
+
+    if (!log) {
+        return false;
+    }
+
+    hatlog_test_run(log);
+
+    min_size = HATLOG_TEST_MAX_SIZE
+             - HATLOG_TEST_BATCH_SIZE * HATLOG_TEST_LINE_LEN;
+    ret      = hatlog_test_accounted(log)
+       && hatlog_test_check_files(path, HATLOG_TEST_MAX_FILES, &lines)
+       && lines <= hatlog_written(log)
+       && hatlog_test_file_size(path, HATLOG_TEST_MAX_FILES + 1) == -1;
+
+    for (i = 0; ret && i <= HATLOG_TEST_MAX_FILES; i++) {
+        size = hatlog_test_file_size(path, i);
+
+        if (size > HATLOG_TEST_MAX_SIZE || size % HATLOG_TEST_LINE_LEN
+            || (i && size <= min_size)) {
+            ret = false;
+        }
+    }
+
+    hatlog_delete(log);
+    hatlog_test_remove(path);
+
+    return ret;
+}
+
+// With max_files at 0, there's only ever the one file.
+static bool
+hatlog_test_truncate(char *path)
+{
+    hatlog_t *log;
+    uint64_t  lines;
+    int64_t   size;
+    bool      ret;
+
+    log = hatlog_test_new(path, HATLOG_TEST_MAX_SIZE, 0);
+
+    if (!log) {
+        return false;
+    }
+
+    hatlog_test_run(log);
+
+    size = hatlog_test_file_size(path, 0);
+    ret  = hatlog_test_accounted(log)
+       && hatlog_test_check_files(path, 0, &lines)
+       && lines < hatlog_written(log)
+       && size > 0 && size <= HATLOG_TEST_MAX_SIZE
+       && hatlog_test_file_size(path, 1) == -1;
+
+    hatlog_delete(log);
+    hatlog_test_remove(path);
+
+    return ret;
+}
+
+/* Every write to /dev/full fails, so every batch should get counted
+ * as an error.  If there's no /dev/full, there's nothing to check.
+ */
+static bool
+hatlog_test_errors(void)
+{
+    hatlog_t *log;
+    bool      ret;
+
+    if (access("/dev/full", W_OK)) {
+        return true;
+    }
+
+    log = hatlog_test_new("/dev/full", 0, 0);
+
+    if (!log) {
+        return false;
+    }
+
+    hatlog_test_run(log);
+
+    ret = hatlog_written(log) + hatlog_dropped(log)
+           == HATLOG_TEST_PRODUCERS * HATLOG_TEST_LINES
+       && hatlog_write_errors(log) > 0;
+
+    hatlog_delete(log);
+
+    return ret;
+}
+
+bool
+test_hatlog(void)
+{
+    char dir[]                     = "/tmp/hatlog_test.XXXXXX";
+    char path[HATLOG_TEST_PATH_LEN];
+    bool ret;
+
+    if (!mkdtemp(dir)) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/log", dir);
+
+    ret = hatlog_test_plain(path) && hatlog_test_rotate(path)
+       && hatlog_test_truncate(path) && hatlog_test_errors();
+
+    hatlog_test_remove(path);
+    rmdir(dir);
+
+    return ret;
+}
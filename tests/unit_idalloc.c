@@ -0,0 +1,215 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_idalloc.c
+ *
+ *  Description:    Tests for the ID allocator behind mmm's thread IDs.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/idalloc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define IDALLOC_TEST_THREADS 4
+#define IDALLOC_TEST_ITERS   100000
+#define IDALLOC_TEST_HOLD    8
+
+typedef struct {
+    idalloc_t        *ids;
+    _Atomic uint8_t  *owned;
+    _Atomic bool      failed;
+} idalloc_test_t;
+
+// Capacities that are, and aren't, multiples of 64, at 1 to 4 levels.
+// clang-format off
+static uint64_t idalloc_capacities[] = {
+    1, 2, 63, 64, 65, 127, 4095, 4096, 4097, 262145, 0
+};
+// clang-format on
+
+/* Fills the allocator, which, from empty, should hand out every ID in
+ * order, fails once it's full, then gives back every third ID and
+ * checks that they come back lowest first.  The high-water mark only
+ * ever goes up.
+ */
+static bool
+idalloc_test_capacity(uint64_t capacity)
+{
+    idalloc_t *ids;
+    uint64_t   i;
+    uint64_t   hwm;
+    int64_t    id;
+    bool       ret;
+
+    ids = idalloc_new(capacity);
+    hwm = 0;
+    ret = false;
+
+    if (idalloc_capacity(ids) != capacity || idalloc_high_water(ids)) {
+        goto done;
+    }
+
+    for (i = 0; i < capacity; i++) {
+        if (idalloc_get(ids) != (int64_t)i || !idalloc_in_use(ids, i)) {
+            fprintf(stderr, "cap %llu: bad id at %llu. ",
+                    (unsigned long long)capacity, (unsigned long long)i);
+            goto done;
+        }
+
+        if (idalloc_high_water(ids) != i + 1) {
+            goto done;
+        }
+    }
+
+    if (idalloc_get(ids) != -1 || idalloc_in_use(ids, capacity)) {
+        fprintf(stderr, "cap %llu: didn't fail when full. ",
+                (unsigned long long)capacity);
+        goto done;
+    }
+
+    hwm = idalloc_high_water(ids);
+
+    for (i = 0; i < capacity; i += 3) {
+        idalloc_put(ids, i);
+
+        if (idalloc_in_use(ids, i) || idalloc_high_water(ids) != hwm) {
+            goto done;
+        }
+    }
+
+    for (i = 0; i < capacity; i += 3) {
+        id = idalloc_get(ids);
+
+        if (id != (int64_t)i || idalloc_high_water(ids) != hwm) {
+            fprintf(stderr, "cap %llu: reused %lld, not %llu. ",
+                    (unsigned long long)capacity, (long long)id,
+                    (unsigned long long)i);
+            goto done;
+        }
+    }
+
+    if (idalloc_get(ids) != -1) {
+        goto done;
+    }
+
+    // Empty it out completely; the high-water mark stays put.
+    for (i = 0; i < capacity; i++) {
+        idalloc_put(ids, i);
+    }
+
+    if (idalloc_high_water(ids) != hwm || idalloc_get(ids) != 0) {
+        goto done;
+    }
+
+    ret = true;
+
+done:
+    idalloc_delete(ids);
+
+    return ret;
+}
+
+/* Each thread repeatedly grabs a handful of IDs and gives them back.
+ * owned[] catches any ID handed to two threads at once.  There are
+ * fewer IDs than the threads try to hold in total, so allocations
+ * fail regularly too.
+ */
+static void *
+idalloc_test_thread(void *arg)
+{
+    idalloc_test_t *info;
+    int64_t         held[IDALLOC_TEST_HOLD];
+    uint64_t        i;
+    uint64_t        j;
+    uint64_t        hwm;
+
+    info = (idalloc_test_t *)arg;
+    hwm  = 0;
+
+    for (i = 0; i < IDALLOC_TEST_ITERS; i++) {
+        for (j = 0; j < IDALLOC_TEST_HOLD; j++) {
+            held[j] = idalloc_get(info->ids);
+
+            if (held[j] < 0) {
+                continue;
+            }
+
+            if (atomic_fetch_add(&info->owned[held[j]], 1)) {
+                atomic_store(&info->failed, true);
+            }
+        }
+
+        if (idalloc_high_water(info->ids) < hwm) {
+            atomic_store(&info->failed, true);
+        }
+
+        hwm = idalloc_high_water(info->ids);
+
+        for (j = 0; j < IDALLOC_TEST_HOLD; j++) {
+            if (held[j] < 0) {
+                continue;
+            }
+
+            if (held[j] >= (int64_t)hwm) {
+                atomic_store(&info->failed, true);
+            }
+
+            atomic_fetch_sub(&info->owned[held[j]], 1);
+            idalloc_put(info->ids, held[j]);
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+idalloc_test_threads(uint64_t capacity)
+{
+    idalloc_test_t info;
+    pthread_t      threads[IDALLOC_TEST_THREADS];
+    uint64_t       i;
+
+    info.ids    = idalloc_new(capacity);
+    info.owned  = (_Atomic uint8_t *)calloc(capacity, sizeof(uint8_t));
+    info.failed = false;
+
+    for (i = 0; i < IDALLOC_TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, idalloc_test_thread, &info);
+    }
+
+    for (i = 0; i < IDALLOC_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Everything got given back, so the lowest ID is free again.
+    if (idalloc_get(info.ids) != 0 || idalloc_high_water(info.ids) > capacity) {
+        info.failed = true;
+    }
+
+    free((void *)info.owned);
+    idalloc_delete(info.ids);
+
+    return !info.failed;
+}
+
+bool
+test_idalloc(void)
+{
+    uint64_t *cap;
+
+    for (cap = idalloc_capacities; *cap; cap++) {
+        if (!idalloc_test_capacity(*cap)) {
+            return false;
+        }
+    }
+
+    // 4 threads holding up to 8 each, against 20 and 100 IDs.
+    return idalloc_test_threads(20) && idalloc_test_threads(100);
+}
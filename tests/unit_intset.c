@@ -0,0 +1,358 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_intset.c
+ *
+ *  Description:    Checks hatrack_intset against a plain bitmap of
+ *                  the same items, through random adds and removes,
+ *                  the four set operations, and concurrent adds.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/intset.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* We only use four chunks of the 32-bit space, so that the reference
+ * bitmaps stay small.  The items we pick in each chunk are limited to
+ * a range sized so that the first chunk ends up a bitmap, the second
+ * stays an array, the third crosses over partway through, and the
+ * last holds just a few items at the very top of the space.
+ */
+#define INTSET_TEST_CHUNKS   4
+#define INTSET_TEST_UNIVERSE (INTSET_TEST_CHUNKS << 16)
+#define INTSET_TEST_OPS      200000
+#define INTSET_TEST_FEW_OPS  20000
+#define INTSET_TEST_THREADS  4
+
+static const uint32_t intset_test_high[INTSET_TEST_CHUNKS] = {
+    0x0000, 0x0001, 0x1234, 0xffff
+};
+
+static const uint32_t intset_test_range[INTSET_TEST_CHUNKS] = {
+    0x10000, 2000, 12000, 16
+};
+
+typedef struct {
+    uint64_t bits[INTSET_TEST_UNIVERSE / 64];
+} intset_test_ref_t;
+
+static inline uint32_t
+intset_test_value(uint32_t ix)
+{
+    return (intset_test_high[ix >> 16] << 16) | (ix & 0xffff);
+}
+
+static inline bool
+intset_test_ref_has(intset_test_ref_t *ref, uint32_t ix)
+{
+    return (ref->bits[ix >> 6] >> (ix & 63)) & 1;
+}
+
+static inline void
+intset_test_ref_set(intset_test_ref_t *ref, uint32_t ix, bool value)
+{
+    if (value) {
+        ref->bits[ix >> 6] |= (1ULL << (ix & 63));
+    }
+    else {
+        ref->bits[ix >> 6] &= ~(1ULL << (ix & 63));
+    }
+
+    return;
+}
+
+static uint32_t
+intset_test_random_ix(void)
+{
+    uint32_t chunk;
+
+    chunk = test_rand() % INTSET_TEST_CHUNKS;
+
+    return (chunk << 16)
+         | (intset_test_high[chunk] == 0xffff
+                ? 0x10000 - intset_test_range[chunk]
+                : 0)
+         | (test_rand() % intset_test_range[chunk]);
+}
+
+/* Checks contains() on every item in the universe, and that len()
+ * and items() agree with the reference.  Since items() is sorted, and
+ * our universe is ordered the same way as the values, we can walk
+ * both at once.
+ */
+static bool
+intset_test_matches(hatrack_intset_t *set, intset_test_ref_t *ref)
+{
+    uint32_t *items;
+    uint64_t  num;
+    uint64_t  n;
+    uint32_t  ix;
+    bool      ret;
+
+    ret = true;
+    n   = 0;
+
+    for (ix = 0; ix < INTSET_TEST_UNIVERSE; ix++) {
+        if (hatrack_intset_contains(set, intset_test_value(ix))
+            != intset_test_ref_has(ref, ix)) {
+            return false;
+        }
+
+        n += intset_test_ref_has(ref, ix);
+    }
+
+    if (hatrack_intset_len(set) != n) {
+        return false;
+    }
+
+    items = hatrack_intset_items(set, &num);
+
+    if (num != n) {
+        ret = false;
+        goto done;
+    }
+
+    n = 0;
+
+    for (ix = 0; ix < INTSET_TEST_UNIVERSE; ix++) {
+        if (!intset_test_ref_has(ref, ix)) {
+            continue;
+        }
+
+        if (items[n++] != intset_test_value(ix)) {
+            ret = false;
+            break;
+        }
+    }
+
+done:
+    if (items) {
+        hatrack_free(items, sizeof(uint32_t) * num);
+    }
+
+    return ret;
+}
+
+static bool
+intset_test_random_ops(hatrack_intset_t  *set,
+                       intset_test_ref_t *ref,
+                       uint64_t           num_ops)
+{
+    uint64_t i;
+    uint32_t ix;
+    bool     present;
+
+    for (i = 0; i < num_ops; i++) {
+        ix      = intset_test_random_ix();
+        present = intset_test_ref_has(ref, ix);
+
+        // Adds outnumber removes, so that the chunks fill up.
+        if (test_rand() % 4) {
+            if (hatrack_intset_add(set, intset_test_value(ix)) == present) {
+                return false;
+            }
+            intset_test_ref_set(ref, ix, true);
+        }
+        else {
+            if (hatrack_intset_remove(set, intset_test_value(ix)) != present) {
+                return false;
+            }
+            intset_test_ref_set(ref, ix, false);
+        }
+    }
+
+    return true;
+}
+
+enum {
+    INTSET_TEST_DIFFERENCE,
+    INTSET_TEST_UNION,
+    INTSET_TEST_INTERSECTION,
+    INTSET_TEST_DISJUNCTION
+};
+
+static bool
+intset_test_op(hatrack_intset_t  *a,
+               hatrack_intset_t  *b,
+               intset_test_ref_t *ref_a,
+               intset_test_ref_t *ref_b,
+               int                op)
+{
+    hatrack_intset_t  *result;
+    intset_test_ref_t *expected;
+    uint64_t           i;
+    bool               ret;
+
+    expected = (intset_test_ref_t *)malloc(sizeof(intset_test_ref_t));
+
+    for (i = 0; i < INTSET_TEST_UNIVERSE / 64; i++) {
+        switch (op) {
+        case INTSET_TEST_DIFFERENCE:
+            expected->bits[i] = ref_a->bits[i] & ~ref_b->bits[i];
+            break;
+        case INTSET_TEST_UNION:
+            expected->bits[i] = ref_a->bits[i] | ref_b->bits[i];
+            break;
+        case INTSET_TEST_INTERSECTION:
+            expected->bits[i] = ref_a->bits[i] & ref_b->bits[i];
+            break;
+        default:
+            expected->bits[i] = ref_a->bits[i] ^ ref_b->bits[i];
+            break;
+        }
+    }
+
+    switch (op) {
+    case INTSET_TEST_DIFFERENCE:
+        result = hatrack_intset_difference(a, b);
+        break;
+    case INTSET_TEST_UNION:
+        result = hatrack_intset_union(a, b);
+        break;
+    case INTSET_TEST_INTERSECTION:
+        result = hatrack_intset_intersection(a, b);
+        break;
+    default:
+        result = hatrack_intset_disjunction(a, b);
+        break;
+    }
+
+    ret = intset_test_matches(result, expected);
+
+    hatrack_intset_delete(result);
+    free(expected);
+
+    return ret;
+}
+
+/* Each thread adds every item in the first three chunks' ranges, so
+ * that every add races with three others; exactly one of them should
+ * get back true for each item.
+ */
+typedef struct {
+    hatrack_intset_t *set;
+    _Atomic uint8_t  *wins;
+} intset_test_adder_t;
+
+static void *
+intset_test_adder(void *arg)
+{
+    intset_test_adder_t *info;
+    uint32_t             chunk;
+    uint32_t             low;
+    uint32_t             ix;
+
+    info = (intset_test_adder_t *)arg;
+
+    for (chunk = 0; chunk < INTSET_TEST_CHUNKS - 1; chunk++) {
+        for (low = 0; low < intset_test_range[chunk]; low++) {
+            ix = (chunk << 16) | low;
+
+            if (hatrack_intset_add(info->set, intset_test_value(ix))) {
+                atomic_fetch_add(&info->wins[ix], 1);
+            }
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+intset_test_concurrent(void)
+{
+    hatrack_intset_t    *set;
+    intset_test_ref_t   *ref;
+    intset_test_adder_t  info;
+    pthread_t            threads[INTSET_TEST_THREADS];
+    uint32_t             chunk;
+    uint32_t             low;
+    uint32_t             ix;
+    uint64_t             i;
+    bool                 ret;
+
+    set       = hatrack_intset_new();
+    ref       = (intset_test_ref_t *)calloc(1, sizeof(intset_test_ref_t));
+    info.set  = set;
+    info.wins = (_Atomic uint8_t *)calloc(INTSET_TEST_UNIVERSE, 1);
+    ret       = true;
+
+    for (i = 0; i < INTSET_TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, intset_test_adder, &info);
+    }
+
+    for (i = 0; i < INTSET_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (chunk = 0; chunk < INTSET_TEST_CHUNKS - 1; chunk++) {
+        for (low = 0; low < intset_test_range[chunk]; low++) {
+            ix = (chunk << 16) | low;
+
+            if (atomic_load(&info.wins[ix]) != 1) {
+                ret = false;
+            }
+
+            intset_test_ref_set(ref, ix, true);
+        }
+    }
+
+    if (!intset_test_matches(set, ref)) {
+        ret = false;
+    }
+
+    hatrack_intset_delete(set);
+    free((void *)info.wins);
+    free(ref);
+
+    return ret;
+}
+
+bool
+test_intset(void)
+{
+    hatrack_intset_t  *a;
+    hatrack_intset_t  *b;
+    intset_test_ref_t *ref_a;
+    intset_test_ref_t *ref_b;
+    int                op;
+    bool               ret;
+
+    a     = hatrack_intset_new();
+    b     = hatrack_intset_new();
+    ref_a = (intset_test_ref_t *)calloc(1, sizeof(intset_test_ref_t));
+    ref_b = (intset_test_ref_t *)calloc(1, sizeof(intset_test_ref_t));
+    ret   = intset_test_matches(a, ref_a);
+
+    /* b gets few enough items that all of its chunks stay arrays,
+     * so the set operations see both kinds of container on each side.
+     */
+    if (!intset_test_random_ops(a, ref_a, INTSET_TEST_OPS)
+        || !intset_test_random_ops(b, ref_b, INTSET_TEST_FEW_OPS)
+        || !intset_test_matches(a, ref_a)
+        || !intset_test_matches(b, ref_b)) {
+        ret = false;
+    }
+
+    for (op = INTSET_TEST_DIFFERENCE; op <= INTSET_TEST_DISJUNCTION; op++) {
+        if (!intset_test_op(a, b, ref_a, ref_b, op)
+            || !intset_test_op(b, a, ref_b, ref_a, op)) {
+            ret = false;
+        }
+    }
+
+    hatrack_intset_delete(a);
+    hatrack_intset_delete(b);
+    free(ref_a);
+    free(ref_b);
+
+    return ret && intset_test_concurrent();
+}
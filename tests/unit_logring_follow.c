@@ -0,0 +1,270 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_logring_follow.c
+ *
+ *  Description:    Runs a slow logring follower against fast
+ *                  producers and a dequeuer, on a small ring, so that
+ *                  the follower gets lapped and loses entries to the
+ *                  dequeuer.  Everything it does return has to be
+ *                  intact, and in order for each producer, and by
+ *                  the time it catches up, the entries it returned
+ *                  plus the ones it says it missed have to add up to
+ *                  the number of ring epochs that went by.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/hatring.h>
+#include <hatrack/logring.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOGRING_FOLLOW_TEST_PRODUCERS 4
+#define LOGRING_FOLLOW_TEST_ENTRIES   20000
+#define LOGRING_FOLLOW_TEST_SIZE      64
+#define LOGRING_FOLLOW_TEST_MARKERS   16
+
+/* The producer id and sequence number, plus two words derived from
+ * them, so a torn copy won't check out.  Markers get enqueued from
+ * the main thread at the end, using producer id
+ * LOGRING_FOLLOW_TEST_PRODUCERS.
+ */
+typedef struct {
+    uint64_t tid;
+    uint64_t seq;
+    uint64_t check;
+    uint64_t inverse;
+} logring_follow_test_msg_t;
+
+/* next_seq[] is one more than the last sequence number seen from
+ * each producer (so 0 means nothing yet).
+ */
+typedef struct {
+    logring_t          *ring;
+    logring_follower_t  follower;
+    uint64_t            returned;
+    uint64_t            missed;
+    uint64_t            markers;
+    uint64_t            next_seq[LOGRING_FOLLOW_TEST_PRODUCERS + 1];
+    _Atomic uint64_t    producers_left;
+    _Atomic bool        failed;
+} logring_follow_test_t;
+
+typedef struct {
+    logring_follow_test_t *info;
+    uint64_t               tid;
+} logring_follow_test_arg_t;
+
+static void
+logring_follow_test_fill(logring_follow_test_msg_t *msg,
+                         uint64_t                   tid,
+                         uint64_t                   seq)
+{
+    msg->tid     = tid;
+    msg->seq     = seq;
+    msg->check   = ((tid << 48) ^ seq) * 0x9e3779b97f4a7c15ULL;
+    msg->inverse = ~msg->check;
+
+    return;
+}
+
+/* Checks that a message is intact, and that it comes after the last
+ * one we saw from the same producer.
+ */
+static bool
+logring_follow_test_ok(logring_follow_test_msg_t *msg,
+                       uint64_t                   len,
+                       uint64_t                  *next_seq)
+{
+    logring_follow_test_msg_t expected;
+
+    if (len != sizeof(logring_follow_test_msg_t)
+        || msg->tid > LOGRING_FOLLOW_TEST_PRODUCERS) {
+        return false;
+    }
+
+    logring_follow_test_fill(&expected, msg->tid, msg->seq);
+
+    if (memcmp(msg, &expected, sizeof(expected))
+        || msg->seq < next_seq[msg->tid]) {
+        return false;
+    }
+
+    next_seq[msg->tid] = msg->seq + 1;
+
+    return true;
+}
+
+static void *
+logring_follow_test_producer(void *arg)
+{
+    logring_follow_test_arg_t *my;
+    logring_follow_test_msg_t  msg;
+    uint64_t                   i;
+
+    my = (logring_follow_test_arg_t *)arg;
+
+    for (i = 0; i < LOGRING_FOLLOW_TEST_ENTRIES; i++) {
+        logring_follow_test_fill(&msg, my->tid, i);
+        logring_enqueue(my->info->ring, &msg, sizeof(msg));
+    }
+
+    atomic_fetch_sub(&my->info->producers_left, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Stops when the producers do, leaving whatever's in the ring.
+static void *
+logring_follow_test_dequeuer(void *arg)
+{
+    logring_follow_test_t    *info;
+    logring_follow_test_msg_t msg;
+    uint64_t                  len;
+    uint64_t                  next_seq[LOGRING_FOLLOW_TEST_PRODUCERS + 1];
+    uint64_t                  i;
+
+    info = (logring_follow_test_t *)arg;
+
+    for (i = 0; i <= LOGRING_FOLLOW_TEST_PRODUCERS; i++) {
+        next_seq[i] = 0;
+    }
+
+    while (atomic_load(&info->producers_left)) {
+        if (!logring_dequeue(info->ring, &msg, &len)) {
+            continue;
+        }
+
+        if (!logring_follow_test_ok(&msg, len, next_seq)) {
+            atomic_store(&info->failed, true);
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Reads the follower's next entry, if there is one.  With nap set,
+ * it sleeps every so often, so that the producers lap it.
+ */
+static bool
+logring_follow_test_read(logring_follow_test_t *info, bool nap)
+{
+    logring_follow_test_msg_t msg;
+    uint64_t                  len;
+    uint64_t                  missed;
+    bool                      ret;
+
+    ret           = logring_follow(&info->follower, &msg, &len, &missed);
+    info->missed += missed;
+
+    if (!ret) {
+        return false;
+    }
+
+    if (!logring_follow_test_ok(&msg, len, info->next_seq)) {
+        atomic_store(&info->failed, true);
+    }
+
+    if (msg.tid == LOGRING_FOLLOW_TEST_PRODUCERS) {
+        info->markers++;
+    }
+
+    info->returned++;
+
+    if (nap && !(info->returned % LOGRING_FOLLOW_TEST_SIZE)) {
+        usleep(100);
+    }
+
+    return true;
+}
+
+static void *
+logring_follow_test_follower(void *arg)
+{
+    logring_follow_test_t *info;
+
+    info = (logring_follow_test_t *)arg;
+
+    while (atomic_load(&info->producers_left)) {
+        logring_follow_test_read(info, true);
+    }
+
+    return NULL;
+}
+
+bool
+test_logring_follow(void)
+{
+    logring_follow_test_t     info;
+    logring_follow_test_arg_t args[LOGRING_FOLLOW_TEST_PRODUCERS];
+    logring_follow_test_msg_t msg;
+    pthread_t                 threads[LOGRING_FOLLOW_TEST_PRODUCERS + 2];
+    uint32_t                  start;
+    uint32_t                  head;
+    uint64_t                  i;
+    bool                      ret;
+
+    info.ring           = logring_new(LOGRING_FOLLOW_TEST_SIZE,
+                                      sizeof(logring_follow_test_msg_t));
+    info.returned       = 0;
+    info.missed         = 0;
+    info.markers        = 0;
+    info.producers_left = LOGRING_FOLLOW_TEST_PRODUCERS;
+    info.failed         = false;
+
+    for (i = 0; i <= LOGRING_FOLLOW_TEST_PRODUCERS; i++) {
+        info.next_seq[i] = 0;
+    }
+
+    logring_follower_init(&info.follower, info.ring, false);
+
+    start = info.follower.next_epoch;
+
+    for (i = 0; i < LOGRING_FOLLOW_TEST_PRODUCERS; i++) {
+        args[i].info = &info;
+        args[i].tid  = i;
+
+        pthread_create(&threads[i],
+                       NULL,
+                       logring_follow_test_producer,
+                       &args[i]);
+    }
+
+    pthread_create(&threads[i++], NULL, logring_follow_test_dequeuer, &info);
+    pthread_create(&threads[i++], NULL, logring_follow_test_follower, &info);
+
+    for (i = 0; i < LOGRING_FOLLOW_TEST_PRODUCERS + 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* With the dequeuer gone, and the ring bigger than the batch,
+     * the follower has to get every one of the markers.
+     */
+    for (i = 0; i < LOGRING_FOLLOW_TEST_MARKERS; i++) {
+        logring_follow_test_fill(&msg, LOGRING_FOLLOW_TEST_PRODUCERS, i);
+        logring_enqueue(info.ring, &msg, sizeof(msg));
+    }
+
+    while (logring_follow_test_read(&info, false)) {
+        continue;
+    }
+
+    head = hatring_enqueue_epoch(atomic_load(&info.ring->ring->epochs));
+    ret  = !info.failed
+       && info.follower.next_epoch == head
+       && info.returned + info.missed == (uint64_t)(head - start)
+       && info.markers == LOGRING_FOLLOW_TEST_MARKERS;
+
+    logring_delete(info.ring);
+
+    return ret;
+}
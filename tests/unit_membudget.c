@@ -0,0 +1,231 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_membudget.c
+ *
+ *  Description:    Tests memory budget hard limits on a dictionary
+ *                  and a queue: writes that would grow them fail once
+ *                  the limit is hit, and removes and dequeues give the
+ *                  budget back, once mmm reclaims what they retired.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/dict.h>
+#include <hatrack/queue.h>
+
+#include <pthread.h>
+
+#define MEMBUDGET_TEST_DICT_LIMIT  (4 << 20)
+#define MEMBUDGET_TEST_QUEUE_LIMIT (256 << 10)
+#define MEMBUDGET_TEST_QUEUE_LOG   10
+
+// Way more than fits under either limit; if we get here, nothing failed.
+#define MEMBUDGET_TEST_MAX_ITEMS   (1 << 22)
+
+/* A thread can't use mmm again once it has called
+ * mmm_clean_up_before_exit(), and that's the only way to make sure
+ * everything retired actually gets freed.  So each step of the test
+ * runs in a thread of its own, which cleans up before it exits, and
+ * the budget gets checked in between.
+ */
+typedef struct {
+    hatrack_membudget_t *budget;
+    hatrack_dict_t      *dict;
+    queue_t             *queue;
+    uint64_t             n;
+    bool                 ok;
+} membudget_test_t;
+
+static void
+membudget_test_step(void *(*fn)(void *), membudget_test_t *info)
+{
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, fn, info);
+    pthread_join(thread, NULL);
+
+    return;
+}
+
+/* Fills the dictionary until a put fails, checks what made it in,
+ * and then removes everything.
+ */
+static void *
+membudget_test_dict_fill(void *arg)
+{
+    membudget_test_t *info;
+    uint64_t          i;
+    void             *value;
+    bool              found;
+
+    info = (membudget_test_t *)arg;
+
+    for (info->n = 1; info->n < MEMBUDGET_TEST_MAX_ITEMS; info->n++) {
+        if (!hatrack_dict_put(info->dict, (void *)info->n, (void *)info->n)) {
+            break;
+        }
+    }
+
+    if (info->n == MEMBUDGET_TEST_MAX_ITEMS
+        || !hatrack_membudget_at_hard_limit(info->budget)
+        || hatrack_dict_add(info->dict, (void *)info->n, (void *)info->n)) {
+        info->ok = false;
+    }
+
+    for (i = 1; i < info->n; i++) {
+        value = hatrack_dict_get(info->dict, (void *)i, &found);
+
+        if (!found || value != (void *)i) {
+            info->ok = false;
+            break;
+        }
+    }
+
+    for (i = 1; i < info->n; i++) {
+        if (!hatrack_dict_remove(info->dict, (void *)i)) {
+            info->ok = false;
+            break;
+        }
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+membudget_test_dict_refill(void *arg)
+{
+    membudget_test_t *info;
+
+    info = (membudget_test_t *)arg;
+
+    if (!hatrack_dict_put(info->dict, (void *)info->n, (void *)info->n)) {
+        info->ok = false;
+    }
+
+    hatrack_dict_delete(info->dict);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Fills the queue until an enqueue fails, and then dequeues
+ * everything, making sure nothing got lost or reordered.
+ */
+static void *
+membudget_test_queue_fill(void *arg)
+{
+    membudget_test_t *info;
+    uint64_t          i;
+    void             *item;
+    bool              found;
+
+    info = (membudget_test_t *)arg;
+
+    for (info->n = 1; info->n < MEMBUDGET_TEST_MAX_ITEMS; info->n++) {
+        if (!queue_enqueue(info->queue, (void *)info->n)) {
+            break;
+        }
+    }
+
+    if (info->n == MEMBUDGET_TEST_MAX_ITEMS
+        || !hatrack_membudget_at_hard_limit(info->budget)
+        || queue_len(info->queue) != info->n - 1) {
+        info->ok = false;
+    }
+
+    for (i = 1; i < info->n; i++) {
+        item = queue_dequeue(info->queue, &found);
+
+        if (!found || item != (void *)i) {
+            info->ok = false;
+            break;
+        }
+    }
+
+    queue_dequeue(info->queue, &found);
+
+    if (found) {
+        info->ok = false;
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// There should be room for a couple of segments' worth again.
+static void *
+membudget_test_queue_refill(void *arg)
+{
+    membudget_test_t *info;
+    uint64_t          i;
+
+    info = (membudget_test_t *)arg;
+
+    for (i = 0; i < (1 << MEMBUDGET_TEST_QUEUE_LOG) * 2; i++) {
+        if (!queue_enqueue(info->queue, (void *)i)) {
+            info->ok = false;
+            break;
+        }
+    }
+
+    queue_delete(info->queue);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Everything retired is freed, and usage is back under the limit.
+static bool
+membudget_test_reclaimed(membudget_test_t *info, uint64_t limit)
+{
+    return !hatrack_membudget_retired_bytes(info->budget)
+        && hatrack_membudget_used(info->budget) < limit
+        && !hatrack_membudget_at_hard_limit(info->budget);
+}
+
+bool
+test_membudget(void)
+{
+    membudget_test_t info;
+    bool             ret;
+
+    info.budget = hatrack_membudget_new(0, MEMBUDGET_TEST_DICT_LIMIT);
+    info.dict   = hatrack_dict_new(HATRACK_DICT_KEY_TYPE_INT);
+    info.ok     = true;
+
+    hatrack_dict_set_membudget(info.dict, info.budget);
+
+    membudget_test_step(membudget_test_dict_fill, &info);
+
+    if (!membudget_test_reclaimed(&info, MEMBUDGET_TEST_DICT_LIMIT)) {
+        info.ok = false;
+    }
+
+    membudget_test_step(membudget_test_dict_refill, &info);
+    hatrack_membudget_delete(info.budget);
+
+    ret         = info.ok;
+    info.budget = hatrack_membudget_new(0, MEMBUDGET_TEST_QUEUE_LIMIT);
+    info.queue  = queue_new_size(MEMBUDGET_TEST_QUEUE_LOG);
+    info.ok     = true;
+
+    queue_set_membudget(info.queue, info.budget);
+
+    membudget_test_step(membudget_test_queue_fill, &info);
+
+    if (!membudget_test_reclaimed(&info, MEMBUDGET_TEST_QUEUE_LIMIT)) {
+        info.ok = false;
+    }
+
+    membudget_test_step(membudget_test_queue_refill, &info);
+    hatrack_membudget_delete(info.budget);
+
+    return ret && info.ok;
+}
@@ -0,0 +1,439 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_par_views.c
+ *
+ *  Description:    Checks the parallel view algorithms against
+ *                  sequential versions, over flexarrays and vectors
+ *                  with unset cells, on both an explicit pool and the
+ *                  built-in one.
+ *
+ *                  The sizes cover empty arrays, arrays with no cells
+ *                  set, arrays that aren't a multiple of the chunk
+ *                  size, and chunk counts that leave a run without a
+ *                  partner in some merge pass.  Sort keys repeat a
+ *                  lot, so stability gets tested too, and the reduce
+ *                  uses a fold that isn't commutative, so that doing
+ *                  the chunks out of order would show.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack.h>
+#include <hatrack/parallel.h>
+
+#define PAR_VIEWS_TEST_KEYS      64
+#define PAR_VIEWS_TEST_POOL_SIZE 3
+
+/* Lengths of the arrays we test, in cells.  Cells whose index is 3
+ * mod 7 never get set.  The last length gets tested with no cells
+ * set at all.
+ */
+static const uint64_t par_views_test_lens[] = {
+    0,
+    1,
+    100,
+    HATRACK_PAR_CHUNK,
+    HATRACK_PAR_CHUNK * 3 + 100,
+    HATRACK_PAR_CHUNK * 7 + 5,
+    HATRACK_PAR_CHUNK + 1,
+};
+
+#define PAR_VIEWS_TEST_NUM_LENS                                                \
+    (sizeof(par_views_test_lens) / sizeof(par_views_test_lens[0]))
+
+/* Items hold their sort key in the high half, and the index of their
+ * cell in the low half, which is what tells us whether sorting was
+ * stable.
+ */
+static void *
+par_views_test_item(uint64_t ix)
+{
+    uint64_t key;
+
+    key = (ix * 0x9e3779b97f4a7c15ULL) >> 58;
+
+    return (void *)((key << 32) | ix);
+}
+
+static uint64_t
+par_views_test_key(void *item)
+{
+    return (uint64_t)item >> 32;
+}
+
+static uint64_t
+par_views_test_ix(void *item)
+{
+    return (uint64_t)item & 0xffffffff;
+}
+
+static bool
+par_views_test_is_set(uint64_t ix, bool fill)
+{
+    return fill && ix % 7 != 3;
+}
+
+static int
+par_views_test_cmp(void *a, void *b, void *aux)
+{
+    uint64_t ka;
+    uint64_t kb;
+
+    (void)aux;
+
+    ka = par_views_test_key(a);
+    kb = par_views_test_key(b);
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+static bool
+par_views_test_pred(void *item, void *aux)
+{
+    (void)aux;
+
+    return !(par_views_test_key(item) & 1);
+}
+
+/* The accumulator is an affine map mod 2^32, z -> a * z + b, with a
+ * in the high half and b in the low half.  Folding composes the
+ * accumulator with the item's map, which is associative, but not
+ * commutative.
+ */
+static uint64_t
+par_views_test_compose(uint64_t first, uint64_t second)
+{
+    uint32_t a1;
+    uint32_t b1;
+    uint32_t a2;
+    uint32_t b2;
+
+    a1 = (uint32_t)(first >> 32);
+    b1 = (uint32_t)first;
+    a2 = (uint32_t)(second >> 32);
+    b2 = (uint32_t)second;
+
+    return ((uint64_t)(a2 * a1) << 32) | (uint32_t)(a2 * b1 + b2);
+}
+
+static void *
+par_views_test_fold(void *acc, void *item, void *aux)
+{
+    uint64_t map;
+
+    (void)aux;
+
+    map = ((par_views_test_key(item) * 2 + 3) << 32) | par_views_test_ix(item);
+
+    return (void *)par_views_test_compose((uint64_t)acc, map);
+}
+
+static void *
+par_views_test_combine(void *acc, void *partial, void *aux)
+{
+    (void)aux;
+
+    return (void *)par_views_test_compose((uint64_t)acc, (uint64_t)partial);
+}
+
+#define PAR_VIEWS_TEST_IDENTITY ((void *)(1ULL << 32))
+
+/* for_each adds up the calls it got, and the indexes it got them
+ * with, and checks that each index matches its item.
+ */
+typedef struct {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t ix_sum;
+    _Atomic bool     failed;
+} par_views_test_each_t;
+
+static void
+par_views_test_each(void *item, uint64_t ix, void *aux)
+{
+    par_views_test_each_t *info;
+
+    info = (par_views_test_each_t *)aux;
+
+    if (par_views_test_ix(item) != ix) {
+        atomic_store(&info->failed, true);
+    }
+
+    atomic_fetch_add(&info->calls, 1);
+    atomic_fetch_add(&info->ix_sum, ix);
+
+    return;
+}
+
+static bool
+par_views_test_same(flexarray_t *arr, void **expected, uint64_t n)
+{
+    uint64_t i;
+    int      status;
+
+    if (flexarray_len(arr) != n) {
+        return false;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (flexarray_get(arr, i, &status) != expected[i]
+            || status != FLEX_OK) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* The sequential versions.  items holds the set cells' items, in
+ * order; we sort them with a counting sort, which is stable.
+ */
+typedef struct {
+    void   **items;
+    void   **sorted;
+    void   **filtered;
+    uint64_t n;
+    uint64_t num_filtered;
+    uint64_t ix_sum;
+    void    *reduced;
+} par_views_test_expected_t;
+
+static void
+par_views_test_expect(par_views_test_expected_t *exp, uint64_t len, bool fill)
+{
+    uint64_t counts[PAR_VIEWS_TEST_KEYS];
+    uint64_t total;
+    uint64_t count;
+    uint64_t i;
+    void    *item;
+
+    exp->items        = (void **)hatrack_malloc(sizeof(void *) * (len + 1));
+    exp->sorted       = (void **)hatrack_malloc(sizeof(void *) * (len + 1));
+    exp->filtered     = (void **)hatrack_malloc(sizeof(void *) * (len + 1));
+    exp->n            = 0;
+    exp->num_filtered = 0;
+    exp->ix_sum       = 0;
+    exp->reduced      = PAR_VIEWS_TEST_IDENTITY;
+
+    for (i = 0; i < PAR_VIEWS_TEST_KEYS; i++) {
+        counts[i] = 0;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (!par_views_test_is_set(i, fill)) {
+            continue;
+        }
+
+        item                 = par_views_test_item(i);
+        exp->items[exp->n++] = item;
+        exp->ix_sum         += i;
+        exp->reduced         = par_views_test_fold(exp->reduced, item, NULL);
+
+        counts[par_views_test_key(item)]++;
+
+        if (par_views_test_pred(item, NULL)) {
+            exp->filtered[exp->num_filtered++] = item;
+        }
+    }
+
+    total = 0;
+
+    for (i = 0; i < PAR_VIEWS_TEST_KEYS; i++) {
+        count      = counts[i];
+        counts[i]  = total;
+        total     += count;
+    }
+
+    for (i = 0; i < exp->n; i++) {
+        item = exp->items[i];
+
+        exp->sorted[counts[par_views_test_key(item)]++] = item;
+    }
+
+    return;
+}
+
+static void
+par_views_test_expected_cleanup(par_views_test_expected_t *exp, uint64_t len)
+{
+    hatrack_free(exp->items, sizeof(void *) * (len + 1));
+    hatrack_free(exp->sorted, sizeof(void *) * (len + 1));
+    hatrack_free(exp->filtered, sizeof(void *) * (len + 1));
+
+    return;
+}
+
+// Checks (and deletes) what the parallel versions came up with.
+static bool
+par_views_test_compare(par_views_test_expected_t *exp,
+                       par_views_test_each_t     *each,
+                       flexarray_t               *sorted,
+                       flexarray_t               *filtered,
+                       void                      *reduced)
+{
+    bool ret;
+
+    ret = !atomic_load(&each->failed)
+       && atomic_load(&each->calls) == exp->n
+       && atomic_load(&each->ix_sum) == exp->ix_sum
+       && reduced == exp->reduced
+       && par_views_test_same(sorted, exp->sorted, exp->n)
+       && par_views_test_same(filtered, exp->filtered, exp->num_filtered);
+
+    flexarray_delete(sorted);
+    flexarray_delete(filtered);
+
+    return ret;
+}
+
+static void
+par_views_test_each_init(par_views_test_each_t *each)
+{
+    atomic_store(&each->calls, 0);
+    atomic_store(&each->ix_sum, 0);
+    atomic_store(&each->failed, false);
+
+    return;
+}
+
+static bool
+par_views_test_flex(hatrack_pool_t *pool, uint64_t len, bool fill)
+{
+    par_views_test_expected_t exp;
+    par_views_test_each_t     each;
+    flexarray_t              *arr;
+    flex_view_t              *view;
+    flexarray_t              *sorted;
+    flexarray_t              *filtered;
+    void                     *reduced;
+    uint64_t                  i;
+    bool                      ret;
+
+    arr = flexarray_new(len);
+
+    for (i = 0; i < len; i++) {
+        if (par_views_test_is_set(i, fill)) {
+            flexarray_set(arr, i, par_views_test_item(i));
+        }
+    }
+
+    par_views_test_expect(&exp, len, fill);
+    par_views_test_each_init(&each);
+
+    view     = flexarray_view(arr);
+    sorted   = flexarray_view_sort(view, pool, par_views_test_cmp, NULL);
+    filtered = flexarray_view_filter(view, pool, par_views_test_pred, NULL);
+    reduced  = flexarray_view_reduce(view,
+                                     pool,
+                                     PAR_VIEWS_TEST_IDENTITY,
+                                     par_views_test_fold,
+                                     par_views_test_combine,
+                                     NULL);
+
+    flexarray_view_for_each(view, pool, par_views_test_each, &each);
+
+    ret = par_views_test_compare(&exp, &each, sorted, filtered, reduced);
+
+    flexarray_view_delete(view);
+    flexarray_delete(arr);
+    par_views_test_expected_cleanup(&exp, len);
+
+    return ret;
+}
+
+static bool
+par_views_test_vector(hatrack_pool_t *pool, uint64_t len, bool fill)
+{
+    par_views_test_expected_t exp;
+    par_views_test_each_t     each;
+    vector_t                 *vec;
+    vector_view_t             view;
+    flexarray_t              *sorted;
+    flexarray_t              *filtered;
+    void                     *reduced;
+    uint64_t                  i;
+    bool                      ret;
+
+    /* vector_set() can't set the last cell yet (the slow path it
+     * takes for that isn't finished), so the vector gets one cell
+     * more than we need, which stays out of the view.
+     */
+    vec = vector_new(0);
+
+    vector_grow(vec, (int64_t)len + 1);
+
+    for (i = 0; i < len; i++) {
+        if (par_views_test_is_set(i, fill)) {
+            vector_set(vec, (int64_t)i, par_views_test_item(i));
+        }
+    }
+
+    par_views_test_expect(&exp, len, fill);
+    par_views_test_each_init(&each);
+
+    /* vector_view() can't hand back a store yet either (nothing
+     * handles VECTOR_OP_VIEW), so we build the view ourselves.
+     * Nothing else touches the vector while we have it, so its
+     * current store is as good as a claimed one.
+     */
+    view.next_ix        = 0;
+    view.size           = (int64_t)len;
+    view.contents       = atomic_load(&vec->store);
+    view.ret_callback   = NULL;
+    view.eject_callback = NULL;
+
+    sorted   = vector_view_sort(&view, pool, par_views_test_cmp, NULL);
+    filtered = vector_view_filter(&view, pool, par_views_test_pred, NULL);
+    reduced  = vector_view_reduce(&view,
+                                  pool,
+                                  PAR_VIEWS_TEST_IDENTITY,
+                                  par_views_test_fold,
+                                  par_views_test_combine,
+                                  NULL);
+
+    vector_view_for_each(&view, pool, par_views_test_each, &each);
+
+    ret = par_views_test_compare(&exp, &each, sorted, filtered, reduced);
+
+    vector_delete(vec);
+    par_views_test_expected_cleanup(&exp, len);
+
+    return ret;
+}
+
+static bool
+par_views_test_pool(hatrack_pool_t *pool)
+{
+    uint64_t i;
+    uint64_t len;
+    bool     fill;
+
+    for (i = 0; i < PAR_VIEWS_TEST_NUM_LENS; i++) {
+        len  = par_views_test_lens[i];
+        fill = i + 1 < PAR_VIEWS_TEST_NUM_LENS;
+
+        if (!par_views_test_flex(pool, len, fill)
+            || !par_views_test_vector(pool, len, fill)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+test_par_views(void)
+{
+    hatrack_pool_t *pool;
+    bool            ret;
+
+    pool = hatrack_pool_new(PAR_VIEWS_TEST_POOL_SIZE);
+    ret  = par_views_test_pool(pool) && par_views_test_pool(NULL);
+
+    hatrack_pool_delete(pool);
+
+    return ret;
+}
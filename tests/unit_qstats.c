@@ -0,0 +1,388 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_qstats.c
+ *
+ *  Description:    Runs hq, capq and hatring through a fixed schedule
+ *                  of enqueues, a sleep, and dequeues, with dwell-time
+ *                  sampling off, on for every item, and on for one
+ *                  item in four.  After each step, the depth and the
+ *                  sample counters have to match the schedule, and
+ *                  every sampled dwell time has to land in a
+ *                  histogram bucket between the sleep and the time
+ *                  the whole step took.
+ *
+ *                  hq and capq then get enough items to grow, to make
+ *                  sure that timestamps survive the migration.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/hq.h>
+#include <hatrack/capq.h>
+#include <hatrack/hatring.h>
+
+#include <unistd.h>
+
+#define QSTATS_TEST_SIZE     256
+#define QSTATS_TEST_ITEMS    10
+#define QSTATS_TEST_FIRST    4
+#define QSTATS_TEST_SLEEP_US 2000
+
+enum
+{
+    QSTATS_TEST_HQ,
+    QSTATS_TEST_CAPQ,
+    QSTATS_TEST_HATRING,
+    QSTATS_TEST_NUM_QUEUES
+};
+
+static void *
+qstats_test_new(uint64_t kind, uint64_t size)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        return hq_new_size(size);
+    case QSTATS_TEST_CAPQ:
+        return capq_new_size(size);
+    default:
+        return hatring_new(size);
+    }
+}
+
+static void
+qstats_test_set_rate(uint64_t kind, void *q, uint64_t rate)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        hq_set_sample_rate((hq_t *)q, rate);
+        break;
+    case QSTATS_TEST_CAPQ:
+        capq_set_sample_rate((capq_t *)q, rate);
+        break;
+    default:
+        hatring_set_sample_rate((hatring_t *)q, rate);
+        break;
+    }
+
+    return;
+}
+
+static void
+qstats_test_enqueue(uint64_t kind, void *q, void *item)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        hq_enqueue((hq_t *)q, item);
+        break;
+    case QSTATS_TEST_CAPQ:
+        capq_enqueue((capq_t *)q, item);
+        break;
+    default:
+        hatring_enqueue((hatring_t *)q, item);
+        break;
+    }
+
+    return;
+}
+
+static void *
+qstats_test_dequeue_one(uint64_t kind, void *q, bool *found)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        return hq_dequeue((hq_t *)q, found);
+    case QSTATS_TEST_CAPQ:
+        return capq_dequeue((capq_t *)q, found);
+    default:
+        return hatring_dequeue((hatring_t *)q, found);
+    }
+}
+
+static void
+qstats_test_stats(uint64_t kind, void *q, hatrack_qstats_snapshot_t *snap)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        hq_stats((hq_t *)q, snap);
+        break;
+    case QSTATS_TEST_CAPQ:
+        capq_stats((capq_t *)q, snap);
+        break;
+    default:
+        hatring_stats((hatring_t *)q, snap);
+        break;
+    }
+
+    return;
+}
+
+static void
+qstats_test_delete(uint64_t kind, void *q)
+{
+    switch (kind) {
+    case QSTATS_TEST_HQ:
+        hq_delete((hq_t *)q);
+        break;
+    case QSTATS_TEST_CAPQ:
+        capq_delete((capq_t *)q);
+        break;
+    default:
+        hatring_delete((hatring_t *)q);
+        break;
+    }
+
+    return;
+}
+
+static inline uint64_t
+qstats_test_bucket(uint64_t dwell)
+{
+    uint64_t ret;
+
+    if (!dwell) {
+        return 0;
+    }
+
+    ret = 64 - __builtin_clzll(dwell);
+
+    if (ret >= HATRACK_QSTATS_BUCKETS) {
+        ret = HATRACK_QSTATS_BUCKETS - 1;
+    }
+
+    return ret;
+}
+
+/* Every queue starts its epochs at a multiple of its size, so the
+ * items that get sampled are the ones whose position since the start
+ * is a multiple of the rate.  This counts them, for the items at
+ * positions [start, start + n).
+ */
+static uint64_t
+qstats_test_expected(uint64_t start, uint64_t n, uint64_t rate)
+{
+    uint64_t ret;
+    uint64_t i;
+
+    if (!rate) {
+        return 0;
+    }
+
+    ret = 0;
+
+    for (i = start; i < start + n; i++) {
+        if (!(i % rate)) {
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/* Checks a snapshot against the expected depth and number of samples.
+ * Every sample was taken from an item that sat through the sleep, and
+ * was dequeued less than max_dwell ns after the first enqueue of the
+ * step.
+ */
+static bool
+qstats_test_check(hatrack_qstats_snapshot_t *snap,
+                  uint64_t                   rate,
+                  uint64_t                   depth,
+                  uint64_t                   samples,
+                  uint64_t                   max_dwell)
+{
+    uint64_t min_dwell;
+    uint64_t total;
+    uint64_t i;
+
+    min_dwell = QSTATS_TEST_SLEEP_US * 1000;
+    total     = 0;
+
+    if (snap->depth != depth || snap->capacity < depth
+        || snap->samples != samples) {
+        return false;
+    }
+
+    if (rate ? snap->sample_rate != rate : snap->sample_rate != 0) {
+        return false;
+    }
+
+    for (i = 0; i < HATRACK_QSTATS_BUCKETS; i++) {
+        total += snap->dwell_hist[i];
+
+        if (snap->dwell_hist[i]
+            && (i < qstats_test_bucket(min_dwell)
+                || i > qstats_test_bucket(max_dwell))) {
+            return false;
+        }
+    }
+
+    if (total != samples) {
+        return false;
+    }
+
+    if (!samples) {
+        return !snap->dwell_total_ns && !snap->dwell_max_ns
+            && !hatrack_qstats_percentile(snap, 50);
+    }
+
+    return snap->dwell_max_ns >= min_dwell && snap->dwell_max_ns <= max_dwell
+        && snap->dwell_total_ns >= samples * min_dwell
+        && snap->dwell_total_ns <= samples * max_dwell
+        && hatrack_qstats_percentile(snap, 50) >= min_dwell;
+}
+
+// Dequeues n items, which have to come out in order, starting at next.
+static bool
+qstats_test_dequeue(uint64_t kind, void *q, uint64_t next, uint64_t n)
+{
+    uint64_t i;
+    void    *item;
+    bool     found;
+
+    for (i = 0; i < n; i++) {
+        item = qstats_test_dequeue_one(kind, q, &found);
+
+        if (!found || item != (void *)(next + i + 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Turning sampling off is tested by turning it on first, which also
+ * allocates the side array, and then turning it back off.
+ */
+static bool
+qstats_test_one(uint64_t kind, uint64_t rate)
+{
+    hatrack_qstats_snapshot_t snap;
+    void                     *q;
+    uint64_t                  start;
+    uint64_t                  size;
+    uint64_t                  n;
+    uint64_t                  samples;
+    uint64_t                  bound;
+    uint64_t                  i;
+    bool                      ret;
+
+    q = qstats_test_new(kind, QSTATS_TEST_SIZE);
+
+    qstats_test_set_rate(kind, q, rate ? rate : 4);
+
+    if (!rate) {
+        qstats_test_set_rate(kind, q, 0);
+    }
+
+    qstats_test_stats(kind, q, &snap);
+
+    size  = snap.capacity;
+    start = hatrack_qstats_now();
+    ret   = qstats_test_check(&snap, rate, 0, 0, 0);
+
+    for (i = 0; i < QSTATS_TEST_ITEMS; i++) {
+        qstats_test_enqueue(kind, q, (void *)(i + 1));
+    }
+
+    qstats_test_stats(kind, q, &snap);
+
+    ret = ret && qstats_test_check(&snap, rate, QSTATS_TEST_ITEMS, 0, 0);
+
+    usleep(QSTATS_TEST_SLEEP_US);
+
+    ret     = ret && qstats_test_dequeue(kind, q, 0, QSTATS_TEST_FIRST);
+    samples = qstats_test_expected(0, QSTATS_TEST_FIRST, rate);
+
+    qstats_test_stats(kind, q, &snap);
+
+    ret = ret
+       && qstats_test_check(&snap,
+                            rate,
+                            QSTATS_TEST_ITEMS - QSTATS_TEST_FIRST,
+                            samples,
+                            hatrack_qstats_now() - start);
+    ret = ret
+       && qstats_test_dequeue(kind,
+                              q,
+                              QSTATS_TEST_FIRST,
+                              QSTATS_TEST_ITEMS - QSTATS_TEST_FIRST);
+
+    samples = qstats_test_expected(0, QSTATS_TEST_ITEMS, rate);
+    bound   = hatrack_qstats_now() - start;
+
+    qstats_test_stats(kind, q, &snap);
+
+    ret = ret && qstats_test_check(&snap, rate, 0, samples, bound);
+
+    if (!ret || kind == QSTATS_TEST_HATRING) {
+        qstats_test_delete(kind, q);
+        return ret;
+    }
+
+    /* The migration renumbers the items it moves, so with a rate
+     * above 1, the count of sampled items can be off by one either
+     * way, at the point where the numbering changes.
+     */
+    n     = size + size / 2;
+    start = hatrack_qstats_now();
+
+    for (i = 0; i < n; i++) {
+        qstats_test_enqueue(kind, q, (void *)(QSTATS_TEST_ITEMS + i + 1));
+    }
+
+    usleep(QSTATS_TEST_SLEEP_US);
+
+    ret = qstats_test_dequeue(kind, q, QSTATS_TEST_ITEMS, n);
+
+    qstats_test_stats(kind, q, &snap);
+
+    if (snap.capacity <= size) {
+        ret = false;
+    }
+
+    if (rate > 1) {
+        samples += qstats_test_expected(QSTATS_TEST_ITEMS, n, rate);
+
+        if (snap.samples + 1 < samples || snap.samples > samples + 1) {
+            ret = false;
+        }
+
+        samples = snap.samples;
+    }
+    else {
+        samples += qstats_test_expected(QSTATS_TEST_ITEMS, n, rate);
+    }
+
+    // The histogram still has the first batch's samples in it.
+    if (hatrack_qstats_now() - start > bound) {
+        bound = hatrack_qstats_now() - start;
+    }
+
+    ret = ret && qstats_test_check(&snap, rate, 0, samples, bound);
+
+    qstats_test_delete(kind, q);
+
+    return ret;
+}
+
+bool
+test_qstats(void)
+{
+    static const uint64_t rates[] = {0, 1, 4};
+    uint64_t              kind;
+    uint64_t              i;
+
+    for (kind = 0; kind < QSTATS_TEST_NUM_QUEUES; kind++) {
+        for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+            if (!qstats_test_one(kind, rates[i])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
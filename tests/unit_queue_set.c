@@ -0,0 +1,422 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_queue_set.c
+ *
+ *  Description:    First checks the ready bitmap by hand, on a set big
+ *                  enough to need three ready words: the bits and the
+ *                  summary have to track which queues have items,
+ *                  dequeues have to round-robin across the ready
+ *                  queues, and a removed queue has to drop out of the
+ *                  bitmap, with its items left where they were.
+ *
+ *                  Then several producers enqueue in bursts, with
+ *                  pauses long enough for the one consumer to go to
+ *                  sleep, and one of them removes a queue halfway
+ *                  through.  Each queue has a single producer, so its
+ *                  items have to come out in order, and every item
+ *                  has to come out, unless it was still in the
+ *                  removed queue.  If the consumer ever sleeps
+ *                  through its whole timeout when there was something
+ *                  to dequeue, an enqueue didn't get announced, or a
+ *                  wakeup got lost.  Finally, we wait until the
+ *                  consumer has said it's waiting, and enqueue one
+ *                  item at a time, each of which has to wake it up.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/queue_set.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUEUE_SET_TEST_QUEUES     130
+#define QUEUE_SET_TEST_PRODUCERS  4
+#define QUEUE_SET_TEST_ITEMS      20000
+#define QUEUE_SET_TEST_BURST      1000
+#define QUEUE_SET_TEST_PAUSE_US   2000
+#define QUEUE_SET_TEST_WAKES      20
+#define QUEUE_SET_TEST_TIMEOUT_NS 1000000000
+#define QUEUE_SET_TEST_REMOVED    0
+
+/* Queue q belongs to producer q % (QUEUE_SET_TEST_PRODUCERS + 1); the
+ * last share belongs to the main thread, which does the wakeups at
+ * the end.  Items are the queue's index in the high 32 bits, and its
+ * count of items so far (starting at 1) in the low bits.
+ */
+#define QUEUE_SET_TEST_OWNERS     (QUEUE_SET_TEST_PRODUCERS + 1)
+
+typedef struct {
+    queue_set_t      *set;
+    hq_t             *queues[QUEUE_SET_TEST_QUEUES];
+    uint64_t          enqueued[QUEUE_SET_TEST_QUEUES];
+    uint64_t          dequeued[QUEUE_SET_TEST_QUEUES];
+    _Atomic uint64_t  total_dequeued;
+    _Atomic bool      done;
+    _Atomic bool      failed;
+} queue_set_test_t;
+
+typedef struct {
+    queue_set_test_t *info;
+    uint64_t          tid;
+} queue_set_test_arg_t;
+
+static uint64_t
+queue_set_test_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void
+queue_set_test_enqueue(queue_set_test_t *info, uint64_t q)
+{
+    uint64_t item;
+
+    item = (q << 32) | ++info->enqueued[q];
+
+    queue_set_enqueue(info->set, q, (void *)item);
+
+    return;
+}
+
+static bool
+queue_set_test_bitmap_is(queue_set_t *set,
+                         uint64_t     w0,
+                         uint64_t     w1,
+                         uint64_t     w2)
+{
+    uint64_t summary;
+
+    summary = (w0 ? 1 : 0) | (w1 ? 2 : 0) | (w2 ? 4 : 0);
+
+    return atomic_load(&set->ready[0]) == w0
+        && atomic_load(&set->ready[1]) == w1
+        && atomic_load(&set->ready[2]) == w2
+        && atomic_load(&set->summary) == summary;
+}
+
+/* Dequeues n items, which have to come from the queues in ixs, each
+ * one once.
+ */
+static bool
+queue_set_test_dequeue_each(queue_set_t *set, uint64_t *ixs, uint64_t n)
+{
+    bool     seen[QUEUE_SET_TEST_QUEUES + 1];
+    uint64_t ix;
+    uint64_t i;
+    uint64_t j;
+    bool     found;
+
+    for (i = 0; i < n; i++) {
+        seen[ixs[i]] = false;
+    }
+
+    for (i = 0; i < n; i++) {
+        queue_set_dequeue_any(set, &found, &ix);
+
+        if (!found) {
+            return false;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (ixs[j] == ix) {
+                break;
+            }
+        }
+
+        if (j == n || seen[ix]) {
+            return false;
+        }
+
+        seen[ix] = true;
+    }
+
+    return true;
+}
+
+static bool
+queue_set_test_bitmap(void)
+{
+    queue_set_t *set;
+    hq_t        *queues[QUEUE_SET_TEST_QUEUES + 1];
+    uint64_t     ready[]   = {0, 64, 129};
+    uint64_t     remains[] = {5};
+    uint64_t     i;
+    bool         found;
+    bool         ret;
+
+    set = queue_set_new(QUEUE_SET_TEST_QUEUES + 1);
+
+    for (i = 0; i < QUEUE_SET_TEST_QUEUES; i++) {
+        queues[i] = hq_new();
+        queue_set_add(set, queues[i]);
+    }
+
+    ret = queue_set_test_bitmap_is(set, 0, 0, 0);
+
+    for (i = 0; i < 2; i++) {
+        queue_set_enqueue(set, 0, (void *)1);
+        queue_set_enqueue(set, 64, (void *)1);
+        queue_set_enqueue(set, 129, (void *)1);
+    }
+
+    ret = ret && queue_set_test_bitmap_is(set, 1, 1, 2);
+
+    // Each ready queue has to come up once before any comes up again.
+    ret = ret && queue_set_test_dequeue_each(set, ready, 3)
+       && queue_set_test_dequeue_each(set, ready, 3);
+
+    queue_set_dequeue_any(set, &found, NULL);
+
+    ret = ret && !found && queue_set_test_bitmap_is(set, 0, 0, 0);
+
+    queue_set_enqueue(set, 5, (void *)1);
+    queue_set_enqueue(set, 70, (void *)1);
+
+    ret = ret && queue_set_test_bitmap_is(set, 1 << 5, 1 << 6, 0)
+       && queue_set_remove(set, 70) == queues[70]
+       && queue_set_test_bitmap_is(set, 1 << 5, 0, 0)
+       && !queue_set_get(set, 70) && !queue_set_remove(set, 70)
+       && queue_set_test_dequeue_each(set, remains, 1)
+       && hq_len(queues[70]) == 1;
+
+    queue_set_dequeue_any(set, &found, NULL);
+
+    ret = ret && !found && queue_set_test_bitmap_is(set, 0, 0, 0);
+
+    // Items already in a queue get announced when it's added.
+    queues[QUEUE_SET_TEST_QUEUES] = hq_new();
+
+    hq_enqueue(queues[QUEUE_SET_TEST_QUEUES], (void *)1);
+
+    ret = ret
+       && queue_set_add(set, queues[QUEUE_SET_TEST_QUEUES])
+              == QUEUE_SET_TEST_QUEUES
+       && queue_set_test_bitmap_is(set, 0, 0, 1 << 2);
+
+    queue_set_delete(set);
+
+    for (i = 0; i <= QUEUE_SET_TEST_QUEUES; i++) {
+        hq_delete(queues[i]);
+    }
+
+    return ret;
+}
+
+/* Each producer sticks to its own queues, picking one at random for
+ * each item.  Producer 0 removes QUEUE_SET_TEST_REMOVED halfway
+ * through, and stops using it.
+ */
+static void *
+queue_set_test_producer(void *arg)
+{
+    queue_set_test_arg_t *my;
+    uint64_t              num_mine;
+    uint64_t              q;
+    uint64_t              i;
+
+    my       = (queue_set_test_arg_t *)arg;
+    num_mine = (QUEUE_SET_TEST_QUEUES - my->tid + QUEUE_SET_TEST_OWNERS - 1)
+             / QUEUE_SET_TEST_OWNERS;
+
+    for (i = 0; i < QUEUE_SET_TEST_ITEMS; i++) {
+        if (i && !(i % QUEUE_SET_TEST_BURST)) {
+            usleep(QUEUE_SET_TEST_PAUSE_US);
+        }
+
+        if (!my->tid && i == QUEUE_SET_TEST_ITEMS / 2) {
+            queue_set_remove(my->info->set, QUEUE_SET_TEST_REMOVED);
+        }
+
+        do {
+            q = my->tid + (test_rand() % num_mine) * QUEUE_SET_TEST_OWNERS;
+        } while (!my->tid && i >= QUEUE_SET_TEST_ITEMS / 2
+                 && q == QUEUE_SET_TEST_REMOVED);
+
+        queue_set_test_enqueue(my->info, q);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Returns true if any queue that's still in the set has items in it.
+static bool
+queue_set_test_pending(queue_set_test_t *info)
+{
+    hq_t    *queue;
+    uint64_t i;
+
+    for (i = 0; i < QUEUE_SET_TEST_QUEUES; i++) {
+        queue = queue_set_get(info->set, i);
+
+        if (queue && hq_len(queue)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void *
+queue_set_test_consumer(void *arg)
+{
+    queue_set_test_t *info;
+    uint64_t          start;
+    uint64_t          item;
+    uint64_t          ix;
+    bool              found;
+
+    info = (queue_set_test_t *)arg;
+
+    while (!atomic_load(&info->done)) {
+        start = queue_set_test_now();
+        item  = (uint64_t)queue_set_dequeue_wait(info->set,
+                                                 &found,
+                                                 &ix,
+                                                 QUEUE_SET_TEST_TIMEOUT_NS);
+
+        /* Nobody goes quiet for anywhere near the timeout, so if we
+         * slept through it, and there was something to get, we missed
+         * a wakeup.
+         */
+        if (queue_set_test_now() - start >= QUEUE_SET_TEST_TIMEOUT_NS
+            && (found || queue_set_test_pending(info))) {
+            atomic_store(&info->failed, true);
+        }
+
+        if (!found) {
+            continue;
+        }
+
+        if (ix >= QUEUE_SET_TEST_QUEUES || (item >> 32) != ix
+            || (item & 0xffffffff) != ++info->dequeued[ix]) {
+            atomic_store(&info->failed, true);
+        }
+
+        atomic_fetch_add(&info->total_dequeued, 1);
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Waits for the consumer to say it's waiting, or to have dequeued n
+ * items.
+ * Gives up after about five seconds.
+ */
+static bool
+queue_set_test_wait_for(queue_set_test_t *info, bool sleeping, uint64_t n)
+{
+    uint64_t i;
+
+    for (i = 0; i < 50000; i++) {
+        if (sleeping ? atomic_load(&info->set->waiters) != 0
+                     : atomic_load(&info->total_dequeued) == n) {
+            return true;
+        }
+
+        usleep(100);
+    }
+
+    return false;
+}
+
+bool
+test_queue_set(void)
+{
+    queue_set_test_t     info;
+    queue_set_test_arg_t args[QUEUE_SET_TEST_PRODUCERS];
+    pthread_t            producers[QUEUE_SET_TEST_PRODUCERS];
+    pthread_t            consumer;
+    uint64_t             total;
+    uint64_t             left;
+    uint64_t             i;
+    bool                 found;
+    bool                 ret;
+
+    if (!queue_set_test_bitmap()) {
+        return false;
+    }
+
+    info.set            = queue_set_new(QUEUE_SET_TEST_QUEUES);
+    info.total_dequeued = 0;
+    info.done           = false;
+    info.failed         = false;
+
+    for (i = 0; i < QUEUE_SET_TEST_QUEUES; i++) {
+        info.queues[i]   = hq_new();
+        info.enqueued[i] = 0;
+        info.dequeued[i] = 0;
+
+        queue_set_add(info.set, info.queues[i]);
+    }
+
+    pthread_create(&consumer, NULL, queue_set_test_consumer, &info);
+
+    for (i = 0; i < QUEUE_SET_TEST_PRODUCERS; i++) {
+        args[i].info = &info;
+        args[i].tid  = i;
+
+        pthread_create(&producers[i], NULL, queue_set_test_producer, &args[i]);
+    }
+
+    for (i = 0; i < QUEUE_SET_TEST_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+
+    total = QUEUE_SET_TEST_PRODUCERS * QUEUE_SET_TEST_ITEMS;
+    left  = (uint64_t)hq_len(info.queues[QUEUE_SET_TEST_REMOVED]);
+    ret   = queue_set_test_wait_for(&info, false, total - left);
+
+    // Each of these has to wake up a consumer that's really asleep.
+    for (i = 0; ret && i < QUEUE_SET_TEST_WAKES; i++) {
+        ret = queue_set_test_wait_for(&info, true, 0);
+
+        queue_set_test_enqueue(&info, QUEUE_SET_TEST_PRODUCERS);
+
+        ret = ret && queue_set_test_wait_for(&info, false, total - left + i + 1);
+    }
+
+    atomic_store(&info.done, true);
+    queue_set_wake_all(info.set);
+    pthread_join(consumer, NULL);
+
+    ret = ret && !info.failed;
+
+    for (i = 0; i < QUEUE_SET_TEST_QUEUES; i++) {
+        if (i == QUEUE_SET_TEST_REMOVED) {
+            left = (uint64_t)hq_len(info.queues[i]);
+        }
+        else {
+            left = 0;
+        }
+
+        if (info.dequeued[i] + left != info.enqueued[i]) {
+            ret = false;
+        }
+    }
+
+    queue_set_dequeue_any(info.set, &found, NULL);
+
+    ret = ret && !found && queue_set_test_bitmap_is(info.set, 0, 0, 0);
+
+    queue_set_delete(info.set);
+
+    for (i = 0; i < QUEUE_SET_TEST_QUEUES; i++) {
+        hq_delete(info.queues[i]);
+    }
+
+    return ret;
+}
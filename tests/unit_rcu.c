@@ -0,0 +1,335 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_rcu.c
+ *
+ *  Description:    Tests RCU-protected pointers: readers (with nested
+ *                  read sections) run against writers that swap in
+ *                  new objects with both publish and cas.  No object
+ *                  may get destroyed while a reader can still see it,
+ *                  and every object that got replaced has to go
+ *                  through the destructor exactly once.  Then we
+ *                  check that hatrack_rcu_synchronize() waits for a
+ *                  reader that's already in a read section.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/rcu.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define RCU_TEST_READERS     4
+#define RCU_TEST_WRITERS     2
+#define RCU_TEST_READS       200000
+#define RCU_TEST_WRITES      20000
+#define RCU_TEST_MAX_OBJECTS (RCU_TEST_WRITERS * RCU_TEST_WRITES + 1)
+
+/* Object ids come from rcu_test_next_id, with 0 for the first object.
+ * check is always ~id, so that readers can tell if they're looking at
+ * something that got torn down.  destroyed[] counts how many times the
+ * destructor saw each id.
+ */
+typedef struct {
+    uint64_t id;
+    uint64_t check;
+} rcu_test_obj_t;
+
+typedef struct {
+    hatrack_rcu_ptr_t *ptr;
+    uint64_t           tid;
+    _Atomic bool      *failed;
+    _Atomic uint64_t  *writers_left;
+} rcu_test_arg_t;
+
+static _Atomic uint64_t rcu_test_next_id;
+static _Atomic uint32_t rcu_test_destroyed[RCU_TEST_MAX_OBJECTS];
+
+static void
+rcu_test_destroy(void *obj, void *aux)
+{
+    rcu_test_obj_t *item;
+
+    (void)aux;
+
+    item = (rcu_test_obj_t *)obj;
+
+    if (item->id < RCU_TEST_MAX_OBJECTS) {
+        atomic_fetch_add(&rcu_test_destroyed[item->id], 1);
+    }
+
+    item->check = 0;
+
+    return;
+}
+
+static rcu_test_obj_t *
+rcu_test_new_obj(void)
+{
+    rcu_test_obj_t *ret;
+
+    ret        = (rcu_test_obj_t *)hatrack_rcu_alloc(sizeof(rcu_test_obj_t));
+    ret->id    = atomic_fetch_add(&rcu_test_next_id, 1);
+    ret->check = ~ret->id;
+
+    return ret;
+}
+
+// An object we got inside a read section must still be intact.
+static bool
+rcu_test_obj_ok(rcu_test_obj_t *obj)
+{
+    return obj->id < RCU_TEST_MAX_OBJECTS && obj->check == ~obj->id
+        && !atomic_load(&rcu_test_destroyed[obj->id]);
+}
+
+static void *
+rcu_test_reader(void *arg)
+{
+    rcu_test_arg_t *my;
+    rcu_test_obj_t *outer;
+    rcu_test_obj_t *inner;
+    uint64_t        i;
+
+    my = (rcu_test_arg_t *)arg;
+
+    for (i = 0; i < RCU_TEST_READS || atomic_load(my->writers_left); i++) {
+        hatrack_rcu_read_begin();
+
+        outer = (rcu_test_obj_t *)hatrack_rcu_load(my->ptr);
+
+        if (!rcu_test_obj_ok(outer)) {
+            atomic_store(my->failed, true);
+        }
+
+        // Ending the nested section must not end the outer one.
+        if (i & 1) {
+            hatrack_rcu_read_begin();
+            inner = (rcu_test_obj_t *)hatrack_rcu_load(my->ptr);
+
+            if (!rcu_test_obj_ok(inner)) {
+                atomic_store(my->failed, true);
+            }
+
+            hatrack_rcu_read_end();
+        }
+
+        if (!rcu_test_obj_ok(outer)) {
+            atomic_store(my->failed, true);
+        }
+
+        hatrack_rcu_read_end();
+    }
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+/* Even writers swap in new objects with publish, odd ones do a
+ * read-copy-update loop with cas, retrying with the same object until
+ * it goes in.
+ */
+static void *
+rcu_test_writer(void *arg)
+{
+    rcu_test_arg_t *my;
+    rcu_test_obj_t *old;
+    rcu_test_obj_t *obj;
+    uint64_t        i;
+
+    my = (rcu_test_arg_t *)arg;
+
+    for (i = 0; i < RCU_TEST_WRITES; i++) {
+        obj = rcu_test_new_obj();
+
+        if (!(my->tid & 1)) {
+            hatrack_rcu_publish(my->ptr, obj);
+            continue;
+        }
+
+        do {
+            hatrack_rcu_read_begin();
+            old = (rcu_test_obj_t *)hatrack_rcu_load(my->ptr);
+
+            if (!rcu_test_obj_ok(old)) {
+                atomic_store(my->failed, true);
+            }
+
+            hatrack_rcu_read_end();
+        } while (!hatrack_rcu_cas(my->ptr, old, obj));
+    }
+
+    atomic_fetch_sub(my->writers_left, 1);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+// Retires whatever's left in the pointer, on a thread that's allowed
+// to give up its mmm registration afterward.
+static void *
+rcu_test_cleanup(void *arg)
+{
+    hatrack_rcu_cleanup((hatrack_rcu_ptr_t *)arg);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static bool
+rcu_test_churn(void)
+{
+    hatrack_rcu_ptr_t ptr;
+    rcu_test_arg_t    args[RCU_TEST_READERS + RCU_TEST_WRITERS];
+    pthread_t         threads[RCU_TEST_READERS + RCU_TEST_WRITERS];
+    _Atomic bool      failed;
+    _Atomic uint64_t  writers_left;
+    rcu_test_obj_t   *first;
+    uint64_t          i;
+    uint64_t          num_objects;
+
+    failed       = false;
+    writers_left = RCU_TEST_WRITERS;
+
+    atomic_store(&rcu_test_next_id, 0);
+
+    for (i = 0; i < RCU_TEST_MAX_OBJECTS; i++) {
+        atomic_store(&rcu_test_destroyed[i], 0);
+    }
+
+    first = rcu_test_new_obj();
+
+    hatrack_rcu_init(&ptr, first, rcu_test_destroy, NULL);
+
+    for (i = 0; i < RCU_TEST_READERS + RCU_TEST_WRITERS; i++) {
+        args[i].ptr          = &ptr;
+        args[i].tid          = i;
+        args[i].failed       = &failed;
+        args[i].writers_left = &writers_left;
+
+        pthread_create(&threads[i],
+                       NULL,
+                       i < RCU_TEST_WRITERS ? rcu_test_writer : rcu_test_reader,
+                       &args[i]);
+    }
+
+    for (i = 0; i < RCU_TEST_READERS + RCU_TEST_WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_create(&threads[0], NULL, rcu_test_cleanup, &ptr);
+    pthread_join(threads[0], NULL);
+
+    /* Every thread that retired anything has exited, which empties
+     * its retirement list, so every object should have been
+     * destroyed by now, once.
+     */
+    num_objects = atomic_load(&rcu_test_next_id);
+
+    for (i = 0; i < num_objects; i++) {
+        if (atomic_load(&rcu_test_destroyed[i]) != 1) {
+            return false;
+        }
+    }
+
+    return !failed;
+}
+
+/* The reader enters a read section, says so, and then stays there
+ * until it's told to leave.  The synchronizer must not return until
+ * the reader's gone.
+ */
+typedef struct {
+    _Atomic bool inside;
+    _Atomic bool leave;
+    _Atomic bool left;
+    _Atomic bool synchronized;
+    _Atomic bool failed;
+} rcu_test_sync_t;
+
+static void *
+rcu_test_sync_reader(void *arg)
+{
+    rcu_test_sync_t *info;
+
+    info = (rcu_test_sync_t *)arg;
+
+    hatrack_rcu_read_begin();
+    atomic_store(&info->inside, true);
+
+    while (!atomic_load(&info->leave)) {
+        usleep(1000);
+    }
+
+    atomic_store(&info->left, true);
+    hatrack_rcu_read_end();
+
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+rcu_test_synchronizer(void *arg)
+{
+    rcu_test_sync_t *info;
+
+    info = (rcu_test_sync_t *)arg;
+
+    hatrack_rcu_synchronize();
+
+    if (!atomic_load(&info->left)) {
+        atomic_store(&info->failed, true);
+    }
+
+    atomic_store(&info->synchronized, true);
+
+    return NULL;
+}
+
+static bool
+rcu_test_synchronize(void)
+{
+    rcu_test_sync_t info;
+    pthread_t       reader;
+    pthread_t       synchronizer;
+
+    atomic_store(&info.inside, false);
+    atomic_store(&info.leave, false);
+    atomic_store(&info.left, false);
+    atomic_store(&info.synchronized, false);
+    atomic_store(&info.failed, false);
+
+    pthread_create(&reader, NULL, rcu_test_sync_reader, &info);
+
+    while (!atomic_load(&info.inside)) {
+        usleep(1000);
+    }
+
+    pthread_create(&synchronizer, NULL, rcu_test_synchronizer, &info);
+
+    // Give the synchronizer plenty of time to return too early.
+    usleep(50000);
+
+    if (atomic_load(&info.synchronized)) {
+        atomic_store(&info.failed, true);
+    }
+
+    atomic_store(&info.leave, true);
+
+    pthread_join(reader, NULL);
+    pthread_join(synchronizer, NULL);
+
+    return !info.failed && info.synchronized;
+}
+
+bool
+test_rcu(void)
+{
+    return rcu_test_churn() && rcu_test_synchronize();
+}
@@ -0,0 +1,178 @@
+/* Copyright © 2022 John Viega
+ *
+ * See LICENSE.txt for licensing info.
+ *
+ *  Name:           unit_solohat.c
+ *
+ *  Description:    Tests solohat's single-writer / multi-reader
+ *                  contract, which the functional tests skip, since
+ *                  solohat isn't safe with multiple writers.
+ *
+ *  Author:         John Viega, john@zork.org
+ */
+
+#include "testhat.h"
+
+#include <hatrack/hash.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define SOLOHAT_TEST_READERS 4
+#define SOLOHAT_TEST_KEYS    20000
+#define SOLOHAT_TEST_ROUNDS  20
+
+/* Values hold the key in the top half, and the writer's round in the
+ * bottom half, so readers can tell when they get back the wrong
+ * item, or an older item than one they've already seen.
+ */
+typedef struct {
+    solohat_t        *table;
+    _Atomic bool      done;
+    _Atomic bool      failed;
+    _Atomic uint64_t  reads;
+} solohat_test_t;
+
+static inline void *
+solohat_test_value(uint64_t key, uint64_t round)
+{
+    return (void *)((key << 32) | round);
+}
+
+/* One writer, starting from the smallest table, so that the first
+ * round migrates over and over.  Each round overwrites every key, and
+ * then removes a third of them, which keeps used buckets piling up,
+ * so later rounds migrate too.
+ */
+static void *
+solohat_test_writer(void *arg)
+{
+    solohat_test_t *info;
+    uint64_t        round;
+    uint64_t        key;
+
+    info = (solohat_test_t *)arg;
+
+    for (round = 1; round <= SOLOHAT_TEST_ROUNDS; round++) {
+        for (key = 0; key < SOLOHAT_TEST_KEYS; key++) {
+            solohat_put(info->table,
+                        hash_int(key),
+                        solohat_test_value(key, round),
+                        NULL);
+
+            // Make sure readers get to run mid-migration, even on one core.
+            if (!(key & 1023)) {
+                sched_yield();
+            }
+        }
+
+        for (key = round % 3; key < SOLOHAT_TEST_KEYS; key += 3) {
+            solohat_remove(info->table, hash_int(key), NULL);
+        }
+    }
+
+    atomic_store(&info->done, true);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+static void *
+solohat_test_reader(void *arg)
+{
+    solohat_test_t *info;
+    uint64_t       *last_seen;
+    uint64_t        key;
+    uint64_t        value;
+    bool            found;
+
+    info      = (solohat_test_t *)arg;
+    last_seen = (uint64_t *)calloc(SOLOHAT_TEST_KEYS, sizeof(uint64_t));
+    key       = 0;
+
+    while (!atomic_load(&info->done)) {
+        key   = (key + 7919) % SOLOHAT_TEST_KEYS;
+        value = (uint64_t)solohat_get(info->table, hash_int(key), &found);
+
+        atomic_fetch_add(&info->reads, 1);
+
+        if (!found) {
+            continue;
+        }
+
+        if ((value >> 32) != key || (value & 0xffffffff) < last_seen[key]
+            || (value & 0xffffffff) > SOLOHAT_TEST_ROUNDS) {
+            atomic_store(&info->failed, true);
+            break;
+        }
+
+        last_seen[key] = value & 0xffffffff;
+
+        if (solohat_len(info->table) > SOLOHAT_TEST_KEYS) {
+            atomic_store(&info->failed, true);
+            break;
+        }
+    }
+
+    free(last_seen);
+    mmm_clean_up_before_exit();
+
+    return NULL;
+}
+
+bool
+test_solohat(void)
+{
+    solohat_test_t info;
+    pthread_t      writer;
+    pthread_t      readers[SOLOHAT_TEST_READERS];
+    uint64_t       i;
+    uint64_t       key;
+    uint64_t       value;
+    bool           found;
+    bool           removed;
+
+    info.table  = solohat_new();
+    info.done   = false;
+    info.failed = false;
+    info.reads  = 0;
+
+    for (i = 0; i < SOLOHAT_TEST_READERS; i++) {
+        pthread_create(&readers[i], NULL, solohat_test_reader, &info);
+    }
+
+    pthread_create(&writer, NULL, solohat_test_writer, &info);
+    pthread_join(writer, NULL);
+
+    for (i = 0; i < SOLOHAT_TEST_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    if (!info.reads) {
+        info.failed = true;
+    }
+
+    // The writer's done, so everything should match its last round.
+    for (key = 0; key < SOLOHAT_TEST_KEYS; key++) {
+        value   = (uint64_t)solohat_get(info.table, hash_int(key), &found);
+        removed = (key % 3) == (SOLOHAT_TEST_ROUNDS % 3);
+
+        if (found == removed) {
+            info.failed = true;
+            break;
+        }
+
+        if (found
+            && value != (uint64_t)solohat_test_value(key,
+                                                     SOLOHAT_TEST_ROUNDS)) {
+            info.failed = true;
+            break;
+        }
+    }
+
+    solohat_delete(info.table);
+
+    return !info.failed;
+}